@@ -0,0 +1,747 @@
+// USB-C Software Network - Throughput and Latency Benchmark Implementation
+//
+// Every benchmark message starts with a bench_msg_t; the rest of the
+// payload is padding up to the size being measured. Echo requests carry
+// the client's send time, so a reply needs no lookup to give its RTT.
+// Messages carry the number of the round they belong to, and anything
+// from an earlier round (a late echo after a loss timeout) is ignored.
+//
+// On the libusb transport each message is one PKT_DATA packet built in
+// place in an OUT transfer slot; on the raw transports it is one data
+// frame built in place in the protocol's transmit frame.
+//
+// BENCH_TRANSPORT=sim needs no second machine: the server runs on a
+// thread of its own, on a raw context joined to the client's by a
+// simulated link (RAW_SIM_LINK).
+
+#include "usb_bench.h"
+#include "usb_log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#define BENCH_POLL_MS 200            // Server receive slice
+#define BENCH_LOSS_MS 200            // Outstanding echoes count as lost after this
+#define BENCH_SYNC_MS 1000           // Wait for a sync reply
+#define BENCH_SYNC_RETRIES 3
+#define BENCH_CONNECT_MS 30000       // Client wait for the server to answer
+#define BENCH_RAW_CONNECT_S 60
+#define BENCH_RETRY_US 50            // Back-off while the raw transport ring is full
+
+// Message operations
+#define BENCH_OP_ECHO        1       // Reflect to the sender
+#define BENCH_OP_ECHO_REPLY  2
+#define BENCH_OP_SINK        3       // Count and drop
+#define BENCH_OP_SYNC        4       // Report and reset the sink counters
+#define BENCH_OP_SYNC_REPLY  5
+#define BENCH_OP_DONE        6       // Sweep finished
+
+typedef struct __attribute__((packed)) {
+    uint8_t  op;                     // BENCH_OP_*
+    uint8_t  reserved;
+    uint16_t round;
+    uint32_t id;
+    uint64_t stamp_ns;               // ECHO: client send time
+    uint64_t count;                  // SYNC_REPLY: sink messages since the last sync
+    uint64_t bytes;                  // SYNC_REPLY: their payload bytes
+} bench_msg_t;
+
+typedef struct bench {
+    usb_net_device_t *device;
+    bool raw;                        // Raw transport instead of the bulk endpoints
+    raw_comm_ctx_t *ctx;             // Raw context the bench runs on
+    size_t max_payload;
+    int transport_depth;             // Transfers in flight (usb) or window (raw)
+    uint16_t round;
+
+    // BENCH_TRANSPORT=sim
+    bool sim;
+    struct bench *server;            // Client: the server on server_thread
+    pthread_t server_thread;
+    atomic_bool quit;                // Server: the client is done
+} bench_t;
+
+typedef struct {
+    const char *test;                // "tx" or "echo"
+    size_t size;
+    int depth;
+    uint64_t sent;
+    uint64_t delivered;
+    uint64_t lost;
+    uint64_t tx_bytes;
+    uint64_t rx_bytes;               // tx: bytes the server counted
+    double seconds;
+    double rtt_us[5];                // min, p50, p99, p99.9, max (echo only)
+    uint64_t retransmits;            // raw: protocol counters over the test
+    uint64_t peer_timeouts;
+} bench_result_t;
+
+static volatile sig_atomic_t bench_stop = 0;
+
+static void bench_signal_handler(int sig) {
+    (void)sig;
+    bench_stop = 1;
+}
+
+static int64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Transport
+
+// The raw session was lost (a cable flap, an outage on the simulated
+// link): wait for it to be resumed, so that the test carries on and its
+// results show the gap
+static int wait_for_link(bench_t *b) {
+    int64_t deadline = now_ns() + (int64_t)BENCH_RAW_CONNECT_S * 1000000000;
+
+    USB_LOG_INFO("Bench: link lost, waiting for it to come back\n");
+    while (!bench_stop && raw_comm_get_state(b->ctx) != RAW_STATE_CONNECTED) {
+        int left = (int)((deadline - now_ns()) / 1000000);
+        if (left <= 0) {
+            USB_LOG_ERROR("Bench: link still down after %d seconds\n", BENCH_RAW_CONNECT_S);
+            return -1;
+        }
+        if (raw_comm_poll(b->ctx, left < BENCH_POLL_MS ? left : BENCH_POLL_MS) < 0) return -1;
+    }
+    return bench_stop ? -1 : 0;
+}
+
+static int bench_send(bench_t *b, const bench_msg_t *msg, size_t len) {
+    usb_frame_t frame;
+
+    if (b->raw) {
+        raw_comm_ctx_t *ctx = b->ctx;
+        int64_t deadline = now_ns() + (int64_t)USB_TIMEOUT_MS * 1000000;
+
+        // Unreliable mode hands a full transport ring back as EAGAIN
+        for (;;) {
+            if (raw_comm_alloc_frame(ctx, &frame) == 0) {
+                memcpy(frame.data, msg, sizeof(bench_msg_t));
+                frame.len = len;
+                if (raw_comm_send_frame(ctx, &frame) >= 0) return 0;
+                if (errno == EAGAIN && now_ns() < deadline && !bench_stop) {
+                    usleep(BENCH_RETRY_US);
+                    continue;
+                }
+            }
+            if (raw_comm_get_state(ctx) == RAW_STATE_CONNECTED || wait_for_link(b) < 0) return -1;
+        }
+    }
+
+    if (usb_net_alloc_frame(b->device, &frame, USB_TIMEOUT_MS) < 0) {
+        USB_LOG_ERROR("Bench: no transfer slot within %d ms\n", USB_TIMEOUT_MS);
+        return -1;
+    }
+    memcpy(frame.data, msg, sizeof(bench_msg_t));
+    frame.len = len;
+    return usb_net_send_frame(b->device, &frame, PKT_DATA) < 0 ? -1 : 0;
+}
+
+// Copy out the message header; anything too short to be one reads as op 0
+static void take_msg(bench_msg_t *msg, size_t *len, const uint8_t *data, size_t data_len) {
+    if (data_len >= sizeof(bench_msg_t)) {
+        memcpy(msg, data, sizeof(bench_msg_t));
+    } else {
+        memset(msg, 0, sizeof(bench_msg_t));
+    }
+    *len = data_len;
+}
+
+// Wait up to timeout_ms for a message. Returns 1, 0 on timeout, -1 on error.
+static int bench_recv(bench_t *b, bench_msg_t *msg, size_t *len, int timeout_ms) {
+    usb_frame_t view;
+
+    if (b->raw) {
+        raw_comm_ctx_t *ctx = b->ctx;
+        int64_t deadline = now_ns() + (int64_t)timeout_ms * 1000000;
+
+        // Batched requests must not wait for the flush timer
+        if (raw_comm_flush(ctx) < 0) return -1;
+        for (;;) {
+            int ret = raw_comm_recv_frame(ctx, &view);
+            if (ret < 0) return -1;
+            if (ret > 0) break;
+
+            int left = (int)((deadline - now_ns()) / 1000000);
+            if (left <= 0 || bench_stop) return 0;
+            if (raw_comm_poll(ctx, left) < 0) return -1;
+        }
+        take_msg(msg, len, view.data, view.len);
+        raw_comm_release_frame(ctx, &view);
+        return 1;
+    }
+
+    usb_xfer_engine_t *xfer = &b->device->xfer;
+    usb_xfer_completion_t done;
+    int ret = usb_xfer_wait_rx(xfer, &done, timeout_ms);
+    if (ret < 0) {
+        USB_LOG_ERROR("Bulk read error: %s\n", libusb_error_name(xfer->last_error));
+        return -1;
+    }
+    if (ret == 0) return 0;
+
+    const packet_header_t *hdr = (const packet_header_t *)done.data;
+    int left = done.len - (int)sizeof(packet_header_t);
+    if (left < 0 || hdr->magic != PACKET_MAGIC || hdr->type != PKT_DATA || hdr->length > left) {
+        take_msg(msg, len, NULL, 0);
+    } else {
+        take_msg(msg, len, done.data + sizeof(packet_header_t), hdr->length);
+    }
+    usb_xfer_release(xfer, done.slot);
+    return 1;
+}
+
+// Client
+
+// Round trip a sync: resets the server's sink counters and returns what
+// they held in *reply
+static int bench_sync(bench_t *b, bench_msg_t *reply, int attempts) {
+    bench_msg_t msg = { .op = BENCH_OP_SYNC };
+
+    for (int i = 0; i < attempts && !bench_stop; i++) {
+        msg.round = ++b->round;
+        if (bench_send(b, &msg, sizeof(msg)) < 0) return -1;
+
+        int64_t deadline = now_ns() + (int64_t)BENCH_SYNC_MS * 1000000;
+        while (!bench_stop) {
+            int left = (int)((deadline - now_ns()) / 1000000);
+            if (left <= 0) break;
+
+            bench_msg_t in;
+            size_t len;
+            int ret = bench_recv(b, &in, &len, left);
+            if (ret < 0) return -1;
+            if (ret == 0) break;
+            if (in.op == BENCH_OP_SYNC_REPLY && in.round == b->round) {
+                if (reply) *reply = in;
+                return 0;
+            }
+        }
+    }
+    return -1;
+}
+
+static int bench_tx(bench_t *b, size_t size, int duration_ms, bench_result_t *r) {
+    bench_msg_t reply;
+
+    if (bench_sync(b, NULL, BENCH_SYNC_RETRIES) < 0) {
+        USB_LOG_ERROR("Bench: server did not answer the sync\n");
+        return -1;
+    }
+
+    bench_msg_t msg = { .op = BENCH_OP_SINK, .round = b->round };
+    int64_t start = now_ns();
+    int64_t end = start + (int64_t)duration_ms * 1000000;
+    while (!bench_stop && now_ns() < end) {
+        msg.id = (uint32_t)r->sent;
+        if (bench_send(b, &msg, size) < 0) return -1;
+        r->sent++;
+        r->tx_bytes += size;
+    }
+
+    if (bench_sync(b, &reply, BENCH_SYNC_RETRIES) < 0) {
+        USB_LOG_ERROR("Bench: server did not answer the sync\n");
+        return -1;
+    }
+    r->seconds = (double)(now_ns() - start) / 1e9;
+    r->delivered = reply.count;
+    r->rx_bytes = reply.bytes;
+    r->lost = r->sent > reply.count ? r->sent - reply.count : 0;
+    return 0;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// Nearest-rank percentile of sorted samples, in microseconds
+static double percentile_us(const uint64_t *sorted, size_t n, double p) {
+    size_t rank = (size_t)(p * (double)n + 0.999999);
+    if (rank < 1) rank = 1;
+    if (rank > n) rank = n;
+    return (double)sorted[rank - 1] / 1000.0;
+}
+
+static int bench_echo(bench_t *b, size_t size, int depth, int duration_ms, bench_result_t *r) {
+    uint64_t *samples = NULL;
+    size_t count = 0, cap = 0;
+    int outstanding = 0;
+    int ret = 0;
+
+    bench_msg_t msg = { .op = BENCH_OP_ECHO, .round = ++b->round };
+    int64_t start = now_ns();
+    int64_t end = start + (int64_t)duration_ms * 1000000;
+
+    while (!bench_stop) {
+        bool sending = now_ns() < end;
+        if (!sending && outstanding == 0) break;
+
+        while (sending && outstanding < depth) {
+            msg.id = (uint32_t)r->sent;
+            msg.stamp_ns = (uint64_t)now_ns();
+            if (bench_send(b, &msg, size) < 0) {
+                ret = -1;
+                goto out;
+            }
+            outstanding++;
+            r->sent++;
+            r->tx_bytes += size;
+        }
+
+        bench_msg_t in;
+        size_t len;
+        int got = bench_recv(b, &in, &len, BENCH_LOSS_MS);
+        if (got < 0) {
+            ret = -1;
+            goto out;
+        }
+        if (got == 0) {
+            // Nothing for BENCH_LOSS_MS: what is still in flight is gone
+            r->lost += (uint64_t)outstanding;
+            outstanding = 0;
+            continue;
+        }
+        if (in.op != BENCH_OP_ECHO_REPLY || in.round != b->round) continue;
+
+        outstanding--;
+        r->delivered++;
+        r->rx_bytes += len;
+        if (count == cap) {
+            size_t grow = cap ? cap * 2 : 4096;
+            uint64_t *p = realloc(samples, grow * sizeof(uint64_t));
+            if (!p) {
+                USB_LOG_ERROR("Bench: out of memory for RTT samples\n");
+                ret = -1;
+                goto out;
+            }
+            samples = p;
+            cap = grow;
+        }
+        samples[count++] = (uint64_t)now_ns() - in.stamp_ns;
+    }
+
+    r->seconds = (double)(now_ns() - start) / 1e9;
+    if (count > 0) {
+        qsort(samples, count, sizeof(uint64_t), cmp_u64);
+        r->rtt_us[0] = (double)samples[0] / 1000.0;
+        r->rtt_us[1] = percentile_us(samples, count, 0.50);
+        r->rtt_us[2] = percentile_us(samples, count, 0.99);
+        r->rtt_us[3] = percentile_us(samples, count, 0.999);
+        r->rtt_us[4] = (double)samples[count - 1] / 1000.0;
+    }
+
+out:
+    free(samples);
+    return ret;
+}
+
+static double mbps(uint64_t bytes, double seconds) {
+    return seconds > 0 ? (double)bytes * 8.0 / seconds / 1e6 : 0.0;
+}
+
+static void write_json(FILE *fp, const bench_t *b, int duration_ms,
+                       const bench_result_t *results, int count) {
+    fprintf(fp, "{\n");
+    fprintf(fp, "  \"benchmark\": \"usb-c-net\",\n");
+    fprintf(fp, "  \"version\": 1,\n");
+    fprintf(fp, "  \"transport\": \"%s\",\n", b->sim ? "sim" : b->raw ? "raw" : "usb");
+    if (b->sim) {
+        fprintf(fp, "  \"link\": \"%s\",\n", b->device->config.raw_sim_link);
+    }
+    fprintf(fp, "  \"max_payload\": %zu,\n", b->max_payload);
+    fprintf(fp, "  \"transport_depth\": %d,\n", b->transport_depth);
+    fprintf(fp, "  \"duration_ms\": %d,\n", duration_ms);
+    fprintf(fp, "  \"results\": [");
+
+    for (int i = 0; i < count; i++) {
+        const bench_result_t *r = &results[i];
+        fprintf(fp, "%s\n    {\"test\": \"%s\", \"size\": %zu, \"depth\": %d, "
+                "\"sent\": %llu, \"delivered\": %llu, \"lost\": %llu, \"seconds\": %.3f, "
+                "\"tx_mbps\": %.2f, \"rx_mbps\": %.2f, \"msgs_per_s\": %.0f",
+                i ? "," : "", r->test, r->size, r->depth,
+                (unsigned long long)r->sent, (unsigned long long)r->delivered,
+                (unsigned long long)r->lost, r->seconds,
+                mbps(r->tx_bytes, r->seconds), mbps(r->rx_bytes, r->seconds),
+                r->seconds > 0 ? (double)r->delivered / r->seconds : 0.0);
+        if (strcmp(r->test, "echo") == 0) {
+            fprintf(fp, ", \"rtt_us\": {\"min\": %.1f, \"p50\": %.1f, \"p99\": %.1f, "
+                    "\"p999\": %.1f, \"max\": %.1f}",
+                    r->rtt_us[0], r->rtt_us[1], r->rtt_us[2], r->rtt_us[3], r->rtt_us[4]);
+        }
+        if (b->raw) {
+            fprintf(fp, ", \"retransmits\": %llu, \"peer_timeouts\": %llu",
+                    (unsigned long long)r->retransmits, (unsigned long long)r->peer_timeouts);
+        }
+        fprintf(fp, "}");
+    }
+    fprintf(fp, "\n  ]\n}\n");
+}
+
+// Parse "a,b,c" into values; "max" stands for max_value
+static int parse_list(const char *list, long max_value, long *out, const char *what) {
+    char buf[128];
+    char *save = NULL;
+    int n = 0;
+
+    strncpy(buf, list, sizeof(buf) - 1);
+    buf[sizeof(buf) - 1] = '\0';
+    for (char *tok = strtok_r(buf, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+        while (*tok == ' ') tok++;
+        long v = strcmp(tok, "max") == 0 ? max_value : strtol(tok, NULL, 10);
+        if (v <= 0) {
+            USB_LOG_ERROR("Invalid %s '%s'\n", what, tok);
+            return -1;
+        }
+        if (n == USB_BENCH_MAX_POINTS) {
+            USB_LOG_ERROR("At most %d %ss per sweep\n", USB_BENCH_MAX_POINTS, what);
+            return -1;
+        }
+        out[n++] = v;
+    }
+    if (n == 0) {
+        USB_LOG_ERROR("No %ss to benchmark\n", what);
+        return -1;
+    }
+    return n;
+}
+
+// Compare the sweep with the configured thresholds: the best tx
+// throughput against BENCH_MIN_MBPS, the loss of every test against
+// BENCH_MAX_LOSS and the RTT p50 of the echo tests at the smallest depth
+// swept against BENCH_MAX_RTT_US. Returns 0 if all are met.
+static int check_thresholds(const usb_net_config_t *config, const bench_result_t *results,
+                            int count, int min_depth) {
+    double best_mbps = 0.0;
+    int failed = 0;
+
+    for (int i = 0; i < count; i++) {
+        const bench_result_t *r = &results[i];
+        bool tx = strcmp(r->test, "tx") == 0;
+        if (tx && mbps(r->rx_bytes, r->seconds) > best_mbps) {
+            best_mbps = mbps(r->rx_bytes, r->seconds);
+        }
+
+        double loss = r->sent ? 100.0 * (double)r->lost / (double)r->sent : 0.0;
+        if (config->bench_max_loss >= 0 && loss > config->bench_max_loss) {
+            USB_LOG_ERROR("Bench: %s %zu bytes depth %d lost %.2f%% (BENCH_MAX_LOSS %.2f%%)\n",
+                          r->test, r->size, r->depth, loss, config->bench_max_loss);
+            failed++;
+        }
+        if (!tx && r->depth == min_depth && config->bench_max_rtt_us > 0 &&
+            (r->delivered == 0 || r->rtt_us[1] > config->bench_max_rtt_us)) {
+            USB_LOG_ERROR("Bench: echo %zu bytes depth %d RTT p50 %.1f us (BENCH_MAX_RTT_US %.1f)\n",
+                          r->size, r->depth, r->rtt_us[1], config->bench_max_rtt_us);
+            failed++;
+        }
+    }
+
+    if (config->bench_min_mbps > 0 && best_mbps < config->bench_min_mbps) {
+        USB_LOG_ERROR("Bench: best tx throughput %.2f Mbit/s (BENCH_MIN_MBPS %.2f)\n",
+                      best_mbps, config->bench_min_mbps);
+        failed++;
+    }
+    return failed ? -1 : 0;
+}
+
+// Protocol counters over one test: retransmissions show the window
+// at work, peer timeouts the connection being lost and resumed
+static void link_stats_start(bench_t *b, bench_result_t *r) {
+    if (!b->raw) return;
+    usb_stats_t stats;
+    raw_comm_get_stats(b->ctx, &stats);
+    r->retransmits = stats.retransmits;
+    r->peer_timeouts = stats.peer_timeouts;
+}
+
+static void link_stats_end(bench_t *b, bench_result_t *r) {
+    if (!b->raw) return;
+    usb_stats_t stats;
+    raw_comm_get_stats(b->ctx, &stats);
+    r->retransmits = stats.retransmits - r->retransmits;
+    r->peer_timeouts = stats.peer_timeouts - r->peer_timeouts;
+}
+
+static int run_client(bench_t *b) {
+    usb_net_config_t *config = &b->device->config;
+    long sizes[USB_BENCH_MAX_POINTS], depths[USB_BENCH_MAX_POINTS];
+    int duration_ms = config->bench_duration_ms > 0 ? config->bench_duration_ms
+                                                    : USB_BENCH_DURATION_MS_DEFAULT;
+
+    int nsizes = parse_list(config->bench_sizes[0] ? config->bench_sizes : USB_BENCH_SIZES_DEFAULT,
+                            (long)b->max_payload, sizes, "size");
+    int ndepths = parse_list(config->bench_depths[0] ? config->bench_depths : USB_BENCH_DEPTHS_DEFAULT,
+                             USB_XFER_MAX_DEPTH, depths, "depth");
+    if (nsizes < 0 || ndepths < 0) return -1;
+
+    bench_result_t *results = calloc((size_t)nsizes * (size_t)(ndepths + 1), sizeof(bench_result_t));
+    if (!results) {
+        USB_LOG_ERROR("Failed to allocate bench results\n");
+        return -1;
+    }
+
+    USB_LOG_INFO("Waiting for the bench server to answer...\n");
+    int64_t deadline = now_ns() + (int64_t)BENCH_CONNECT_MS * 1000000;
+    int ret = -1;
+    while (!bench_stop && now_ns() < deadline) {
+        if ((ret = bench_sync(b, NULL, 1)) == 0) break;
+    }
+    if (ret < 0) {
+        USB_LOG_ERROR("Bench server not answering\n");
+        free(results);
+        return -1;
+    }
+
+    int count = 0;
+    for (int s = 0; s < nsizes && !bench_stop && ret == 0; s++) {
+        size_t size = (size_t)sizes[s];
+        if (size < sizeof(bench_msg_t)) size = sizeof(bench_msg_t);
+        if (size > b->max_payload) {
+            USB_LOG_INFO("Skipping %zu byte payloads (largest is %zu)\n", size, b->max_payload);
+            continue;
+        }
+
+        bench_result_t *r = &results[count];
+        r->test = "tx";
+        r->size = size;
+        r->depth = b->transport_depth;
+        link_stats_start(b, r);
+        if ((ret = bench_tx(b, size, duration_ms, r)) < 0) break;
+        link_stats_end(b, r);
+        USB_LOG_INFO("tx   %6zu bytes             %9.2f Mbit/s, %llu lost\n", size,
+                     mbps(r->rx_bytes, r->seconds), (unsigned long long)r->lost);
+        count++;
+
+        for (int d = 0; d < ndepths && !bench_stop; d++) {
+            r = &results[count];
+            r->test = "echo";
+            r->size = size;
+            r->depth = (int)depths[d];
+            link_stats_start(b, r);
+            if ((ret = bench_echo(b, size, r->depth, duration_ms, r)) < 0) break;
+            link_stats_end(b, r);
+            USB_LOG_INFO("echo %6zu bytes, depth %3d  %9.2f Mbit/s each way, "
+                         "RTT p50 %.1f us, p99 %.1f us, p99.9 %.1f us\n", size, r->depth,
+                         mbps(r->rx_bytes, r->seconds), r->rtt_us[1], r->rtt_us[2], r->rtt_us[3]);
+            count++;
+        }
+    }
+
+    bench_msg_t done = { .op = BENCH_OP_DONE, .round = ++b->round };
+    if (ret == 0) bench_send(b, &done, sizeof(done));
+    if (b->raw) raw_comm_flush(b->ctx);
+
+    FILE *fp = stdout;
+    if (config->bench_output[0]) {
+        fp = fopen(config->bench_output, "w");
+        if (!fp) {
+            USB_LOG_ERROR("Cannot write %s: %s\n", config->bench_output, strerror(errno));
+            fp = stdout;
+        }
+    }
+    write_json(fp, b, duration_ms, results, count);
+    if (fp != stdout) {
+        fclose(fp);
+        USB_LOG_INFO("Results written to %s\n", config->bench_output);
+    }
+
+    if (ret == 0) {
+        long min_depth = depths[0];
+        for (int d = 1; d < ndepths; d++) {
+            if (depths[d] < min_depth) min_depth = depths[d];
+        }
+        ret = check_thresholds(config, results, count, (int)min_depth);
+    }
+
+    free(results);
+    return ret;
+}
+
+// Server
+
+static int run_server(bench_t *b) {
+    uint64_t sink_msgs = 0, sink_bytes = 0, echoes = 0;
+
+    USB_LOG_INFO("Bench server ready (Ctrl+C to stop)\n");
+    while (!bench_stop && !atomic_load(&b->quit)) {
+        bench_msg_t msg;
+        size_t len;
+        int ret = bench_recv(b, &msg, &len, BENCH_POLL_MS);
+        if (ret < 0) return -1;
+        if (ret == 0) continue;
+
+        switch (msg.op) {
+            case BENCH_OP_ECHO:
+                msg.op = BENCH_OP_ECHO_REPLY;
+                if (bench_send(b, &msg, len) < 0) return -1;
+                echoes++;
+                break;
+            case BENCH_OP_SINK:
+                sink_msgs++;
+                sink_bytes += len;
+                break;
+            case BENCH_OP_SYNC:
+                msg.op = BENCH_OP_SYNC_REPLY;
+                msg.count = sink_msgs;
+                msg.bytes = sink_bytes;
+                if (bench_send(b, &msg, sizeof(msg)) < 0) return -1;
+                sink_msgs = sink_bytes = 0;
+                break;
+            case BENCH_OP_DONE:
+                USB_LOG_INFO("Client finished its sweep (%llu echoes)\n", (unsigned long long)echoes);
+                echoes = 0;
+                break;
+            default:
+                break;  // Not a benchmark message
+        }
+    }
+    return 0;
+}
+
+static void *sim_server_main(void *arg) {
+    run_server(arg);
+    return NULL;
+}
+
+// BENCH_TRANSPORT=sim: set up the simulated link and start the server on
+// the far end of it
+static int start_sim_server(bench_t *b) {
+    bench_t *server = calloc(1, sizeof(bench_t));
+    raw_comm_ctx_t *peer = calloc(1, sizeof(raw_comm_ctx_t));
+    if (!server || !peer) {
+        USB_LOG_ERROR("Failed to allocate the bench server\n");
+        free(server);
+        free(peer);
+        return -1;
+    }
+    if (usb_net_raw_setup_sim(b->device, peer) < 0) {
+        free(server);
+        free(peer);
+        return -1;
+    }
+
+    server->device = b->device;
+    server->raw = true;
+    server->ctx = peer;
+    if (pthread_create(&b->server_thread, NULL, sim_server_main, server) != 0) {
+        USB_LOG_ERROR("Failed to start the bench server thread\n");
+        raw_comm_cleanup(peer);
+        raw_comm_cleanup(b->ctx);
+        free(server);
+        free(peer);
+        return -1;
+    }
+    b->server = server;
+    return 0;
+}
+
+// Shut the raw side down (and the simulated server, if any)
+static void bench_disconnect(bench_t *b) {
+    if (!b->raw) return;
+
+    if (b->server) {
+        atomic_store(&b->server->quit, true);
+        pthread_join(b->server_thread, NULL);
+        raw_comm_cleanup(b->server->ctx);
+        free(b->server->ctx);
+        free(b->server);
+        b->server = NULL;
+    }
+    raw_comm_cleanup(b->ctx);
+}
+
+// Bring up the configured transport and wait for the other side
+static int bench_connect(bench_t *b) {
+    usb_net_device_t *device = b->device;
+
+    if (!b->raw) {
+        if (usb_net_wait_for_peer(device, "peer") < 0) return -1;
+        if (!device->xfer.running) {
+            USB_LOG_ERROR("Bench mode requires the async transfer engine\n");
+            return -1;
+        }
+        b->max_payload = (size_t)device->config.usb_mtu;
+        b->transport_depth = device->xfer.depth;
+        return 0;
+    }
+
+    if ((b->sim ? start_sim_server(b) : usb_net_raw_setup(device)) < 0) return -1;
+
+    USB_LOG_INFO("Waiting for raw peer connection...\n");
+    for (int i = 0; i < BENCH_RAW_CONNECT_S && !bench_stop; i++) {
+        raw_comm_poll(&device->raw_ctx, 1000);
+        if (raw_comm_get_state(&device->raw_ctx) == RAW_STATE_CONNECTED) break;
+    }
+    if (raw_comm_get_state(&device->raw_ctx) != RAW_STATE_CONNECTED) {
+        USB_LOG_ERROR("No raw peer after %d seconds\n", BENCH_RAW_CONNECT_S);
+        bench_disconnect(b);
+        return -1;
+    }
+
+    b->max_payload = raw_comm_max_payload(&device->raw_ctx);
+    b->transport_depth = device->config.raw_window;
+    USB_LOG_INFO("Connected to peer 0x%08x\n", raw_comm_get_peer_id(&device->raw_ctx));
+    return 0;
+}
+
+// Run benchmark mode
+int usb_bench_run(usb_net_device_t *device) {
+    usb_net_config_t *config = &device->config;
+    bench_t bench;
+
+    memset(&bench, 0, sizeof(bench));
+    bench.device = device;
+    bench.ctx = &device->raw_ctx;
+
+    const char *transport = config->bench_transport[0] ? config->bench_transport : "usb";
+    if (strcmp(transport, "raw") == 0) {
+        bench.raw = true;
+    } else if (strcmp(transport, "sim") == 0) {
+        bench.raw = bench.sim = true;
+    } else if (strcmp(transport, "usb") != 0) {
+        USB_LOG_ERROR("Unknown BENCH_TRANSPORT '%s' (usb, raw or sim)\n", transport);
+        return -1;
+    }
+
+    bool server = strcmp(config->bench_role, "server") == 0;
+    if (!server && config->bench_role[0] && strcmp(config->bench_role, "client") != 0) {
+        USB_LOG_ERROR("Unknown BENCH_ROLE '%s' (client or server)\n", config->bench_role);
+        return -1;
+    }
+    if (server && bench.sim) {
+        USB_LOG_ERROR("BENCH_TRANSPORT=sim runs its own server; leave BENCH_ROLE as client\n");
+        return -1;
+    }
+
+    USB_LOG_INFO("\n=== Running in BENCH mode (%s, %s transport) ===\n",
+                 server ? "server" : "client", transport);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = bench_signal_handler;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    bench_stop = 0;
+
+    if (bench_connect(&bench) < 0) return -1;
+    if (bench.max_payload < sizeof(bench_msg_t)) {
+        USB_LOG_ERROR("Link payload of %zu bytes is too small to benchmark\n", bench.max_payload);
+        bench_disconnect(&bench);
+        return -1;
+    }
+
+    int ret = server ? run_server(&bench) : run_client(&bench);
+
+    bench_disconnect(&bench);
+    return ret;
+}
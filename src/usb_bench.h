@@ -0,0 +1,37 @@
+// USB-C Software Network - Throughput and Latency Benchmark
+// Measures the link with a sweep of payload sizes and in-flight depths
+// instead of the handful of PING/PONG exchanges of the other modes.
+//
+// One side runs as the server (BENCH_ROLE=server) and reflects: echo
+// requests come straight back and sink messages are only counted. The
+// client drives the sweep and for every payload size runs
+//
+//   tx    - unidirectional: sink messages as fast as the transport takes
+//           them, then a sync round trip that reports what arrived
+//   echo  - bidirectional: echo requests kept depth deep in flight, for
+//           throughput in both directions and round-trip percentiles
+//           (depth 1 is the unloaded latency)
+//
+// Both the libusb bulk endpoints and the raw transports are supported
+// (BENCH_TRANSPORT), as is a simulated link with both sides in one
+// process, for regression runs without hardware (BENCH_TRANSPORT=sim,
+// shaped by RAW_SIM_LINK). Results are written as one JSON document.
+//
+// BENCH_MIN_MBPS, BENCH_MAX_LOSS and BENCH_MAX_RTT_US turn a sweep into a
+// pass/fail check: the client reports every threshold the results miss
+// and the mode fails, so a regression test can run it (ctest bench-sim).
+
+#ifndef USB_BENCH_H
+#define USB_BENCH_H
+
+#include "usb_net_core.h"
+
+#define USB_BENCH_DURATION_MS_DEFAULT 2000
+#define USB_BENCH_SIZES_DEFAULT  "64,256,1024,max"
+#define USB_BENCH_DEPTHS_DEFAULT "1,8,32"
+#define USB_BENCH_MAX_POINTS 16      // Sizes or depths per sweep
+
+// Run the benchmark client or server as configured
+int usb_bench_run(usb_net_device_t *device);
+
+#endif // USB_BENCH_H
@@ -0,0 +1,602 @@
+// USB-C Software Network - Bonded Multi-Link TUN Backend Implementation
+//
+// Threads:
+//   main     - TUN -> USB: reads frames into an OUT slot of the least busy
+//              link, packing them as TUN mode does (USB_BATCH_SIZE), and
+//              numbers them with the shared packet seq
+//   link RX  - one per link: claims the link's peer, walks its completed
+//              IN buffers and hands each record to the reorder buffer,
+//              which writes frames to the TUN device in seq order. It also
+//              owns the link's lifetime: failover and reclaiming.
+//
+// Reordering: frames ahead of next_seq are copied into a ring indexed by
+// seq and released as soon as the gap before them fills. A gap that is
+// not filled within reorder_ms (the frame was on a link that failed, or
+// was dropped) is skipped; frames behind next_seq count as late and are
+// dropped. A jump further back than the ring means the peer restarted
+// its numbering and resynchronises. A restarted peer also enumerates
+// again, so the first link to come up after all were down starts from a
+// fresh reorder state and takes its next_seq from the first frame. (A
+// peer restarting its numbering with every link staying up, less than
+// the ring behind, would see its frames dropped as late until it passed
+// the old next_seq.)
+
+#include "usb_bond.h"
+#include "usb_log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+
+#define BOND_POLL_MS 200             // TUN and IN wait slice
+#define BOND_TX_WAIT_MS 10           // Wait for a slot when every link is full
+#define BOND_DOWN_WAIT_MS 50         // Uplink back-off while no link is up
+#define BOND_PARTNER_CHECK_MS 50     // Rate limit for the Type-C monitor check
+#define BOND_POOL_SLAB 64            // Held frame buffers mapped at a time
+
+static volatile sig_atomic_t bond_stop = 0;
+
+static void bond_signal_handler(int sig) {
+    (void)sig;
+    bond_stop = 1;
+}
+
+static int64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Reorder buffer (rx_lock held)
+
+static void deliver(usb_bond_t *bond, const uint8_t *data, uint16_t len) {
+    if (write(bond->tun.fd, data, len) < 0 && errno != EAGAIN) {
+        USB_LOG_WARN_RATELIMIT("TUN write: %s\n", strerror(errno));
+    }
+    bond->rx_frames++;
+}
+
+// Release the frames that directly follow next_seq
+static void drain_pending(usb_bond_t *bond) {
+    for (;;) {
+        usb_bond_pending_t *p = &bond->pending[bond->next_seq % USB_BOND_REORDER_MAX];
+        if (!p->used || p->seq != bond->next_seq) break;
+
+        deliver(bond, p->data, p->len);
+        usb_pool_put(&bond->pending_pool, p->data);
+        p->data = NULL;
+        p->used = false;
+        bond->pending_count--;
+        bond->next_seq++;
+    }
+    bond->gap_since_ms = now_ms();
+}
+
+// Give up on the gap before the oldest held frame
+static void skip_gap(usb_bond_t *bond) {
+    uint32_t oldest = 0;
+    bool found = false;
+
+    for (int i = 0; i < USB_BOND_REORDER_MAX; i++) {
+        usb_bond_pending_t *p = &bond->pending[i];
+        if (p->used && (!found || (int32_t)(p->seq - oldest) < 0)) {
+            oldest = p->seq;
+            found = true;
+        }
+    }
+    if (!found) return;
+
+    bond->lost += oldest - bond->next_seq;
+    bond->next_seq = oldest;
+    drain_pending(bond);
+}
+
+// Drop every held frame
+static void release_pending(usb_bond_t *bond) {
+    for (int i = 0; i < USB_BOND_REORDER_MAX; i++) {
+        usb_bond_pending_t *p = &bond->pending[i];
+        if (!p->used) continue;
+        usb_pool_put(&bond->pending_pool, p->data);
+        p->data = NULL;
+        p->used = false;
+    }
+    bond->pending_count = 0;
+}
+
+void usb_bond_reorder_input(usb_bond_t *bond, uint32_t seq, const uint8_t *data, uint16_t len) {
+    if (!bond->synced) {
+        bond->next_seq = seq;
+        bond->synced = true;
+    }
+
+    int32_t ahead = (int32_t)(seq - bond->next_seq);
+
+    if (ahead == 0) {
+        deliver(bond, data, len);
+        bond->next_seq++;
+        if (bond->pending_count > 0) drain_pending(bond);
+        return;
+    }
+
+    if (ahead < 0) {
+        if (ahead > -USB_BOND_REORDER_MAX) {
+            bond->late++;
+            return;
+        }
+        // Far behind: the peer restarted, drop what was held for the old run
+        USB_LOG_INFO("Bond: peer sequence restarted at %u\n", seq);
+        release_pending(bond);
+        bond->next_seq = seq + 1;
+        deliver(bond, data, len);
+        return;
+    }
+
+    // Too far ahead to hold: give up on gaps until it fits
+    while (ahead >= USB_BOND_REORDER_MAX) {
+        if (bond->pending_count > 0) {
+            skip_gap(bond);
+        } else {
+            bond->lost += (uint32_t)ahead;
+            bond->next_seq = seq;
+        }
+        ahead = (int32_t)(seq - bond->next_seq);
+    }
+    if (ahead == 0) {
+        usb_bond_reorder_input(bond, seq, data, len);
+        return;
+    }
+
+    usb_bond_pending_t *p = &bond->pending[seq % USB_BOND_REORDER_MAX];
+    if (p->used) {
+        bond->late++;  // Duplicate
+        return;
+    }
+    p->data = usb_pool_get(&bond->pending_pool);
+    if (!p->data) {
+        bond->lost++;
+        return;
+    }
+    if (bond->pending_count == 0) bond->gap_since_ms = now_ms();
+    memcpy(p->data, data, len);
+    p->seq = seq;
+    p->len = len;
+    p->used = true;
+    bond->pending_count++;
+    bond->reordered++;
+}
+
+void usb_bond_reorder_expire(usb_bond_t *bond) {
+    if (bond->pending_count > 0 && now_ms() - bond->gap_since_ms >= bond->reorder_ms) {
+        skip_gap(bond);
+    }
+}
+
+void usb_bond_reorder_reset(usb_bond_t *bond) {
+    release_pending(bond);
+    bond->synced = false;
+}
+
+// Links
+
+// Picks up pending monitor events first; only the cached state is read
+static bool partner_present(usb_bond_link_t *link) {
+    if (usb_typec_get_fd(&link->typec) < 0) return true;
+
+    usb_typec_process(&link->typec);
+    return link->typec.partner;
+}
+
+static int links_up(usb_bond_t *bond) {
+    int up = 0;
+    for (int i = 0; i < bond->count; i++) {
+        if (atomic_load(&bond->links[i].up)) up++;
+    }
+    return up;
+}
+
+static int link_connect(usb_bond_link_t *link) {
+    usb_bond_t *bond = link->bond;
+    usb_net_device_t *device = bond->device;
+
+    if (!partner_present(link)) {
+        // Woken by the attach itself rather than a rescan
+        usb_typec_wait(&link->typec, BOND_POLL_MS);
+        return -1;
+    }
+    if (usb_discovery_find(&link->discovery, SCAN_INTERVAL_MS, &link->handle, &link->layout) < 0) {
+        return -1;
+    }
+
+    if (usb_xfer_start(&link->xfer, device->ctx, link->handle,
+                       link->layout.endpoint_in, link->layout.endpoint_out,
+                       device->config.xfer_queue_depth, bond->buffer_size, NULL) < 0) {
+        USB_LOG_ERROR("Link %d: cannot start transfers\n", link->index);
+        usb_discovery_release(&link->discovery, link->handle, &link->layout);
+        link->handle = NULL;
+        usleep(SCAN_INTERVAL_MS * 1000);
+        return -1;
+    }
+
+    link->partner_checked_ms = now_ms();
+
+    // The first link of a new session: the peer may have restarted
+    pthread_mutex_lock(&bond->rx_lock);
+    if (links_up(bond) == 0) usb_bond_reorder_reset(bond);
+    atomic_store(&link->up, true);
+    pthread_mutex_unlock(&bond->rx_lock);
+    USB_LOG_INFO("Link %d up on port %s (bulk IN 0x%02x / OUT 0x%02x), %d of %d links up\n",
+                 link->index, link->layout.port_path, link->layout.endpoint_in,
+                 link->layout.endpoint_out, links_up(bond), bond->count);
+    return 0;
+}
+
+static void link_down(usb_bond_link_t *link, const char *reason) {
+    atomic_store(&link->up, false);
+
+    // Wait for the uplink to let go of the link's slots
+    pthread_mutex_lock(&link->tx_lock);
+    usb_xfer_stop(&link->xfer);
+    pthread_mutex_unlock(&link->tx_lock);
+
+    usb_discovery_release(&link->discovery, link->handle, &link->layout);
+    link->handle = NULL;
+
+    if (reason) {
+        link->failovers++;
+        USB_LOG_INFO("Link %d down (%s), %d of %d links up\n",
+                     link->index, reason, links_up(link->bond), link->bond->count);
+    }
+}
+
+// USB -> TUN for one link
+static void *link_rx_main(void *arg) {
+    usb_bond_link_t *link = arg;
+    usb_bond_t *bond = link->bond;
+    int wait_ms = bond->reorder_ms < BOND_POLL_MS ? bond->reorder_ms : BOND_POLL_MS;
+
+    while (!bond_stop) {
+        if (!atomic_load(&link->up)) {
+            if (link_connect(link) < 0) {
+                // Nobody else may be running the reorder timer
+                pthread_mutex_lock(&bond->rx_lock);
+                usb_bond_reorder_expire(bond);
+                pthread_mutex_unlock(&bond->rx_lock);
+            }
+            continue;
+        }
+
+        int64_t now = now_ms();
+        if (now - link->partner_checked_ms >= BOND_PARTNER_CHECK_MS) {
+            link->partner_checked_ms = now;
+            if (!partner_present(link)) {
+                link_down(link, "Type-C partner gone");
+                continue;
+            }
+        }
+
+        usb_xfer_completion_t done;
+        int ret = usb_xfer_wait_rx(&link->xfer, &done, wait_ms);
+        if (ret < 0) {
+            link_down(link, libusb_error_name(link->xfer.last_error));
+            continue;
+        }
+
+        pthread_mutex_lock(&bond->rx_lock);
+        if (ret > 0) {
+            int off = 0;
+            do {
+                const packet_header_t *hdr = (const packet_header_t *)(done.data + off);
+                int left = done.len - off - (int)sizeof(packet_header_t);
+                if (left < 0 || hdr->magic != PACKET_MAGIC || hdr->type != PKT_DATA ||
+                    hdr->length > left || hdr->length > bond->device->config.usb_mtu) {
+                    bond->rx_dropped++;
+                    break;  // The next record cannot be located
+                }
+                usb_bond_reorder_input(bond, hdr->seq,
+                                       (const uint8_t *)hdr + sizeof(packet_header_t),
+                                       hdr->length);
+                off += (int)sizeof(packet_header_t) + hdr->length;
+            } while (off < done.len);
+        }
+        usb_bond_reorder_expire(bond);
+        pthread_mutex_unlock(&bond->rx_lock);
+
+        if (ret > 0) {
+            usb_xfer_release(&link->xfer, done.slot);
+            link->rx_transfers++;
+        }
+    }
+
+    if (atomic_load(&link->up)) link_down(link, NULL);
+    return NULL;
+}
+
+// Pick the up link with the most free OUT slots and take one of them.
+// Returns the link with tx_lock held, NULL if no slot could be had.
+static usb_bond_link_t *acquire_link(usb_bond_t *bond, int *slot, uint8_t **buf, size_t *cap) {
+    int best = -1;
+    int best_free = 0;
+
+    for (int n = 0; n < bond->count; n++) {
+        int i = (bond->next_link + n) % bond->count;
+        usb_bond_link_t *link = &bond->links[i];
+
+        pthread_mutex_lock(&link->tx_lock);
+        if (atomic_load(&link->up)) {
+            int free_slots = usb_xfer_tx_free(&link->xfer);
+            if (best < 0 || free_slots > best_free) {
+                best = i;
+                best_free = free_slots;
+            }
+        }
+        pthread_mutex_unlock(&link->tx_lock);
+    }
+    if (best < 0) return NULL;
+
+    bond->next_link = (best + 1) % bond->count;
+    usb_bond_link_t *link = &bond->links[best];
+
+    pthread_mutex_lock(&link->tx_lock);
+    if (atomic_load(&link->up)) {
+        // Every link is full: wait briefly on the one that was least so
+        *slot = usb_xfer_tx_acquire(&link->xfer, buf, cap, best_free > 0 ? 0 : BOND_TX_WAIT_MS);
+        if (*slot >= 0) return link;
+    }
+    pthread_mutex_unlock(&link->tx_lock);
+    return NULL;
+}
+
+static void submit_link(usb_bond_link_t *link, int slot, size_t fill) {
+    if (fill > 0) {
+        // A failed submit shows up as an error on the link's RX side
+        if (usb_xfer_tx_submit(&link->xfer, slot, fill) == 0) link->tx_transfers++;
+    } else {
+        usb_xfer_tx_abort(&link->xfer, slot);
+    }
+    pthread_mutex_unlock(&link->tx_lock);
+}
+
+// TUN -> USB across the links
+static void bond_uplink(usb_bond_t *bond) {
+    usb_net_device_t *device = bond->device;
+    struct pollfd pfd = { .fd = bond->tun.fd, .events = POLLIN };
+    size_t record_max = sizeof(packet_header_t) + (size_t)device->config.usb_mtu;
+
+    while (!bond_stop) {
+        if (links_up(bond) == 0) {
+            usleep(BOND_DOWN_WAIT_MS * 1000);  // Frames wait in the kernel queue
+            continue;
+        }
+
+        int pr = poll(&pfd, 1, BOND_POLL_MS);
+        if (pr < 0) {
+            if (errno == EINTR) continue;
+            USB_LOG_ERROR("TUN poll: %s\n", strerror(errno));
+            break;
+        }
+        if (pr == 0) continue;
+
+        usb_bond_link_t *link = NULL;
+        uint8_t *buf = NULL;
+        size_t cap = 0;
+        size_t fill = 0;
+        int slot = -1;
+
+        for (int i = 0; i < USB_TUN_BATCH && !bond_stop; i++) {
+            if (!link) {
+                link = acquire_link(bond, &slot, &buf, &cap);
+                if (!link) break;  // Links stalled; the kernel queues or drops meanwhile
+            }
+
+            uint8_t *rec = buf + fill;
+            ssize_t n = read(bond->tun.fd, rec + sizeof(packet_header_t),
+                             cap - fill - sizeof(packet_header_t));
+            if (n < 0) {
+                if (errno != EAGAIN && errno != EINTR) {
+                    USB_LOG_ERROR("TUN read: %s\n", strerror(errno));
+                    bond_stop = 1;
+                }
+                break;
+            }
+
+            usb_net_fill_header(device, (packet_header_t *)rec, PKT_DATA, (int)n);
+            fill += sizeof(packet_header_t) + (size_t)n;
+            bond->tx_frames++;
+
+            // Keep packing while a full-size frame still fits
+            if (cap - fill >= record_max) continue;
+
+            submit_link(link, slot, fill);
+            link = NULL;
+            fill = 0;
+        }
+
+        // Queue drained: send what has been packed so far. The slot is not
+        // kept across the poll so that a failing link is never held up.
+        if (link) submit_link(link, slot, fill);
+    }
+}
+
+// Split "a,b,c" into the links' port paths
+static int parse_links(usb_bond_t *bond, const char *ports, const char *typec_ports) {
+    char list[512];
+    char *save = NULL;
+
+    strncpy(list, ports, sizeof(list) - 1);
+    list[sizeof(list) - 1] = '\0';
+    for (char *tok = strtok_r(list, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+        while (*tok == ' ') tok++;
+        if (!*tok) continue;
+        if (bond->count == USB_BOND_MAX_LINKS) {
+            USB_LOG_ERROR("At most %d bonded links are supported\n", USB_BOND_MAX_LINKS);
+            return -1;
+        }
+        strncpy(bond->links[bond->count].port_path, tok, USB_PORT_PATH_MAX - 1);
+        bond->count++;
+    }
+
+    strncpy(list, typec_ports, sizeof(list) - 1);
+    list[sizeof(list) - 1] = '\0';
+    int n = 0;
+    for (char *tok = strtok_r(list, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+        while (*tok == ' ') tok++;
+        if (n < bond->count) {
+            strncpy(bond->links[n].typec_port_path, tok,
+                    sizeof(bond->links[n].typec_port_path) - 1);
+        }
+        n++;
+    }
+    if (n > 0 && n != bond->count) {
+        USB_LOG_ERROR("BOND_TYPEC_PORTS lists %d ports for %d links\n", n, bond->count);
+        return -1;
+    }
+    return 0;
+}
+
+static void bond_free(usb_bond_t *bond) {
+    for (int i = 0; i < bond->count; i++) {
+        usb_typec_close(&bond->links[i].typec);
+        usb_discovery_cleanup(&bond->links[i].discovery);
+        pthread_mutex_destroy(&bond->links[i].tx_lock);
+    }
+    release_pending(bond);
+    usb_pool_destroy(&bond->pending_pool);
+    pthread_mutex_destroy(&bond->rx_lock);
+    usb_tun_close(&bond->tun);
+    free(bond);
+}
+
+// Run bonded TUN mode
+int usb_bond_run(usb_net_device_t *device) {
+    usb_net_config_t *config = &device->config;
+
+    USB_LOG_INFO("\n=== Running in bonded TUN mode ===\n");
+
+    usb_bond_t *bond = calloc(1, sizeof(usb_bond_t));
+    if (!bond) {
+        USB_LOG_ERROR("Failed to allocate bond state\n");
+        return -1;
+    }
+    bond->device = device;
+    bond->tun.fd = -1;
+    pthread_mutex_init(&bond->rx_lock, NULL);
+
+    // Without BOND_USB_PORTS the single configured port forms a bond of one
+    int ret = 0;
+    if (config->bond_usb_ports[0]) {
+        ret = parse_links(bond, config->bond_usb_ports, config->bond_typec_ports);
+    } else {
+        strncpy(bond->links[0].port_path, config->usb_port_path, USB_PORT_PATH_MAX - 1);
+        strncpy(bond->links[0].typec_port_path, config->typec_port_path,
+                sizeof(bond->links[0].typec_port_path) - 1);
+        bond->count = 1;
+    }
+    for (int i = 0; i < bond->count; i++) {
+        usb_bond_link_t *link = &bond->links[i];
+        link->bond = bond;
+        link->index = i;
+        pthread_mutex_init(&link->tx_lock, NULL);
+        atomic_init(&link->up, false);
+        if (bond->count > 1 && !link->port_path[0]) {
+            USB_LOG_ERROR("Bonded links need a USB port path each\n");
+            ret = -1;
+        }
+    }
+    if (ret < 0) {
+        bond_free(bond);
+        return -1;
+    }
+
+    bond->buffer_size = usb_net_xfer_buffer_size(device);
+    bond->reorder_ms = config->bond_reorder_ms > 0 ? config->bond_reorder_ms
+                                                   : USB_BOND_REORDER_MS_DEFAULT;
+    // Held frames come and go with every reordering; a pool keeps that off
+    // malloc. Its size is bounded by the reorder buffer, not by the pool.
+    if (usb_pool_init(&bond->pending_pool, (size_t)config->usb_mtu, BOND_POOL_SLAB, 0) < 0) {
+        bond->buffer_size = 0;
+    }
+    if (bond->buffer_size == 0) {
+        USB_LOG_ERROR("Failed to allocate bond buffers\n");
+        bond_free(bond);
+        return -1;
+    }
+
+    for (int i = 0; i < bond->count; i++) {
+        usb_bond_link_t *link = &bond->links[i];
+        USB_LOG_INFO("Link %d: port path %s%s%s\n", i,
+                     link->port_path[0] ? link->port_path : "(any)",
+                     link->typec_port_path[0] ? ", Type-C " : "", link->typec_port_path);
+        // The port path names the bus, so the bus filter only applies without one
+        if (usb_discovery_init(&link->discovery, device->ctx,
+                               link->port_path[0] ? 0 : config->usb_bus, link->port_path) < 0) {
+            bond_free(bond);
+            return -1;
+        }
+        if (link->typec_port_path[0] && usb_typec_open(&link->typec, link->typec_port_path) < 0) {
+            USB_LOG_WARN("Link %d: Type-C port not monitored\n", i);
+        }
+    }
+
+    if (usb_tun_open(&bond->tun, config->tun_name, config->tun_tap, config->usb_mtu) < 0) {
+        bond_free(bond);
+        return -1;
+    }
+    if (config->tun_address[0]) {
+        usb_tun_set_address(&bond->tun, config->tun_address);
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = bond_signal_handler;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    bond_stop = 0;
+
+    for (int i = 0; i < bond->count; i++) {
+        usb_bond_link_t *link = &bond->links[i];
+        if (pthread_create(&link->rx_thread, NULL, link_rx_main, link) != 0) {
+            USB_LOG_ERROR("Failed to start link %d thread: %s\n", i, strerror(errno));
+            bond_stop = 1;
+            break;
+        }
+        link->rx_running = true;
+    }
+
+    USB_LOG_INFO("Waiting for peer devices to connect...\n\n");
+    int64_t deadline = now_ms() + (int64_t)MAX_SCAN_ATTEMPTS * SCAN_INTERVAL_MS;
+    while (!bond_stop && links_up(bond) == 0 && now_ms() < deadline) {
+        usleep(BOND_DOWN_WAIT_MS * 1000);
+    }
+
+    ret = 0;
+    if (!bond_stop && links_up(bond) == 0) {
+        USB_LOG_ERROR("No peer device found on any bonded link\n");
+        ret = -1;
+    } else if (!bond_stop) {
+        USB_LOG_INFO("Bridging %s over %d link(s) (Ctrl+C to stop)\n", bond->tun.name, bond->count);
+        bond_uplink(bond);
+    }
+
+    bond_stop = 1;
+    for (int i = 0; i < bond->count; i++) {
+        if (bond->links[i].rx_running) pthread_join(bond->links[i].rx_thread, NULL);
+    }
+
+    USB_LOG_INFO("\nBonded TUN mode stopped: %lu frames sent, %lu received, %lu dropped\n",
+                 bond->tx_frames, bond->rx_frames, bond->rx_dropped);
+    USB_LOG_INFO("Reordering: %lu held back, %lu late, %lu lost\n",
+                 bond->reordered, bond->late, bond->lost);
+    for (int i = 0; i < bond->count; i++) {
+        usb_bond_link_t *link = &bond->links[i];
+        USB_LOG_INFO("Link %d: %lu transfers sent, %lu received, %lu failovers\n",
+                     i, link->tx_transfers, link->rx_transfers, link->failovers);
+    }
+
+    bond_free(bond);
+    return ret;
+}
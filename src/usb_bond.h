@@ -0,0 +1,107 @@
+// USB-C Software Network - Bonded Multi-Link TUN Backend
+// Carries one TUN/TAP interface over several USB-C cables at once.
+//
+// Each link is a peer claimed on its own USB port path with its own async
+// transfer engine. Outgoing frames are striped across the links that are
+// up, one transfer at a time: every transfer goes to the link with the
+// most free OUT slots, so a slow or stalled cable gets less traffic and
+// a full one none (per-link flow control). The packet header's seq
+// numbers the frames across all links; the receiver puts them back in
+// order before they reach the interface and gives up on a gap after
+// BOND_REORDER_MS.
+//
+// A link is failed over when its transfers report an error or, with a
+// Type-C port configured for it, as soon as the port monitor
+// (usb_typec.h) reports the partner gone. The remaining links carry on
+// and the failed one is reclaimed when its peer enumerates again.
+
+#ifndef USB_BOND_H
+#define USB_BOND_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "usb_net_core.h"
+#include "usb_tun.h"
+#include "usb_pool.h"
+#include "usb_typec.h"
+
+#define USB_BOND_MAX_LINKS 8
+#define USB_BOND_REORDER_MAX 256      // Frames held while waiting for a gap
+#define USB_BOND_REORDER_MS_DEFAULT 10
+
+typedef struct usb_bond usb_bond_t;
+
+typedef struct {
+    usb_bond_t *bond;
+    int index;
+    char port_path[USB_PORT_PATH_MAX];  // USB port the link's peer sits on
+    char typec_port_path[256];          // Empty = no partner monitoring
+    usb_typec_t typec;                  // Open while typec_port_path is monitored
+
+    usb_discovery_t discovery;
+    libusb_device_handle *handle;
+    usb_layout_t layout;
+    usb_xfer_engine_t xfer;
+
+    // Taken by the uplink while it fills a slot of this link and by the
+    // RX thread while it stops the engine, so neither sees it half gone
+    pthread_mutex_t tx_lock;
+    atomic_bool up;
+    pthread_t rx_thread;
+    bool rx_running;
+    int64_t partner_checked_ms;         // Last look at the port monitor
+
+    // Statistics
+    unsigned long tx_transfers;
+    unsigned long rx_transfers;
+    unsigned long failovers;
+} usb_bond_link_t;
+
+// A frame that arrived ahead of the next expected seq
+typedef struct {
+    bool used;
+    uint32_t seq;
+    uint16_t len;
+    uint8_t *data;               // From pending_pool while used
+} usb_bond_pending_t;
+
+struct usb_bond {
+    usb_net_device_t *device;
+    usb_tun_t tun;
+    usb_bond_link_t links[USB_BOND_MAX_LINKS];
+    int count;
+    size_t buffer_size;          // Transfer size of every link
+    int next_link;               // Tie-break for equally free links
+
+    // Reordering, shared by the link RX threads
+    pthread_mutex_t rx_lock;
+    bool synced;                 // next_seq has been set by a first frame
+    uint32_t next_seq;
+    usb_bond_pending_t pending[USB_BOND_REORDER_MAX];
+    usb_pool_t pending_pool;     // usb_mtu byte buffers for held frames
+    int pending_count;
+    int64_t gap_since_ms;        // When the oldest missing frame was first waited for
+    int reorder_ms;
+
+    // Statistics
+    unsigned long tx_frames;
+    unsigned long rx_frames;
+    unsigned long rx_dropped;    // Malformed records
+    unsigned long reordered;     // Frames that waited for an earlier one
+    unsigned long late;          // Duplicates and frames behind a skipped gap
+    unsigned long lost;          // Frames given up on
+};
+
+// Bridge the interface to every link in BOND_USB_PORTS until interrupted
+int usb_bond_run(usb_net_device_t *device);
+
+// Reorder buffer (rx_lock held): take a received frame, writing what is
+// in order to tun.fd; skip the gap once held for reorder_ms; drop what is
+// held and take next_seq from the next frame
+void usb_bond_reorder_input(usb_bond_t *bond, uint32_t seq, const uint8_t *data, uint16_t len);
+void usb_bond_reorder_expire(usb_bond_t *bond);
+void usb_bond_reorder_reset(usb_bond_t *bond);
+
+#endif // USB_BOND_H
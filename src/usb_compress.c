@@ -0,0 +1,243 @@
+// USB-C Software Network - Payload Compression Implementation
+//
+// LZ4 block format: a sequence is a token (literal count in the high
+// nibble, match length - 4 in the low one, 15 meaning "more bytes
+// follow, each adding up to 255"), the literals, and a 16-bit little
+// endian match offset. The last sequence has literals only. The last 5
+// bytes are always literals and no match starts in the last 12, which
+// lets decoders copy in whole words; the decoder here checks every bound
+// instead, as its input comes off the wire.
+
+#include "usb_compress.h"
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+
+#define LZ4_MIN_MATCH     4
+#define LZ4_LAST_LITERALS 5
+#define LZ4_MFLIMIT       12
+#define LZ4_MAX_OFFSET    65535
+#define LZ4_HASH_MIN_LOG  8
+#define LZ4_HASH_MAX_LOG  12   // 16 KiB table, sized down for short inputs
+#define LZ4_SKIP_SHIFT    5    // Literal run length that doubles the search step
+
+static const char *codec_names[USB_CODEC_MAX] = { "none", "lz4" };
+
+static uint32_t load32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint32_t lz4_hash(uint32_t v, int log) {
+    return (v * 2654435761u) >> (32 - log);
+}
+
+// Room for a token with len in its nibble, plus the extra length bytes
+static size_t length_bytes(size_t len) {
+    return len < 15 ? 0 : (len - 15) / 255 + 1;
+}
+
+static uint8_t *put_length(uint8_t *op, size_t len) {
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = (uint8_t)len;
+    return op;
+}
+
+static size_t lz4_compress(const uint8_t *src, size_t len, uint8_t *dst, size_t dst_len) {
+    uint32_t table[1 << LZ4_HASH_MAX_LOG];
+    const uint8_t *ip = src;
+    const uint8_t *anchor = src;
+    const uint8_t *end = src + len;
+    uint8_t *op = dst;
+    uint8_t *oend = dst + dst_len;
+
+    if (len > LZ4_MFLIMIT) {
+        const uint8_t *mflimit = end - LZ4_MFLIMIT;
+        const uint8_t *match_limit = end - LZ4_LAST_LITERALS;
+        int log = LZ4_HASH_MIN_LOG;
+        while (log < LZ4_HASH_MAX_LOG && ((size_t)1 << log) < len) {
+            log++;
+        }
+        memset(table, 0, sizeof(uint32_t) << log);
+
+        while (ip <= mflimit) {
+            uint32_t seq = load32(ip);
+            uint32_t h = lz4_hash(seq, log);
+            const uint8_t *ref = src + table[h];
+            table[h] = (uint32_t)(ip - src);
+
+            if (ref >= ip || ip - ref > LZ4_MAX_OFFSET || load32(ref) != seq) {
+                ip += 1 + ((size_t)(ip - anchor) >> LZ4_SKIP_SHIFT);
+                continue;
+            }
+
+            // Extend the match both ways
+            while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+                ip--;
+                ref--;
+            }
+            const uint8_t *mp = ip + LZ4_MIN_MATCH;
+            const uint8_t *rp = ref + LZ4_MIN_MATCH;
+            while (mp < match_limit && *mp == *rp) {
+                mp++;
+                rp++;
+            }
+
+            size_t lit = (size_t)(ip - anchor);
+            size_t match = (size_t)(mp - ip) - LZ4_MIN_MATCH;
+            if ((size_t)(oend - op) < 1 + length_bytes(lit) + lit + 2 + length_bytes(match)) {
+                return 0;
+            }
+
+            uint8_t *token = op++;
+            *token = (uint8_t)((lit < 15 ? lit : 15) << 4);
+            if (lit >= 15) op = put_length(op, lit - 15);
+            memcpy(op, anchor, lit);
+            op += lit;
+
+            uint16_t offset = (uint16_t)(ip - ref);
+            *op++ = (uint8_t)offset;
+            *op++ = (uint8_t)(offset >> 8);
+
+            *token |= (uint8_t)(match < 15 ? match : 15);
+            if (match >= 15) op = put_length(op, match - 15);
+
+            ip = anchor = mp;
+
+            // The bytes just before the next position often start the next match
+            if (ip <= mflimit) {
+                table[lz4_hash(load32(ip - 2), log)] = (uint32_t)(ip - 2 - src);
+            }
+        }
+    }
+
+    size_t lit = (size_t)(end - anchor);
+    if ((size_t)(oend - op) < 1 + length_bytes(lit) + lit) {
+        return 0;
+    }
+    *op++ = (uint8_t)((lit < 15 ? lit : 15) << 4);
+    if (lit >= 15) op = put_length(op, lit - 15);
+    memcpy(op, anchor, lit);
+    op += lit;
+
+    return (size_t)(op - dst);
+}
+
+// Extra length bytes after a nibble of 15. False if src ends first.
+static bool get_length(const uint8_t **ip, const uint8_t *iend, size_t *len) {
+    uint8_t b;
+
+    do {
+        if (*ip >= iend) return false;
+        b = *(*ip)++;
+        *len += b;
+    } while (b == 255);
+    return true;
+}
+
+static int lz4_decompress(const uint8_t *src, size_t len, uint8_t *dst, size_t dst_len) {
+    const uint8_t *ip = src;
+    const uint8_t *iend = src + len;
+    uint8_t *op = dst;
+    uint8_t *oend = dst + dst_len;
+
+    for (;;) {
+        if (ip >= iend) return -1;
+        uint8_t token = *ip++;
+
+        size_t lit = token >> 4;
+        if (lit == 15 && !get_length(&ip, iend, &lit)) return -1;
+        if ((size_t)(iend - ip) < lit || (size_t)(oend - op) < lit) return -1;
+        memcpy(op, ip, lit);
+        op += lit;
+        ip += lit;
+
+        if (ip == iend) break;  // Literals-only last sequence
+
+        if (iend - ip < 2) return -1;
+        size_t offset = (size_t)ip[0] | (size_t)ip[1] << 8;
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op - dst)) return -1;
+
+        size_t match = token & 15;
+        if (match == 15 && !get_length(&ip, iend, &match)) return -1;
+        match += LZ4_MIN_MATCH;
+        if ((size_t)(oend - op) < match) return -1;
+
+        // An offset shorter than the match repeats the bytes just written
+        const uint8_t *ref = op - offset;
+        if (offset >= match) {
+            memcpy(op, ref, match);
+            op += match;
+        } else {
+            while (match--) {
+                *op++ = *ref++;
+            }
+        }
+    }
+
+    return (int)(op - dst);
+}
+
+size_t usb_compress(usb_codec_t codec, const uint8_t *src, size_t len,
+                    uint8_t *dst, size_t dst_len) {
+    switch (codec) {
+        case USB_CODEC_LZ4:
+            return lz4_compress(src, len, dst, dst_len);
+        default:
+            return 0;
+    }
+}
+
+int usb_decompress(usb_codec_t codec, const uint8_t *src, size_t len,
+                   uint8_t *dst, size_t dst_len) {
+    switch (codec) {
+        case USB_CODEC_LZ4:
+            return lz4_decompress(src, len, dst, dst_len);
+        default:
+            return -1;
+    }
+}
+
+const char *usb_codec_name(usb_codec_t codec) {
+    return (codec >= 0 && codec < USB_CODEC_MAX) ? codec_names[codec] : "?";
+}
+
+int usb_codec_parse_list(const char *names, uint32_t *codecs) {
+    uint32_t bits = 0;
+
+    while (*names) {
+        size_t len = strcspn(names, ",");
+        int codec = 0;
+
+        while (codec < USB_CODEC_MAX &&
+               (strlen(codec_names[codec]) != len || strncmp(names, codec_names[codec], len) != 0)) {
+            codec++;
+        }
+        if (codec == USB_CODEC_MAX) return -1;
+        if (codec != USB_CODEC_NONE) bits |= USB_CODEC_BIT(codec);
+
+        names += len;
+        if (*names == ',') names++;
+    }
+
+    *codecs = bits;
+    return 0;
+}
+
+void usb_codec_format_list(uint32_t codecs, char *out, size_t outlen) {
+    size_t used = 0;
+
+    out[0] = '\0';
+    for (int codec = USB_CODEC_NONE + 1; codec < USB_CODEC_MAX; codec++) {
+        if (!(codecs & USB_CODEC_BIT(codec)) || used >= outlen) continue;
+        used += (size_t)snprintf(out + used, outlen - used, "%s%s", used ? "," : "", codec_names[codec]);
+    }
+    if (!out[0]) {
+        snprintf(out, outlen, "none");
+    }
+}
@@ -0,0 +1,54 @@
+// USB-C Software Network - Payload Compression
+// Codecs for compressing data frame payloads on slow links. The codec in
+// use travels in the frame header, so a receiver needs no state to
+// decompress.
+//
+// LZ4 is implemented here in the LZ4 block format (no frame header, no
+// dictionary): a greedy single-probe hash match finder that skips ahead
+// faster the longer it goes without a match, so incompressible data costs
+// little more than a copy.
+
+#ifndef USB_COMPRESS_H
+#define USB_COMPRESS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    USB_CODEC_NONE = 0,
+    USB_CODEC_LZ4 = 1,
+    USB_CODEC_MAX
+} usb_codec_t;
+
+#define USB_CODEC_BIT(codec) (1u << (codec))
+
+// Compress len bytes of src into dst. Returns the compressed size, or 0 if
+// it does not fit in dst_len bytes (pass len - 1 to accept only output
+// that is smaller than the input).
+size_t usb_compress(usb_codec_t codec, const uint8_t *src, size_t len,
+                    uint8_t *dst, size_t dst_len);
+
+// Decompress into dst. Returns the original size, or -1 if src is corrupt
+// or would not fit in dst_len bytes.
+int usb_decompress(usb_codec_t codec, const uint8_t *src, size_t len,
+                   uint8_t *dst, size_t dst_len);
+
+// "none", "lz4"
+const char *usb_codec_name(usb_codec_t codec);
+
+// Parse a comma-separated list of codec names into USB_CODEC_BIT() bits.
+// "none" alone gives 0. Returns -1 on an unknown name.
+int usb_codec_parse_list(const char *names, uint32_t *codecs);
+
+// Format USB_CODEC_BIT() bits as a comma-separated list, "none" if empty
+void usb_codec_format_list(uint32_t codecs, char *out, size_t outlen);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // USB_COMPRESS_H
@@ -0,0 +1,244 @@
+// USB-C Software Network - CRC32C Implementation
+//
+// All paths operate on the raw (non-inverted) CRC register; usb_crc32c()
+// applies the standard pre/post inversion around them.
+//
+// Three-lane merge: for lanes A, B, C of CRC_LANE bytes each,
+//   crc(s, A|B|C) = crc(s, A)*x^(16L) + crc(0, B)*x^(8L) + crc(0, C)  mod P
+// with L = CRC_LANE. The crc32 instruction on a 64-bit operand v yields
+// v*x^32 mod P, and a carry-less multiply of two reflected 32-bit values
+// yields their product times x, so multiplying by a constant
+// K = x^(n - 33) mod P first and reducing with crc32 gives crc*x^n mod P.
+// The constants are derived at startup with the bitwise multmodp() below.
+
+#include "usb_crc32c.h"
+#include <string.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#include <wmmintrin.h>
+#define CRC_HAVE_X86 1
+#elif defined(__aarch64__)
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#define CRC_HAVE_ARM 1
+#endif
+
+#define CRC32C_POLY 0x82F63B78u  // Castagnoli, bit-reflected
+#define CRC_LANE    256          // Bytes per lane in the three-lane loop
+
+typedef uint32_t (*crc_fn_t)(uint32_t crc, const uint8_t *p, size_t len);
+
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+static crc_fn_t crc_fn;
+static const char *crc_impl_name;
+static uint32_t crc_table[8][256];
+static uint32_t lane_k1;         // x^(8L - 33) mod P
+static uint32_t lane_k2;         // x^(16L - 33) mod P
+
+static uint64_t load64(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+// a*b mod P, reflected (bit 31 is x^0)
+static uint32_t multmodp(uint32_t a, uint32_t b) {
+    uint32_t m = 1u << 31;
+    uint32_t p = 0;
+
+    for (;;) {
+        if (a & m) {
+            p ^= b;
+            if ((a & (m - 1)) == 0) break;
+        }
+        m >>= 1;
+        b = (b & 1) ? (b >> 1) ^ CRC32C_POLY : b >> 1;
+    }
+    return p;
+}
+
+// x^n mod P
+static uint32_t xnmodp(uint64_t n) {
+    uint32_t p = 1u << 31;       // x^0
+    uint32_t sq = 1u << 30;      // x^1
+
+    while (n) {
+        if (n & 1) p = multmodp(sq, p);
+        sq = multmodp(sq, sq);
+        n >>= 1;
+    }
+    return p;
+}
+
+// Slicing-by-8 fallback
+static uint32_t crc_table_update(uint32_t crc, const uint8_t *p, size_t len) {
+    while (len && ((uintptr_t)p & 7)) {
+        crc = crc_table[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+        len--;
+    }
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    while (len >= 8) {
+        uint64_t w = load64(p) ^ crc;
+        crc = crc_table[7][w & 0xFF] ^
+              crc_table[6][(w >> 8) & 0xFF] ^
+              crc_table[5][(w >> 16) & 0xFF] ^
+              crc_table[4][(w >> 24) & 0xFF] ^
+              crc_table[3][(w >> 32) & 0xFF] ^
+              crc_table[2][(w >> 40) & 0xFF] ^
+              crc_table[1][(w >> 48) & 0xFF] ^
+              crc_table[0][w >> 56];
+        p += 8;
+        len -= 8;
+    }
+#endif
+
+    while (len--) {
+        crc = crc_table[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+static void build_tables(void) {
+    for (uint32_t n = 0; n < 256; n++) {
+        uint32_t c = n;
+        for (int k = 0; k < 8; k++) {
+            c = (c & 1) ? (c >> 1) ^ CRC32C_POLY : c >> 1;
+        }
+        crc_table[0][n] = c;
+    }
+
+    for (uint32_t n = 0; n < 256; n++) {
+        uint32_t c = crc_table[0][n];
+        for (int k = 1; k < 8; k++) {
+            c = crc_table[0][c & 0xFF] ^ (c >> 8);
+            crc_table[k][n] = c;
+        }
+    }
+}
+
+#ifdef CRC_HAVE_X86
+__attribute__((target("sse4.2")))
+static uint32_t crc_sse42_update(uint32_t crc, const uint8_t *p, size_t len) {
+    while (len && ((uintptr_t)p & 7)) {
+        crc = _mm_crc32_u8(crc, *p++);
+        len--;
+    }
+
+#ifdef __x86_64__
+    while (len >= 8) {
+        crc = (uint32_t)_mm_crc32_u64(crc, load64(p));
+        p += 8;
+        len -= 8;
+    }
+#endif
+
+    while (len--) {
+        crc = _mm_crc32_u8(crc, *p++);
+    }
+    return crc;
+}
+
+#ifdef __x86_64__
+// crc * x^n mod P, with k = x^(n - 33) mod P
+__attribute__((target("sse4.2,pclmul")))
+static uint32_t clmul_shift(uint32_t crc, uint32_t k) {
+    __m128i prod = _mm_clmulepi64_si128(_mm_cvtsi32_si128((int)crc),
+                                        _mm_cvtsi32_si128((int)k), 0x00);
+    return (uint32_t)_mm_crc32_u64(0, (uint64_t)_mm_cvtsi128_si64(prod));
+}
+
+// Three independent crc32 dependency chains hide the instruction's
+// 3-cycle latency; the lanes are merged with two carry-less multiplies
+__attribute__((target("sse4.2,pclmul")))
+static uint32_t crc_sse42_clmul_update(uint32_t crc, const uint8_t *p, size_t len) {
+    while (len && ((uintptr_t)p & 7)) {
+        crc = _mm_crc32_u8(crc, *p++);
+        len--;
+    }
+
+    while (len >= 3 * CRC_LANE) {
+        uint64_t c0 = crc, c1 = 0, c2 = 0;
+
+        for (size_t i = 0; i < CRC_LANE; i += 8) {
+            c0 = _mm_crc32_u64(c0, load64(p + i));
+            c1 = _mm_crc32_u64(c1, load64(p + CRC_LANE + i));
+            c2 = _mm_crc32_u64(c2, load64(p + 2 * CRC_LANE + i));
+        }
+
+        crc = clmul_shift((uint32_t)c0, lane_k2) ^ clmul_shift((uint32_t)c1, lane_k1) ^ (uint32_t)c2;
+        p += 3 * CRC_LANE;
+        len -= 3 * CRC_LANE;
+    }
+
+    return crc_sse42_update(crc, p, len);
+}
+#endif
+#endif // CRC_HAVE_X86
+
+#ifdef CRC_HAVE_ARM
+__attribute__((target("arch=armv8-a+crc")))
+static uint32_t crc_armv8_update(uint32_t crc, const uint8_t *p, size_t len) {
+    while (len && ((uintptr_t)p & 7)) {
+        crc = __crc32cb(crc, *p++);
+        len--;
+    }
+
+    while (len >= 8) {
+        crc = __crc32cd(crc, load64(p));
+        p += 8;
+        len -= 8;
+    }
+
+    while (len--) {
+        crc = __crc32cb(crc, *p++);
+    }
+    return crc;
+}
+#endif
+
+static void crc_select(void) {
+    lane_k1 = xnmodp(8 * CRC_LANE - 33);
+    lane_k2 = xnmodp(16 * CRC_LANE - 33);
+
+#ifdef CRC_HAVE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2")) {
+#ifdef __x86_64__
+        if (__builtin_cpu_supports("pclmul")) {
+            crc_fn = crc_sse42_clmul_update;
+            crc_impl_name = "sse4.2+pclmul";
+            return;
+        }
+#endif
+        crc_fn = crc_sse42_update;
+        crc_impl_name = "sse4.2";
+        return;
+    }
+#endif
+
+#ifdef CRC_HAVE_ARM
+    if (getauxval(AT_HWCAP) & HWCAP_CRC32) {
+        crc_fn = crc_armv8_update;
+        crc_impl_name = "armv8";
+        return;
+    }
+#endif
+
+    build_tables();
+    crc_fn = crc_table_update;
+    crc_impl_name = "table";
+}
+
+uint32_t usb_crc32c(uint32_t crc, const void *data, size_t len) {
+    pthread_once(&crc_once, crc_select);
+    return ~crc_fn(~crc, (const uint8_t *)data, len);
+}
+
+const char *usb_crc32c_impl(void) {
+    pthread_once(&crc_once, crc_select);
+    return crc_impl_name;
+}
@@ -0,0 +1,23 @@
+// USB-C Software Network - CRC32C (Castagnoli) Checksum
+// Frame checksum for the raw protocol. The implementation is picked once
+// at runtime:
+//   - x86-64 with SSE4.2: crc32 instruction; frames of 3 lanes or more are
+//     split into three independent instruction streams that are merged
+//     with a PCLMULQDQ carry-less multiply
+//   - AArch64 with the CRC extension: crc32c instructions
+//   - otherwise: slicing-by-8 tables
+
+#ifndef USB_CRC32C_H
+#define USB_CRC32C_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Update a CRC32C with len bytes. Start with crc = 0; calls chain, so
+// usb_crc32c(usb_crc32c(0, a, n), b, m) is the CRC of a followed by b.
+uint32_t usb_crc32c(uint32_t crc, const void *data, size_t len);
+
+// Name of the implementation in use ("sse4.2+pclmul", "armv8", "table")
+const char *usb_crc32c_impl(void);
+
+#endif // USB_CRC32C_H
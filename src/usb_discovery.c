@@ -0,0 +1,400 @@
+// USB-C Software Network - Peer Device Discovery Implementation
+//
+// Locking: disc->lock protects the pending queue and its counters, which
+// the hotplug callback updates from whichever thread is handling libusb
+// events (ours while waiting, the transfer engine's event thread once a
+// peer is running). Devices are only opened by usb_discovery_find(), never
+// from the callback, as libusb requires.
+
+#include "usb_discovery.h"
+#include "usb_log.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#define USB_DISCOVERY_POLL_MS  1000  // Device list rescan without hotplug
+#define USB_DISCOVERY_RETRY_MS 100   // Re-open a busy or not yet accessible device
+
+#define TRY_CLAIMED  0
+#define TRY_DROP     1
+#define TRY_RETRY   -1
+
+static int64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Physical port path in the sysfs form "bus-port.port...", "" for root hubs
+static void port_path_of(libusb_device *dev, char *path, size_t size) {
+    uint8_t ports[8];
+    int n = libusb_get_port_numbers(dev, ports, (int)sizeof(ports));
+
+    path[0] = '\0';
+    if (n <= 0) return;
+
+    int len = snprintf(path, size, "%d-%d", libusb_get_bus_number(dev), ports[0]);
+    for (int i = 1; i < n && len > 0 && (size_t)len < size; i++) {
+        len += snprintf(path + len, size - (size_t)len, ".%d", ports[i]);
+    }
+}
+
+static void queue_device(usb_discovery_t *disc, libusb_device *dev) {
+    pthread_mutex_lock(&disc->lock);
+    bool queued = false;
+    for (int i = 0; i < disc->pending_count; i++) {
+        if (disc->pending[i] == dev) queued = true;
+    }
+    if (!queued) {
+        if (disc->pending_count < USB_DISCOVERY_PENDING_MAX) {
+            disc->pending[disc->pending_count++] = libusb_ref_device(dev);
+        } else {
+            disc->overflow = true;
+        }
+    }
+    pthread_mutex_unlock(&disc->lock);
+}
+
+static libusb_device *dequeue_device(usb_discovery_t *disc) {
+    libusb_device *dev = NULL;
+
+    pthread_mutex_lock(&disc->lock);
+    if (disc->pending_count > 0) {
+        dev = disc->pending[0];
+        disc->pending_count--;
+        memmove(&disc->pending[0], &disc->pending[1],
+                (size_t)disc->pending_count * sizeof(libusb_device *));
+    }
+    pthread_mutex_unlock(&disc->lock);
+    return dev;
+}
+
+static int LIBUSB_CALL hotplug_callback(libusb_context *ctx, libusb_device *dev,
+                                        libusb_hotplug_event event, void *user_data) {
+    usb_discovery_t *disc = user_data;
+    (void)ctx;
+
+    if (event == LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED) {
+        pthread_mutex_lock(&disc->lock);
+        disc->arrivals++;
+        pthread_mutex_unlock(&disc->lock);
+        queue_device(disc, dev);
+    } else if (event == LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT) {
+        pthread_mutex_lock(&disc->lock);
+        disc->departures++;
+        for (int i = 0; i < disc->pending_count; i++) {
+            if (disc->pending[i] != dev) continue;
+            libusb_unref_device(dev);
+            disc->pending_count--;
+            memmove(&disc->pending[i], &disc->pending[i + 1],
+                    (size_t)(disc->pending_count - i) * sizeof(libusb_device *));
+            break;
+        }
+        pthread_mutex_unlock(&disc->lock);
+    }
+    return 0;  // Stay registered
+}
+
+static usb_layout_t *cache_find(usb_discovery_t *disc, uint16_t vid, uint16_t pid,
+                                const char *port_path) {
+    for (int i = 0; i < disc->cache_count; i++) {
+        usb_layout_t *layout = &disc->cache[i];
+        if (layout->vendor_id == vid && layout->product_id == pid &&
+            strcmp(layout->port_path, port_path) == 0) {
+            return layout;
+        }
+    }
+    return NULL;
+}
+
+static void cache_store(usb_discovery_t *disc, const usb_layout_t *layout) {
+    usb_layout_t *slot = cache_find(disc, layout->vendor_id, layout->product_id,
+                                    layout->port_path);
+    if (!slot) {
+        if (disc->cache_count < USB_DISCOVERY_CACHE_MAX) {
+            slot = &disc->cache[disc->cache_count++];
+        } else {
+            slot = &disc->cache[disc->cache_next];
+            disc->cache_next = (disc->cache_next + 1) % USB_DISCOVERY_CACHE_MAX;
+        }
+    }
+    *slot = *layout;
+}
+
+static void cache_forget(usb_discovery_t *disc, usb_layout_t *layout) {
+    int i = (int)(layout - disc->cache);
+    disc->cache_count--;
+    memmove(&disc->cache[i], &disc->cache[i + 1],
+            (size_t)(disc->cache_count - i) * sizeof(usb_layout_t));
+    if (disc->cache_next > disc->cache_count) disc->cache_next = 0;
+}
+
+static int claim(libusb_device_handle *handle, int iface) {
+    if (libusb_kernel_driver_active(handle, iface) == 1) {
+        libusb_detach_kernel_driver(handle, iface);
+    }
+    return libusb_claim_interface(handle, iface);
+}
+
+// Walk the active configuration for an interface with bulk IN and OUT
+// endpoints and claim it
+static int claim_from_descriptor(libusb_device *dev, libusb_device_handle *handle,
+                                 usb_layout_t *layout) {
+    struct libusb_config_descriptor *config;
+    int ret = libusb_get_active_config_descriptor(dev, &config);
+    if (ret != 0) return ret;
+
+    ret = LIBUSB_ERROR_NOT_FOUND;
+    for (int iface = 0; iface < config->bNumInterfaces && ret != 0; iface++) {
+        const struct libusb_interface *interface = &config->interface[iface];
+        for (int alt = 0; alt < interface->num_altsetting; alt++) {
+            const struct libusb_interface_descriptor *iface_desc = &interface->altsetting[alt];
+            uint8_t ep_in = 0, ep_out = 0;
+
+            for (int ep = 0; ep < iface_desc->bNumEndpoints; ep++) {
+                const struct libusb_endpoint_descriptor *ep_desc = &iface_desc->endpoint[ep];
+
+                if ((ep_desc->bmAttributes & LIBUSB_TRANSFER_TYPE_MASK) == LIBUSB_TRANSFER_TYPE_BULK) {
+                    if (ep_desc->bEndpointAddress & LIBUSB_ENDPOINT_IN) {
+                        ep_in = ep_desc->bEndpointAddress;
+                    } else {
+                        ep_out = ep_desc->bEndpointAddress;
+                    }
+                }
+            }
+
+            if (!ep_in || !ep_out) continue;
+
+            ret = claim(handle, iface);
+            if (ret == 0) {
+                layout->interface_num = iface;
+                layout->endpoint_in = ep_in;
+                layout->endpoint_out = ep_out;
+            }
+            break;
+        }
+    }
+
+    libusb_free_config_descriptor(config);
+    return ret;
+}
+
+// Open and claim one candidate. TRY_RETRY if it may work shortly (udev has
+// not granted access yet, or another process still holds the interface).
+static int try_device(usb_discovery_t *disc, libusb_device *dev,
+                      libusb_device_handle **handle, usb_layout_t *layout) {
+    struct libusb_device_descriptor desc;
+    char port_path[USB_PORT_PATH_MAX];
+    int bus = libusb_get_bus_number(dev);
+
+    if (libusb_get_device_descriptor(dev, &desc) != 0) return TRY_DROP;
+
+    if (disc->target_bus > 0 && bus != disc->target_bus) return TRY_DROP;
+
+    port_path_of(dev, port_path, sizeof(port_path));
+    if (!port_path[0]) return TRY_DROP;  // Root hub
+    if (disc->target_port_path[0] && strcmp(port_path, disc->target_port_path) != 0) {
+        return TRY_DROP;
+    }
+
+    // Skip root hubs (VID 1d6b is Linux Foundation) and hubs (class 0x09)
+    if (desc.idVendor == 0x1d6b || desc.bDeviceClass == 0x09) return TRY_DROP;
+
+    libusb_device_handle *h;
+    int ret = libusb_open(dev, &h);
+    if (ret == LIBUSB_ERROR_ACCESS || ret == LIBUSB_ERROR_BUSY) return TRY_RETRY;
+    if (ret != 0) return TRY_DROP;
+
+    usb_layout_t found = {
+        .vendor_id = desc.idVendor,
+        .product_id = desc.idProduct,
+        .bus = bus,
+    };
+    memcpy(found.port_path, port_path, sizeof(found.port_path));
+
+    // Known device on a known port: skip the descriptor walk
+    usb_layout_t *cached = cache_find(disc, desc.idVendor, desc.idProduct, port_path);
+    bool from_cache = false;
+    ret = LIBUSB_ERROR_NOT_FOUND;
+    if (cached) {
+        ret = claim(h, cached->interface_num);
+        if (ret == 0) {
+            found = *cached;
+            from_cache = true;
+            disc->cache_hits++;
+        } else if (ret != LIBUSB_ERROR_BUSY && ret != LIBUSB_ERROR_NO_DEVICE) {
+            cache_forget(disc, cached);  // Firmware changed, look again
+        }
+    }
+    if (ret != 0 && ret != LIBUSB_ERROR_BUSY && ret != LIBUSB_ERROR_NO_DEVICE) {
+        ret = claim_from_descriptor(dev, h, &found);
+        if (ret == 0) cache_store(disc, &found);
+    }
+
+    if (ret != 0) {
+        libusb_close(h);
+        return ret == LIBUSB_ERROR_BUSY ? TRY_RETRY : TRY_DROP;
+    }
+
+    USB_LOG_INFO("Found peer device: %04x:%04x on port %s%s\n",
+                 found.vendor_id, found.product_id, found.port_path,
+                 from_cache ? " (cached layout)" : "");
+    USB_LOG_INFO("  Bulk IN: 0x%02x, Bulk OUT: 0x%02x\n", found.endpoint_in, found.endpoint_out);
+
+    *handle = h;
+    *layout = found;
+    return TRY_CLAIMED;
+}
+
+// Try every device on the bus once
+static int scan_list(usb_discovery_t *disc, libusb_device_handle **handle,
+                     usb_layout_t *layout) {
+    libusb_device **devs;
+    ssize_t cnt = libusb_get_device_list(disc->ctx, &devs);
+    if (cnt < 0) {
+        USB_LOG_ERROR("Failed to get device list\n");
+        return -1;
+    }
+
+    int ret = -1;
+    for (ssize_t i = 0; i < cnt && ret != 0; i++) {
+        ret = try_device(disc, devs[i], handle, layout) == TRY_CLAIMED ? 0 : -1;
+    }
+
+    libusb_free_device_list(devs, 1);
+    return ret;
+}
+
+// Try the queued arrivals. Devices worth another attempt are queued again
+// and *retry is set.
+static int scan_pending(usb_discovery_t *disc, libusb_device_handle **handle,
+                        usb_layout_t *layout, bool *retry) {
+    libusb_device *later[USB_DISCOVERY_PENDING_MAX];
+    int later_count = 0;
+    int ret = -1;
+
+    pthread_mutex_lock(&disc->lock);
+    bool overflow = disc->overflow;
+    disc->overflow = false;
+    pthread_mutex_unlock(&disc->lock);
+
+    if (overflow && scan_list(disc, handle, layout) == 0) return 0;
+
+    libusb_device *dev;
+    while (ret != 0 && (dev = dequeue_device(disc)) != NULL) {
+        int result = try_device(disc, dev, handle, layout);
+        if (result == TRY_CLAIMED) {
+            ret = 0;
+        } else if (result == TRY_RETRY && later_count < USB_DISCOVERY_PENDING_MAX) {
+            later[later_count++] = libusb_ref_device(dev);
+        }
+        libusb_unref_device(dev);
+    }
+
+    for (int i = 0; i < later_count; i++) {
+        queue_device(disc, later[i]);
+        libusb_unref_device(later[i]);
+    }
+    *retry = later_count > 0;
+    return ret;
+}
+
+int usb_discovery_init(usb_discovery_t *disc, libusb_context *ctx, int bus,
+                       const char *port_path) {
+    memset(disc, 0, sizeof(usb_discovery_t));
+    disc->ctx = ctx;
+    disc->target_bus = bus;
+    if (port_path) {
+        strncpy(disc->target_port_path, port_path, sizeof(disc->target_port_path) - 1);
+    }
+    pthread_mutex_init(&disc->lock, NULL);
+
+    if (!libusb_has_capability(LIBUSB_CAP_HAS_HOTPLUG)) {
+        USB_LOG_INFO("USB hotplug unsupported, polling for the peer every %d ms\n",
+                     USB_DISCOVERY_POLL_MS);
+        return 0;
+    }
+
+    // ENUMERATE queues everything already attached before this returns
+    int ret = libusb_hotplug_register_callback(ctx,
+            LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED | LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT,
+            LIBUSB_HOTPLUG_ENUMERATE, LIBUSB_HOTPLUG_MATCH_ANY,
+            LIBUSB_HOTPLUG_MATCH_ANY, LIBUSB_HOTPLUG_MATCH_ANY,
+            hotplug_callback, disc, &disc->hotplug_handle);
+    if (ret != LIBUSB_SUCCESS) {
+        USB_LOG_WARN("Failed to register USB hotplug callback: %s, polling instead\n",
+                     libusb_error_name(ret));
+        return 0;
+    }
+
+    disc->hotplug = true;
+    return 0;
+}
+
+void usb_discovery_cleanup(usb_discovery_t *disc) {
+    if (!disc->ctx) return;
+
+    if (disc->hotplug) {
+        libusb_hotplug_deregister_callback(disc->ctx, disc->hotplug_handle);
+        disc->hotplug = false;
+    }
+
+    libusb_device *dev;
+    while ((dev = dequeue_device(disc)) != NULL) {
+        libusb_unref_device(dev);
+    }
+
+    pthread_mutex_destroy(&disc->lock);
+    disc->ctx = NULL;
+}
+
+int usb_discovery_find(usb_discovery_t *disc, int timeout_ms,
+                       libusb_device_handle **handle, usb_layout_t *layout) {
+    int64_t deadline = now_ms() + (timeout_ms > 0 ? timeout_ms : 0);
+
+    if (!disc->hotplug) {
+        // Polling fallback: walk the device list every USB_DISCOVERY_POLL_MS
+        for (;;) {
+            if (scan_list(disc, handle, layout) == 0) return 0;
+
+            int64_t left = deadline - now_ms();
+            if (left <= 0) return -1;
+            usleep((useconds_t)(left < USB_DISCOVERY_POLL_MS ? left : USB_DISCOVERY_POLL_MS) * 1000);
+        }
+    }
+
+    // Pick up arrivals signalled before we got here
+    struct timeval zero = { 0, 0 };
+    libusb_handle_events_timeout_completed(disc->ctx, &zero, NULL);
+
+    for (;;) {
+        bool retry = false;
+        if (scan_pending(disc, handle, layout, &retry) == 0) return 0;
+
+        int64_t left = deadline - now_ms();
+        if (left <= 0) return -1;
+        if (retry && left > USB_DISCOVERY_RETRY_MS) left = USB_DISCOVERY_RETRY_MS;
+
+        // Hotplug callbacks run from here; returns once events were handled
+        struct timeval tv = {
+            .tv_sec = (time_t)(left / 1000),
+            .tv_usec = (suseconds_t)(left % 1000) * 1000,
+        };
+        int ret = libusb_handle_events_timeout_completed(disc->ctx, &tv, NULL);
+        if (ret < 0 && ret != LIBUSB_ERROR_INTERRUPTED) {
+            USB_LOG_ERROR("USB event handling failed: %s\n", libusb_error_name(ret));
+            return -1;
+        }
+    }
+}
+
+void usb_discovery_release(usb_discovery_t *disc, libusb_device_handle *handle,
+                           const usb_layout_t *layout) {
+    libusb_device *dev = libusb_get_device(handle);
+
+    libusb_release_interface(handle, layout->interface_num);
+    if (disc->hotplug) queue_device(disc, dev);
+    libusb_close(handle);
+}
@@ -0,0 +1,88 @@
+// USB-C Software Network - Peer Device Discovery
+// Finds and claims the peer's bulk endpoints without walking the whole
+// bus on every attempt.
+//
+// A libusb hotplug callback queues devices as they arrive, so a waiting
+// caller wakes as soon as the peer enumerates instead of on the next
+// one-second rescan. Endpoint layouts that have been claimed before are
+// cached by VID:PID and port path: a device that comes back after a cable
+// flap is claimed without reading its configuration descriptor again.
+// Port paths come from libusb_get_port_numbers() rather than sysfs.
+// Without hotplug support the device list is polled as before, with the
+// same filters and cache.
+
+#ifndef USB_DISCOVERY_H
+#define USB_DISCOVERY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <libusb-1.0/libusb.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define USB_DISCOVERY_CACHE_MAX   16  // Remembered endpoint layouts
+#define USB_DISCOVERY_PENDING_MAX 32  // Arrived devices not yet tried
+#define USB_PORT_PATH_MAX         32  // "bus-port.port..." incl. NUL
+
+// Where a peer's bulk endpoints were found
+typedef struct {
+    uint16_t vendor_id;
+    uint16_t product_id;
+    char port_path[USB_PORT_PATH_MAX];  // Same form as USB_PORT_PATH
+    int bus;
+    int interface_num;
+    uint8_t endpoint_in;
+    uint8_t endpoint_out;
+} usb_layout_t;
+
+typedef struct {
+    libusb_context *ctx;
+    int target_bus;                     // 0 = any bus
+    char target_port_path[USB_PORT_PATH_MAX];  // Empty = any port
+    bool hotplug;                       // Callback registered
+    libusb_hotplug_callback_handle hotplug_handle;
+
+    // Filled by the hotplug callback on whichever thread handles libusb
+    // events, drained by usb_discovery_find()
+    pthread_mutex_t lock;
+    libusb_device *pending[USB_DISCOVERY_PENDING_MAX];  // Referenced
+    int pending_count;
+    bool overflow;                      // Arrivals were lost, walk the list once
+    unsigned long arrivals;
+    unsigned long departures;
+
+    usb_layout_t cache[USB_DISCOVERY_CACHE_MAX];
+    int cache_count;
+    int cache_next;                     // Entry replaced when full
+    unsigned long cache_hits;
+} usb_discovery_t;
+
+// Set up discovery on a libusb context, filtering by bus (0 = any) and
+// port path (NULL/empty = any). Registers the hotplug callback when the
+// platform supports it; the devices already present are queued at once.
+int usb_discovery_init(usb_discovery_t *disc, libusb_context *ctx, int bus,
+                       const char *port_path);
+
+// Deregister the callback and drop queued devices
+void usb_discovery_cleanup(usb_discovery_t *disc);
+
+// Wait up to timeout_ms (0 = try once) for a device with bulk IN and OUT
+// endpoints and claim its interface. Returns 0 with *handle open and
+// *layout filled, -1 if none was found in time.
+int usb_discovery_find(usb_discovery_t *disc, int timeout_ms,
+                       libusb_device_handle **handle, usb_layout_t *layout);
+
+// Release and close a handle returned by usb_discovery_find(). The device
+// is queued again, so a later find reclaims it at once if it is still
+// attached and drops it if it has gone.
+void usb_discovery_release(usb_discovery_t *disc, libusb_device_handle *handle,
+                           const usb_layout_t *layout);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // USB_DISCOVERY_H
@@ -0,0 +1,54 @@
+// USB-C Software Network - Frame Buffer Descriptor
+// A frame is a payload with reserved headroom in front of it, so each
+// protocol layer can write its header in place instead of copying the
+// payload into a separate message buffer.
+//
+//   base                    data                      data + len
+//   |<----- headroom ------>|<-------- payload ------->|
+//
+// Frames handed out by the stack (alloc/recv) point into stack-owned
+// buffers such as transfer slots or window slots and must be given back
+// with the matching send or release call.
+
+#ifndef USB_FRAME_H
+#define USB_FRAME_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    uint8_t *base;       // Start of the buffer, headroom begins here
+    size_t capacity;     // Total buffer size
+    size_t headroom;     // Bytes reserved in front of data
+    uint8_t *data;       // Payload (base + headroom)
+    size_t len;          // Payload bytes
+    int slot;            // Stack buffer index, -1 = caller-owned
+    uint8_t channel;     // Logical channel (raw protocol), 0 = default
+} usb_frame_t;
+
+// Describe a caller-owned buffer with headroom bytes reserved for headers
+static inline void usb_frame_init(usb_frame_t *frame, uint8_t *buffer, size_t size,
+                                  size_t headroom) {
+    frame->base = buffer;
+    frame->capacity = size;
+    frame->headroom = headroom;
+    frame->data = buffer + headroom;
+    frame->len = 0;
+    frame->slot = -1;
+    frame->channel = 0;
+}
+
+// Payload bytes that fit after the headroom
+static inline size_t usb_frame_room(const usb_frame_t *frame) {
+    return frame->capacity - frame->headroom;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // USB_FRAME_H
@@ -0,0 +1,167 @@
+// USB-C Software Network - Logging
+//
+// Shutdown: producers announce themselves in log_writers around their use
+// of the queue, so usb_log_stop() can clear log_running, wait for the ones
+// already inside and only then drain and free the queue.
+
+#include "usb_log.h"
+#include "usb_queue.h"
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+
+static usb_queue_t log_queue;
+static pthread_t log_thread;
+static int log_stop_fd = -1;
+static atomic_bool log_running;
+static _Atomic int log_writers;
+static _Atomic unsigned long log_dropped;
+
+static int64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static FILE *level_stream(int level) {
+    return level <= USB_LOG_LEVEL_WARN ? stderr : stdout;
+}
+
+// Write out every queued message. Returns the number written.
+static int drain(void) {
+    usb_queue_slot_t *slot;
+    int n = 0;
+
+    while ((slot = usb_queue_peek(&log_queue)) != NULL) {
+        fwrite(slot->data, 1, slot->len, level_stream((int)slot->peer_id));
+        usb_queue_release(&log_queue, slot);
+        n++;
+    }
+    if (n > 0) {
+        fflush(stdout);
+        fflush(stderr);
+    }
+    return n;
+}
+
+static void *log_thread_main(void *arg) {
+    (void)arg;
+
+    while (usb_queue_wait_data(&log_queue, -1, log_stop_fd) > 0) {
+        drain();
+    }
+    drain();
+    return NULL;
+}
+
+void usb_log_write(int level, const char *fmt, ...) {
+    va_list ap;
+
+    atomic_fetch_add_explicit(&log_writers, 1, memory_order_seq_cst);
+    if (!atomic_load_explicit(&log_running, memory_order_seq_cst)) {
+        atomic_fetch_sub_explicit(&log_writers, 1, memory_order_release);
+        va_start(ap, fmt);
+        vfprintf(level_stream(level), fmt, ap);
+        va_end(ap);
+        return;
+    }
+
+    usb_queue_slot_t *slot = usb_queue_reserve(&log_queue);
+    if (!slot) {
+        atomic_fetch_add_explicit(&log_dropped, 1, memory_order_relaxed);
+        atomic_fetch_sub_explicit(&log_writers, 1, memory_order_release);
+        return;
+    }
+
+    va_start(ap, fmt);
+    int n = vsnprintf((char *)slot->data, USB_LOG_MSG_MAX, fmt, ap);
+    va_end(ap);
+
+    if (n < 0) {
+        n = 0;
+    } else if (n >= USB_LOG_MSG_MAX) {
+        // Keep the line structure of a truncated message
+        n = USB_LOG_MSG_MAX - 1;
+        slot->data[n - 1] = '\n';
+    }
+    slot->len = (size_t)n;
+    slot->peer_id = (uint32_t)level;
+    usb_queue_commit(&log_queue, slot);
+    atomic_fetch_sub_explicit(&log_writers, 1, memory_order_release);
+}
+
+bool usb_log_ratelimit(usb_log_ratelimit_t *rl, int interval_ms, unsigned long *held) {
+    int64_t now = now_ms();
+    int64_t next = atomic_load_explicit(&rl->next_ms, memory_order_relaxed);
+
+    // One thread wins the interval; the others count as suppressed
+    if (now < next || !atomic_compare_exchange_strong_explicit(&rl->next_ms, &next,
+                                                               now + interval_ms,
+                                                               memory_order_relaxed,
+                                                               memory_order_relaxed)) {
+        atomic_fetch_add_explicit(&rl->suppressed, 1, memory_order_relaxed);
+        return false;
+    }
+
+    *held = atomic_exchange_explicit(&rl->suppressed, 0, memory_order_relaxed);
+    return true;
+}
+
+int usb_log_start(void) {
+    if (atomic_load(&log_running)) return 0;
+
+    if (usb_queue_init(&log_queue, USB_LOG_QUEUE_DEPTH, USB_LOG_MSG_MAX) < 0) {
+        return -1;
+    }
+
+    log_stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (log_stop_fd < 0) {
+        fprintf(stderr, "Log eventfd: %s\n", strerror(errno));
+        usb_queue_free(&log_queue);
+        return -1;
+    }
+
+    // Whatever was printed before start must come out first
+    fflush(stdout);
+
+    if (pthread_create(&log_thread, NULL, log_thread_main, NULL) != 0) {
+        fprintf(stderr, "Failed to start log thread: %s\n", strerror(errno));
+        close(log_stop_fd);
+        log_stop_fd = -1;
+        usb_queue_free(&log_queue);
+        return -1;
+    }
+
+    atomic_store(&log_running, true);
+    return 0;
+}
+
+void usb_log_stop(void) {
+    if (!atomic_load(&log_running)) return;
+
+    atomic_store(&log_running, false);
+    while (atomic_load_explicit(&log_writers, memory_order_acquire) > 0) {
+        sched_yield();
+    }
+
+    uint64_t one = 1;
+    if (write(log_stop_fd, &one, sizeof(one)) < 0) {
+        fprintf(stderr, "Log eventfd: %s\n", strerror(errno));
+    }
+    pthread_join(log_thread, NULL);
+
+    close(log_stop_fd);
+    log_stop_fd = -1;
+    usb_queue_free(&log_queue);
+
+    unsigned long dropped = atomic_exchange(&log_dropped, 0);
+    if (dropped > 0) {
+        fprintf(stderr, "%lu log messages dropped (log queue full)\n", dropped);
+    }
+}
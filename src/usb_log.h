@@ -0,0 +1,91 @@
+// USB-C Software Network - Logging
+// printf-style logging with the level filtered at compile time. A call
+// above USB_LOG_LEVEL compiles to nothing and its arguments are never
+// evaluated, so per-packet traces cost nothing in a normal build; build
+// with -DUSB_LOG_LEVEL=4 (CMake: -DUSB_LOG_LEVEL=4) to see them.
+//
+// Messages are written as given, callers end their lines with "\n":
+// errors and warnings go to stderr, the rest to stdout. Between
+// usb_log_start() and usb_log_stop() the calling thread only formats the
+// message into a lock-free queue (usb_queue.h) and a background thread
+// writes it out, so no datapath thread waits on a stdio lock or on a
+// journald pipe. A message that finds the queue full is dropped and
+// counted. Outside that window messages are written directly.
+//
+// USB_LOG_WARN_RATELIMIT() is for conditions that can repeat for every
+// packet: each call site logs at most once per interval and reports how
+// many messages it held back.
+
+#ifndef USB_LOG_H
+#define USB_LOG_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define USB_LOG_LEVEL_ERROR 0
+#define USB_LOG_LEVEL_WARN  1
+#define USB_LOG_LEVEL_INFO  2
+#define USB_LOG_LEVEL_DEBUG 3    // Protocol events (handshakes, control messages)
+#define USB_LOG_LEVEL_TRACE 4    // Every packet
+
+#ifndef USB_LOG_LEVEL
+#define USB_LOG_LEVEL USB_LOG_LEVEL_INFO
+#endif
+
+#define USB_LOG_QUEUE_DEPTH 1024
+#define USB_LOG_MSG_MAX     256   // Longer messages are truncated
+#define USB_LOG_RATELIMIT_MS 1000
+
+#define USB_LOG_AT(level, ...) do { \
+    if ((level) <= USB_LOG_LEVEL) usb_log_write((level), __VA_ARGS__); \
+} while (0)
+
+#define USB_LOG_ERROR(...) USB_LOG_AT(USB_LOG_LEVEL_ERROR, __VA_ARGS__)
+#define USB_LOG_WARN(...)  USB_LOG_AT(USB_LOG_LEVEL_WARN, __VA_ARGS__)
+#define USB_LOG_INFO(...)  USB_LOG_AT(USB_LOG_LEVEL_INFO, __VA_ARGS__)
+#define USB_LOG_DEBUG(...) USB_LOG_AT(USB_LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define USB_LOG_TRACE(...) USB_LOG_AT(USB_LOG_LEVEL_TRACE, __VA_ARGS__)
+
+// Per call site state of a rate-limited message
+typedef struct {
+    _Atomic(int64_t) next_ms;
+    _Atomic(unsigned long) suppressed;
+} usb_log_ratelimit_t;
+
+#define USB_LOG_WARN_RATELIMIT(...) do { \
+    static usb_log_ratelimit_t usb_log_rl_; \
+    unsigned long usb_log_held_; \
+    if (USB_LOG_LEVEL_WARN <= USB_LOG_LEVEL && \
+        usb_log_ratelimit(&usb_log_rl_, USB_LOG_RATELIMIT_MS, &usb_log_held_)) { \
+        if (usb_log_held_) { \
+            usb_log_write(USB_LOG_LEVEL_WARN, "(%lu similar messages suppressed)\n", \
+                          usb_log_held_); \
+        } \
+        usb_log_write(USB_LOG_LEVEL_WARN, __VA_ARGS__); \
+    } \
+} while (0)
+
+// Write one message at level; use the macros above instead
+void usb_log_write(int level, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+// True if a rate-limited site may log now. *held is set to the number of
+// messages it suppressed since it last logged.
+bool usb_log_ratelimit(usb_log_ratelimit_t *rl, int interval_ms, unsigned long *held);
+
+// Start the background writer. Returns 0, or -1 (messages then keep being
+// written directly).
+int usb_log_start(void);
+
+// Write out everything queued and stop the background writer
+void usb_log_stop(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // USB_LOG_H
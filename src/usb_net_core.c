@@ -9,84 +9,45 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <inttypes.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
 #include <time.h>
-#include <getopt.h>
-#include <libusb-1.0/libusb.h>
-#include "usb_raw_comm.h"
-
-#define USB_TIMEOUT_MS 5000
-#define USB_NET_MTU 1500
-#define PACKET_MAGIC 0x55534243  // "USBC" in little-endian
-#define MAX_SCAN_ATTEMPTS 30
-#define SCAN_INTERVAL_MS 1000
-
-// Packet types for our simple protocol
-typedef enum {
-    PKT_PING = 1,
-    PKT_PONG = 2,
-    PKT_DATA = 3,
-    PKT_ACK  = 4
-} packet_type_t;
-
-// Simple packet header
-typedef struct __attribute__((packed)) {
-    uint32_t magic;
-    uint8_t  type;
-    uint8_t  flags;
-    uint16_t length;
-    uint32_t seq;
-} packet_header_t;
-
-// Operating mode
-typedef enum {
-    MODE_NONE,
-    MODE_HOST,
-    MODE_DEVICE,
-    MODE_RAW,    // Raw communication (no USB enumeration required)
-    MODE_LIST    // Just list devices
-} usb_net_mode_t;
-
-// Configuration from env file
-typedef struct {
-    char detection_method[32];
-    char typec_port[32];
-    char typec_port_path[256];
-    int usb_bus;
-    char usb_port_path[32];      // Physical port path like "1-4" or "2-1.3"
-    char usb_device_path[256];
-} usb_net_config_t;
-
-typedef struct {
-    libusb_context *ctx;
-    libusb_device_handle *dev_handle;
-    uint8_t endpoint_in;
-    uint8_t endpoint_out;
-    int interface_num;
-    usb_net_mode_t mode;
-    usb_net_config_t config;
-    uint32_t seq_num;
-    raw_comm_ctx_t raw_ctx;      // Raw communication context
-} usb_net_device_t;
+#include "usb_net_core.h"
+#include "usb_bond.h"
+#include "usb_raw_window.h"
+#include "usb_raw_runtime.h"
+#include "usb_typec.h"
+#include "usb_log.h"
 
 // Initialize libusb and scan for USB-C devices
 int usb_net_init(usb_net_device_t *device) {
     int ret;
     
     memset(device, 0, sizeof(usb_net_device_t));
+    device->config.usb_mtu = USB_NET_MTU;
+    device->config.raw_window = RAW_WINDOW_DEFAULT;
+    device->config.raw_mtu = RAW_MTU_DEFAULT;
+    device->config.raw_keepalive_ms = RAW_KEEPALIVE_MS_DEFAULT;
+    device->config.raw_cpu_rx = -1;
+    device->config.raw_cpu_tx = -1;
+    device->config.raw_cpu_control = -1;
+    device->config.bond_reorder_ms = USB_BOND_REORDER_MS_DEFAULT;
+    device->config.bench_max_loss = -1;
+    device->stats = &device->stats_local;
+    usb_stats_reset(device->stats);
     
     ret = libusb_init(&device->ctx);
     if (ret < 0) {
-        fprintf(stderr, "Failed to initialize libusb: %s\n", libusb_error_name(ret));
+        USB_LOG_ERROR("Failed to initialize libusb: %s\n", libusb_error_name(ret));
         return -1;
     }
     
     libusb_set_option(device->ctx, LIBUSB_OPTION_LOG_LEVEL, LIBUSB_LOG_LEVEL_INFO);
     
-    printf("USB-C Software Network initialized\n");
-    printf("libusb initialized successfully\n");
+    USB_LOG_INFO("USB-C Software Network initialized\n");
+    USB_LOG_INFO("libusb initialized successfully\n");
     
     return 0;
 }
@@ -99,7 +60,7 @@ void usb_net_list_devices(usb_net_device_t *device) {
     
     cnt = libusb_get_device_list(device->ctx, &devs);
     if (cnt < 0) {
-        fprintf(stderr, "Failed to get device list\n");
+        USB_LOG_ERROR("Failed to get device list\n");
         return;
     }
     
@@ -153,29 +114,90 @@ void usb_net_list_devices(usb_net_device_t *device) {
     libusb_free_device_list(devs, 1);
 }
 
+// Size the frame buffers for the configured MTU
+static int usb_net_alloc_frames(usb_net_device_t *device) {
+    int mtu = device->config.usb_mtu;
+
+    if (mtu < USB_NET_MTU_MIN || mtu > USB_NET_MTU_MAX) {
+        USB_LOG_WARN("Invalid USB_MTU %d (%d-%d), using %d\n",
+                     mtu, USB_NET_MTU_MIN, USB_NET_MTU_MAX, USB_NET_MTU);
+        mtu = device->config.usb_mtu = USB_NET_MTU;
+    }
+
+    size_t frame_size = (size_t)mtu + USB_NET_FRAME_HEADROOM;
+    if (device->tx_frame && device->frame_size == frame_size) return 0;
+
+    free(device->tx_frame);
+    free(device->rx_frame);
+    device->tx_frame = malloc(frame_size);
+    device->rx_frame = malloc(frame_size);
+    device->frame_size = frame_size;
+
+    if (!device->tx_frame || !device->rx_frame) {
+        USB_LOG_ERROR("Failed to allocate %zu byte frame buffers\n", frame_size);
+        free(device->tx_frame);
+        free(device->rx_frame);
+        device->tx_frame = device->rx_frame = NULL;
+        device->frame_size = 0;
+        return -1;
+    }
+
+    USB_LOG_INFO("USB MTU: %d bytes\n", mtu);
+    return 0;
+}
+
+// Transfer buffer size for the configured MTU and batching
+size_t usb_net_xfer_buffer_size(usb_net_device_t *device) {
+    if (usb_net_alloc_frames(device) < 0) return 0;
+
+    // Aggregated TUN transfers need room for several packets
+    size_t buffer_size = device->frame_size;
+    if (device->config.usb_batch_size > 0) {
+        size_t batch = (size_t)device->config.usb_batch_size;
+        if (batch > USB_NET_BATCH_MAX) batch = USB_NET_BATCH_MAX;
+        if (batch > buffer_size) buffer_size = batch;
+    }
+    return buffer_size;
+}
+
+// Start the async transfer pipeline on the claimed bulk endpoints.
+// On failure usb_net_send()/usb_net_recv() fall back to synchronous transfers.
+static void usb_net_start_xfer(usb_net_device_t *device) {
+    if (!device->endpoint_in || !device->endpoint_out) return;
+
+    size_t buffer_size = usb_net_xfer_buffer_size(device);
+    if (buffer_size == 0) return;
+
+    if (usb_xfer_start(&device->xfer, device->ctx, device->dev_handle,
+                       device->endpoint_in, device->endpoint_out,
+                       device->config.xfer_queue_depth, buffer_size, device->stats) < 0) {
+        USB_LOG_WARN("Async transfers unavailable, using synchronous bulk transfers\n");
+    }
+}
+
 // Open a specific USB device for communication
 int usb_net_open_device(usb_net_device_t *device, uint16_t vendor_id, uint16_t product_id) {
     device->dev_handle = libusb_open_device_with_vid_pid(device->ctx, vendor_id, product_id);
     
     if (!device->dev_handle) {
-        fprintf(stderr, "Cannot open device %04x:%04x\n", vendor_id, product_id);
+        USB_LOG_ERROR("Cannot open device %04x:%04x\n", vendor_id, product_id);
         return -1;
     }
     
-    printf("Opened USB device %04x:%04x\n", vendor_id, product_id);
+    USB_LOG_INFO("Opened USB device %04x:%04x\n", vendor_id, product_id);
     
     // Detach kernel driver if active
     if (libusb_kernel_driver_active(device->dev_handle, 0) == 1) {
-        printf("Kernel driver is active, detaching...\n");
+        USB_LOG_INFO("Kernel driver is active, detaching...\n");
         if (libusb_detach_kernel_driver(device->dev_handle, 0) != 0) {
-            fprintf(stderr, "Could not detach kernel driver\n");
+            USB_LOG_WARN("Could not detach kernel driver\n");
         }
     }
     
     // Claim interface 0
     int ret = libusb_claim_interface(device->dev_handle, 0);
     if (ret < 0) {
-        fprintf(stderr, "Cannot claim interface: %s\n", libusb_error_name(ret));
+        USB_LOG_ERROR("Cannot claim interface: %s\n", libusb_error_name(ret));
         libusb_close(device->dev_handle);
         device->dev_handle = NULL;
         return -1;
@@ -198,10 +220,10 @@ int usb_net_open_device(usb_net_device_t *device, uint16_t vendor_id, uint16_t p
                 if ((ep->bmAttributes & LIBUSB_TRANSFER_TYPE_MASK) == LIBUSB_TRANSFER_TYPE_BULK) {
                     if (ep->bEndpointAddress & LIBUSB_ENDPOINT_IN) {
                         device->endpoint_in = ep->bEndpointAddress;
-                        printf("Found bulk IN endpoint: 0x%02x\n", device->endpoint_in);
+                        USB_LOG_INFO("Found bulk IN endpoint: 0x%02x\n", device->endpoint_in);
                     } else {
                         device->endpoint_out = ep->bEndpointAddress;
-                        printf("Found bulk OUT endpoint: 0x%02x\n", device->endpoint_out);
+                        USB_LOG_INFO("Found bulk OUT endpoint: 0x%02x\n", device->endpoint_out);
                     }
                 }
             }
@@ -209,6 +231,7 @@ int usb_net_open_device(usb_net_device_t *device, uint16_t vendor_id, uint16_t p
         libusb_free_config_descriptor(config);
     }
     
+    usb_net_start_xfer(device);
     return 0;
 }
 
@@ -218,18 +241,25 @@ int usb_net_send(usb_net_device_t *device, const uint8_t *data, int len) {
     int ret;
     
     if (!device->dev_handle || !device->endpoint_out) {
-        fprintf(stderr, "Device not opened or no OUT endpoint\n");
+        USB_LOG_ERROR("Device not opened or no OUT endpoint\n");
         return -1;
     }
     
+    if (device->xfer.running) {
+        return usb_xfer_send(&device->xfer, data, (size_t)len, USB_TIMEOUT_MS);
+    }
+    
     ret = libusb_bulk_transfer(device->dev_handle, device->endpoint_out,
                                 (unsigned char*)data, len, &transferred, USB_TIMEOUT_MS);
     
     if (ret < 0) {
-        fprintf(stderr, "Bulk write error: %s\n", libusb_error_name(ret));
+        usb_stat_add(&device->stats->tx_errors, 1);
+        USB_LOG_WARN_RATELIMIT("Bulk write error: %s\n", libusb_error_name(ret));
         return -1;
     }
     
+    usb_stat_add(&device->stats->tx_packets, 1);
+    usb_stat_add(&device->stats->tx_bytes, (uint64_t)transferred);
     return transferred;
 }
 
@@ -239,50 +269,79 @@ int usb_net_recv(usb_net_device_t *device, uint8_t *buffer, int max_len) {
     int ret;
     
     if (!device->dev_handle || !device->endpoint_in) {
-        fprintf(stderr, "Device not opened or no IN endpoint\n");
+        USB_LOG_ERROR("Device not opened or no IN endpoint\n");
         return -1;
     }
     
+    if (device->xfer.running) {
+        usb_xfer_completion_t done;
+        ret = usb_xfer_wait_rx(&device->xfer, &done, USB_TIMEOUT_MS);
+        if (ret < 0) {
+            USB_LOG_ERROR("Bulk read error: %s\n", libusb_error_name(device->xfer.last_error));
+            return -1;
+        }
+        if (ret == 0) {
+            return 0;  // Timeout
+        }
+        
+        transferred = (done.len < max_len) ? done.len : max_len;
+        memcpy(buffer, done.data, transferred);
+        usb_xfer_release(&device->xfer, done.slot);
+        return transferred;
+    }
+    
     ret = libusb_bulk_transfer(device->dev_handle, device->endpoint_in,
                                 buffer, max_len, &transferred, USB_TIMEOUT_MS);
     
     if (ret < 0 && ret != LIBUSB_ERROR_TIMEOUT) {
-        fprintf(stderr, "Bulk read error: %s\n", libusb_error_name(ret));
+        usb_stat_add(&device->stats->rx_errors, 1);
+        USB_LOG_ERROR("Bulk read error: %s\n", libusb_error_name(ret));
         return -1;
     }
     
+    if (transferred > 0) {
+        usb_stat_add(&device->stats->rx_packets, 1);
+        usb_stat_add(&device->stats->rx_bytes, (uint64_t)transferred);
+    }
     return transferred;
 }
 
 // Cleanup
 void usb_net_cleanup(usb_net_device_t *device) {
-    if (device->dev_handle) {
-        libusb_release_interface(device->dev_handle, device->interface_num);
-        libusb_close(device->dev_handle);
-        device->dev_handle = NULL;
-    }
+    usb_net_close_peer(device);
+    usb_discovery_cleanup(&device->discovery);
     
     if (device->ctx) {
         libusb_exit(device->ctx);
         device->ctx = NULL;
     }
     
-    printf("USB-C Software Network cleaned up\n");
+    free(device->tx_frame);
+    free(device->rx_frame);
+    device->tx_frame = device->rx_frame = NULL;
+    
+    if (device->stats_page) {
+        device->stats = &device->stats_local;
+        usb_stats_page_destroy(device->stats_page, device->config.stats_shm_name);
+        device->stats_page = NULL;
+    }
+    
+    USB_LOG_INFO("USB-C Software Network cleaned up\n");
 }
 
 // Load configuration from env file
-int load_config(usb_net_device_t *device, const char *config_path) {
+int usb_net_load_config(usb_net_device_t *device, const char *config_path) {
     FILE *fp;
     char line[512];
     char *key, *value;
     
     fp = fopen(config_path, "r");
     if (!fp) {
-        fprintf(stderr, "Warning: Cannot open config file: %s\n", config_path);
+        USB_LOG_WARN("Cannot open config file: %s\n", config_path);
         return -1;
     }
     
-    printf("Loading config from: %s\n", config_path);
+    USB_LOG_INFO("Loading config from: %s\n", config_path);
     
     while (fgets(line, sizeof(line), fp)) {
         // Skip comments and empty lines
@@ -315,329 +374,430 @@ int load_config(usb_net_device_t *device, const char *config_path) {
             strncpy(device->config.usb_port_path, value, sizeof(device->config.usb_port_path)-1);
         } else if (strcmp(key, "USB_DEVICE_PATH") == 0) {
             strncpy(device->config.usb_device_path, value, sizeof(device->config.usb_device_path)-1);
+        } else if (strcmp(key, "USB_XFER_QUEUE_DEPTH") == 0) {
+            device->config.xfer_queue_depth = atoi(value);
+        } else if (strcmp(key, "USB_MTU") == 0) {
+            device->config.usb_mtu = atoi(value);
+        } else if (strcmp(key, "USB_BATCH_SIZE") == 0) {
+            device->config.usb_batch_size = atoi(value);
+        } else if (strcmp(key, "TUN_NAME") == 0) {
+            strncpy(device->config.tun_name, value, sizeof(device->config.tun_name)-1);
+        } else if (strcmp(key, "TUN_TYPE") == 0) {
+            device->config.tun_tap = (strcmp(value, "tap") == 0);
+        } else if (strcmp(key, "TUN_ADDRESS") == 0) {
+            strncpy(device->config.tun_address, value, sizeof(device->config.tun_address)-1);
+        } else if (strcmp(key, "BOND_USB_PORTS") == 0) {
+            strncpy(device->config.bond_usb_ports, value, sizeof(device->config.bond_usb_ports)-1);
+        } else if (strcmp(key, "BOND_TYPEC_PORTS") == 0) {
+            strncpy(device->config.bond_typec_ports, value, sizeof(device->config.bond_typec_ports)-1);
+        } else if (strcmp(key, "BOND_REORDER_MS") == 0) {
+            device->config.bond_reorder_ms = atoi(value);
+        } else if (strcmp(key, "RAW_TRANSPORT") == 0) {
+            strncpy(device->config.raw_transport, value, sizeof(device->config.raw_transport)-1);
+        } else if (strcmp(key, "RAW_SHM_NAME") == 0) {
+            strncpy(device->config.raw_shm_name, value, sizeof(device->config.raw_shm_name)-1);
+        } else if (strcmp(key, "RAW_VDM_DEVICE") == 0) {
+            strncpy(device->config.raw_vdm_device, value, sizeof(device->config.raw_vdm_device)-1);
+        } else if (strcmp(key, "RAW_DBC_DEVICE") == 0) {
+            strncpy(device->config.raw_dbc_device, value, sizeof(device->config.raw_dbc_device)-1);
+        } else if (strcmp(key, "RAW_SIM_LINK") == 0) {
+            strncpy(device->config.raw_sim_link, value, sizeof(device->config.raw_sim_link)-1);
+        } else if (strcmp(key, "RAW_WINDOW") == 0) {
+            device->config.raw_window = atoi(value);
+        } else if (strcmp(key, "RAW_CHECKSUM") == 0) {
+            strncpy(device->config.raw_checksum, value, sizeof(device->config.raw_checksum)-1);
+        } else if (strcmp(key, "RAW_COMPRESSION") == 0) {
+            strncpy(device->config.raw_compression, value, sizeof(device->config.raw_compression)-1);
+        } else if (strcmp(key, "RAW_MTU") == 0) {
+            device->config.raw_mtu = atoi(value);
+        } else if (strcmp(key, "RAW_BATCH_US") == 0) {
+            device->config.raw_batch_us = atoi(value);
+        } else if (strcmp(key, "RAW_BATCH_BYTES") == 0) {
+            device->config.raw_batch_bytes = atoi(value);
+        } else if (strcmp(key, "RAW_KEEPALIVE_MS") == 0) {
+            device->config.raw_keepalive_ms = atoi(value);
+        } else if (strcmp(key, "RAW_THREADS") == 0) {
+            device->config.raw_threads = atoi(value) != 0;
+        } else if (strcmp(key, "RAW_QUEUE_DEPTH") == 0) {
+            device->config.raw_queue_depth = atoi(value);
+        } else if (strcmp(key, "RAW_CPU_RX") == 0) {
+            device->config.raw_cpu_rx = atoi(value);
+        } else if (strcmp(key, "RAW_CPU_TX") == 0) {
+            device->config.raw_cpu_tx = atoi(value);
+        } else if (strcmp(key, "RAW_CPU_CONTROL") == 0) {
+            device->config.raw_cpu_control = atoi(value);
+        } else if (strcmp(key, "IO_URING") == 0) {
+            device->config.io_uring = atoi(value) != 0;
+        } else if (strcmp(key, "IO_URING_SQPOLL") == 0) {
+            device->config.io_uring_sqpoll_ms = atoi(value);
+        } else if (strcmp(key, "BENCH_ROLE") == 0) {
+            strncpy(device->config.bench_role, value, sizeof(device->config.bench_role)-1);
+        } else if (strcmp(key, "BENCH_TRANSPORT") == 0) {
+            strncpy(device->config.bench_transport, value, sizeof(device->config.bench_transport)-1);
+        } else if (strcmp(key, "BENCH_SIZES") == 0) {
+            strncpy(device->config.bench_sizes, value, sizeof(device->config.bench_sizes)-1);
+        } else if (strcmp(key, "BENCH_DEPTHS") == 0) {
+            strncpy(device->config.bench_depths, value, sizeof(device->config.bench_depths)-1);
+        } else if (strcmp(key, "BENCH_DURATION_MS") == 0) {
+            device->config.bench_duration_ms = atoi(value);
+        } else if (strcmp(key, "BENCH_OUTPUT") == 0) {
+            strncpy(device->config.bench_output, value, sizeof(device->config.bench_output)-1);
+        } else if (strcmp(key, "BENCH_MIN_MBPS") == 0) {
+            device->config.bench_min_mbps = atof(value);
+        } else if (strcmp(key, "BENCH_MAX_LOSS") == 0) {
+            device->config.bench_max_loss = atof(value);  // "1" and "1%" alike
+        } else if (strcmp(key, "BENCH_MAX_RTT_US") == 0) {
+            device->config.bench_max_rtt_us = atof(value);
+        } else if (strcmp(key, "FILE_TRANSPORT") == 0) {
+            strncpy(device->config.file_transport, value, sizeof(device->config.file_transport)-1);
+        } else if (strcmp(key, "FILE_PATH") == 0) {
+            strncpy(device->config.file_path, value, sizeof(device->config.file_path)-1);
+        } else if (strcmp(key, "STATS_SHM_NAME") == 0) {
+            strncpy(device->config.stats_shm_name, value, sizeof(device->config.stats_shm_name)-1);
         }
     }
     
     fclose(fp);
     
-    printf("Config loaded: method=%s, bus=%d, port_path=%s\n", 
-           device->config.detection_method, device->config.usb_bus,
-           device->config.usb_port_path[0] ? device->config.usb_port_path : "(not set)");
+    USB_LOG_INFO("Config loaded: method=%s, bus=%d, port_path=%s\n", 
+                 device->config.detection_method, device->config.usb_bus,
+                 device->config.usb_port_path[0] ? device->config.usb_port_path : "(not set)");
     
     return 0;
 }
 
-// Attempt Type-C data role swap via sysfs
-int typec_role_swap(usb_net_device_t *device, const char *role) {
-    char path[512];
-    int fd;
+// Attempt Type-C data role swap via sysfs, waiting for the port to
+// report the new role instead of for a fixed time
+int usb_net_typec_role_swap(usb_net_device_t *device, const char *role) {
+    usb_typec_t tc;
     
     if (strlen(device->config.typec_port_path) == 0) {
-        printf("No Type-C port path configured, skipping role swap\n");
+        USB_LOG_INFO("No Type-C port path configured, skipping role swap\n");
         return -1;
     }
     
-    snprintf(path, sizeof(path), "%s/data_role", device->config.typec_port_path);
-    
-    fd = open(path, O_WRONLY);
-    if (fd < 0) {
-        printf("Cannot open %s for role swap: %s\n", path, strerror(errno));
+    if (usb_typec_open(&tc, device->config.typec_port_path) < 0) {
         return -1;
     }
     
-    if (write(fd, role, strlen(role)) < 0) {
-        printf("Role swap to '%s' failed: %s\n", role, strerror(errno));
-        close(fd);
+    int ret = usb_typec_set_role(&tc, USB_TYPEC_DATA_ROLE, role, TYPEC_ROLE_SWAP_WAIT_MS);
+    usb_typec_close(&tc);
+    
+    if (ret == -2) {
+        USB_LOG_WARN("Type-C role swap to '%s' requested, port has not switched yet\n", role);
+        return 0;
+    }
+    if (ret < 0) {
         return -1;
     }
     
-    close(fd);
-    printf("Type-C role swap to '%s' successful\n", role);
+    USB_LOG_INFO("Type-C role swap to '%s' successful (%d ms)\n", role, ret);
     return 0;
 }
 
-// Find and open a USB device on the specified bus with bulk endpoints
-int find_peer_device(usb_net_device_t *device) {
-    libusb_device **devs;
-    ssize_t cnt;
-    int target_bus = device->config.usb_bus;
-    const char *target_port_path = device->config.usb_port_path;
-    
-    cnt = libusb_get_device_list(device->ctx, &devs);
-    if (cnt < 0) {
-        fprintf(stderr, "Failed to get device list\n");
-        return -1;
-    }
+// Set up discovery on first use: the bus and port filters come from the
+// config, which is loaded after usb_net_init()
+static int usb_net_start_discovery(usb_net_device_t *device) {
+    if (device->discovery.ctx) return 0;
     
+    const char *target_port_path = device->config.usb_port_path;
     if (target_port_path[0]) {
-        printf("Scanning for peer device on port path %s (bus %d)...\n", target_port_path, target_bus);
+        USB_LOG_INFO("Scanning for peer device on port path %s (bus %d)...\n",
+                     target_port_path, device->config.usb_bus);
     } else {
-        printf("Scanning for peer device on bus %d (no port path filter)...\n", target_bus);
+        USB_LOG_INFO("Scanning for peer device on bus %d (no port path filter)...\n",
+                     device->config.usb_bus);
     }
     
-    for (int i = 0; i < cnt; i++) {
-        libusb_device *dev = devs[i];
-        struct libusb_device_descriptor desc;
-        
-        if (libusb_get_device_descriptor(dev, &desc) != 0) continue;
-        
-        int bus = libusb_get_bus_number(dev);
-        int dev_addr = libusb_get_device_address(dev);
-        
-        // Filter by target bus if specified
-        if (target_bus > 0 && bus != target_bus) continue;
-        
-        // Filter by port path if specified
-        if (target_port_path[0]) {
-            // Get the port path for this device from sysfs
-            char sysfs_path[256];
-            char dev_port_path[64] = "";
-            
-            // Try to find this device's port path by matching bus and device number
-            snprintf(sysfs_path, sizeof(sysfs_path), "/sys/bus/usb/devices/%s/devnum", target_port_path);
-            FILE *f = fopen(sysfs_path, "r");
-            if (f) {
-                int sysfs_devnum = 0;
-                if (fscanf(f, "%d", &sysfs_devnum) == 1) {
-                    fclose(f);
-                    // Check busnum too
-                    snprintf(sysfs_path, sizeof(sysfs_path), "/sys/bus/usb/devices/%s/busnum", target_port_path);
-                    f = fopen(sysfs_path, "r");
-                    if (f) {
-                        int sysfs_busnum = 0;
-                        if (fscanf(f, "%d", &sysfs_busnum) == 1) {
-                            if (sysfs_busnum == bus && sysfs_devnum == dev_addr) {
-                                // This device matches our target port path!
-                                printf("  Found device at target port %s: %04x:%04x\n", 
-                                       target_port_path, desc.idVendor, desc.idProduct);
-                            } else {
-                                // Skip - not on our target port
-                                fclose(f);
-                                continue;
-                            }
-                        }
-                        fclose(f);
-                    }
-                } else {
-                    fclose(f);
-                    // Port path exists but no device there currently
-                    continue;
-                }
-            } else {
-                // Target port path doesn't have a device connected
-                continue;
-            }
-        }
-        
-        // Skip root hubs (VID 1d6b is Linux Foundation)
-        if (desc.idVendor == 0x1d6b) continue;
-        
-        // Skip hubs (class 0x09)
-        if (desc.bDeviceClass == 0x09) continue;
-        
-        // Try to open this device
-        libusb_device_handle *handle;
-        int ret = libusb_open(dev, &handle);
-        if (ret != 0) {
-            continue;  // Can't open, try next
-        }
-        
-        // Check if device has bulk endpoints
-        struct libusb_config_descriptor *config;
-        ret = libusb_get_active_config_descriptor(dev, &config);
-        if (ret != 0) {
-            libusb_close(handle);
-            continue;
-        }
-        
-        uint8_t ep_in = 0, ep_out = 0;
-        
-        for (int iface = 0; iface < config->bNumInterfaces; iface++) {
-            const struct libusb_interface *interface = &config->interface[iface];
-            for (int alt = 0; alt < interface->num_altsetting; alt++) {
-                const struct libusb_interface_descriptor *iface_desc = &interface->altsetting[alt];
-                
-                for (int ep = 0; ep < iface_desc->bNumEndpoints; ep++) {
-                    const struct libusb_endpoint_descriptor *ep_desc = &iface_desc->endpoint[ep];
-                    
-                    if ((ep_desc->bmAttributes & LIBUSB_TRANSFER_TYPE_MASK) == LIBUSB_TRANSFER_TYPE_BULK) {
-                        if (ep_desc->bEndpointAddress & LIBUSB_ENDPOINT_IN) {
-                            ep_in = ep_desc->bEndpointAddress;
-                        } else {
-                            ep_out = ep_desc->bEndpointAddress;
-                        }
-                    }
-                }
-                
-                // If we found both endpoints, use this interface
-                if (ep_in && ep_out) {
-                    // Detach kernel driver if needed
-                    if (libusb_kernel_driver_active(handle, iface) == 1) {
-                        libusb_detach_kernel_driver(handle, iface);
-                    }
-                    
-                    ret = libusb_claim_interface(handle, iface);
-                    if (ret == 0) {
-                        device->dev_handle = handle;
-                        device->endpoint_in = ep_in;
-                        device->endpoint_out = ep_out;
-                        device->interface_num = iface;
-                        
-                        printf("Found peer device: %04x:%04x on bus %d\n",
-                               desc.idVendor, desc.idProduct, bus);
-                        printf("  Bulk IN: 0x%02x, Bulk OUT: 0x%02x\n", ep_in, ep_out);
-                        
-                        libusb_free_config_descriptor(config);
-                        libusb_free_device_list(devs, 1);
-                        return 0;
-                    }
-                }
-            }
-        }
-        
-        libusb_free_config_descriptor(config);
-        libusb_close(handle);
+    return usb_discovery_init(&device->discovery, device->ctx,
+                              device->config.usb_bus, target_port_path);
+}
+
+// Claim the peer once it has been found and start transfers on it
+static int usb_net_claim_peer(usb_net_device_t *device, int timeout_ms) {
+    libusb_device_handle *handle;
+    
+    if (usb_net_start_discovery(device) < 0) return -1;
+    if (usb_discovery_find(&device->discovery, timeout_ms, &handle, &device->layout) < 0) {
+        return -1;
     }
     
-    libusb_free_device_list(devs, 1);
-    return -1;
+    device->dev_handle = handle;
+    device->endpoint_in = device->layout.endpoint_in;
+    device->endpoint_out = device->layout.endpoint_out;
+    device->interface_num = device->layout.interface_num;
+    usb_net_start_xfer(device);
+    return 0;
 }
 
-// Send a packet with our simple protocol
-int send_packet(usb_net_device_t *device, packet_type_t type, const uint8_t *data, int len) {
-    uint8_t buffer[USB_NET_MTU + sizeof(packet_header_t)];
-    packet_header_t *hdr = (packet_header_t *)buffer;
+// Find and open a USB device on the specified bus with bulk endpoints
+int usb_net_find_peer(usb_net_device_t *device) {
+    return usb_net_claim_peer(device, 0);
+}
+
+void usb_net_close_peer(usb_net_device_t *device) {
+    usb_xfer_stop(&device->xfer);
     
+    if (!device->dev_handle) return;
+    
+    if (device->discovery.ctx) {
+        usb_discovery_release(&device->discovery, device->dev_handle, &device->layout);
+    } else {
+        libusb_release_interface(device->dev_handle, device->interface_num);
+        libusb_close(device->dev_handle);
+    }
+    device->dev_handle = NULL;
+    device->endpoint_in = device->endpoint_out = 0;
+}
+
+// Fill a packet header in place
+void usb_net_fill_header(usb_net_device_t *device, packet_header_t *hdr,
+                         packet_type_t type, int len) {
     hdr->magic = PACKET_MAGIC;
     hdr->type = type;
     hdr->flags = 0;
     hdr->length = len;
     hdr->seq = device->seq_num++;
+}
+
+// Hand out a transmit frame
+int usb_net_alloc_frame(usb_net_device_t *device, usb_frame_t *frame, int timeout_ms) {
+    if (device->xfer.running) {
+        uint8_t *buf;
+        size_t cap;
+        
+        int slot = usb_xfer_tx_acquire(&device->xfer, &buf, &cap, timeout_ms);
+        if (slot < 0) return -1;
+        
+        usb_frame_init(frame, buf, cap, USB_NET_FRAME_HEADROOM);
+        frame->slot = slot;
+        return 0;
+    }
     
-    if (data && len > 0) {
-        memcpy(buffer + sizeof(packet_header_t), data, len);
+    if (!device->tx_frame) return -1;
+    
+    usb_frame_init(frame, device->tx_frame, device->frame_size, USB_NET_FRAME_HEADROOM);
+    return 0;
+}
+
+// Write the packet header into the headroom and send the frame
+int usb_net_send_frame(usb_net_device_t *device, usb_frame_t *frame, packet_type_t type) {
+    if (frame->headroom < USB_NET_FRAME_HEADROOM || frame->len > usb_frame_room(frame)) {
+        USB_LOG_ERROR("Invalid frame (headroom %zu, %zu bytes)\n", frame->headroom, frame->len);
+        usb_net_release_frame(device, frame);
+        return -1;
+    }
+    
+    packet_header_t *hdr = (packet_header_t *)(frame->data - USB_NET_FRAME_HEADROOM);
+    size_t total = USB_NET_FRAME_HEADROOM + frame->len;
+    
+    usb_net_fill_header(device, hdr, type, (int)frame->len);
+    
+    int ret;
+    if (frame->slot >= 0) {
+        ret = usb_xfer_tx_submit(&device->xfer, frame->slot, total);
+        frame->slot = -1;
+    } else {
+        ret = usb_net_send(device, (uint8_t *)hdr, (int)total);
     }
     
-    return usb_net_send(device, buffer, sizeof(packet_header_t) + len);
+    return (ret < 0) ? -1 : (int)frame->len;
 }
 
-// Receive a packet
-int recv_packet(usb_net_device_t *device, packet_type_t *type, uint8_t *data, int max_len) {
-    uint8_t buffer[USB_NET_MTU + sizeof(packet_header_t)];
+// Borrow the next received packet
+int usb_net_recv_frame(usb_net_device_t *device, usb_frame_t *view, packet_type_t *type) {
+    uint8_t *buf;
     int received;
+    int slot = -1;
+    
+    if (device->xfer.running) {
+        usb_xfer_completion_t done;
+        int ret = usb_xfer_wait_rx(&device->xfer, &done, USB_TIMEOUT_MS);
+        if (ret < 0) {
+            USB_LOG_ERROR("Bulk read error: %s\n", libusb_error_name(device->xfer.last_error));
+            return -1;
+        }
+        if (ret == 0) {
+            return 0;  // Timeout
+        }
+        
+        buf = done.data;
+        received = done.len;
+        slot = done.slot;
+        usb_frame_init(view, buf, device->xfer.buffer_size, USB_NET_FRAME_HEADROOM);
+    } else {
+        if (!device->rx_frame) return -1;
+        
+        received = usb_net_recv(device, device->rx_frame, (int)device->frame_size);
+        if (received <= 0) {
+            return received;
+        }
+        
+        buf = device->rx_frame;
+        usb_frame_init(view, buf, device->frame_size, USB_NET_FRAME_HEADROOM);
+    }
+    view->slot = slot;
     
-    received = usb_net_recv(device, buffer, sizeof(buffer));
     if (received < (int)sizeof(packet_header_t)) {
+        usb_stat_add(&device->stats->rx_short, 1);
+        usb_net_release_frame(device, view);
         return -1;
     }
     
-    packet_header_t *hdr = (packet_header_t *)buffer;
+    packet_header_t *hdr = (packet_header_t *)buf;
     
     if (hdr->magic != PACKET_MAGIC) {
-        fprintf(stderr, "Invalid packet magic: 0x%08x\n", hdr->magic);
+        usb_stat_add(&device->stats->rx_bad_magic, 1);
+        USB_LOG_WARN_RATELIMIT("Invalid packet magic: 0x%08x\n", hdr->magic);
+        usb_net_release_frame(device, view);
         return -1;
     }
     
     *type = hdr->type;
     
-    int data_len = received - sizeof(packet_header_t);
-    if (data_len > max_len) data_len = max_len;
+    int data_len = received - (int)sizeof(packet_header_t);
+    view->len = (hdr->length < data_len) ? hdr->length : (size_t)data_len;
+    return 1;
+}
+
+// Return a borrowed frame to the transfer engine
+void usb_net_release_frame(usb_net_device_t *device, usb_frame_t *frame) {
+    if (frame->slot >= 0) {
+        if (frame->base == device->xfer.out_slots[frame->slot].buffer) {
+            usb_xfer_tx_abort(&device->xfer, frame->slot);
+        } else {
+            usb_xfer_release(&device->xfer, frame->slot);
+        }
+    }
+    
+    frame->base = frame->data = NULL;
+    frame->len = 0;
+    frame->slot = -1;
+}
+
+// Send a packet with our simple protocol
+int usb_net_send_packet(usb_net_device_t *device, packet_type_t type, const uint8_t *data, int len) {
+    usb_frame_t frame;
+    
+    if (usb_net_alloc_frame(device, &frame, USB_TIMEOUT_MS) < 0) {
+        return -1;
+    }
+    
+    if (len < 0 || (size_t)len > usb_frame_room(&frame)) {
+        USB_LOG_ERROR("Packet of %d bytes does not fit a frame\n", len);
+        usb_net_release_frame(device, &frame);
+        return -1;
+    }
+    
+    if (data && len > 0) {
+        memcpy(frame.data, data, len);
+    }
+    frame.len = (size_t)len;
+    
+    int ret = usb_net_send_frame(device, &frame, type);
+    return (ret < 0) ? -1 : (int)sizeof(packet_header_t) + ret;
+}
+
+// Receive a packet
+int usb_net_recv_packet(usb_net_device_t *device, packet_type_t *type, uint8_t *data, int max_len) {
+    usb_frame_t view;
+    
+    if (usb_net_recv_frame(device, &view, type) <= 0) {
+        return -1;
+    }
     
+    int data_len = (view.len < (size_t)max_len) ? (int)view.len : max_len;
     if (data && data_len > 0) {
-        memcpy(data, buffer + sizeof(packet_header_t), data_len);
+        memcpy(data, view.data, data_len);
     }
     
+    usb_net_release_frame(device, &view);
     return data_len;
 }
 
-// Run as USB host - scan for device and initiate communication
-int run_host_mode(usb_net_device_t *device) {
+// Wait for a peer device until found or MAX_SCAN_ATTEMPTS intervals pass.
+// Discovery wakes on hotplug arrivals, so each attempt ends early on success.
+int usb_net_wait_for_peer(usb_net_device_t *device, const char *what) {
     int attempts = 0;
     
-    printf("\n=== Running in HOST mode ===\n");
-    printf("Waiting for peer device to connect...\n\n");
+    if (usb_net_find_peer(device) == 0) {
+        return 0;
+    }
     
-    // Try to find a peer device
     while (attempts < MAX_SCAN_ATTEMPTS) {
-        if (find_peer_device(device) == 0) {
-            break;
-        }
-        
         attempts++;
-        printf("Scan attempt %d/%d - no peer found, waiting...\n", 
-               attempts, MAX_SCAN_ATTEMPTS);
-        usleep(SCAN_INTERVAL_MS * 1000);
+        USB_LOG_INFO("Scan attempt %d/%d - no %s found, waiting...\n", 
+                     attempts, MAX_SCAN_ATTEMPTS, what);
+        
+        if (usb_net_claim_peer(device, SCAN_INTERVAL_MS) == 0) {
+            return 0;
+        }
     }
     
-    if (!device->dev_handle) {
-        fprintf(stderr, "Failed to find peer device after %d attempts\n", MAX_SCAN_ATTEMPTS);
+    USB_LOG_ERROR("Failed to find %s device after %d attempts\n", what, MAX_SCAN_ATTEMPTS);
+    return -1;
+}
+
+// Run as USB host - scan for device and initiate communication
+int usb_net_run_host(usb_net_device_t *device) {
+    USB_LOG_INFO("\n=== Running in HOST mode ===\n");
+    USB_LOG_INFO("Waiting for peer device to connect...\n\n");
+    
+    // Try to find a peer device
+    if (usb_net_wait_for_peer(device, "peer") < 0) {
         return -1;
     }
     
-    printf("\nPeer device found! Starting communication...\n\n");
+    USB_LOG_INFO("\nPeer device found! Starting communication...\n\n");
     
     // Send PING packets and wait for PONG
     for (int i = 0; i < 5; i++) {
         char msg[64];
         snprintf(msg, sizeof(msg), "PING #%d from host", i + 1);
         
-        printf("Sending: %s\n", msg);
-        int ret = send_packet(device, PKT_PING, (uint8_t*)msg, strlen(msg) + 1);
+        USB_LOG_INFO("Sending: %s\n", msg);
+        int ret = usb_net_send_packet(device, PKT_PING, (uint8_t*)msg, strlen(msg) + 1);
         if (ret < 0) {
-            fprintf(stderr, "Send failed\n");
+            USB_LOG_ERROR("Send failed\n");
             continue;
         }
         
         // Wait for response
         uint8_t recv_data[256];
         packet_type_t pkt_type;
-        ret = recv_packet(device, &pkt_type, recv_data, sizeof(recv_data) - 1);
+        ret = usb_net_recv_packet(device, &pkt_type, recv_data, sizeof(recv_data) - 1);
         if (ret >= 0) {
             recv_data[ret] = '\0';
-            printf("Received: type=%d, data='%s'\n", pkt_type, recv_data);
+            USB_LOG_INFO("Received: type=%d, data='%s'\n", pkt_type, recv_data);
         } else {
-            printf("No response (timeout)\n");
+            USB_LOG_INFO("No response (timeout)\n");
         }
         
         sleep(1);
     }
     
-    printf("\nHost mode communication test complete\n");
+    USB_LOG_INFO("\nHost mode communication test complete\n");
     return 0;
 }
 
 // Run as USB device - wait for host connection and respond
-int run_device_mode(usb_net_device_t *device) {
-    printf("\n=== Running in DEVICE mode ===\n");
+int usb_net_run_device(usb_net_device_t *device) {
+    USB_LOG_INFO("\n=== Running in DEVICE mode ===\n");
     
     // Try Type-C role swap to device if sysfs is available
     if (strlen(device->config.typec_port_path) > 0) {
-        printf("Attempting Type-C data role swap to device...\n");
-        typec_role_swap(device, "device");
-        sleep(2);  // Give time for role swap to complete
+        USB_LOG_INFO("Attempting Type-C data role swap to device...\n");
+        usb_net_typec_role_swap(device, "device");
     }
     
-    printf("Waiting for host connection...\n\n");
+    USB_LOG_INFO("Waiting for host connection...\n\n");
     
     // In device mode, we also scan but we'll respond instead of initiate
-    int attempts = 0;
-    while (attempts < MAX_SCAN_ATTEMPTS) {
-        if (find_peer_device(device) == 0) {
-            break;
-        }
-        
-        attempts++;
-        printf("Scan attempt %d/%d - no host found, waiting...\n", 
-               attempts, MAX_SCAN_ATTEMPTS);
-        usleep(SCAN_INTERVAL_MS * 1000);
-    }
-    
-    if (!device->dev_handle) {
-        fprintf(stderr, "Failed to find host device after %d attempts\n", MAX_SCAN_ATTEMPTS);
+    if (usb_net_wait_for_peer(device, "host") < 0) {
         return -1;
     }
     
-    printf("\nHost connected! Waiting for packets...\n\n");
+    USB_LOG_INFO("\nHost connected! Waiting for packets...\n\n");
     
     // Receive loop - respond to PINGs with PONGs
     int recv_count = 0;
@@ -645,47 +805,216 @@ int run_device_mode(usb_net_device_t *device) {
         uint8_t recv_data[256];
         packet_type_t pkt_type;
         
-        int ret = recv_packet(device, &pkt_type, recv_data, sizeof(recv_data) - 1);
+        int ret = usb_net_recv_packet(device, &pkt_type, recv_data, sizeof(recv_data) - 1);
         if (ret < 0) {
             continue;  // Timeout, keep waiting
         }
         
         recv_data[ret] = '\0';
-        printf("Received: type=%d, data='%s'\n", pkt_type, recv_data);
+        USB_LOG_INFO("Received: type=%d, data='%s'\n", pkt_type, recv_data);
         recv_count++;
         
         // Respond to PING with PONG
         if (pkt_type == PKT_PING) {
             char response[64];
             snprintf(response, sizeof(response), "PONG from device");
-            printf("Sending: %s\n", response);
-            send_packet(device, PKT_PONG, (uint8_t*)response, strlen(response) + 1);
+            USB_LOG_INFO("Sending: %s\n", response);
+            usb_net_send_packet(device, PKT_PONG, (uint8_t*)response, strlen(response) + 1);
         }
     }
     
-    printf("\nDevice mode communication test complete\n");
+    USB_LOG_INFO("\nDevice mode communication test complete\n");
     return 0;
 }
 
 // Run in raw communication mode (no USB enumeration required)
 // This allows two USB hosts to communicate directly over USB-C
-int run_raw_mode(usb_net_device_t *device) {
-    printf("\n=== Running in RAW mode (no USB enumeration) ===\n");
-    printf("This mode allows direct host-to-host communication.\n\n");
+static int64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// RAW mode on the threaded runtime: the handshake runs on the control
+// thread, and test messages go out on schedule while the peer's arrive
+static int run_raw_threaded(usb_net_device_t *device) {
+    raw_runtime_t rt;
+    raw_runtime_opts_t opts;
+    
+    raw_runtime_opts_init(&opts);
+    if (device->config.raw_queue_depth > 0) opts.queue_depth = device->config.raw_queue_depth;
+    opts.cpu_rx = device->config.raw_cpu_rx;
+    opts.cpu_tx = device->config.raw_cpu_tx;
+    opts.cpu_control = device->config.raw_cpu_control;
+    
+    if (raw_runtime_start(&rt, &device->raw_ctx, &opts) < 0) {
+        raw_comm_cleanup(&device->raw_ctx);
+        return -1;
+    }
+    
+    USB_LOG_INFO("\nWaiting for peer connection...\n");
+    USB_LOG_INFO("(Run this same command on the other device)\n\n");
+    
+    int max_wait_s = 60;
+    int64_t deadline = now_ms() + max_wait_s * 1000;
+    int64_t next_report = now_ms() + 5000;
+    while (raw_runtime_get_state(&rt) != RAW_STATE_CONNECTED && now_ms() < deadline) {
+        usleep(100 * 1000);
+        if (now_ms() >= next_report) {
+            USB_LOG_INFO("Still waiting for peer... (%d/%d)\n",
+                         (int)((now_ms() - deadline) / 1000) + max_wait_s, max_wait_s);
+            next_report += 5000;
+        }
+    }
     
+    if (raw_runtime_get_state(&rt) != RAW_STATE_CONNECTED) {
+        USB_LOG_INFO("\nFailed to connect to peer after %d seconds\n", max_wait_s);
+        raw_runtime_stop(&rt);
+        raw_comm_cleanup(&device->raw_ctx);
+        return -1;
+    }
+    
+    USB_LOG_INFO("\nConnected to peer 0x%08x!\n", raw_runtime_get_peer_id(&rt));
+    USB_LOG_INFO("\n=== Connection established! Testing data exchange... ===\n\n");
+    
+    int sent = 0;
+    int64_t next_send = now_ms();
+    int64_t end = 0;
+    for (;;) {
+        int64_t now = now_ms();
+        if (sent < 5 && now >= next_send) {
+            char msg[64];
+            snprintf(msg, sizeof(msg), "Test message #%d from 0x%08x",
+                     sent + 1, device->raw_ctx.local_id);
+            USB_LOG_INFO("Sending: %s\n", msg);
+            raw_runtime_send(&rt, 0, (uint8_t *)msg, strlen(msg) + 1, 1000);
+            sent++;
+            next_send += 1000;
+            if (sent == 5) end = now + 2000;  // Last replies
+        }
+        
+        int64_t wake = (sent < 5) ? next_send : end;
+        if (now >= wake && sent == 5) break;
+        
+        uint8_t recv_buf[256];
+        int n = raw_runtime_recv(&rt, recv_buf, sizeof(recv_buf) - 1, NULL,
+                                 (int)(wake > now ? wake - now : 0));
+        if (n < 0) break;
+        if (n > 0) {
+            recv_buf[n] = '\0';
+            USB_LOG_INFO("Received: %s\n", recv_buf);
+        }
+    }
+    
+    USB_LOG_INFO("\nRaw mode communication test complete (%" PRIu64 " sent, %" PRIu64 " received)\n",
+                 usb_stat_read(&rt.tx_msgs), usb_stat_read(&rt.rx_msgs));
+    raw_runtime_stop(&rt);
+    raw_comm_cleanup(&device->raw_ctx);
+    return 0;
+}
+
+// Apply the RAW_* options to a context using transport name
+static int set_raw_options(usb_net_device_t *device, raw_comm_ctx_t *ctx, const char *name) {
+    // Compress by default where the wire, not the CPU, is the bottleneck
+    const char *compression = device->config.raw_compression;
+    if (!compression[0] && (strcmp(name, "vdm") == 0 || strcmp(name, "file") == 0)) {
+        compression = "lz4";
+    }
+    
+    if (raw_comm_set_mtu(ctx, (size_t)device->config.raw_mtu) < 0 ||
+        raw_comm_set_window(ctx, device->config.raw_window) < 0 ||
+        raw_comm_set_batching(ctx, device->config.raw_batch_us,
+                              (size_t)(device->config.raw_batch_bytes > 0 ?
+                                       device->config.raw_batch_bytes : 0)) < 0 ||
+        raw_comm_set_keepalive(ctx, device->config.raw_keepalive_ms) < 0 ||
+        (device->config.raw_checksum[0] &&
+         raw_comm_set_checksum(ctx, device->config.raw_checksum) < 0) ||
+        (compression[0] && raw_comm_set_compression(ctx, compression) < 0)) {
+        return -1;
+    }
+    return 0;
+}
+
+// Set up the raw context from the config and start listening for a peer
+int usb_net_raw_setup(usb_net_device_t *device) {
     // Initialize raw communication
     raw_comm_init(&device->raw_ctx, device->config.typec_port_path);
+    if (device->stats_page) {
+        raw_comm_set_stats(&device->raw_ctx, &device->stats_page->raw);
+    }
     
     // Detect available communication method
     raw_comm_method_t method = raw_comm_detect_method(&device->raw_ctx);
-    printf("Using communication method: %d\n", method);
+    USB_LOG_INFO("Using communication method: %d\n", method);
+    
+    // Override the default transport if configured. A port with PD uses
+    // the VDM device, when one is configured, unless told otherwise. DbC
+    // takes a controller port away from the xhci driver, so it is only
+    // used when asked for.
+    const char *name = device->config.raw_transport;
+    if (!name[0] && method == RAW_METHOD_PD_VDM && device->config.raw_vdm_device[0]) {
+        name = "vdm";
+    } else if (!name[0] && device->config.raw_shm_name[0]) {
+        name = "shm";
+    }
+    if (name[0]) {
+        const char *arg = device->config.raw_shm_name;
+        if (strcmp(name, "vdm") == 0) {
+            arg = device->config.raw_vdm_device;
+        } else if (strcmp(name, "dbc") == 0) {
+            arg = device->config.raw_dbc_device;
+        }
+        if (raw_comm_set_transport(&device->raw_ctx, name, arg) < 0) {
+            raw_comm_cleanup(&device->raw_ctx);
+            return -1;
+        }
+    }
+    
+    if (set_raw_options(device, &device->raw_ctx, name) < 0) {
+        raw_comm_cleanup(&device->raw_ctx);
+        return -1;
+    }
     
     // Start listening for peer
     raw_comm_listen(&device->raw_ctx);
+    return 0;
+}
+
+int usb_net_raw_setup_sim(usb_net_device_t *device, raw_comm_ctx_t *peer) {
+    if (raw_comm_init_sim_pair(&device->raw_ctx, peer, device->config.raw_sim_link) < 0) {
+        return -1;
+    }
+    if (device->stats_page) {
+        raw_comm_set_stats(&device->raw_ctx, &device->stats_page->raw);
+    }
+    
+    if (set_raw_options(device, &device->raw_ctx, "sim") < 0 ||
+        set_raw_options(device, peer, "sim") < 0) {
+        raw_comm_cleanup(peer);
+        raw_comm_cleanup(&device->raw_ctx);
+        return -1;
+    }
+    
+    raw_comm_listen(&device->raw_ctx);
+    raw_comm_listen(peer);
+    return 0;
+}
+
+int usb_net_run_raw(usb_net_device_t *device) {
+    USB_LOG_INFO("\n=== Running in RAW mode (no USB enumeration) ===\n");
+    USB_LOG_INFO("This mode allows direct host-to-host communication.\n\n");
+    
+    if (usb_net_raw_setup(device) < 0) {
+        return -1;
+    }
+    
+    if (device->config.raw_threads) {
+        return run_raw_threaded(device);
+    }
     
     // Main communication loop
-    printf("\nWaiting for peer connection...\n");
-    printf("(Run this same command on the other device)\n\n");
+    USB_LOG_INFO("\nWaiting for peer connection...\n");
+    USB_LOG_INFO("(Run this same command on the other device)\n\n");
     
     int timeout_count = 0;
     int max_timeouts = 60;  // 60 seconds total
@@ -698,32 +1027,32 @@ int run_raw_mode(usb_net_device_t *device) {
         
         if (state == RAW_STATE_CONNECTED) {
             uint32_t peer_id = raw_comm_get_peer_id(&device->raw_ctx);
-            printf("\nConnected to peer 0x%08x!\n", peer_id);
+            USB_LOG_INFO("\nConnected to peer 0x%08x!\n", peer_id);
             break;
         }
         
         timeout_count++;
         
         if (timeout_count % 5 == 0) {
-            printf("Still waiting for peer... (%d/%d)\n", timeout_count, max_timeouts);
+            USB_LOG_INFO("Still waiting for peer... (%d/%d)\n", timeout_count, max_timeouts);
         }
     }
     
     if (raw_comm_get_state(&device->raw_ctx) != RAW_STATE_CONNECTED) {
-        printf("\nFailed to connect to peer after %d seconds\n", max_timeouts);
+        USB_LOG_INFO("\nFailed to connect to peer after %d seconds\n", max_timeouts);
         raw_comm_cleanup(&device->raw_ctx);
         return -1;
     }
     
     // Connected! Now exchange some test messages
-    printf("\n=== Connection established! Testing data exchange... ===\n\n");
+    USB_LOG_INFO("\n=== Connection established! Testing data exchange... ===\n\n");
     
     for (int i = 0; i < 5; i++) {
         char msg[64];
         snprintf(msg, sizeof(msg), "Test message #%d from 0x%08x", 
                  i + 1, device->raw_ctx.local_id);
         
-        printf("Sending: %s\n", msg);
+        USB_LOG_INFO("Sending: %s\n", msg);
         raw_comm_send(&device->raw_ctx, (uint8_t *)msg, strlen(msg) + 1);
         
         // Wait for response
@@ -732,111 +1061,17 @@ int run_raw_mode(usb_net_device_t *device) {
         int n = raw_comm_recv(&device->raw_ctx, recv_buf, sizeof(recv_buf) - 1);
         if (n > 0) {
             recv_buf[n] = '\0';
-            printf("Received: %s\n", recv_buf);
+            USB_LOG_INFO("Received: %s\n", recv_buf);
         }
         
         sleep(1);
     }
     
-    printf("\nRaw mode communication test complete\n");
+    USB_LOG_INFO("\nRaw mode communication test complete\n");
     raw_comm_cleanup(&device->raw_ctx);
     return 0;
 }
 
-void print_usage(const char *prog) {
-    printf("Usage: %s [OPTIONS]\n\n", prog);
-    printf("Options:\n");
-    printf("  --mode host|device|raw|list   Operating mode (default: list)\n");
-    printf("  --config <path>               Path to config file (default: target_usb_c_port.env)\n");
-    printf("  --help                        Show this help message\n");
-    printf("\nModes:\n");
-    printf("  host    - Act as USB host, scan for device, send PING packets\n");
-    printf("  device  - Act as USB device, wait for host, respond with PONG\n");
-    printf("  raw     - Raw mode: direct host-to-host without USB enumeration\n");
-    printf("  list    - Just list USB devices and exit\n");
-    printf("\nExamples:\n");
-    printf("  %s --mode raw                  # Recommended for host-to-host\n", prog);
-    printf("  %s --mode host\n", prog);
-    printf("  %s --mode device --config /path/to/config.env\n", prog);
-}
-
-int main(int argc, char *argv[]) {
-    usb_net_device_t device;
-    usb_net_mode_t mode = MODE_LIST;
-    const char *config_path = "target_usb_c_port.env";
-    int ret;
-    
-    // Parse command line arguments
-    static struct option long_options[] = {
-        {"mode",   required_argument, 0, 'm'},
-        {"config", required_argument, 0, 'c'},
-        {"help",   no_argument,       0, 'h'},
-        {0, 0, 0, 0}
-    };
-    
-    int opt;
-    while ((opt = getopt_long(argc, argv, "m:c:h", long_options, NULL)) != -1) {
-        switch (opt) {
-            case 'm':
-                if (strcmp(optarg, "host") == 0) {
-                    mode = MODE_HOST;
-                } else if (strcmp(optarg, "device") == 0) {
-                    mode = MODE_DEVICE;
-                } else if (strcmp(optarg, "raw") == 0) {
-                    mode = MODE_RAW;
-                } else if (strcmp(optarg, "list") == 0) {
-                    mode = MODE_LIST;
-                } else {
-                    fprintf(stderr, "Invalid mode: %s\n", optarg);
-                    print_usage(argv[0]);
-                    return 1;
-                }
-                break;
-            case 'c':
-                config_path = optarg;
-                break;
-            case 'h':
-                print_usage(argv[0]);
-                return 0;
-            default:
-                print_usage(argv[0]);
-                return 1;
-        }
-    }
-    
-    printf("=== USB-C Software Network (Direct Hardware Access) ===\n");
-    printf("No kernel gadget drivers required!\n\n");
-    
-    ret = usb_net_init(&device);
-    if (ret < 0) {
-        return 1;
-    }
-    
-    // Load configuration
-    load_config(&device, config_path);
-    device.mode = mode;
-    
-    // Execute based on mode
-    switch (mode) {
-        case MODE_HOST:
-            ret = run_host_mode(&device);
-            break;
-        case MODE_DEVICE:
-            ret = run_device_mode(&device);
-            break;
-        case MODE_RAW:
-            ret = run_raw_mode(&device);
-            break;
-        case MODE_LIST:
-        default:
-            usb_net_list_devices(&device);
-            printf("\nUse --mode raw for host-to-host communication\n");
-            printf("Or --mode host/device for traditional USB mode\n");
-            ret = 0;
-            break;
-    }
-    
-    usb_net_cleanup(&device);
-    
-    return ret < 0 ? 1 : 0;
+void usb_net_get_stats(usb_net_device_t *device, usb_stats_t *out) {
+    usb_stats_snapshot(device->stats, out);
 }
@@ -0,0 +1,205 @@
+// USB-C Software Network - Core USB Hardware Access Layer
+// Shared types for the libusb data path so that the mode runners
+// (host/device/raw/tun) can live in their own translation units.
+
+#ifndef USB_NET_CORE_H
+#define USB_NET_CORE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <libusb-1.0/libusb.h>
+#include "usb_raw_comm.h"
+#include "usb_xfer.h"
+#include "usb_discovery.h"
+#include "usb_frame.h"
+#include "usb_stats.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define USB_TIMEOUT_MS 5000
+#define USB_NET_MTU 1500          // Default bulk payload size (USB_MTU)
+#define USB_NET_MTU_MIN 576
+#define USB_NET_MTU_MAX 65535     // packet_header_t.length is 16 bits
+#define USB_NET_BATCH_MAX (1024 * 1024)  // Largest aggregated transfer
+#define PACKET_MAGIC 0x55534243  // "USBC" in little-endian
+#define MAX_SCAN_ATTEMPTS 30
+#define SCAN_INTERVAL_MS 1000
+#define TYPEC_ROLE_SWAP_WAIT_MS 2000  // Longest wait for data_role to switch
+#define USB_NET_FRAME_HEADROOM sizeof(packet_header_t)
+
+// Packet types for our simple protocol
+typedef enum {
+    PKT_PING = 1,
+    PKT_PONG = 2,
+    PKT_DATA = 3,
+    PKT_ACK  = 4
+} packet_type_t;
+
+// Simple packet header
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint8_t  type;
+    uint8_t  flags;
+    uint16_t length;
+    uint32_t seq;
+} packet_header_t;
+
+// Operating mode
+typedef enum {
+    MODE_NONE,
+    MODE_HOST,
+    MODE_DEVICE,
+    MODE_RAW,    // Raw communication (no USB enumeration required)
+    MODE_TUN,    // Carry IP traffic between a TUN/TAP device and the bulk endpoints
+    MODE_BOND,   // TUN mode striped across several links (usb_bond.h)
+    MODE_BENCH,  // Throughput and latency benchmark (usb_bench.h)
+    MODE_SEND_FILE,  // Stream a file to the other side (usb_sendfile.h)
+    MODE_RECV_FILE,  // Receive a file, resuming an interrupted transfer
+    MODE_STATS,  // Print the counters another instance publishes
+    MODE_LIST    // Just list devices
+} usb_net_mode_t;
+
+// Configuration from env file
+typedef struct {
+    char detection_method[32];
+    char typec_port[32];
+    char typec_port_path[256];
+    int usb_bus;
+    char usb_port_path[32];      // Physical port path like "1-4" or "2-1.3"
+    char usb_device_path[256];
+    int xfer_queue_depth;        // In-flight bulk transfers per endpoint
+    int usb_mtu;                 // Largest bulk packet payload
+    int usb_batch_size;          // TUN mode: pack packets into transfers this big, 0 = off
+    char tun_name[16];           // Interface name (empty = kernel picks usbcN)
+    bool tun_tap;                // TAP (Ethernet frames) instead of TUN (IP packets)
+    char tun_address[64];        // Optional IPv4 address in CIDR form
+    char bond_usb_ports[256];    // BOND mode: comma-separated USB port paths, one per link
+    char bond_typec_ports[512];  // BOND mode: matching Type-C port paths (optional)
+    int bond_reorder_ms;         // BOND mode: longest wait for a missing frame
+    char raw_transport[16];      // RAW mode transport: "shm", "file", "vdm" or "dbc"
+    char raw_shm_name[64];       // Shared memory segment name (empty = per port)
+    char raw_vdm_device[256];    // PD VDM passthrough device for the "vdm" transport
+    char raw_dbc_device[256];    // "dbc" transport end: "host", "target" or a tty
+    char raw_sim_link[256];      // Simulated link settings (usb_raw_sim.c), BENCH_TRANSPORT=sim
+    int raw_window;              // RAW mode frames in flight, 0 = unreliable
+    char raw_checksum[16];       // RAW mode data checksum: "crc32c" or "none"
+    char raw_compression[32];    // RAW mode payload codecs offered, empty = per transport
+    int raw_mtu;                 // RAW mode largest message (header + payload)
+    int raw_batch_us;            // RAW mode batch flush delay, 0 = no batching
+    int raw_batch_bytes;         // RAW mode batch flush threshold, 0 = link MTU
+    int raw_keepalive_ms;        // RAW mode liveness check floor, 0 = off
+    bool raw_threads;            // RAW mode: RX/TX/control threads (usb_raw_runtime.h)
+    int raw_queue_depth;         // RAW mode thread queue depth, 0 = default
+    int raw_cpu_rx;              // CPU for each RAW mode thread, -1 = any
+    int raw_cpu_tx;
+    int raw_cpu_control;
+    bool io_uring;               // io_uring for file transport and TUN I/O (usb_uring.h)
+    int io_uring_sqpoll_ms;      // io_uring submission thread idle time, 0 = no thread
+    char bench_role[16];         // BENCH mode: "client" (runs the sweep) or "server"
+    char bench_transport[16];    // BENCH mode: "usb" (bulk endpoints) or "raw"
+    char bench_sizes[128];       // BENCH mode: payload sizes to sweep, comma-separated
+    char bench_depths[64];       // BENCH mode: echo requests in flight to sweep
+    int bench_duration_ms;       // BENCH mode: length of each measurement
+    char bench_output[256];      // BENCH mode: JSON results file (empty = stdout)
+    double bench_min_mbps;       // BENCH mode: fail below this peak tx throughput (0 = off)
+    double bench_max_loss;       // BENCH mode: fail above this loss in % of any test (<0 = off)
+    double bench_max_rtt_us;     // BENCH mode: fail above this unloaded RTT p50 (0 = off)
+    char file_transport[16];     // File modes: "usb" (bulk endpoints) or "raw"
+    char file_path[256];         // File modes: file to send, or destination file or directory
+    char stats_shm_name[64];     // Publish counters in this shared memory page (empty = off)
+} usb_net_config_t;
+
+typedef struct {
+    libusb_context *ctx;
+    libusb_device_handle *dev_handle;
+    uint8_t endpoint_in;
+    uint8_t endpoint_out;
+    int interface_num;
+    usb_net_mode_t mode;
+    usb_net_config_t config;
+    uint32_t seq_num;
+    usb_xfer_engine_t xfer;      // Async bulk transfer pipeline
+    // Frame buffers for the synchronous fallback path, frame_size bytes
+    // (usb_mtu + USB_NET_FRAME_HEADROOM) each
+    uint8_t *tx_frame;
+    uint8_t *rx_frame;
+    size_t frame_size;
+    raw_comm_ctx_t raw_ctx;      // Raw communication context
+    usb_discovery_t discovery;   // Peer discovery, set up by the first scan
+    usb_layout_t layout;         // Where the claimed peer was found
+    // Counters of the bulk path; stats points at stats_local or into the
+    // published page, whose raw half the raw context counts into
+    usb_stats_t stats_local;
+    usb_stats_t *stats;
+    usb_stats_page_t *stats_page;
+} usb_net_device_t;
+
+int usb_net_init(usb_net_device_t *device);
+void usb_net_list_devices(usb_net_device_t *device);
+int usb_net_open_device(usb_net_device_t *device, uint16_t vendor_id, uint16_t product_id);
+int usb_net_send(usb_net_device_t *device, const uint8_t *data, int len);
+int usb_net_recv(usb_net_device_t *device, uint8_t *buffer, int max_len);
+void usb_net_cleanup(usb_net_device_t *device);
+int usb_net_load_config(usb_net_device_t *device, const char *config_path);
+// Swap the Type-C data role and wait until the port reports it
+int usb_net_typec_role_swap(usb_net_device_t *device, const char *role);
+// Claim a peer with bulk endpoints if one is attached now
+int usb_net_find_peer(usb_net_device_t *device);
+
+// Wait up to MAX_SCAN_ATTEMPTS * SCAN_INTERVAL_MS for a peer. Returns as
+// soon as it enumerates.
+int usb_net_wait_for_peer(usb_net_device_t *device, const char *what);
+
+// Stop transfers and release the claimed peer, e.g. after it disconnected
+void usb_net_close_peer(usb_net_device_t *device);
+
+// Transfer buffer size for usb_mtu and usb_batch_size, 0 if the frame
+// buffers cannot be allocated
+size_t usb_net_xfer_buffer_size(usb_net_device_t *device);
+
+// Fill a packet header in place (e.g. in the headroom of a transfer buffer)
+void usb_net_fill_header(usb_net_device_t *device, packet_header_t *hdr,
+                         packet_type_t type, int len);
+
+// Zero-copy packet path. usb_net_alloc_frame() hands out an OUT transfer
+// slot (or the fallback tx_frame) with USB_NET_FRAME_HEADROOM in front of
+// the payload; usb_net_send_frame() writes the packet header in place and
+// submits it. Caller-owned frames from usb_frame_init() go through
+// usb_net_send() instead.
+int usb_net_alloc_frame(usb_net_device_t *device, usb_frame_t *frame, int timeout_ms);
+int usb_net_send_frame(usb_net_device_t *device, usb_frame_t *frame, packet_type_t type);
+
+// Borrow the next received packet straight out of its IN transfer buffer.
+// Returns 1 with *view filled, 0 on timeout, -1 on error or a bad packet.
+int usb_net_recv_frame(usb_net_device_t *device, usb_frame_t *view, packet_type_t *type);
+
+// Return a received view, or an allocated frame that will not be sent
+void usb_net_release_frame(usb_net_device_t *device, usb_frame_t *frame);
+
+int usb_net_send_packet(usb_net_device_t *device, packet_type_t type, const uint8_t *data, int len);
+int usb_net_recv_packet(usb_net_device_t *device, packet_type_t *type, uint8_t *data, int max_len);
+
+// Copy the bulk path counters
+void usb_net_get_stats(usb_net_device_t *device, usb_stats_t *out);
+
+// Configure the raw context (transport, MTU, window, checksum, batching)
+// from the config and start listening. Cleans the context up on failure.
+int usb_net_raw_setup(usb_net_device_t *device);
+
+// As usb_net_raw_setup(), with device->raw_ctx and peer joined in this
+// process by a link simulated as RAW_SIM_LINK describes. Both get the same
+// options; whoever drives peer plays the other side.
+int usb_net_raw_setup_sim(usb_net_device_t *device, raw_comm_ctx_t *peer);
+
+int usb_net_run_host(usb_net_device_t *device);
+int usb_net_run_device(usb_net_device_t *device);
+int usb_net_run_raw(usb_net_device_t *device);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // USB_NET_CORE_H
@@ -0,0 +1,198 @@
+// USB-C Software Network - Command Line Front End
+// Parses the options, loads the config file and runs one of the demo and
+// tool modes on top of the library (libusbcnet). Everything else lives in
+// the library, so this file is all an embedding application replaces.
+
+#include <stdio.h>
+#include <string.h>
+#include <getopt.h>
+#include "usb_net_core.h"
+#include "usb_tun.h"
+#include "usb_bond.h"
+#include "usb_bench.h"
+#include "usb_sendfile.h"
+#include "usb_uring.h"
+#include "usb_log.h"
+
+// Map the counters of the running instance and print them once
+static int run_stats_mode(usb_net_device_t *device) {
+    if (!device->config.stats_shm_name[0]) {
+        USB_LOG_ERROR("STATS_SHM_NAME is not set\n");
+        return -1;
+    }
+    
+    const usb_stats_page_t *page = usb_stats_page_open(device->config.stats_shm_name);
+    if (!page) {
+        return -1;
+    }
+    
+    printf("pid %d\n", page->pid);
+    usb_stats_print(stdout, "usb", &page->usb);
+    usb_stats_print(stdout, "raw", &page->raw);
+    usb_stats_page_close(page);
+    return 0;
+}
+
+static void print_usage(const char *prog) {
+    printf("Usage: %s [OPTIONS]\n\n", prog);
+    printf("Options:\n");
+    printf("  --mode host|device|raw|tun|bond|bench|send-file|recv-file|stats|list\n");
+    printf("                                Operating mode (default: list)\n");
+    printf("  --config <path>               Path to config file (default: target_usb_c_port.env)\n");
+    printf("  --file <path>                 File to send or where to receive (overrides FILE_PATH)\n");
+    printf("  --help                        Show this help message\n");
+    printf("\nModes:\n");
+    printf("  host    - Act as USB host, scan for device, send PING packets\n");
+    printf("  device  - Act as USB device, wait for host, respond with PONG\n");
+    printf("  raw     - Raw mode: direct host-to-host without USB enumeration\n");
+    printf("  tun     - Bridge a TUN/TAP interface to the bulk endpoints (IP traffic)\n");
+    printf("  bond    - Like tun, striped across the links in BOND_USB_PORTS\n");
+    printf("  bench   - Measure throughput and RTT (BENCH_ROLE=server on the other side,\n");
+    printf("            or BENCH_TRANSPORT=sim for both sides over a simulated link)\n");
+    printf("  send-file - Send a file to recv-file on the other side, resuming if interrupted\n");
+    printf("  recv-file - Receive a file from send-file\n");
+    printf("  stats   - Print the counters of the instance publishing STATS_SHM_NAME\n");
+    printf("  list    - Just list USB devices and exit\n");
+    printf("\nExamples:\n");
+    printf("  %s --mode raw                  # Recommended for host-to-host\n", prog);
+    printf("  %s --mode host\n", prog);
+    printf("  %s --mode device --config /path/to/config.env\n", prog);
+    printf("  %s --mode send-file --file image.bin\n", prog);
+}
+
+int main(int argc, char *argv[]) {
+    usb_net_device_t device;
+    usb_net_mode_t mode = MODE_LIST;
+    const char *config_path = "target_usb_c_port.env";
+    const char *file_path = NULL;
+    int ret;
+    
+    // Parse command line arguments
+    static struct option long_options[] = {
+        {"mode",   required_argument, 0, 'm'},
+        {"config", required_argument, 0, 'c'},
+        {"file",   required_argument, 0, 'f'},
+        {"help",   no_argument,       0, 'h'},
+        {0, 0, 0, 0}
+    };
+    
+    int opt;
+    while ((opt = getopt_long(argc, argv, "m:c:f:h", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'm':
+                if (strcmp(optarg, "host") == 0) {
+                    mode = MODE_HOST;
+                } else if (strcmp(optarg, "device") == 0) {
+                    mode = MODE_DEVICE;
+                } else if (strcmp(optarg, "raw") == 0) {
+                    mode = MODE_RAW;
+                } else if (strcmp(optarg, "tun") == 0) {
+                    mode = MODE_TUN;
+                } else if (strcmp(optarg, "bond") == 0) {
+                    mode = MODE_BOND;
+                } else if (strcmp(optarg, "bench") == 0) {
+                    mode = MODE_BENCH;
+                } else if (strcmp(optarg, "send-file") == 0) {
+                    mode = MODE_SEND_FILE;
+                } else if (strcmp(optarg, "recv-file") == 0) {
+                    mode = MODE_RECV_FILE;
+                } else if (strcmp(optarg, "stats") == 0) {
+                    mode = MODE_STATS;
+                } else if (strcmp(optarg, "list") == 0) {
+                    mode = MODE_LIST;
+                } else {
+                    USB_LOG_ERROR("Invalid mode: %s\n", optarg);
+                    print_usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'c':
+                config_path = optarg;
+                break;
+            case 'f':
+                file_path = optarg;
+                break;
+            case 'h':
+                print_usage(argv[0]);
+                return 0;
+            default:
+                print_usage(argv[0]);
+                return 1;
+        }
+    }
+    
+    // From here on the datapath threads never write to stdio themselves.
+    // list and stats print their results straight to stdout instead.
+    if (mode != MODE_LIST && mode != MODE_STATS) {
+        usb_log_start();
+    }
+    
+    USB_LOG_INFO("=== USB-C Software Network (Direct Hardware Access) ===\n");
+    USB_LOG_INFO("No kernel gadget drivers required!\n\n");
+    
+    ret = usb_net_init(&device);
+    if (ret < 0) {
+        usb_log_stop();
+        return 1;
+    }
+    
+    // Load configuration
+    usb_net_load_config(&device, config_path);
+    device.mode = mode;
+    if (file_path) {
+        snprintf(device.config.file_path, sizeof(device.config.file_path), "%s", file_path);
+    }
+    usb_uring_configure(device.config.io_uring, device.config.io_uring_sqpoll_ms);
+    
+    // Publish the counters for external readers
+    if (device.config.stats_shm_name[0] && mode != MODE_STATS && mode != MODE_LIST) {
+        device.stats_page = usb_stats_page_create(device.config.stats_shm_name);
+        if (device.stats_page) {
+            device.stats = &device.stats_page->usb;
+            USB_LOG_INFO("Publishing statistics in shared memory %s\n", device.config.stats_shm_name);
+        }
+    }
+    
+    // Execute based on mode
+    switch (mode) {
+        case MODE_HOST:
+            ret = usb_net_run_host(&device);
+            break;
+        case MODE_DEVICE:
+            ret = usb_net_run_device(&device);
+            break;
+        case MODE_RAW:
+            ret = usb_net_run_raw(&device);
+            break;
+        case MODE_TUN:
+            ret = usb_tun_run(&device);
+            break;
+        case MODE_BOND:
+            ret = usb_bond_run(&device);
+            break;
+        case MODE_BENCH:
+            ret = usb_bench_run(&device);
+            break;
+        case MODE_SEND_FILE:
+            ret = usb_sendfile_run_send(&device);
+            break;
+        case MODE_RECV_FILE:
+            ret = usb_sendfile_run_recv(&device);
+            break;
+        case MODE_STATS:
+            ret = run_stats_mode(&device);
+            break;
+        case MODE_LIST:
+        default:
+            usb_net_list_devices(&device);
+            USB_LOG_INFO("\nUse --mode raw for host-to-host communication\n");
+            USB_LOG_INFO("Or --mode host/device for traditional USB mode\n");
+            ret = 0;
+            break;
+    }
+    
+    usb_net_cleanup(&device);
+    usb_log_stop();
+    
+    return ret < 0 ? 1 : 0;
+}
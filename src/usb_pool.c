@@ -0,0 +1,259 @@
+// USB-C Software Network - Frame Buffer Pool Implementation
+//
+// Thread caches are matched to their pool by address and id, so a cache
+// entry left behind by a destroyed pool is recognised as stale (and simply
+// dropped) even when a new pool is set up at the same address. A thread
+// that exits flushes its caches back to the pools that are still live.
+
+#include "usb_pool.h"
+#include "usb_log.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+typedef struct {
+    usb_pool_t *pool;
+    uint64_t id;
+    int count;
+    void *bufs[USB_POOL_CACHE_MAX];
+} pool_cache_t;
+
+static _Thread_local pool_cache_t thread_cache[USB_POOL_CACHE_POOLS];
+static _Thread_local bool thread_cache_armed;
+
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static usb_pool_t *live_pools;
+static uint64_t next_pool_id = 1;
+static pthread_key_t exit_key;
+static pthread_once_t exit_key_once = PTHREAD_ONCE_INIT;
+
+// Slabs
+
+static size_t slab_bytes(size_t bytes) {
+    size_t unit = bytes >= USB_SLAB_HUGE_SIZE / 2 ? USB_SLAB_HUGE_SIZE : (size_t)sysconf(_SC_PAGESIZE);
+    return (bytes + unit - 1) & ~(unit - 1);
+}
+
+void *usb_slab_alloc(size_t bytes) {
+    size_t len = slab_bytes(bytes);
+    void *mem = MAP_FAILED;
+
+    if (len % USB_SLAB_HUGE_SIZE == 0) {
+#ifdef MAP_HUGETLB
+        mem = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+    }
+    if (mem == MAP_FAILED) {
+        mem = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mem == MAP_FAILED) {
+            USB_LOG_ERROR("Failed to map %zu byte slab: %s\n", len, strerror(errno));
+            return NULL;
+        }
+#ifdef MADV_HUGEPAGE
+        // No reserved hugepages: let THP back the slab if it can
+        if (len % USB_SLAB_HUGE_SIZE == 0) madvise(mem, len, MADV_HUGEPAGE);
+#endif
+    }
+    return mem;
+}
+
+void usb_slab_free(void *mem, size_t bytes) {
+    if (mem) munmap(mem, slab_bytes(bytes));
+}
+
+// Shared free list (pool->lock held)
+
+static void list_push(usb_pool_t *pool, void *buf) {
+    *(void **)buf = pool->free_list;
+    pool->free_list = buf;
+    pool->free_count++;
+}
+
+static void *list_pop(usb_pool_t *pool) {
+    void *buf = pool->free_list;
+    if (buf) {
+        pool->free_list = *(void **)buf;
+        pool->free_count--;
+    }
+    return buf;
+}
+
+// Map another slab and put its buffers on the free list
+static int grow(usb_pool_t *pool) {
+    int n = pool->per_slab;
+    if (pool->max_buffers > 0 && pool->total + n > pool->max_buffers) {
+        n = pool->max_buffers - pool->total;
+    }
+    if (n <= 0) return -1;
+
+    usb_pool_slab_t *slab = malloc(sizeof(usb_pool_slab_t));
+    if (!slab) return -1;
+    slab->bytes = (size_t)n * pool->buf_size;
+    slab->mem = usb_slab_alloc(slab->bytes);
+    if (!slab->mem) {
+        free(slab);
+        return -1;
+    }
+    slab->next = pool->slabs;
+    pool->slabs = slab;
+
+    // Push in reverse so buffers are handed out in address order
+    for (int i = n - 1; i >= 0; i--) {
+        list_push(pool, (uint8_t *)slab->mem + (size_t)i * pool->buf_size);
+    }
+    pool->total += n;
+    return 0;
+}
+
+// Move up to n buffers from a cache to the pool
+static void spill(usb_pool_t *pool, pool_cache_t *cache, int n) {
+    pthread_mutex_lock(&pool->lock);
+    while (n-- > 0 && cache->count > 0) {
+        list_push(pool, cache->bufs[--cache->count]);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+// Thread caches
+
+static void flush_thread_caches(void *arg) {
+    pool_cache_t *caches = arg;
+
+    pthread_mutex_lock(&registry_lock);
+    for (int i = 0; i < USB_POOL_CACHE_POOLS; i++) {
+        pool_cache_t *cache = &caches[i];
+        for (usb_pool_t *p = live_pools; p && cache->count > 0; p = p->next_live) {
+            if (p == cache->pool && p->id == cache->id) spill(p, cache, cache->count);
+        }
+        cache->pool = NULL;
+        cache->count = 0;
+    }
+    pthread_mutex_unlock(&registry_lock);
+}
+
+static void make_exit_key(void) {
+    if (pthread_key_create(&exit_key, flush_thread_caches) != 0) {
+        USB_LOG_WARN("Buffer pool: no thread exit hook, exiting threads keep their caches\n");
+    }
+}
+
+// The calling thread's cache for pool, claiming a free or stale entry.
+// NULL if every entry caches another live pool.
+static pool_cache_t *thread_cache_for(usb_pool_t *pool) {
+    pool_cache_t *spare = NULL;
+
+    for (int i = 0; i < USB_POOL_CACHE_POOLS; i++) {
+        pool_cache_t *cache = &thread_cache[i];
+        if (cache->pool == pool) {
+            if (cache->id == pool->id) return cache;
+            cache->pool = NULL;  // Stale: the pool was destroyed and set up again
+        }
+        if (!cache->pool && !spare) spare = cache;
+    }
+    if (!spare) return NULL;
+
+    if (!thread_cache_armed) {
+        pthread_once(&exit_key_once, make_exit_key);
+        pthread_setspecific(exit_key, thread_cache);
+        thread_cache_armed = true;
+    }
+    spare->pool = pool;
+    spare->id = pool->id;
+    spare->count = 0;
+    return spare;
+}
+
+// Pools
+
+int usb_pool_init(usb_pool_t *pool, size_t buf_size, int per_slab, int max_buffers) {
+    memset(pool, 0, sizeof(usb_pool_t));
+
+    if (buf_size == 0 || per_slab < 1 || max_buffers < 0) {
+        USB_LOG_ERROR("Invalid buffer pool (%zu bytes x %d)\n", buf_size, per_slab);
+        return -1;
+    }
+
+    // Room for the free list link, and buffers never share a cache line
+    if (buf_size < sizeof(void *)) buf_size = sizeof(void *);
+    pool->buf_size = (buf_size + USB_POOL_ALIGN - 1) & ~(size_t)(USB_POOL_ALIGN - 1);
+    pool->per_slab = per_slab;
+    pool->max_buffers = max_buffers;
+    pthread_mutex_init(&pool->lock, NULL);
+
+    pthread_mutex_lock(&registry_lock);
+    pool->id = next_pool_id++;
+    pool->next_live = live_pools;
+    live_pools = pool;
+    pthread_mutex_unlock(&registry_lock);
+    return 0;
+}
+
+void usb_pool_destroy(usb_pool_t *pool) {
+    if (pool->id == 0) return;  // Never initialised, or already destroyed
+
+    pthread_mutex_lock(&registry_lock);
+    for (usb_pool_t **p = &live_pools; *p; p = &(*p)->next_live) {
+        if (*p == pool) {
+            *p = pool->next_live;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&registry_lock);
+
+    // Only this thread's cache can be cleared; the others go stale by id
+    for (int i = 0; i < USB_POOL_CACHE_POOLS; i++) {
+        if (thread_cache[i].pool == pool) {
+            thread_cache[i].pool = NULL;
+            thread_cache[i].count = 0;
+        }
+    }
+
+    usb_pool_slab_t *slab = pool->slabs;
+    while (slab) {
+        usb_pool_slab_t *next = slab->next;
+        usb_slab_free(slab->mem, slab->bytes);
+        free(slab);
+        slab = next;
+    }
+    pthread_mutex_destroy(&pool->lock);
+    memset(pool, 0, sizeof(usb_pool_t));
+}
+
+void *usb_pool_get(usb_pool_t *pool) {
+    pool_cache_t *cache = thread_cache_for(pool);
+
+    if (cache && cache->count > 0) {
+        return cache->bufs[--cache->count];
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    if (!pool->free_list) grow(pool);
+    void *buf = list_pop(pool);
+
+    // Refill half the cache while the lock is held anyway
+    while (buf && cache && cache->count < USB_POOL_CACHE_MAX / 2 && pool->free_list) {
+        cache->bufs[cache->count++] = list_pop(pool);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return buf;
+}
+
+void usb_pool_put(usb_pool_t *pool, void *buf) {
+    if (!buf) return;
+
+    pool_cache_t *cache = thread_cache_for(pool);
+    if (!cache) {
+        pthread_mutex_lock(&pool->lock);
+        list_push(pool, buf);
+        pthread_mutex_unlock(&pool->lock);
+        return;
+    }
+
+    if (cache->count == USB_POOL_CACHE_MAX) {
+        spill(pool, cache, USB_POOL_CACHE_MAX / 2);
+    }
+    cache->bufs[cache->count++] = buf;
+}
@@ -0,0 +1,72 @@
+// USB-C Software Network - Frame Buffer Pools
+// Long-lived buffers (transfer slots, queue rings, window arenas) are
+// carved out of slabs: one anonymous mapping per slab, on 2 MiB hugepages
+// when the system has them reserved, otherwise with transparent hugepages
+// requested, so a set of buffers costs a few TLB entries instead of one
+// per 4 KiB page.
+//
+// usb_pool_t hands out fixed-size buffers from slabs of per_slab buffers,
+// adding a slab whenever it runs dry. Every thread keeps a small cache of
+// free buffers per pool, so getting and putting a buffer in the steady
+// state touches no lock and never calls malloc; only refilling or
+// spilling a cache takes the pool lock. Slabs are only returned to the
+// system by usb_pool_destroy().
+
+#ifndef USB_POOL_H
+#define USB_POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#define USB_POOL_ALIGN       64         // Buffers start on a cache line
+#define USB_POOL_CACHE_MAX   32         // Free buffers a thread keeps per pool
+#define USB_POOL_CACHE_POOLS 8          // Pools a thread caches at once
+#define USB_SLAB_HUGE_SIZE   (2u << 20)
+
+typedef struct usb_pool_slab {
+    struct usb_pool_slab *next;
+    void *mem;
+    size_t bytes;
+} usb_pool_slab_t;
+
+typedef struct usb_pool {
+    size_t buf_size;             // Rounded up to USB_POOL_ALIGN
+    int per_slab;
+    int max_buffers;             // 0 = no limit
+    uint64_t id;                 // Unique per usb_pool_init(), tags thread caches
+
+    pthread_mutex_t lock;
+    void *free_list;             // Linked through the first word of each buffer
+    int free_count;
+    int total;                   // Buffers carved so far
+    usb_pool_slab_t *slabs;
+
+    struct usb_pool *next_live;  // Registry of pools thread caches may flush to
+} usb_pool_t;
+
+// Map a slab of at least bytes, zeroed. Returns NULL on failure.
+void *usb_slab_alloc(size_t bytes);
+
+// Unmap a slab; bytes must be the size passed to usb_slab_alloc()
+void usb_slab_free(void *mem, size_t bytes);
+
+// Set up a pool of buf_size buffers, allocated per_slab at a time and at
+// most max_buffers in total (0 = no limit; buffers sitting in another
+// thread's cache count as in use). No memory is mapped until the first
+// usb_pool_get(). Returns 0 or -1.
+int usb_pool_init(usb_pool_t *pool, size_t buf_size, int per_slab, int max_buffers);
+
+// Unmap every slab. No buffer may be in use, and no other thread may use
+// the pool any more; their cached buffers are forgotten.
+void usb_pool_destroy(usb_pool_t *pool);
+
+// Take a buffer (uninitialised). Returns NULL once max_buffers are in use
+// or a slab cannot be mapped.
+void *usb_pool_get(usb_pool_t *pool);
+
+// Return a buffer taken from this pool, from any thread
+void usb_pool_put(usb_pool_t *pool, void *buf);
+
+#endif // USB_POOL_H
@@ -0,0 +1,233 @@
+// USB-C Software Network - Bounded Lock-Free Message Queue Implementation
+//
+// Slot sequence numbers: slot i starts at seq = i. A producer may reserve
+// position pos when its slot's seq == pos and publishes it with
+// seq = pos + 1; the consumer reads position head once seq == head + 1 and
+// hands the slot back to the next lap with seq = head + depth.
+
+#include "usb_queue.h"
+#include "usb_log.h"
+#include "usb_pool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#define USB_QUEUE_SLOT_ALIGN 64   // Keep slots on separate cache lines
+#define USB_QUEUE_SPACE_SLICE_MS 10  // Re-check bound for several waiting producers
+
+static void ring_fd(int fd) {
+    uint64_t one = 1;
+    if (write(fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        USB_LOG_ERROR("queue eventfd: %s\n", strerror(errno));
+    }
+}
+
+static void drain_fd(int fd) {
+    uint64_t value;
+    while (read(fd, &value, sizeof(value)) > 0) {
+    }
+}
+
+static int64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+int usb_queue_init(usb_queue_t *q, int depth, size_t slot_size) {
+    memset(q, 0, sizeof(usb_queue_t));
+    q->data_fd = q->space_fd = -1;
+
+    if (depth < 1 || depth > USB_QUEUE_DEPTH_MAX || slot_size == 0) {
+        USB_LOG_ERROR("Invalid queue depth %d (1-%d)\n", depth, USB_QUEUE_DEPTH_MAX);
+        return -1;
+    }
+
+    uint32_t n = 1;
+    while (n < (uint32_t)depth) n <<= 1;
+    q->mask = n - 1;
+    q->slot_size = slot_size;
+    size_t stride = (slot_size + USB_QUEUE_SLOT_ALIGN - 1) & ~(size_t)(USB_QUEUE_SLOT_ALIGN - 1);
+
+    q->slots = calloc(n, sizeof(usb_queue_slot_t));
+    q->storage_bytes = (size_t)n * stride;
+    q->storage = usb_slab_alloc(q->storage_bytes);
+    q->data_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    q->space_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (!q->slots || !q->storage || q->data_fd < 0 || q->space_fd < 0) {
+        USB_LOG_ERROR("Failed to allocate %u-slot queue\n", n);
+        free(q->slots);
+        usb_slab_free(q->storage, q->storage_bytes);
+        if (q->data_fd >= 0) close(q->data_fd);
+        if (q->space_fd >= 0) close(q->space_fd);
+        memset(q, 0, sizeof(usb_queue_t));
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < n; i++) {
+        atomic_init(&q->slots[i].seq, i);
+        q->slots[i].data = q->storage + (size_t)i * stride;
+    }
+    atomic_init(&q->tail, 0);
+    atomic_init(&q->count, 0);
+    atomic_init(&q->space_waiters, 0);
+    return 0;
+}
+
+void usb_queue_free(usb_queue_t *q) {
+    if (!q->slots) return;  // Never initialised, or already freed
+
+    free(q->slots);
+    usb_slab_free(q->storage, q->storage_bytes);
+    close(q->data_fd);
+    close(q->space_fd);
+    memset(q, 0, sizeof(usb_queue_t));
+}
+
+usb_queue_slot_t *usb_queue_reserve(usb_queue_t *q) {
+    uint64_t pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+
+    for (;;) {
+        usb_queue_slot_t *slot = &q->slots[pos & q->mask];
+        uint64_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        int64_t diff = (int64_t)(seq - pos);
+
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&q->tail, &pos, pos + 1,
+                                                      memory_order_relaxed,
+                                                      memory_order_relaxed)) {
+                slot->len = 0;
+                slot->peer_id = 0;
+                slot->empty = false;
+                return slot;
+            }
+        } else if (diff < 0) {
+            return NULL;  // Consumer has not released this slot from the last lap
+        } else {
+            pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+        }
+    }
+}
+
+void usb_queue_commit(usb_queue_t *q, usb_queue_slot_t *slot) {
+    uint64_t pos = atomic_load_explicit(&slot->seq, memory_order_relaxed);
+    atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+
+    // Empty -> non-empty: make data_fd readable
+    if (atomic_fetch_add(&q->count, 1) == 0) {
+        ring_fd(q->data_fd);
+    }
+}
+
+void usb_queue_abort(usb_queue_t *q, usb_queue_slot_t *slot) {
+    slot->empty = true;
+    usb_queue_commit(q, slot);
+}
+
+static usb_queue_slot_t *head_slot(usb_queue_t *q) {
+    usb_queue_slot_t *slot = &q->slots[q->head & q->mask];
+    uint64_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+    return seq == q->head + 1 ? slot : NULL;
+}
+
+void usb_queue_release(usb_queue_t *q, usb_queue_slot_t *slot) {
+    atomic_store_explicit(&slot->seq, q->head + q->mask + 1, memory_order_release);
+    q->head++;
+
+    // Non-empty -> empty: clear data_fd, then re-check so a commit racing
+    // with the drain is not left without a wakeup
+    if (atomic_fetch_sub(&q->count, 1) == 1) {
+        drain_fd(q->data_fd);
+        if (atomic_load(&q->count) > 0) ring_fd(q->data_fd);
+    }
+
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&q->space_waiters, memory_order_relaxed) > 0) {
+        ring_fd(q->space_fd);
+    }
+}
+
+usb_queue_slot_t *usb_queue_peek(usb_queue_t *q) {
+    usb_queue_slot_t *slot;
+
+    while ((slot = head_slot(q)) != NULL && slot->empty) {
+        usb_queue_release(q, slot);
+    }
+    return slot;
+}
+
+static bool queue_full(usb_queue_t *q) {
+    uint64_t pos = atomic_load(&q->tail);
+    uint64_t seq = atomic_load(&q->slots[pos & q->mask].seq);
+    return (int64_t)(seq - pos) < 0;
+}
+
+// Sleep on fd (and stop_fd) for up to wait_ms. -1 if stop_fd fired.
+static int wait_fd(int fd, int wait_ms, int stop_fd) {
+    struct pollfd pfd[2] = {
+        { .fd = fd, .events = POLLIN },
+        { .fd = stop_fd, .events = POLLIN },
+    };
+    int ret = poll(pfd, stop_fd >= 0 ? 2 : 1, wait_ms);
+    if (ret < 0 && errno != EINTR) {
+        USB_LOG_WARN_RATELIMIT("queue poll: %s\n", strerror(errno));
+        return -1;
+    }
+    if (ret > 0 && stop_fd >= 0 && (pfd[1].revents & POLLIN)) return -1;
+    return 0;
+}
+
+int usb_queue_wait_data(usb_queue_t *q, int timeout_ms, int stop_fd) {
+    int64_t deadline = now_ms() + timeout_ms;
+
+    for (;;) {
+        if (usb_queue_peek(q)) return 1;
+
+        int wait_ms = -1;
+        if (timeout_ms >= 0) {
+            wait_ms = (int)(deadline - now_ms());
+            if (wait_ms <= 0) return 0;
+        }
+
+        if (usb_queue_count(q) > 0) {
+            // Committed out of order behind a producer still writing
+            sched_yield();
+            continue;
+        }
+        if (wait_fd(q->data_fd, wait_ms, stop_fd) < 0) return -1;
+    }
+}
+
+int usb_queue_wait_space(usb_queue_t *q, int timeout_ms, int stop_fd) {
+    int64_t deadline = now_ms() + timeout_ms;
+
+    for (;;) {
+        atomic_fetch_add(&q->space_waiters, 1);
+        atomic_thread_fence(memory_order_seq_cst);
+        bool full = queue_full(q);
+
+        int ret = 0;
+        if (full) {
+            int wait_ms = USB_QUEUE_SPACE_SLICE_MS;
+            if (timeout_ms >= 0) {
+                int left = (int)(deadline - now_ms());
+                if (left < wait_ms) wait_ms = left;
+            }
+            if (wait_ms > 0) {
+                ret = wait_fd(q->space_fd, wait_ms, stop_fd);
+                drain_fd(q->space_fd);
+            }
+        }
+        atomic_fetch_sub(&q->space_waiters, 1);
+
+        if (!full) return 1;
+        if (ret < 0) return -1;
+        if (timeout_ms >= 0 && now_ms() >= deadline) return queue_full(q) ? 0 : 1;
+    }
+}
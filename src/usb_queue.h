@@ -0,0 +1,91 @@
+// USB-C Software Network - Bounded Lock-Free Message Queue
+// Fixed-size message slots passed between threads without locks: any
+// number of producers, one consumer (MPSC, which covers SPSC).
+//
+// Producers claim a slot with a CAS on the tail and publish it by bumping
+// the slot's sequence number (Vyukov's bounded queue), so a producer that
+// is preempted mid-write never blocks the others. Messages are written and
+// read in place: reserve/commit on the producer side, peek/release on the
+// consumer side.
+//
+// Wakeups: data_fd is an eventfd that is readable while messages are
+// queued, so the consumer can sleep in poll/epoll next to other fds. It is
+// only written when the queue goes from empty to non-empty and only
+// drained when it goes back, so a busy queue costs no system calls.
+
+#ifndef USB_QUEUE_H
+#define USB_QUEUE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define USB_QUEUE_DEPTH_MAX 4096
+
+typedef struct {
+    _Atomic(uint64_t) seq;       // Slot state, see usb_queue.c
+    uint8_t *data;               // slot_size bytes
+    size_t len;                  // Message bytes, set by the producer
+    uint32_t peer_id;            // Sender or destination, caller defined
+    uint8_t channel;             // Logical channel, caller defined
+    bool empty;                  // Aborted reservation, skipped by peek
+} usb_queue_slot_t;
+
+typedef struct {
+    usb_queue_slot_t *slots;
+    uint8_t *storage;            // Slab of depth slots (usb_pool.h)
+    size_t storage_bytes;
+    uint32_t mask;               // depth - 1
+    size_t slot_size;
+    int data_fd;                 // Readable while messages are queued
+    int space_fd;                // Rung for producers waiting on a full queue
+
+    _Atomic(uint64_t) tail __attribute__((aligned(64)));  // Next slot to reserve
+    _Atomic(int) space_waiters;
+    uint64_t head __attribute__((aligned(64)));          // Next slot to read (consumer only)
+    _Atomic(int) count;          // Committed and not yet released
+} usb_queue_t;
+
+// Allocate a queue of depth slots (rounded up to a power of two) of
+// slot_size bytes each
+int usb_queue_init(usb_queue_t *q, int depth, size_t slot_size);
+
+// Free a queue; a zeroed, never initialised queue is left alone
+void usb_queue_free(usb_queue_t *q);
+
+// Producer side. Reserve returns NULL while the queue is full. A reserved
+// slot must be committed, or aborted if nothing is to be sent after all.
+usb_queue_slot_t *usb_queue_reserve(usb_queue_t *q);
+void usb_queue_commit(usb_queue_t *q, usb_queue_slot_t *slot);
+void usb_queue_abort(usb_queue_t *q, usb_queue_slot_t *slot);
+
+// Consumer side. Peek returns the oldest message without removing it,
+// NULL if none is ready; release frees it for producers.
+usb_queue_slot_t *usb_queue_peek(usb_queue_t *q);
+void usb_queue_release(usb_queue_t *q, usb_queue_slot_t *slot);
+
+// Block until a message is ready (consumer) or a slot is free (producer),
+// at most timeout_ms (-1 = forever). stop_fd (-1 = none) aborts the wait
+// when readable. Returns 1 when ready, 0 on timeout, -1 if stopped.
+int usb_queue_wait_data(usb_queue_t *q, int timeout_ms, int stop_fd);
+int usb_queue_wait_space(usb_queue_t *q, int timeout_ms, int stop_fd);
+
+// Messages committed and not yet released
+static inline int usb_queue_count(usb_queue_t *q) {
+    return atomic_load_explicit(&q->count, memory_order_relaxed);
+}
+
+static inline int usb_queue_depth(const usb_queue_t *q) {
+    return (int)q->mask + 1;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // USB_QUEUE_H
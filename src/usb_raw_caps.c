@@ -0,0 +1,104 @@
+// USB-C Software Network - Raw Protocol Capabilities Implementation
+
+#include "usb_raw_caps.h"
+#include "usb_raw_comm.h"
+#include <string.h>
+
+static uint8_t *put_tlv(uint8_t *p, const uint8_t *end, uint8_t type, const void *value, size_t len) {
+    if (!p || len > 255 || (size_t)(end - p) < 2 + len) return NULL;
+
+    *p++ = type;
+    *p++ = (uint8_t)len;
+    memcpy(p, value, len);
+    return p + len;
+}
+
+static uint8_t *put_u32(uint8_t *p, const uint8_t *end, uint8_t type, uint32_t v) {
+    uint8_t le[4] = { (uint8_t)v, (uint8_t)(v >> 8), (uint8_t)(v >> 16), (uint8_t)(v >> 24) };
+    return put_tlv(p, end, type, le, sizeof(le));
+}
+
+static uint32_t get_u32(const uint8_t *p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+void raw_caps_init(raw_caps_t *caps) {
+    memset(caps, 0, sizeof(raw_caps_t));
+    caps->mtu = RAW_MTU_DEFAULT;
+    caps->csum = RAW_CSUM_CRC32C;
+}
+
+int raw_caps_encode(const raw_caps_t *caps, uint8_t *out, size_t outlen) {
+    const uint8_t *end = out + outlen;
+    uint8_t *p = out;
+    uint8_t window[2] = { (uint8_t)caps->window, (uint8_t)(caps->window >> 8) };
+    uint8_t codecs[8];
+
+    for (int i = 0; i < 4; i++) {
+        codecs[i] = (uint8_t)(caps->codecs >> (8 * i));
+        codecs[4 + i] = (uint8_t)(caps->codecs_wanted >> (8 * i));
+    }
+
+    p = put_u32(p, end, RAW_CAP_MTU, caps->mtu);
+    p = put_tlv(p, end, RAW_CAP_WINDOW, window, sizeof(window));
+    p = put_tlv(p, end, RAW_CAP_CHECKSUM, &caps->csum, 1);
+    p = put_tlv(p, end, RAW_CAP_CODECS, codecs, sizeof(codecs));
+    p = put_u32(p, end, RAW_CAP_BATCH, caps->batch_us);
+    p = put_u32(p, end, RAW_CAP_TICKET, caps->ticket);
+    p = put_u32(p, end, RAW_CAP_FEATURES, caps->features);
+    if (caps->transport[0]) {
+        p = put_tlv(p, end, RAW_CAP_TRANSPORT, caps->transport,
+                    strnlen(caps->transport, sizeof(caps->transport)));
+    }
+
+    return p ? (int)(p - out) : -1;
+}
+
+int raw_caps_decode(raw_caps_t *caps, const uint8_t *in, size_t len) {
+    const uint8_t *p = in;
+    const uint8_t *end = in + len;
+
+    while (end - p >= 2) {
+        uint8_t type = p[0];
+        size_t vlen = p[1];
+        const uint8_t *v = p + 2;
+        if ((size_t)(end - v) < vlen) return -1;
+        p = v + vlen;
+
+        // A value shorter than its type needs is ignored like an unknown type
+        switch (type) {
+            case RAW_CAP_MTU:
+                if (vlen >= 4) caps->mtu = get_u32(v);
+                break;
+            case RAW_CAP_WINDOW:
+                if (vlen >= 2) caps->window = (uint16_t)(v[0] | v[1] << 8);
+                break;
+            case RAW_CAP_CHECKSUM:
+                if (vlen >= 1) caps->csum = v[0];
+                break;
+            case RAW_CAP_CODECS:
+                if (vlen >= 8) {
+                    caps->codecs = get_u32(v);
+                    caps->codecs_wanted = get_u32(v + 4);
+                }
+                break;
+            case RAW_CAP_BATCH:
+                if (vlen >= 4) caps->batch_us = get_u32(v);
+                break;
+            case RAW_CAP_TICKET:
+                if (vlen >= 4) caps->ticket = get_u32(v);
+                break;
+            case RAW_CAP_FEATURES:
+                if (vlen >= 4) caps->features = get_u32(v);
+                break;
+            case RAW_CAP_TRANSPORT: {
+                size_t n = vlen < sizeof(caps->transport) - 1 ? vlen : sizeof(caps->transport) - 1;
+                memcpy(caps->transport, v, n);
+                caps->transport[n] = '\0';
+                break;
+            }
+        }
+    }
+
+    return p == end ? 0 : -1;
+}
@@ -0,0 +1,53 @@
+// USB-C Software Network - Raw Protocol Capabilities
+// Binary capability block carried by RAW_MSG_HANDSHAKE and
+// RAW_MSG_HANDSHAKE_ACK. It is a sequence of TLVs: a type byte, a length
+// byte and that many value bytes, integers little endian. Receivers skip
+// types they do not know, so options can be added without a protocol
+// version bump; an option a peer leaves out takes the value set by
+// raw_caps_init(), the most conservative one.
+
+#ifndef USB_RAW_CAPS_H
+#define USB_RAW_CAPS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// TLV types
+#define RAW_CAP_MTU        0x01  // u32: largest message accepted, header included
+#define RAW_CAP_WINDOW     0x02  // u16: reliable window offered, 0 = unreliable
+#define RAW_CAP_CHECKSUM   0x03  // u8: raw_csum_t asked for on data frames
+#define RAW_CAP_CODECS     0x04  // u32 decodable, u32 asked for: USB_CODEC_BIT() sets
+#define RAW_CAP_BATCH      0x05  // u32: batch delay in us asked of the sender
+#define RAW_CAP_TICKET     0x06  // u32: resume ticket issued to the peer, 0 = none
+#define RAW_CAP_FEATURES   0x07  // u32: RAW_FEAT_* bits
+#define RAW_CAP_TRANSPORT  0x08  // Transport name, not NUL terminated
+
+// RAW_CAP_FEATURES bits
+#define RAW_FEAT_KEEPALIVE 0x0001  // Answers keepalive requests
+#define RAW_FEAT_BATCH     0x0002  // Unpacks aggregated transport messages
+
+#define RAW_CAPS_MAX 96  // Longest encoded block
+
+typedef struct {
+    uint32_t mtu;
+    uint16_t window;
+    uint8_t csum;                // raw_csum_t
+    uint32_t codecs;             // Payload codecs the sender can decompress
+    uint32_t codecs_wanted;      // ... and would like the peer to use
+    uint32_t batch_us;
+    uint32_t ticket;
+    uint32_t features;
+    char transport[16];          // "" = not announced
+} raw_caps_t;
+
+// Defaults for a peer that sends nothing
+void raw_caps_init(raw_caps_t *caps);
+
+// Encode into out. Returns the block length, or -1 if it does not fit.
+int raw_caps_encode(const raw_caps_t *caps, uint8_t *out, size_t outlen);
+
+// Decode a block over the defaults already in caps. Returns 0, or -1 if
+// the block is truncated (the options before the damage are kept).
+int raw_caps_decode(raw_caps_t *caps, const uint8_t *in, size_t len);
+
+#endif // USB_RAW_CAPS_H
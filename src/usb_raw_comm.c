@@ -7,6 +7,12 @@
 // 3. Raw xHCI debug - Direct controller access (fallback)
 
 #include "usb_raw_comm.h"
+#include "usb_raw_transport.h"
+#include "usb_raw_window.h"
+#include "usb_raw_peer.h"
+#include "usb_raw_caps.h"
+#include "usb_crc32c.h"
+#include "usb_log.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -16,9 +22,29 @@
 #include <time.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
-#include <dirent.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
 #include <poll.h>
 
+#define RAW_DISCOVERY_INTERVAL_MS 2000
+#define RAW_POLL_MAX_EVENTS 8
+#define RAW_POLL_BUDGET 64       // Control messages handled per wakeup
+#define RAW_ARQ_TICK_MS 5        // Retransmission check interval while frames are in flight
+#define RAW_SEND_TIMEOUT_MS 5000 // Longest raw_comm_send() waits for window space
+#define RAW_RESUME_INTERVAL_MS 200   // Resume attempts while a session is suspended
+#define RAW_RESUME_TIMEOUT_MS 30000  // Suspended sessions are given up after this
+#define RAW_KEEPALIVE_MAX_MS 1000    // Longest silence before a keepalive request
+#define RAW_KEEPALIVE_INITIAL_MS 100 // Silence allowed before the first RTT sample
+#define RAW_KEEPALIVE_PROBES 3       // Unanswered requests before a peer is dead
+
+// epoll tags
+enum {
+    RAW_EV_TRANSPORT = 1,
+    RAW_EV_TIMER,
+    RAW_EV_FLUSH,
+    RAW_EV_TYPEC
+};
+
 // Generate a random local ID
 static uint32_t generate_local_id(void) {
     uint32_t id;
@@ -32,68 +58,420 @@ static uint32_t generate_local_id(void) {
     return id | 0x80000000;  // Ensure high bit set to avoid 0
 }
 
-// Calculate simple checksum
-static uint16_t calc_checksum(const uint8_t *data, size_t len) {
-    uint32_t sum = 0;
-    for (size_t i = 0; i < len; i++) {
-        sum += data[i];
+static const char *csum_name(raw_csum_t csum) {
+    return (csum == RAW_CSUM_NONE) ? "none" : "crc32c";
+}
+
+static int64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void epoll_watch(raw_comm_ctx_t *ctx, int fd, uint32_t events, uint32_t tag) {
+    if (ctx->epoll_fd < 0 || fd < 0) return;
+    
+    struct epoll_event ev = { .events = events, .data.u64 = ((uint64_t)tag << 32) | (uint32_t)fd };
+    if (epoll_ctl(ctx->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        USB_LOG_ERROR("epoll_ctl: %s\n", strerror(errno));
     }
-    return (uint16_t)(sum & 0xFFFF);
 }
 
-// Check if Type-C port has partner connected
-static bool check_typec_partner(const char *port_path) {
-    char partner_path[512];
-    struct stat st;
+// Arm the protocol timer (periodic, 0 = disarm)
+static void arm_timer(raw_comm_ctx_t *ctx, int interval_ms) {
+    if (ctx->timer_fd < 0 || ctx->timer_ms == interval_ms) return;
+    ctx->timer_ms = interval_ms;
+    
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = interval_ms / 1000;
+    its.it_value.tv_nsec = (long)(interval_ms % 1000) * 1000000L;
+    its.it_interval = its.it_value;
+    timerfd_settime(ctx->timer_fd, 0, &its, NULL);
+}
+
+static int run_events(raw_comm_ctx_t *ctx, int timeout_ms, raw_peer_t *send_peer);
+static void update_timer(raw_comm_ctx_t *ctx);
+
+// Hand a built message to the active transport
+static int transport_send(raw_comm_ctx_t *ctx, const uint8_t *msg, size_t len) {
+    if (!ctx->transport) return -1;
+    
+    int ret = ctx->transport->send(ctx, msg, len);
+    if (ret < 0) {
+        usb_stat_add(&ctx->stats->tx_errors, 1);
+    } else {
+        usb_stat_add(&ctx->stats->tx_packets, 1);
+        usb_stat_add(&ctx->stats->tx_bytes, len);
+    }
+    return ret;
+}
+
+static int transport_recv(raw_comm_ctx_t *ctx, uint8_t *msg, size_t max_len, uint32_t *from_id) {
+    if (!ctx->transport) return -1;
+    
+    int ret = ctx->transport->recv(ctx, msg, max_len, from_id);
+    if (ret < 0) {
+        usb_stat_add(&ctx->stats->rx_errors, 1);
+    } else if (ret > 0) {
+        usb_stat_add(&ctx->stats->rx_packets, 1);
+        usb_stat_add(&ctx->stats->rx_bytes, (uint64_t)ret);
+    }
+    return ret;
+}
+
+// Add the transport's readiness fd to the event loop
+static void transport_watch(raw_comm_ctx_t *ctx) {
+    if (ctx->transport && ctx->transport->get_fd) {
+        epoll_watch(ctx, ctx->transport->get_fd(ctx), EPOLLIN, RAW_EV_TRANSPORT);
+    }
+}
+
+static void transport_unwatch(raw_comm_ctx_t *ctx) {
+    if (ctx->transport && ctx->transport->get_fd && ctx->epoll_fd >= 0) {
+        int fd = ctx->transport->get_fd(ctx);
+        if (fd >= 0) epoll_ctl(ctx->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+    }
+}
+
+static void transport_close(raw_comm_ctx_t *ctx) {
+    transport_unwatch(ctx);
+    if (ctx->transport && ctx->transport->close) {
+        ctx->transport->close(ctx);
+    }
+    ctx->transport = NULL;
+    ctx->transport_priv = NULL;
+}
+
+// One-shot batch flush timer (0 = disarm)
+static void arm_flush(raw_comm_ctx_t *ctx, int delay_us) {
+    if (ctx->flush_fd < 0) return;
     
-    snprintf(partner_path, sizeof(partner_path), "%s-partner", port_path);
-    return (stat(partner_path, &st) == 0 && S_ISDIR(st.st_mode));
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = delay_us / 1000000;
+    its.it_value.tv_nsec = (long)(delay_us % 1000000) * 1000L;
+    timerfd_settime(ctx->flush_fd, 0, &its, NULL);
 }
 
-// Read sysfs attribute
-static int read_sysfs_attr(const char *path, char *buf, size_t buflen) {
-    int fd = open(path, O_RDONLY);
-    if (fd < 0) return -1;
+// Send the pending batch as one transport message
+static int flush_batch(raw_comm_ctx_t *ctx) {
+    if (ctx->batch_count == 0) return 0;
     
-    ssize_t n = read(fd, buf, buflen - 1);
-    close(fd);
+    int ret = transport_send(ctx, ctx->batch_buffer, ctx->batch_len);
+    if (ctx->batch_count > 1) {
+        ctx->batches_sent++;
+        ctx->batched_msgs += ctx->batch_count;
+    }
+    
+    ctx->batch_len = 0;
+    ctx->batch_count = 0;
+    arm_flush(ctx, 0);
+    return ret;
+}
+
+// Connected peer to send to (0 = primary), NULL if there is none
+static raw_peer_t *tx_target(raw_comm_ctx_t *ctx, uint32_t peer_id) {
+    raw_peer_t *peer = raw_peer_find(ctx->peers, peer_id ? peer_id : ctx->peer_id);
+    return (peer && peer->state == RAW_STATE_CONNECTED) ? peer : NULL;
+}
+
+// Batch delay towards a peer: the longer of ours and the one it asked for
+static int batch_delay(raw_comm_ctx_t *ctx, raw_peer_t *peer) {
+    if (!(peer->peer_features & RAW_FEAT_BATCH)) return 0;
+    return ctx->batch_delay_us > (int)peer->peer_batch_us ? ctx->batch_delay_us : (int)peer->peer_batch_us;
+}
+
+// Send a built message, packing it into the current batch once connected.
+// A batch only ever holds messages for one peer.
+static int queue_message(raw_comm_ctx_t *ctx, raw_peer_t *peer, const uint8_t *msg, size_t len) {
+    int delay_us = peer && peer->state == RAW_STATE_CONNECTED ? batch_delay(ctx, peer) : 0;
+    if (delay_us == 0) {
+        return transport_send(ctx, msg, len);
+    }
+    
+    size_t limit = peer->link_mtu;
+    if (ctx->batch_bytes > 0 && ctx->batch_bytes < limit) {
+        limit = ctx->batch_bytes;
+    }
+    
+    int ret = 0;
+    if (ctx->batch_count > 0 &&
+        (ctx->batch_dst != peer->id || ctx->batch_len + len > peer->link_mtu)) {
+        ret = flush_batch(ctx);
+    }
+    
+    // Nothing to pack it with
+    if (ctx->batch_count == 0 && len >= limit) {
+        int sent = transport_send(ctx, msg, len);
+        return (ret < 0) ? ret : sent;
+    }
     
-    if (n < 0) return -1;
-    buf[n] = '\0';
+    memcpy(ctx->batch_buffer + ctx->batch_len, msg, len);
+    ctx->batch_len += len;
+    if (++ctx->batch_count == 1) {
+        ctx->batch_dst = peer->id;
+        arm_flush(ctx, delay_us);
+    }
     
-    // Remove trailing newline
-    while (n > 0 && (buf[n-1] == '\n' || buf[n-1] == '\r')) {
-        buf[--n] = '\0';
+    if (ctx->batch_len >= limit) {
+        int flushed = flush_batch(ctx);
+        if (flushed < 0) ret = flushed;
     }
     
-    return (int)n;
+    return (ret < 0) ? ret : (int)len;
 }
 
-// Write sysfs attribute
-static int write_sysfs_attr(const char *path, const char *value) {
-    int fd = open(path, O_WRONLY);
-    if (fd < 0) return -1;
+// Select and open a transport
+int raw_comm_set_transport(raw_comm_ctx_t *ctx, const char *name, const char *arg) {
+    const raw_transport_ops_t *ops = NULL;
     
-    ssize_t n = write(fd, value, strlen(value));
-    close(fd);
+    if (strcmp(name, raw_transport_shm.name) == 0) {
+        ops = &raw_transport_shm;
+    } else if (strcmp(name, raw_transport_file.name) == 0) {
+        ops = &raw_transport_file;
+    } else if (strcmp(name, raw_transport_vdm.name) == 0) {
+        ops = &raw_transport_vdm;
+    } else if (strcmp(name, raw_transport_dbc.name) == 0) {
+        ops = &raw_transport_dbc;
+    } else if (strcmp(name, raw_transport_sim.name) == 0) {
+        ops = &raw_transport_sim;
+    } else {
+        USB_LOG_ERROR("Unknown raw transport: %s\n", name);
+        return -1;
+    }
+    
+    transport_close(ctx);
+    
+    if (ops->open && ops->open(ctx, arg) < 0) {
+        USB_LOG_ERROR("Failed to open %s transport\n", ops->name);
+        return -1;
+    }
+    
+    ctx->transport = ops;
+    transport_watch(ctx);
+    USB_LOG_INFO("Raw transport: %s\n", ops->name);
+    return 0;
+}
+
+const raw_transport_ops_t *raw_comm_swap_transport(raw_comm_ctx_t *ctx,
+                                                   const raw_transport_ops_t *ops) {
+    const raw_transport_ops_t *old = ctx->transport;
     
-    return (n > 0) ? 0 : -1;
+    transport_unwatch(ctx);
+    ctx->transport = ops;
+    transport_watch(ctx);
+    return old;
 }
 
-// Initialize raw communication context
-int raw_comm_init(raw_comm_ctx_t *ctx, const char *typec_port_path) {
+static void free_window(raw_peer_t *peer) {
+    if (!peer->window) return;
+    raw_window_free(peer->window);
+    free(peer->window);
+    peer->window = NULL;
+}
+
+// Allocate a window of up to window frames of mtu bytes each
+static raw_window_t *alloc_window(int window, size_t mtu) {
+    raw_window_t *win = malloc(sizeof(raw_window_t));
+    if (!win || raw_window_init(win, window, mtu) < 0) {
+        USB_LOG_ERROR("Failed to allocate send/receive window\n");
+        free(win);
+        return NULL;
+    }
+    return win;
+}
+
+// A link is up or being negotiated with the current buffer sizes
+static bool link_busy(raw_comm_ctx_t *ctx) {
+    if (ctx->tx_borrowed || ctx->rx_borrowed) return true;
+    
+    for (int i = 0; i < RAW_PEER_MAX; i++) {
+        raw_conn_state_t state = ctx->peers->peers[i].state;
+        if (state == RAW_STATE_HANDSHAKING || state == RAW_STATE_CONNECTED) return true;
+    }
+    return false;
+}
+
+// Enable or disable windowed reliable delivery. Windows are allocated per
+// peer at the handshake, so this only changes what later handshakes offer.
+int raw_comm_set_window(raw_comm_ctx_t *ctx, int window) {
+    if (window < 0 || window > RAW_WINDOW_MAX) {
+        USB_LOG_ERROR("Invalid window size %d (0-%d)\n", window, RAW_WINDOW_MAX);
+        return -1;
+    }
+    
+    ctx->window_size = window;
+    return 0;
+}
+
+// Resize the message buffers
+int raw_comm_set_mtu(raw_comm_ctx_t *ctx, size_t mtu) {
+    if (mtu < RAW_MTU_MIN || mtu > RAW_MTU_MAX) {
+        USB_LOG_ERROR("Invalid MTU %zu (%d-%d)\n", mtu, RAW_MTU_MIN, RAW_MTU_MAX);
+        return -1;
+    }
+    
+    if (mtu == ctx->mtu) return 0;
+    
+    if (link_busy(ctx)) {
+        USB_LOG_ERROR("Cannot change the MTU while a link is up\n");
+        return -1;
+    }
+    
+    uint8_t *tx = malloc(mtu);
+    uint8_t *rx = malloc(mtu);
+    uint8_t *batch = malloc(mtu);
+    uint8_t *comp = malloc(mtu);
+    uint8_t *rx_comp = malloc(mtu);
+    
+    if (!tx || !rx || !batch || !comp || !rx_comp) {
+        USB_LOG_ERROR("Failed to allocate %zu byte message buffers\n", mtu);
+        free(tx);
+        free(rx);
+        free(batch);
+        free(comp);
+        free(rx_comp);
+        return -1;
+    }
+    
+    free(ctx->tx_buffer);
+    free(ctx->rx_buffer);
+    free(ctx->batch_buffer);
+    free(ctx->comp_buffer);
+    free(ctx->rx_comp_buffer);
+    ctx->tx_buffer = tx;
+    ctx->rx_buffer = rx;
+    ctx->batch_buffer = batch;
+    ctx->comp_buffer = comp;
+    ctx->rx_comp_buffer = rx_comp;
+    ctx->rx_len = ctx->rx_off = 0;
+    ctx->rx_frame_count = ctx->rx_frame_next = 0;
+    ctx->rx_parse_error = 0;
+    
+    ctx->mtu = mtu;
+    return 0;
+}
+
+// Configure send aggregation
+int raw_comm_set_batching(raw_comm_ctx_t *ctx, int delay_us, size_t flush_bytes) {
+    if (delay_us < 0 || delay_us >= 1000000) {
+        USB_LOG_ERROR("Invalid batch delay %d us (0-999999)\n", delay_us);
+        return -1;
+    }
+    
+    if (delay_us == 0) {
+        flush_batch(ctx);
+    }
+    
+    ctx->batch_delay_us = delay_us;
+    ctx->batch_bytes = flush_bytes;
+    return 0;
+}
+
+int raw_comm_flush(raw_comm_ctx_t *ctx) {
+    return flush_batch(ctx);
+}
+
+// Largest payload on the link to the primary peer
+size_t raw_comm_max_payload(raw_comm_ctx_t *ctx) {
+    raw_peer_t *peer = tx_target(ctx, 0);
+    return (peer ? peer->link_mtu : ctx->mtu) - RAW_FRAME_HEADROOM;
+}
+
+// Select the data frame checksum
+int raw_comm_set_checksum(raw_comm_ctx_t *ctx, const char *name) {
+    if (strcmp(name, "crc32c") == 0) {
+        ctx->csum_pref = RAW_CSUM_CRC32C;
+    } else if (strcmp(name, "none") == 0) {
+        ctx->csum_pref = RAW_CSUM_NONE;
+    } else {
+        USB_LOG_ERROR("Unknown checksum: %s (crc32c or none)\n", name);
+        return -1;
+    }
+    return 0;
+}
+
+// Select the codecs asked for in the handshake
+int raw_comm_set_compression(raw_comm_ctx_t *ctx, const char *names) {
+    uint32_t codecs;
+    
+    if (usb_codec_parse_list(names, &codecs) < 0) {
+        USB_LOG_ERROR("Unknown compression: %s (lz4 or none)\n", names);
+        return -1;
+    }
+    
+    ctx->codecs = codecs;
+    return 0;
+}
+
+// Configure liveness checks. Applies to connected peers at the next timer tick.
+int raw_comm_set_keepalive(raw_comm_ctx_t *ctx, int min_ms) {
+    if (min_ms < 0 || min_ms > RAW_KEEPALIVE_MAX_MS) {
+        USB_LOG_ERROR("Invalid keepalive interval %d ms (0-%d)\n", min_ms, RAW_KEEPALIVE_MAX_MS);
+        return -1;
+    }
+    
+    ctx->keepalive_ms = min_ms;
+    update_timer(ctx);
+    return 0;
+}
+
+// Reset a context to the disconnected state with a fresh local ID
+static int reset_context(raw_comm_ctx_t *ctx) {
     memset(ctx, 0, sizeof(raw_comm_ctx_t));
     
+    ctx->stats = &ctx->stats_local;
+    usb_stats_reset(ctx->stats);
     ctx->state = RAW_STATE_DISCONNECTED;
     ctx->local_id = generate_local_id();
+    ctx->mtu = RAW_MTU_DEFAULT;
+    ctx->csum_pref = RAW_CSUM_CRC32C;
+    ctx->keepalive_ms = RAW_KEEPALIVE_MS_DEFAULT;
     ctx->pd_fd = -1;
     ctx->xhci_fd = -1;
     
-    printf("Raw communication initialized (local_id=0x%08x)\n", ctx->local_id);
+    ctx->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    ctx->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    ctx->flush_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (ctx->epoll_fd < 0 || ctx->timer_fd < 0 || ctx->flush_fd < 0) {
+        USB_LOG_ERROR("Raw event loop setup: %s\n", strerror(errno));
+    }
+    epoll_watch(ctx, ctx->timer_fd, EPOLLIN, RAW_EV_TIMER);
+    epoll_watch(ctx, ctx->flush_fd, EPOLLIN, RAW_EV_FLUSH);
+    
+    ctx->tx_buffer = malloc(ctx->mtu);
+    ctx->rx_buffer = malloc(ctx->mtu);
+    ctx->batch_buffer = malloc(ctx->mtu);
+    ctx->comp_buffer = malloc(ctx->mtu);
+    ctx->rx_comp_buffer = malloc(ctx->mtu);
+    ctx->peers = malloc(sizeof(raw_peer_table_t));
+    if (!ctx->tx_buffer || !ctx->rx_buffer || !ctx->batch_buffer ||
+        !ctx->comp_buffer || !ctx->rx_comp_buffer || !ctx->peers) {
+        USB_LOG_ERROR("Failed to allocate message buffers\n");
+        return -1;
+    }
+    raw_peer_table_init(ctx->peers);
+    
+    USB_LOG_INFO("Raw communication initialized (local_id=0x%08x)\n", ctx->local_id);
+    return 0;
+}
+
+// Initialize raw communication context
+int raw_comm_init(raw_comm_ctx_t *ctx, const char *typec_port_path) {
+    if (reset_context(ctx) < 0) {
+        return -1;
+    }
     
     if (typec_port_path && typec_port_path[0]) {
         strncpy(ctx->typec_port_path, typec_port_path, sizeof(ctx->typec_port_path) - 1);
-        printf("Type-C port path: %s\n", ctx->typec_port_path);
+        USB_LOG_INFO("Type-C port path: %s\n", ctx->typec_port_path);
         
         // Check for USB PD support
         snprintf(ctx->pd_path, sizeof(ctx->pd_path), 
@@ -101,18 +479,71 @@ int raw_comm_init(raw_comm_ctx_t *ctx, const char *typec_port_path) {
         
         struct stat st;
         if (stat(ctx->pd_path, &st) == 0) {
-            printf("USB Power Delivery path found: %s\n", ctx->pd_path);
+            USB_LOG_INFO("USB Power Delivery path found: %s\n", ctx->pd_path);
         } else {
             ctx->pd_path[0] = '\0';
-            printf("No USB Power Delivery sysfs support\n");
+            USB_LOG_INFO("No USB Power Delivery sysfs support\n");
+        }
+        
+        // Partner attach/detach and role changes, see usb_typec.h
+        if (usb_typec_open(&ctx->typec, ctx->typec_port_path) == 0) {
+            epoll_watch(ctx, usb_typec_get_fd(&ctx->typec), EPOLLIN, RAW_EV_TYPEC);
         }
     }
     
+    // Default transport: shared memory ring, falling back to /tmp files
+    if (raw_comm_set_transport(ctx, "shm", NULL) < 0) {
+        raw_comm_set_transport(ctx, "file", NULL);
+    }
+    
+    return 0;
+}
+
+// Initialize a loopback pair
+int raw_comm_init_pair(raw_comm_ctx_t *a, raw_comm_ctx_t *b) {
+    if (reset_context(a) < 0 || reset_context(b) < 0) {
+        return -1;
+    }
+    
+    if (raw_shm_open_pair(a, b) < 0) {
+        USB_LOG_ERROR("Failed to create loopback ring pair\n");
+        raw_comm_cleanup(a);
+        raw_comm_cleanup(b);
+        return -1;
+    }
+    
+    transport_watch(a);
+    transport_watch(b);
+    
+    USB_LOG_INFO("Loopback pair: 0x%08x <-> 0x%08x\n", a->local_id, b->local_id);
+    return 0;
+}
+
+// Initialize a pair over a simulated link
+int raw_comm_init_sim_pair(raw_comm_ctx_t *a, raw_comm_ctx_t *b, const char *link) {
+    if (reset_context(a) < 0 || reset_context(b) < 0) {
+        return -1;
+    }
+    
+    if (raw_sim_open_pair(a, b, link) < 0) {
+        USB_LOG_ERROR("Failed to create simulated link\n");
+        raw_comm_cleanup(a);
+        raw_comm_cleanup(b);
+        return -1;
+    }
+    
+    transport_watch(a);
+    transport_watch(b);
+    
+    USB_LOG_INFO("Simulated pair: 0x%08x <-> 0x%08x\n", a->local_id, b->local_id);
     return 0;
 }
 
 // Cleanup
 void raw_comm_cleanup(raw_comm_ctx_t *ctx) {
+    flush_batch(ctx);
+    transport_close(ctx);
+    
     if (ctx->pd_fd >= 0) {
         close(ctx->pd_fd);
         ctx->pd_fd = -1;
@@ -128,8 +559,43 @@ void raw_comm_cleanup(raw_comm_ctx_t *ctx) {
         ctx->xhci_fd = -1;
     }
     
+    usb_typec_close(&ctx->typec);
+    
+    if (ctx->timer_fd >= 0) {
+        close(ctx->timer_fd);
+        ctx->timer_fd = -1;
+    }
+    
+    if (ctx->flush_fd >= 0) {
+        close(ctx->flush_fd);
+        ctx->flush_fd = -1;
+    }
+    
+    if (ctx->epoll_fd >= 0) {
+        close(ctx->epoll_fd);
+        ctx->epoll_fd = -1;
+    }
+    
+    if (ctx->peers) {
+        for (int i = 0; i < RAW_PEER_MAX; i++) {
+            free_window(&ctx->peers->peers[i]);
+        }
+        free(ctx->peers);
+        ctx->peers = NULL;
+    }
+    ctx->peer_id = 0;
+    ctx->tx_peer = ctx->rx_peer = NULL;
+    
+    free(ctx->tx_buffer);
+    free(ctx->rx_buffer);
+    free(ctx->batch_buffer);
+    free(ctx->comp_buffer);
+    free(ctx->rx_comp_buffer);
+    ctx->tx_buffer = ctx->rx_buffer = ctx->batch_buffer = NULL;
+    ctx->comp_buffer = ctx->rx_comp_buffer = NULL;
+    
     ctx->state = RAW_STATE_DISCONNECTED;
-    printf("Raw communication cleaned up\n");
+    USB_LOG_INFO("Raw communication cleaned up\n");
 }
 
 // Detect available communication methods
@@ -144,368 +610,1179 @@ raw_comm_method_t raw_comm_detect_method(raw_comm_ctx_t *ctx) {
                  "%s/usb_power_delivery/source_capabilities", ctx->typec_port_path);
         
         if (stat(vdm_path, &st) == 0) {
-            printf("Detected method: USB PD VDM\n");
+            USB_LOG_INFO("Detected method: USB PD VDM\n");
             ctx->method = RAW_METHOD_PD_VDM;
             return RAW_METHOD_PD_VDM;
         }
         
         // Fall back to Type-C sysfs polling
-        printf("Detected method: Type-C sysfs polling\n");
+        USB_LOG_INFO("Detected method: Type-C sysfs polling\n");
         ctx->method = RAW_METHOD_TYPEC_SYSFS;
         return RAW_METHOD_TYPEC_SYSFS;
     }
     
-    // Check for xHCI debug capability
-    // Look for debug capability in xHCI extended capabilities
-    FILE *fp = fopen("/proc/iomem", "r");
-    if (fp) {
-        char line[256];
-        while (fgets(line, sizeof(line), fp)) {
-            if (strstr(line, "xhci") || strstr(line, "XHCI")) {
-                printf("Found xHCI controller: %s", line);
-                // Could implement debug capability detection here
-            }
-        }
-        fclose(fp);
+    // Check for an xHCI controller whose driver exposes its Debug Capability
+    if (raw_dbc_find_controller(ctx->dbc_path, sizeof(ctx->dbc_path)) == 0) {
+        USB_LOG_INFO("Detected method: xHCI Debug Capability (%s)\n", ctx->dbc_path);
+        ctx->method = RAW_METHOD_XHCI_DEBUG;
+        return RAW_METHOD_XHCI_DEBUG;
     }
     
     // Default to polling method (monitor sysfs for changes)
-    printf("Detected method: Polling\n");
+    USB_LOG_INFO("Detected method: Polling\n");
     ctx->method = RAW_METHOD_POLLING;
     return RAW_METHOD_POLLING;
 }
 
+// Write the protocol header in place in front of a payload that already
+// sits at msg + sizeof(raw_msg_header_t). peer = NULL broadcasts. channel
+// only applies to data frames.
+static void write_header(raw_comm_ctx_t *ctx, raw_peer_t *peer, uint8_t msg_type,
+                         uint8_t channel, uint8_t *msg, size_t payload_len) {
+    raw_msg_header_t *hdr = (raw_msg_header_t *)msg;
+    memcpy(hdr->magic, RAW_MSG_MAGIC, 4);
+    hdr->version = RAW_PROTOCOL_VERSION;
+    hdr->msg_type = msg_type;
+    hdr->length = (uint32_t)payload_len;
+    hdr->src_id = ctx->local_id;
+    hdr->dst_id = peer ? peer->id : 0;
+    // Only data frames consume a sequence number
+    hdr->seq = !peer ? 0 : (msg_type == RAW_MSG_DATA) ? peer->seq_tx++ : peer->seq_tx;
+    
+    // The negotiated algorithm only applies once connected. A resume must
+    // be readable by a peer that has already lost the connection.
+    bool negotiated = peer && peer->state == RAW_STATE_CONNECTED &&
+                      msg_type != RAW_MSG_RESUME && msg_type != RAW_MSG_RESUME_ACK;
+    raw_csum_t csum = negotiated ? peer->csum : RAW_CSUM_CRC32C;
+    hdr->flags = (uint16_t)csum;
+    if (msg_type == RAW_MSG_DATA && peer && peer->ka_piggyback) {
+        hdr->flags |= RAW_FLAG_KEEPALIVE;
+        peer->ka_piggyback = false;
+    }
+    if (msg_type == RAW_MSG_DATA && peer && peer->comp_pending) {
+        hdr->flags |= (uint16_t)(peer->codec << RAW_FLAG_CODEC_SHIFT);
+        peer->comp_pending = false;
+    }
+    if (msg_type == RAW_MSG_DATA) {
+        hdr->flags |= (uint16_t)((channel << RAW_FLAG_CHANNEL_SHIFT) & RAW_FLAG_CHANNEL_MASK);
+    }
+    
+    // Calculate checksum over header (checksum field zeroed) and payload
+    hdr->checksum = 0;
+    if (csum == RAW_CSUM_CRC32C) {
+        hdr->checksum = usb_crc32c(0, msg, sizeof(raw_msg_header_t) + payload_len);
+    }
+}
+
 // Build a protocol message
-static int build_message(raw_comm_ctx_t *ctx, uint8_t msg_type,
+static int build_message(raw_comm_ctx_t *ctx, raw_peer_t *peer, uint8_t msg_type,
                          const uint8_t *payload, size_t payload_len,
                          uint8_t *output, size_t output_size) {
     if (output_size < sizeof(raw_msg_header_t) + payload_len) {
         return -1;
     }
     
-    raw_msg_header_t *hdr = (raw_msg_header_t *)output;
-    memcpy(hdr->magic, RAW_MSG_MAGIC, 4);
-    hdr->version = RAW_PROTOCOL_VERSION;
-    hdr->msg_type = msg_type;
-    hdr->length = (uint16_t)payload_len;
-    hdr->src_id = ctx->local_id;
-    hdr->dst_id = ctx->peer_id;
-    hdr->seq = ctx->seq_tx++;
-    hdr->reserved = 0;
-    
     if (payload && payload_len > 0) {
         memcpy(output + sizeof(raw_msg_header_t), payload, payload_len);
     }
     
-    // Calculate checksum over header (excluding checksum field) and payload
-    hdr->checksum = 0;
-    hdr->checksum = calc_checksum(output, sizeof(raw_msg_header_t) + payload_len);
-    
+    write_header(ctx, peer, msg_type, RAW_CHANNEL_DEFAULT, output, payload_len);
     return (int)(sizeof(raw_msg_header_t) + payload_len);
 }
 
-// Parse a protocol message
-static int parse_message(const uint8_t *input, size_t input_len,
-                         raw_msg_header_t *hdr, uint8_t *payload, size_t payload_max) {
-    if (input_len < sizeof(raw_msg_header_t)) {
-        return -1;
+// Broadcast a discovery message
+static void send_discovery(raw_comm_ctx_t *ctx) {
+    uint8_t msg_buf[64];
+    
+    // The header already says who is asking
+    int msg_len = build_message(ctx, NULL, RAW_MSG_DISCOVERY, NULL, 0, msg_buf, sizeof(msg_buf));
+    
+    if (msg_len > 0) {
+        transport_send(ctx, msg_buf, msg_len);
+    }
+    ctx->discovery_ms = now_ms();
+}
+
+// Our capability block for handshake payloads, see usb_raw_caps.h. The
+// peer's window is set up here so that only a window that could be
+// allocated is offered. The resume ticket stays the same for as long as
+// the peer is known, so a repeated handshake cannot leave the two sides
+// with different tickets.
+static int format_caps(raw_comm_ctx_t *ctx, raw_peer_t *peer, uint8_t *out, size_t outlen) {
+    if (peer->window && (ctx->window_size == 0 || peer->window->msg_size != ctx->mtu ||
+                         peer->window->slots < ctx->window_size)) {
+        free_window(peer);
+    }
+    if (ctx->window_size > 0 && !peer->window) {
+        peer->window = alloc_window(ctx->window_size, ctx->mtu);
     }
     
-    memcpy(hdr, input, sizeof(raw_msg_header_t));
+    if (peer->ticket_local == 0) {
+        peer->ticket_local = generate_local_id();  // Random, never 0
+    }
     
-    // Verify magic
-    if (memcmp(hdr->magic, RAW_MSG_MAGIC, 4) != 0) {
-        return -2;  // Invalid magic
+    raw_caps_t caps;
+    raw_caps_init(&caps);
+    caps.mtu = (uint32_t)ctx->mtu;
+    caps.window = peer->window ? (uint16_t)ctx->window_size : 0;
+    caps.csum = (uint8_t)ctx->csum_pref;
+    caps.codecs = RAW_CODECS_BUILTIN;
+    caps.codecs_wanted = ctx->codecs;
+    caps.batch_us = (uint32_t)ctx->batch_delay_us;
+    caps.ticket = peer->ticket_local;
+    caps.features = RAW_FEAT_KEEPALIVE | RAW_FEAT_BATCH;
+    if (ctx->transport) {
+        strncpy(caps.transport, ctx->transport->name, sizeof(caps.transport) - 1);
     }
     
-    // Verify version
-    if (hdr->version != RAW_PROTOCOL_VERSION) {
-        return -3;  // Version mismatch
+    return raw_caps_encode(&caps, out, outlen);
+}
+
+// Take the peer's capabilities. Options it left out, or that were lost to
+// a damaged block, fall back to the most conservative choice; without a
+// ticket the connection cannot be resumed.
+static void apply_caps(raw_peer_t *peer, const uint8_t *payload, int payload_len) {
+    raw_caps_t caps;
+    
+    raw_caps_init(&caps);
+    if (payload_len > 0 && raw_caps_decode(&caps, payload, (size_t)payload_len) < 0) {
+        USB_LOG_WARN_RATELIMIT("Truncated capabilities from peer 0x%08x\n", peer->id);
     }
     
-    // Verify length
-    if (input_len < sizeof(raw_msg_header_t) + hdr->length) {
-        return -4;  // Incomplete message
+    peer->peer_window_size = caps.window;
+    peer->peer_csum = caps.csum == RAW_CSUM_NONE ? RAW_CSUM_NONE : RAW_CSUM_CRC32C;
+    peer->peer_mtu = (caps.mtu >= RAW_MTU_MIN && caps.mtu <= RAW_MTU_MAX) ? caps.mtu : RAW_MTU_DEFAULT;
+    peer->ticket_peer = caps.ticket;
+    peer->peer_codecs = caps.codecs;
+    peer->peer_codecs_wanted = caps.codecs_wanted;
+    peer->peer_batch_us = caps.batch_us < 1000000 ? caps.batch_us : 0;
+    peer->peer_features = caps.features;
+    
+    if (caps.transport[0]) {
+        USB_LOG_DEBUG("Peer 0x%08x uses the %s transport\n", peer->id, caps.transport);
     }
+}
+
+// Refresh the queue depth gauges from the reliable windows
+static void sample_queues(raw_comm_ctx_t *ctx) {
+    uint64_t in_flight = 0;
+    uint64_t queued = 0;
     
-    // Copy payload
-    size_t copy_len = (hdr->length < payload_max) ? hdr->length : payload_max;
-    if (payload && copy_len > 0) {
-        memcpy(payload, input + sizeof(raw_msg_header_t), copy_len);
+    for (int i = 0; i < RAW_PEER_MAX; i++) {
+        const raw_peer_t *peer = &ctx->peers->peers[i];
+        if (!peer->reliable) continue;
+        in_flight += (uint64_t)raw_window_in_flight(peer->window);
+        queued += peer->window->rcv_next - peer->window->rcv_read;
     }
     
-    return (int)copy_len;
+    usb_stat_set(&ctx->stats->tx_in_flight, in_flight);
+    usb_stat_set(&ctx->stats->rx_queued, queued);
 }
 
-// Type-C sysfs based communication - write to a shared file
-// This is a workaround: we use a known file path that both sides can access
-// In practice, this would use actual PD VDM or other hardware mechanism
-static const char *SHARED_COMM_FILE = "/tmp/usbc_net_comm";
+// True if some lost connection is waiting to be resumed
+static bool has_suspended(raw_comm_ctx_t *ctx) {
+    for (int i = 0; i < RAW_PEER_MAX; i++) {
+        if (ctx->peers->peers[i].suspended_ms != 0) return true;
+    }
+    return false;
+}
 
-static int sysfs_send_message(raw_comm_ctx_t *ctx, const uint8_t *msg, size_t len) {
-    char path[512];
+// Discovery repeats while detecting and resume attempts while a session
+// is suspended. Once connected the timer ticks fast while some window has
+// frames in flight and at half the keepalive floor otherwise, for the
+// liveness checks. Every window change ends up here, so it also samples
+// the queue depths.
+static void update_timer(raw_comm_ctx_t *ctx) {
+    sample_queues(ctx);
+    bool suspended = has_suspended(ctx);
     
-    // For now, use a temp file as shared memory for IPC
-    // In real implementation, this would go over USB PD VDM
-    snprintf(path, sizeof(path), "%s.%08x", SHARED_COMM_FILE, ctx->local_id);
+    if (ctx->state == RAW_STATE_DETECTING) {
+        arm_timer(ctx, suspended ? RAW_RESUME_INTERVAL_MS : RAW_DISCOVERY_INTERVAL_MS);
+        return;
+    }
     
-    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
-    if (fd < 0) {
-        perror("Failed to open comm file for writing");
-        return -1;
+    for (int i = 0; i < RAW_PEER_MAX; i++) {
+        raw_peer_t *peer = &ctx->peers->peers[i];
+        if (peer->reliable && raw_window_needs_timer(peer->window)) {
+            arm_timer(ctx, RAW_ARQ_TICK_MS);
+            return;
+        }
     }
     
-    ssize_t written = write(fd, msg, len);
-    close(fd);
+    if (ctx->state == RAW_STATE_CONNECTED && ctx->keepalive_ms > 0) {
+        int tick = ctx->keepalive_ms / 2 > RAW_ARQ_TICK_MS ? ctx->keepalive_ms / 2 : RAW_ARQ_TICK_MS;
+        arm_timer(ctx, tick);
+        return;
+    }
+    arm_timer(ctx, suspended ? RAW_RESUME_INTERVAL_MS : 0);
+}
+
+// Context state follows its peers: connected while any peer is
+static void update_state(raw_comm_ctx_t *ctx) {
+    bool handshaking = false;
     
-    if (written != (ssize_t)len) {
-        return -1;
+    for (int i = 0; i < RAW_PEER_MAX; i++) {
+        raw_conn_state_t state = ctx->peers->peers[i].state;
+        if (state == RAW_STATE_CONNECTED) {
+            ctx->state = RAW_STATE_CONNECTED;
+            return;
+        }
+        handshaking |= (state == RAW_STATE_HANDSHAKING);
     }
     
-    printf("  [TX] Sent %zd bytes to %s\n", written, path);
-    return (int)written;
+    ctx->state = handshaking ? RAW_STATE_HANDSHAKING :
+                 ctx->listening ? RAW_STATE_DETECTING : RAW_STATE_DISCONNECTED;
 }
 
-static int sysfs_recv_message(raw_comm_ctx_t *ctx, uint8_t *msg, size_t max_len, 
-                               uint32_t *from_id) {
-    DIR *dir = opendir("/tmp");
-    if (!dir) return -1;
+// Forget a peer. A peer whose window still backs a lent frame stays in the
+// table, disconnected, until the frame is sent or released.
+static void remove_peer(raw_comm_ctx_t *ctx, raw_peer_t *peer) {
+    if ((ctx->tx_borrowed && ctx->tx_peer == peer) || (ctx->rx_borrowed && ctx->rx_peer == peer)) {
+        return;
+    }
     
-    struct dirent *entry;
-    char best_path[512] = "";
-    time_t best_mtime = 0;
-    uint32_t best_id = 0;
+    if (ctx->tx_peer == peer) ctx->tx_peer = NULL;
+    if (ctx->rx_peer == peer) ctx->rx_peer = NULL;
+    free_window(peer);
+    raw_peer_remove(ctx->peers, peer);
+}
+
+// Remove a dropped peer once its lent frame has come back
+static void reap_peer(raw_comm_ctx_t *ctx, raw_peer_t *peer) {
+    if (peer && peer->id != 0 && peer->state == RAW_STATE_DISCONNECTED && peer->suspended_ms == 0) {
+        remove_peer(ctx, peer);
+    }
+}
+
+// Look up a peer, adding it if unknown. A full table gives up the least
+// recently heard peer that has only been discovered.
+static raw_peer_t *add_peer(raw_comm_ctx_t *ctx, uint32_t id) {
+    raw_peer_t *peer = raw_peer_add(ctx->peers, id);
     
-    // Look for comm files from other peers
-    while ((entry = readdir(dir)) != NULL) {
-        if (strncmp(entry->d_name, "usbc_net_comm.", 14) == 0) {
-            // Extract sender ID from filename
-            uint32_t sender_id = (uint32_t)strtoul(entry->d_name + 14, NULL, 16);
-            
-            // Skip our own messages
-            if (sender_id == ctx->local_id) continue;
-            
-            char path[512];
-            snprintf(path, sizeof(path), "/tmp/%s", entry->d_name);
-            
-            struct stat st;
-            if (stat(path, &st) == 0) {
-                // Get the most recent message
-                if (st.st_mtime > best_mtime) {
-                    best_mtime = st.st_mtime;
-                    strncpy(best_path, path, sizeof(best_path) - 1);
-                    best_id = sender_id;
-                }
+    if (!peer && id != 0) {
+        raw_peer_t *oldest = NULL;
+        for (int i = 0; i < RAW_PEER_MAX; i++) {
+            raw_peer_t *p = &ctx->peers->peers[i];
+            if (p->state == RAW_STATE_DETECTING && (!oldest || p->last_rx_ms < oldest->last_rx_ms)) {
+                oldest = p;
             }
         }
+        if (oldest) {
+            remove_peer(ctx, oldest);
+            peer = raw_peer_add(ctx->peers, id);
+        }
     }
-    closedir(dir);
     
-    if (best_path[0] == '\0') {
-        return 0;  // No messages
+    if (!peer) {
+        USB_LOG_ERROR("Peer table full, ignoring peer 0x%08x\n", id);
+        return NULL;
     }
     
-    int fd = open(best_path, O_RDONLY);
-    if (fd < 0) return -1;
-    
-    ssize_t n = read(fd, msg, max_len);
-    close(fd);
-    
-    // Delete the message after reading
-    unlink(best_path);
-    
-    if (n > 0) {
-        *from_id = best_id;
-        printf("  [RX] Received %zd bytes from 0x%08x\n", n, best_id);
+    if (peer->last_rx_ms == 0) {
+        peer->last_rx_ms = now_ms();
     }
-    
-    return (int)n;
+    return peer;
 }
 
-// Start listening for peer connections
-int raw_comm_listen(raw_comm_ctx_t *ctx) {
-    printf("\n=== Starting raw communication listener ===\n");
-    printf("Local ID: 0x%08x\n", ctx->local_id);
-    printf("Method: %d\n", ctx->method);
+// The peer has just been heard from: no keepalive outstanding
+static void reset_liveness(raw_peer_t *peer) {
+    peer->last_rx_ms = now_ms();
+    peer->ka_probe_ms = 0;
+    peer->ka_probes = 0;
+    peer->ka_piggyback = false;
+    peer->ka_reply = false;
+}
+
+static void enter_connected(raw_comm_ctx_t *ctx, raw_peer_t *peer) {
+    peer->state = RAW_STATE_CONNECTED;
+    peer->suspended_ms = 0;  // A full handshake replaces a suspended session
+    ctx->state = RAW_STATE_CONNECTED;
+    USB_LOG_INFO("\n*** CONNECTED to peer 0x%08x ***\n\n", peer->id);
     
-    ctx->state = RAW_STATE_DETECTING;
+    // The first peer to connect becomes the default destination
+    if (!tx_target(ctx, 0)) {
+        ctx->peer_id = peer->id;
+    }
     
-    // Check if Type-C cable is connected
-    if (ctx->typec_port_path[0]) {
-        if (check_typec_partner(ctx->typec_port_path)) {
-            printf("Type-C cable detected (partner present)\n");
-        } else {
-            printf("Waiting for Type-C cable connection...\n");
-        }
+    // Sequence numbers restart with every connection
+    peer->seq_tx = 0;
+    peer->seq_rx = 0;
+    
+    peer->ka_srtt_us = 0;
+    reset_liveness(peer);
+    
+    // Skip checksums only if both sides asked to
+    peer->csum = (ctx->csum_pref == RAW_CSUM_NONE && peer->peer_csum == RAW_CSUM_NONE) ?
+                 RAW_CSUM_NONE : RAW_CSUM_CRC32C;
+    if (peer->csum == RAW_CSUM_CRC32C) {
+        USB_LOG_INFO("Frame checksum: %s (%s)\n", csum_name(peer->csum), usb_crc32c_impl());
+    } else {
+        USB_LOG_INFO("Frame checksum: %s\n", csum_name(peer->csum));
     }
+    USB_LOG_DEBUG("Header validation: %s\n", raw_parse_impl());
     
-    // Send discovery broadcast
-    uint8_t msg_buf[256];
-    char payload[64];
-    snprintf(payload, sizeof(payload), "DISCOVER:%08x", ctx->local_id);
+    peer->link_mtu = ctx->mtu < peer->peer_mtu ? ctx->mtu : peer->peer_mtu;
+    USB_LOG_INFO("Link MTU: %zu bytes\n", peer->link_mtu);
     
-    int msg_len = build_message(ctx, RAW_MSG_DISCOVERY, 
-                                 (uint8_t *)payload, strlen(payload) + 1,
-                                 msg_buf, sizeof(msg_buf));
+    // Compress if either side asked for it, with a codec the peer has
+    uint32_t codecs = (ctx->codecs | peer->peer_codecs_wanted) & peer->peer_codecs & RAW_CODECS_BUILTIN;
+    peer->codec = codecs ? (usb_codec_t)__builtin_ctz(codecs) : USB_CODEC_NONE;
+    peer->comp_pending = false;
+    peer->comp_skip = 0;
+    peer->comp_backoff = 0;
+    if (peer->codec != USB_CODEC_NONE) {
+        USB_LOG_INFO("Payload compression: %s\n", usb_codec_name(peer->codec));
+    }
+    if (batch_delay(ctx, peer) > 0) {
+        USB_LOG_INFO("Batching: up to %d us\n", batch_delay(ctx, peer));
+    }
     
-    if (msg_len > 0) {
-        printf("Broadcasting discovery message...\n");
-        sysfs_send_message(ctx, msg_buf, msg_len);
+    int window = ctx->window_size < peer->peer_window_size ? ctx->window_size : peer->peer_window_size;
+    peer->reliable = peer->window && window > 0;
+    if (peer->reliable) {
+        raw_window_reset(peer->window, window);
+        USB_LOG_INFO("Reliable delivery enabled (window %d)\n", window);
+    } else {
+        free_window(peer);
     }
     
-    return 0;
+    update_timer(ctx);
+    
+    if (ctx->on_connected) {
+        ctx->on_connected(ctx->callback_ctx);
+    }
 }
 
-// Connect to a specific peer
-int raw_comm_connect(raw_comm_ctx_t *ctx, uint32_t peer_id) {
-    printf("Attempting to connect to peer 0x%08x\n", peer_id);
+// Tear down the connection to one peer. The primary role passes on to
+// another connected peer, if any. With suspend, a connection the peer can
+// resume keeps its sequence numbers and window for RAW_RESUME_TIMEOUT_MS.
+static void drop_peer(raw_comm_ctx_t *ctx, raw_peer_t *peer, bool suspend) {
+    uint32_t id = peer->id;
+    bool was_suspended = peer->suspended_ms != 0;
     
-    ctx->peer_id = peer_id;
-    ctx->state = RAW_STATE_HANDSHAKING;
+    if (ctx->batch_count > 0 && ctx->batch_dst == id) {
+        ctx->batch_len = 0;
+        ctx->batch_count = 0;
+        arm_flush(ctx, 0);
+    }
     
-    // Send handshake
-    uint8_t msg_buf[256];
-    char payload[64];
-    snprintf(payload, sizeof(payload), "HANDSHAKE:%08x->%08x", 
-             ctx->local_id, peer_id);
+    if (suspend && peer->state == RAW_STATE_CONNECTED && peer->ticket_peer != 0) {
+        peer->suspended_ms = now_ms();
+        USB_LOG_INFO("Lost peer 0x%08x, session suspended\n", id);
+    } else {
+        peer->suspended_ms = 0;
+    }
+    
+    peer->state = RAW_STATE_DISCONNECTED;
+    peer->reliable = false;
+    if (peer->suspended_ms == 0) {
+        remove_peer(ctx, peer);
+    }
+    
+    if (ctx->peer_id == id) {
+        ctx->peer_id = 0;
+        for (int i = 0; i < RAW_PEER_MAX; i++) {
+            if (ctx->peers->peers[i].state == RAW_STATE_CONNECTED) {
+                ctx->peer_id = ctx->peers->peers[i].id;
+                break;
+            }
+        }
+    }
+    
+    update_state(ctx);
+    update_timer(ctx);
+    
+    // A suspended session already reported the link going down
+    if (ctx->on_disconnected && !was_suspended) {
+        ctx->on_disconnected(ctx->callback_ctx);
+    }
+}
+
+// Retransmit whatever is due for one peer
+static void service_window(raw_comm_ctx_t *ctx, raw_peer_t *peer) {
+    raw_window_t *win = peer->window;
+    int64_t now = now_us();
+    bool dead = false;
+    raw_tx_slot_t *slot;
+    
+    while ((slot = raw_window_next_rtx(win, now, &dead)) != NULL) {
+        usb_stat_add(&ctx->stats->retransmits, 1);
+        queue_message(ctx, peer, slot->msg, slot->len);
+    }
+    
+    if (dead) {
+        USB_LOG_ERROR("Peer 0x%08x stopped acknowledging data, dropping link\n", peer->id);
+        drop_peer(ctx, peer, true);
+        return;
+    }
+    
+    if (raw_window_probe_due(win, now)) {
+        uint8_t msg_buf[64];
+        int msg_len = build_message(ctx, peer, RAW_MSG_KEEPALIVE, NULL, 0, msg_buf, sizeof(msg_buf));
+        if (msg_len > 0) {
+            queue_message(ctx, peer, msg_buf, msg_len);
+        }
+    }
+}
+
+static void send_keepalive(raw_comm_ctx_t *ctx, raw_peer_t *peer, uint32_t flags, uint64_t stamp_us) {
+    raw_keepalive_t ka = { .flags = flags, .stamp_us = stamp_us };
+    uint8_t msg_buf[64];
     
-    int msg_len = build_message(ctx, RAW_MSG_HANDSHAKE,
-                                 (uint8_t *)payload, strlen(payload) + 1,
+    int msg_len = build_message(ctx, peer, RAW_MSG_KEEPALIVE, (uint8_t *)&ka, sizeof(ka),
                                  msg_buf, sizeof(msg_buf));
+    if (msg_len > 0) {
+        queue_message(ctx, peer, msg_buf, msg_len);
+    }
+}
+
+// Round trip of an answered keepalive request (RFC 6298 smoothing)
+static void keepalive_rtt(raw_peer_t *peer, int64_t rtt_us) {
+    if (rtt_us <= 0) rtt_us = 1;
+    if (peer->ka_srtt_us == 0) {
+        peer->ka_srtt_us = rtt_us;
+        peer->ka_rttvar_us = rtt_us / 2;
+    } else {
+        int64_t err = rtt_us > peer->ka_srtt_us ? rtt_us - peer->ka_srtt_us : peer->ka_srtt_us - rtt_us;
+        peer->ka_rttvar_us += (err - peer->ka_rttvar_us) / 4;
+        peer->ka_srtt_us += (rtt_us - peer->ka_srtt_us) / 8;
+    }
+}
+
+// Silence allowed before a keepalive request: twice the round-trip
+// timeout measured by the window, or by keepalives on unreliable links
+static int64_t keepalive_interval(raw_comm_ctx_t *ctx, raw_peer_t *peer) {
+    int64_t interval = RAW_KEEPALIVE_INITIAL_MS;
+    
+    if (peer->reliable && peer->window->rtt_valid) {
+        interval = 2 * (peer->window->srtt_us + 4 * peer->window->rttvar_us) / 1000;
+    } else if (peer->ka_srtt_us > 0) {
+        interval = 2 * (peer->ka_srtt_us + 4 * peer->ka_rttvar_us) / 1000;
+    }
+    
+    if (interval < ctx->keepalive_ms) interval = ctx->keepalive_ms;
+    if (interval > RAW_KEEPALIVE_MAX_MS) interval = RAW_KEEPALIVE_MAX_MS;
+    return interval;
+}
+
+// Ask a silent peer for a keepalive, once per interval. Traffic from the
+// peer (ACKs included) counts, so a busy link sends no explicit requests;
+// while data still goes out to the peer the request rides on the next
+// frame. Returns true if the peer was declared dead and dropped.
+static bool check_liveness(raw_comm_ctx_t *ctx, raw_peer_t *peer, int64_t now) {
+    int64_t interval = keepalive_interval(ctx, peer);
+    
+    if (now - peer->last_rx_ms < interval) {
+        peer->ka_probes = 0;
+        peer->ka_probe_ms = 0;
+        return false;
+    }
+    if (peer->ka_probe_ms != 0 && now - peer->ka_probe_ms < interval) {
+        return false;
+    }
+    
+    if (peer->ka_probes >= RAW_KEEPALIVE_PROBES) {
+        USB_LOG_ERROR("Peer 0x%08x silent for %lld ms, dropping link\n",
+                      peer->id, (long long)(now - peer->last_rx_ms));
+        usb_stat_add(&ctx->stats->peer_timeouts, 1);
+        drop_peer(ctx, peer, true);
+        return true;
+    }
+    
+    peer->ka_probes++;
+    peer->ka_probe_ms = now;
+    usb_stat_add(&ctx->stats->keepalives, 1);
     
+    // Piggyback only once in a row: the frame it waits for may never come
+    if (!peer->ka_piggyback && now - peer->last_tx_ms < interval) {
+        peer->ka_piggyback = true;
+    } else {
+        peer->ka_piggyback = false;
+        send_keepalive(ctx, peer, RAW_KEEPALIVE_REQUEST, (uint64_t)now_us());
+    }
+    return false;
+}
+
+// Timer tick: check every connected peer is still there, service every
+// reliable one and keep the tick running while frames are in flight
+static void service_windows(raw_comm_ctx_t *ctx) {
+    int64_t now = now_ms();
+    
+    for (int i = 0; i < RAW_PEER_MAX; i++) {
+        raw_peer_t *peer = &ctx->peers->peers[i];
+        if (peer->state == RAW_STATE_CONNECTED && ctx->keepalive_ms > 0 &&
+            (peer->peer_features & RAW_FEAT_KEEPALIVE) && check_liveness(ctx, peer, now)) {
+            continue;
+        }
+        if (peer->reliable) {
+            service_window(ctx, peer);
+        }
+    }
+    
+    update_timer(ctx);
+}
+
+// Send the cumulative/selective ACK if the receive state changed
+static void flush_ack(raw_comm_ctx_t *ctx, raw_peer_t *peer) {
+    if (peer->ka_reply) {
+        peer->ka_reply = false;
+        send_keepalive(ctx, peer, RAW_KEEPALIVE_REPLY, 0);
+    }
+    if (!peer->reliable || !peer->window->ack_pending) return;
+    
+    raw_sack_t ack;
+    uint8_t msg_buf[64];
+    raw_window_build_ack(peer->window, &ack);
+    
+    int msg_len = build_message(ctx, peer, RAW_MSG_DATA_ACK, (uint8_t *)&ack, sizeof(ack),
+                                 msg_buf, sizeof(msg_buf));
     if (msg_len > 0) {
-        sysfs_send_message(ctx, msg_buf, msg_len);
+        queue_message(ctx, peer, msg_buf, msg_len);
+    }
+}
+
+static void flush_acks(raw_comm_ctx_t *ctx) {
+    for (int i = 0; i < RAW_PEER_MAX; i++) {
+        flush_ack(ctx, &ctx->peers->peers[i]);
     }
+}
+
+// Present the peer's ticket along with our receive state
+static void send_resume(raw_comm_ctx_t *ctx, raw_peer_t *peer, uint8_t msg_type) {
+    raw_resume_t resume;
+    raw_sack_t ack = { .cum_ack = peer->seq_rx, .window = 0, .sack = 0 };
+    uint8_t msg_buf[64];
     
-    return 0;
+    if (peer->window) {
+        raw_window_build_ack(peer->window, &ack);
+    }
+    resume.ticket = peer->ticket_peer;
+    resume.ack = ack;
+    
+    int msg_len = build_message(ctx, peer, msg_type, (uint8_t *)&resume, sizeof(resume),
+                                 msg_buf, sizeof(msg_buf));
+    if (msg_len > 0) {
+        transport_send(ctx, msg_buf, msg_len);
+    }
 }
 
-// Send data to connected peer
-int raw_comm_send(raw_comm_ctx_t *ctx, const uint8_t *data, size_t len) {
+// Try to resume every suspended session, at most every
+// RAW_RESUME_INTERVAL_MS unless forced, and give up on sessions suspended
+// for too long
+static void resume_sessions(raw_comm_ctx_t *ctx, bool force) {
+    int64_t now = now_ms();
+    bool expired = false;
+    
+    if (!force && now - ctx->resume_ms < RAW_RESUME_INTERVAL_MS / 2) return;
+    ctx->resume_ms = now;
+    
+    for (int i = 0; i < RAW_PEER_MAX; i++) {
+        raw_peer_t *peer = &ctx->peers->peers[i];
+        if (peer->suspended_ms == 0) continue;
+        
+        if (now - peer->suspended_ms >= RAW_RESUME_TIMEOUT_MS) {
+            USB_LOG_INFO("Suspended session with peer 0x%08x expired\n", peer->id);
+            peer->suspended_ms = 0;
+            remove_peer(ctx, peer);
+            expired = true;
+            continue;
+        }
+        send_resume(ctx, peer, RAW_MSG_RESUME);
+    }
+    
+    if (expired) {
+        update_timer(ctx);
+    }
+}
+
+// The peer presented a valid ticket: carry on where the link was lost.
+// Frames the peer is missing go out again straight away.
+static void resume_peer(raw_comm_ctx_t *ctx, raw_peer_t *peer, const raw_resume_t *resume) {
+    bool was_suspended = peer->suspended_ms != 0;
+    
+    peer->suspended_ms = 0;
+    peer->state = RAW_STATE_CONNECTED;
+    ctx->state = RAW_STATE_CONNECTED;
+    reset_liveness(peer);
+    if (!tx_target(ctx, 0)) {
+        ctx->peer_id = peer->id;
+    }
+    
+    peer->reliable = peer->window != NULL;
+    if (peer->reliable) {
+        raw_sack_t ack = resume->ack;
+        raw_window_resume(peer->window, &ack, now_us());
+    }
+    if (was_suspended) {
+        USB_LOG_INFO("\n*** RESUMED session with peer 0x%08x (%d frames to resend) ***\n\n",
+                     peer->id, peer->reliable ? raw_window_in_flight(peer->window) : 0);
+    } else {
+        USB_LOG_DEBUG("Peer 0x%08x resumed its side of the session\n", peer->id);
+    }
+    if (peer->reliable) {
+        service_window(ctx, peer);
+    }
+    update_timer(ctx);
+    
+    if (was_suspended && ctx->on_connected) {
+        ctx->on_connected(ctx->callback_ctx);
+    }
+}
+
+// Reliable peer with an in-order frame ready, round-robin from rx_next_peer
+static raw_peer_t *ready_peer(raw_comm_ctx_t *ctx) {
+    for (int n = 0; n < RAW_PEER_MAX; n++) {
+        raw_peer_t *peer = &ctx->peers->peers[(ctx->rx_next_peer + n) % RAW_PEER_MAX];
+        if (peer->reliable && raw_window_peek(peer->window)) {
+            return peer;
+        }
+    }
+    return NULL;
+}
+
+// True if data from some connected peer is delivered straight from rx_buffer
+static bool has_unreliable(raw_comm_ctx_t *ctx) {
+    for (int i = 0; i < RAW_PEER_MAX; i++) {
+        raw_peer_t *peer = &ctx->peers->peers[i];
+        if (peer->state == RAW_STATE_CONNECTED && !peer->reliable) return true;
+    }
+    return false;
+}
+
+// Start listening for peer connections
+int raw_comm_listen(raw_comm_ctx_t *ctx) {
+    USB_LOG_INFO("\n=== Starting raw communication listener ===\n");
+    USB_LOG_INFO("Local ID: 0x%08x\n", ctx->local_id);
+    USB_LOG_INFO("Method: %d\n", ctx->method);
+    
+    ctx->listening = true;
     if (ctx->state != RAW_STATE_CONNECTED) {
-        fprintf(stderr, "Cannot send: not connected\n");
+        ctx->state = RAW_STATE_DETECTING;
+    }
+    
+    // Check if Type-C cable is connected
+    if (ctx->typec_port_path[0]) {
+        if (ctx->typec.partner) {
+            USB_LOG_INFO("Type-C cable detected (partner present)\n");
+        } else {
+            USB_LOG_INFO("Waiting for Type-C cable connection...\n");
+        }
+    }
+    
+    // Send discovery broadcast, then repeat it from the timer
+    USB_LOG_INFO("Broadcasting discovery message...\n");
+    send_discovery(ctx);
+    update_timer(ctx);
+    
+    return 0;
+}
+
+// Connect to a specific peer
+int raw_comm_connect(raw_comm_ctx_t *ctx, uint32_t peer_id) {
+    USB_LOG_INFO("Attempting to connect to peer 0x%08x\n", peer_id);
+    
+    raw_peer_t *peer = add_peer(ctx, peer_id);
+    if (!peer) {
         return -1;
     }
+    if (peer->state == RAW_STATE_CONNECTED) {
+        return 0;
+    }
     
-    uint8_t msg_buf[1024];
-    int msg_len = build_message(ctx, RAW_MSG_DATA, data, len, 
-                                 msg_buf, sizeof(msg_buf));
+    peer->state = RAW_STATE_HANDSHAKING;
+    if (ctx->state != RAW_STATE_CONNECTED) {
+        ctx->state = RAW_STATE_HANDSHAKING;
+    }
+    
+    // Send handshake
+    uint8_t msg_buf[sizeof(raw_msg_header_t) + RAW_CAPS_MAX];
+    uint8_t caps[RAW_CAPS_MAX];
+    int caps_len = format_caps(ctx, peer, caps, sizeof(caps));
+    
+    int msg_len = caps_len < 0 ? -1 :
+                  build_message(ctx, peer, RAW_MSG_HANDSHAKE, caps, (size_t)caps_len,
+                                msg_buf, sizeof(msg_buf));
     
     if (msg_len > 0) {
-        return sysfs_send_message(ctx, msg_buf, msg_len);
+        transport_send(ctx, msg_buf, msg_len);
     }
     
-    return -1;
+    return 0;
 }
 
-// Receive data from connected peer
-int raw_comm_recv(raw_comm_ctx_t *ctx, uint8_t *buffer, size_t max_len) {
-    uint8_t msg_buf[1024];
+// Reliable mode: process ACKs and retransmissions until a slot to the
+// peer frees up
+static int wait_for_window(raw_comm_ctx_t *ctx, raw_peer_t *peer) {
+    int64_t deadline = now_ms() + RAW_SEND_TIMEOUT_MS;
+    uint32_t id = peer->id;
+    
+    // Frames still sitting in the batch cannot be acknowledged
+    if (!raw_window_can_send(peer->window)) {
+        flush_batch(ctx);
+    }
+    
+    while (!raw_window_can_send(peer->window)) {
+        int wait_ms = (int)(deadline - now_ms());
+        if (wait_ms <= 0) {
+            USB_LOG_WARN_RATELIMIT("Cannot send: window stalled\n");
+            return -1;
+        }
+        if (run_events(ctx, wait_ms, peer) < 0 || peer->id != id || !peer->reliable) {
+            return -1;
+        }
+    }
+    
+    return 0;
+}
+
+// Hand out a transmit frame in the context's own memory: the peer's next
+// retransmission slot, or the heap transmit buffer ctx->tx_buffer
+int raw_comm_alloc_frame_to(raw_comm_ctx_t *ctx, uint32_t peer_id, usb_frame_t *frame) {
+    raw_peer_t *peer = tx_target(ctx, peer_id);
+    if (!peer) {
+        USB_LOG_WARN_RATELIMIT("Cannot send: not connected\n");
+        return -1;
+    }
+    
+    if (ctx->tx_borrowed) {
+        USB_LOG_ERROR("Transmit frame already allocated\n");
+        return -1;
+    }
+    
+    if (peer->reliable) {
+        if (wait_for_window(ctx, peer) < 0) return -1;
+        
+        // Built straight into the retransmission slot
+        raw_tx_slot_t *slot = raw_window_tx_slot(peer->window);
+        usb_frame_init(frame, slot->msg, peer->link_mtu, RAW_FRAME_HEADROOM);
+        frame->slot = raw_window_index(peer->window, peer->window->snd_nxt);
+    } else {
+        usb_frame_init(frame, ctx->tx_buffer, peer->link_mtu, RAW_FRAME_HEADROOM);
+    }
+    
+    ctx->tx_borrowed = true;
+    ctx->tx_peer = peer;
+    return 0;
+}
+
+int raw_comm_alloc_frame(raw_comm_ctx_t *ctx, usb_frame_t *frame) {
+    return raw_comm_alloc_frame_to(ctx, 0, frame);
+}
+
+static bool is_tx_frame(raw_comm_ctx_t *ctx, const usb_frame_t *frame) {
+    raw_peer_t *peer = ctx->tx_peer;
+    return frame->base == ctx->tx_buffer ||
+           (peer && peer->window && frame->base == raw_window_tx_slot(peer->window)->msg);
+}
+
+// Compress a data payload into comp_buffer, behind room for the header.
+// Returns the message to send instead, or NULL to send the payload as it
+// is. A payload that does not shrink enough starts a bypass, doubled each
+// time in a row, so incompressible flows cost next to nothing.
+static uint8_t *compress_payload(raw_comm_ctx_t *ctx, raw_peer_t *peer, const uint8_t *data,
+                                 size_t *len) {
+    if (peer->codec == USB_CODEC_NONE || *len < RAW_COMP_MIN_BYTES) return NULL;
+    
+    if (peer->comp_skip > 0) {
+        peer->comp_skip--;
+        return NULL;
+    }
+    
+    uint8_t *out = ctx->comp_buffer + RAW_FRAME_HEADROOM;
+    size_t packed = usb_compress(peer->codec, data, *len, out, *len - *len / 16);
+    if (packed == 0) {
+        peer->comp_backoff = peer->comp_backoff == 0 ? 1 :
+                             peer->comp_backoff < RAW_COMP_BYPASS_MAX ? peer->comp_backoff * 2 :
+                             RAW_COMP_BYPASS_MAX;
+        peer->comp_skip = peer->comp_backoff;
+        return NULL;
+    }
+    
+    usb_stat_add(&ctx->stats->tx_compressed, 1);
+    usb_stat_add(&ctx->stats->tx_comp_saved, *len - packed);
+    peer->comp_backoff = 0;
+    peer->comp_pending = true;
+    *len = packed;
+    return ctx->comp_buffer;
+}
+
+// Send a frame, writing the header into its headroom
+int raw_comm_send_frame(raw_comm_ctx_t *ctx, usb_frame_t *frame) {
+    raw_peer_t *peer;
+    
+    if (ctx->tx_borrowed && is_tx_frame(ctx, frame)) {
+        ctx->tx_borrowed = false;
+        peer = ctx->tx_peer;
+        reap_peer(ctx, peer);
+    } else {
+        peer = tx_target(ctx, 0);
+    }
+    
+    if (!peer || peer->state != RAW_STATE_CONNECTED) {
+        USB_LOG_WARN_RATELIMIT("Cannot send: not connected\n");
+        return -1;
+    }
+    
+    if (frame->headroom < RAW_FRAME_HEADROOM || frame->len > peer->link_mtu - RAW_FRAME_HEADROOM ||
+        frame->len > usb_frame_room(frame) || frame->channel >= RAW_CHANNELS) {
+        USB_LOG_ERROR("Invalid frame (headroom %zu, %zu bytes, channel %u)\n", frame->headroom,
+                      frame->len, frame->channel);
+        return -1;
+    }
+    
+    uint8_t *msg = frame->data - RAW_FRAME_HEADROOM;
+    
+    // Caller-owned buffer: keep a copy for retransmission, once there is room
+    bool copy = peer->reliable && msg != raw_window_tx_slot(peer->window)->msg;
+    if (copy && wait_for_window(ctx, peer) < 0) {
+        return -1;
+    }
+    
+    peer->tx_frames++;
+    peer->tx_bytes += frame->len;
+    peer->last_tx_ms = now_ms();
+    
+    size_t payload_len = frame->len;
+    uint8_t *packed = compress_payload(ctx, peer, frame->data, &payload_len);
+    if (packed) {
+        msg = packed;
+        copy = peer->reliable;
+    }
+    size_t msg_len = RAW_FRAME_HEADROOM + payload_len;
+    write_header(ctx, peer, RAW_MSG_DATA, frame->channel, msg, payload_len);
+    
+    if (peer->reliable) {
+        raw_window_t *win = peer->window;
+        raw_tx_slot_t *slot = raw_window_tx_slot(win);
+        
+        if (copy) {
+            memcpy(slot->msg, msg, msg_len);
+        }
+        raw_window_tx_commit(win, msg_len, now_us());
+        arm_timer(ctx, RAW_ARQ_TICK_MS);
+        
+        // A transport failure here is repaired by retransmission
+        queue_message(ctx, peer, slot->msg, msg_len);
+        return (int)frame->len;
+    }
+    
+    if (queue_message(ctx, peer, msg, msg_len) < 0) {
+        return -1;
+    }
+    
+    return (int)frame->len;
+}
+
+// Send data to a connected peer on a logical channel
+int raw_comm_send_channel(raw_comm_ctx_t *ctx, uint32_t peer_id, uint8_t channel,
+                          const uint8_t *data, size_t len) {
+    raw_peer_t *peer = tx_target(ctx, peer_id);
+    usb_frame_t frame;
+    
+    if (channel >= RAW_CHANNELS) {
+        USB_LOG_ERROR("Cannot send: no channel %u\n", channel);
+        return -1;
+    }
+    
+    if (peer && len > peer->link_mtu - RAW_FRAME_HEADROOM) {
+        USB_LOG_ERROR("Cannot send: %zu bytes exceeds %zu byte payload limit\n",
+                      len, peer->link_mtu - RAW_FRAME_HEADROOM);
+        return -1;
+    }
+    
+    if (raw_comm_alloc_frame_to(ctx, peer_id, &frame) < 0) {
+        return -1;
+    }
+    
+    if (len > 0) {
+        memcpy(frame.data, data, len);
+    }
+    frame.len = len;
+    frame.channel = channel;
+    
+    return raw_comm_send_frame(ctx, &frame);
+}
+
+// Send data to a connected peer
+int raw_comm_send_to(raw_comm_ctx_t *ctx, uint32_t peer_id, const uint8_t *data, size_t len) {
+    return raw_comm_send_channel(ctx, peer_id, RAW_CHANNEL_DEFAULT, data, len);
+}
+
+// Send data to the primary peer
+int raw_comm_send(raw_comm_ctx_t *ctx, const uint8_t *data, size_t len) {
+    return raw_comm_send_to(ctx, 0, data, len);
+}
+
+// Receive and dispatch one message into rx_buffer. *consumed is set when a
+// message was taken off the transport, so callers can tell "nothing
+// pending" apart from "control message handled". A data frame from an
+// unreliable peer is lent out through *view (if given) and 1 is returned.
+static int recv_one(raw_comm_ctx_t *ctx, usb_frame_t *view, bool *consumed) {
     uint32_t from_id;
     
-    int n = sysfs_recv_message(ctx, msg_buf, sizeof(msg_buf), &from_id);
-    if (n <= 0) return n;
+    *consumed = false;
     
+    // A transport message may hold several protocol messages back to back;
+    // they are validated a batch at a time ahead of dispatch
+    if (ctx->rx_frame_next >= ctx->rx_frame_count && ctx->rx_parse_error == 0) {
+        if (ctx->rx_off >= ctx->rx_len) {
+            // rx_buffer is still lent out to the caller
+            if (ctx->rx_borrowed && ctx->rx_in_place) return 0;
+            
+            int n = transport_recv(ctx, ctx->rx_buffer, ctx->mtu, &from_id);
+            if (n <= 0) return n;
+            
+            ctx->rx_len = (size_t)n;
+            ctx->rx_off = 0;
+        }
+        
+        ctx->rx_frame_count = raw_parse_batch(ctx->rx_buffer, ctx->rx_len, ctx->rx_off,
+                                              ctx->rx_frames, RAW_PARSE_BATCH,
+                                              &ctx->rx_off, &ctx->rx_parse_error);
+        ctx->rx_frame_next = 0;
+    }
+    
+    *consumed = true;
+    
+    if (ctx->rx_frame_next >= ctx->rx_frame_count) {
+        static const size_t rejects[] = {
+            offsetof(usb_stats_t, rx_short),
+            offsetof(usb_stats_t, rx_bad_magic),
+            offsetof(usb_stats_t, rx_bad_version),
+            offsetof(usb_stats_t, rx_bad_length),
+            offsetof(usb_stats_t, rx_bad_checksum),
+        };
+        int error = ctx->rx_parse_error;
+        usb_stat_add((usb_stat_t *)((char *)ctx->stats + rejects[-error - 1]), 1);
+        
+        // The rest of the transport message cannot be delimited
+        ctx->rx_off = ctx->rx_len;
+        ctx->rx_parse_error = 0;
+        USB_LOG_WARN_RATELIMIT("Failed to parse message: %d\n", error);
+        return -1;
+    }
+    
+    const raw_frame_ref_t *ref = &ctx->rx_frames[ctx->rx_frame_next++];
+    uint8_t *msg = ctx->rx_buffer + ref->offset;
+    int payload_len = (int)ref->length;
     raw_msg_header_t hdr;
-    uint8_t payload[1024];
+    memcpy(&hdr, msg, sizeof(hdr));
     
-    int payload_len = parse_message(msg_buf, n, &hdr, payload, sizeof(payload));
-    if (payload_len < 0) {
-        fprintf(stderr, "Failed to parse message: %d\n", payload_len);
+    // Shared media (hubs, daisy chains) carry traffic for other nodes too
+    if (hdr.dst_id != 0 && hdr.dst_id != ctx->local_id) {
+        usb_stat_add(&ctx->stats->rx_foreign, 1);
+        return 0;
+    }
+    if (hdr.src_id == 0 || hdr.src_id == ctx->local_id) {
+        return 0;
+    }
+    
+    const uint8_t *payload = msg + sizeof(raw_msg_header_t);
+    raw_peer_t *peer = raw_peer_find(ctx->peers, hdr.src_id);
+    bool connected = peer && peer->state == RAW_STATE_CONNECTED;
+    
+    // Unchecked frames only from a peer that agreed to them
+    raw_csum_t csum = (raw_csum_t)(hdr.flags & RAW_FLAG_CSUM_MASK);
+    if (csum != RAW_CSUM_CRC32C &&
+        (csum != RAW_CSUM_NONE || !connected || peer->csum != RAW_CSUM_NONE)) {
+        usb_stat_add(&ctx->stats->rx_unchecked, 1);
+        USB_LOG_WARN_RATELIMIT("Failed to parse message: %d\n", -6);
         return -1;
     }
     
-    printf("  Received message type %d from 0x%08x, payload %d bytes\n",
-           hdr.msg_type, hdr.src_id, payload_len);
+    if (peer) {
+        peer->last_rx_ms = now_ms();
+    }
     
-    // Handle message based on type and state
+    // Piggybacked keepalive request: any ACK answers it on reliable links
+    if (connected && (hdr.flags & RAW_FLAG_KEEPALIVE)) {
+        if (peer->reliable) {
+            peer->window->ack_pending = true;
+        } else {
+            peer->ka_reply = true;
+        }
+    }
+    
+    USB_LOG_TRACE("  Received message type %d from 0x%08x, payload %d bytes\n",
+                  hdr.msg_type, hdr.src_id, payload_len);
+    
+    // Handle message based on type and the sender's state
     switch (hdr.msg_type) {
         case RAW_MSG_DISCOVERY:
-            printf("  -> Discovery from peer 0x%08x\n", hdr.src_id);
-            if (ctx->state == RAW_STATE_DETECTING) {
+            USB_LOG_DEBUG("  -> Discovery from peer 0x%08x\n", hdr.src_id);
+            if (peer && peer->suspended_ms != 0) {
+                // The peer is back: resume instead of starting over
+                send_resume(ctx, peer, RAW_MSG_RESUME);
+            } else if (ctx->listening && (!peer || peer->state == RAW_STATE_DETECTING) &&
+                (peer || (peer = add_peer(ctx, hdr.src_id)))) {
                 // Respond to discovery
-                ctx->peer_id = hdr.src_id;
+                peer->state = RAW_STATE_DETECTING;
                 
-                uint8_t ack_buf[256];
-                char ack_payload[64];
-                snprintf(ack_payload, sizeof(ack_payload), "ACK:%08x", ctx->local_id);
-                
-                int ack_len = build_message(ctx, RAW_MSG_DISCOVERY_ACK,
-                                            (uint8_t *)ack_payload, strlen(ack_payload) + 1,
+                uint8_t ack_buf[64];
+                int ack_len = build_message(ctx, peer, RAW_MSG_DISCOVERY_ACK, NULL, 0,
                                             ack_buf, sizeof(ack_buf));
                 if (ack_len > 0) {
-                    sysfs_send_message(ctx, ack_buf, ack_len);
+                    transport_send(ctx, ack_buf, ack_len);
                 }
             }
             break;
             
         case RAW_MSG_DISCOVERY_ACK:
-            printf("  -> Discovery ACK from peer 0x%08x\n", hdr.src_id);
-            if (ctx->state == RAW_STATE_DETECTING) {
-                ctx->peer_id = hdr.src_id;
-                ctx->state = RAW_STATE_HANDSHAKING;
+            USB_LOG_DEBUG("  -> Discovery ACK from peer 0x%08x\n", hdr.src_id);
+            if (peer && peer->suspended_ms != 0) {
+                send_resume(ctx, peer, RAW_MSG_RESUME);
+            } else if (ctx->listening && (!peer || peer->state == RAW_STATE_DETECTING)) {
                 raw_comm_connect(ctx, hdr.src_id);
             }
             break;
             
         case RAW_MSG_HANDSHAKE:
-            printf("  -> Handshake from peer 0x%08x\n", hdr.src_id);
-            if (ctx->state == RAW_STATE_DETECTING || ctx->state == RAW_STATE_HANDSHAKING) {
-                ctx->peer_id = hdr.src_id;
+            USB_LOG_DEBUG("  -> Handshake from peer 0x%08x\n", hdr.src_id);
+            if (((peer && peer->state == RAW_STATE_HANDSHAKING) || (ctx->listening && !connected)) &&
+                (peer || (peer = add_peer(ctx, hdr.src_id)))) {
+                apply_caps(peer, payload, payload_len);
                 
                 // Send handshake ack
-                uint8_t ack_buf[256];
-                char ack_payload[64];
-                snprintf(ack_payload, sizeof(ack_payload), "HSHAKE_ACK:%08x", ctx->local_id);
+                uint8_t ack_buf[sizeof(raw_msg_header_t) + RAW_CAPS_MAX];
+                uint8_t caps[RAW_CAPS_MAX];
+                int caps_len = format_caps(ctx, peer, caps, sizeof(caps));
                 
-                int ack_len = build_message(ctx, RAW_MSG_HANDSHAKE_ACK,
-                                            (uint8_t *)ack_payload, strlen(ack_payload) + 1,
+                int ack_len = caps_len < 0 ? -1 :
+                              build_message(ctx, peer, RAW_MSG_HANDSHAKE_ACK, caps, (size_t)caps_len,
                                             ack_buf, sizeof(ack_buf));
                 if (ack_len > 0) {
-                    sysfs_send_message(ctx, ack_buf, ack_len);
+                    transport_send(ctx, ack_buf, ack_len);
                 }
                 
-                ctx->state = RAW_STATE_CONNECTED;
-                printf("\n*** CONNECTED to peer 0x%08x ***\n\n", ctx->peer_id);
-                
-                if (ctx->on_connected) {
-                    ctx->on_connected(ctx->callback_ctx);
-                }
+                enter_connected(ctx, peer);
             }
             break;
             
         case RAW_MSG_HANDSHAKE_ACK:
-            printf("  -> Handshake ACK from peer 0x%08x\n", hdr.src_id);
-            if (ctx->state == RAW_STATE_HANDSHAKING) {
-                ctx->state = RAW_STATE_CONNECTED;
-                printf("\n*** CONNECTED to peer 0x%08x ***\n\n", ctx->peer_id);
-                
-                if (ctx->on_connected) {
-                    ctx->on_connected(ctx->callback_ctx);
+            USB_LOG_DEBUG("  -> Handshake ACK from peer 0x%08x\n", hdr.src_id);
+            if (peer && peer->state == RAW_STATE_HANDSHAKING) {
+                apply_caps(peer, payload, payload_len);
+                enter_connected(ctx, peer);
+            }
+            break;
+            
+        case RAW_MSG_RESUME:
+        case RAW_MSG_RESUME_ACK: {
+            USB_LOG_DEBUG("  -> Resume%s from peer 0x%08x\n",
+                          hdr.msg_type == RAW_MSG_RESUME_ACK ? " ACK" : "", hdr.src_id);
+            raw_resume_t resume;
+            bool valid = false;
+            if (peer && payload_len >= (int)sizeof(resume) && (connected || peer->suspended_ms != 0)) {
+                memcpy(&resume, payload, sizeof(resume));
+                valid = peer->ticket_local != 0 && resume.ticket == peer->ticket_local;
+            }
+            
+            if (valid && hdr.msg_type == RAW_MSG_RESUME) {
+                // Also when still connected: the link went down on the peer's side only
+                send_resume(ctx, peer, RAW_MSG_RESUME_ACK);
+                resume_peer(ctx, peer, &resume);
+            } else if (valid && peer->suspended_ms != 0) {
+                resume_peer(ctx, peer, &resume);
+            } else if (!valid && hdr.msg_type == RAW_MSG_RESUME && !connected) {
+                // Nothing to resume here: tell the peer to start over
+                raw_peer_t stranger;
+                memset(&stranger, 0, sizeof(stranger));
+                stranger.id = hdr.src_id;
+                uint8_t msg_buf[64];
+                int msg_len = build_message(ctx, &stranger, RAW_MSG_DISCONNECT, NULL, 0,
+                                             msg_buf, sizeof(msg_buf));
+                if (msg_len > 0) {
+                    transport_send(ctx, msg_buf, msg_len);
                 }
             }
             break;
+        }
             
-        case RAW_MSG_DATA:
-            if (ctx->state == RAW_STATE_CONNECTED && payload_len > 0) {
-                size_t copy_len = (payload_len < (int)max_len) ? payload_len : max_len;
-                memcpy(buffer, payload, copy_len);
+        case RAW_MSG_DATA: {
+            // Decompressed only if somebody takes it: unreliable frames
+            // nobody reads are dropped below anyway
+            usb_codec_t codec = (usb_codec_t)((hdr.flags & RAW_FLAG_CODEC_MASK) >> RAW_FLAG_CODEC_SHIFT);
+            uint8_t channel = (uint8_t)((hdr.flags & RAW_FLAG_CHANNEL_MASK) >> RAW_FLAG_CHANNEL_SHIFT);
+            if (connected && codec != USB_CODEC_NONE && (peer->reliable || view)) {
+                uint8_t *out = peer->reliable ? ctx->comp_buffer : ctx->rx_comp_buffer;
+                payload_len = usb_decompress(codec, payload, (size_t)payload_len, out,
+                                             peer->link_mtu - RAW_FRAME_HEADROOM);
+                if (payload_len < 0) {
+                    usb_stat_add(&ctx->stats->rx_bad_compressed, 1);
+                    USB_LOG_WARN_RATELIMIT("Failed to decompress %s payload from 0x%08x\n",
+                                           usb_codec_name(codec), hdr.src_id);
+                    return -1;
+                }
+                payload = out;
+            }
+            
+            if (connected) {
+                peer->rx_frames++;
+                peer->rx_bytes += (unsigned long)payload_len;
+            }
+            if (connected && peer->reliable) {
+                // Held in the window and handed out in order by raw_comm_recv_frame()
+                if (raw_window_on_data(peer->window, hdr.seq, channel, payload, payload_len) == 0) {
+                    usb_stat_add(&ctx->stats->rx_duplicates, 1);
+                }
+                peer->seq_rx = peer->window->rcv_next;
+            } else if (connected && payload_len > 0) {
+                peer->seq_rx = hdr.seq + 1;
                 
-                if (ctx->on_data) {
-                    ctx->on_data(ctx->callback_ctx, payload, payload_len);
+                if (view) {
+                    if (payload == ctx->rx_comp_buffer) {
+                        usb_frame_init(view, ctx->rx_comp_buffer, ctx->mtu, 0);
+                    } else {
+                        usb_frame_init(view, msg, sizeof(raw_msg_header_t) + payload_len,
+                                       RAW_FRAME_HEADROOM);
+                    }
+                    view->len = (size_t)payload_len;
+                    view->channel = channel;
+                    ctx->rx_borrowed = true;
+                    ctx->rx_in_place = true;
+                    ctx->rx_peer = peer;
+                    return 1;
+                }
+            }
+            break;
+        }
+            
+        case RAW_MSG_DATA_ACK:
+            if (connected && peer->reliable && payload_len >= (int)sizeof(raw_sack_t)) {
+                raw_sack_t ack;
+                memcpy(&ack, payload, sizeof(ack));
+                unsigned long samples = peer->window->rtt_samples;
+                raw_window_on_ack(peer->window, &ack, now_us());
+                if (peer->window->rtt_samples != samples) {
+                    usb_stats_hist_add(&ctx->stats->latency, (uint64_t)peer->window->last_rtt_us);
                 }
                 
-                return (int)copy_len;
+                // SACK holes may call for a fast retransmit
+                service_window(ctx, peer);
+                update_timer(ctx);
             }
             break;
             
-        case RAW_MSG_DISCONNECT:
-            printf("  -> Disconnect from peer 0x%08x\n", hdr.src_id);
-            ctx->state = RAW_STATE_DISCONNECTED;
-            ctx->peer_id = 0;
+        case RAW_MSG_KEEPALIVE:
+            if (connected && payload_len >= (int)sizeof(raw_keepalive_t)) {
+                raw_keepalive_t ka;
+                memcpy(&ka, payload, sizeof(ka));
+                if (ka.flags & RAW_KEEPALIVE_REQUEST) {
+                    send_keepalive(ctx, peer, RAW_KEEPALIVE_REPLY, ka.stamp_us);
+                }
+                if ((ka.flags & RAW_KEEPALIVE_REPLY) && ka.stamp_us != 0) {
+                    keepalive_rtt(peer, now_us() - (int64_t)ka.stamp_us);
+                }
+            } else if (connected && peer->reliable) {
+                // Zero-window probe: answer with the current window
+                peer->window->ack_pending = true;
+            }
+            break;
             
-            if (ctx->on_disconnected) {
-                ctx->on_disconnected(ctx->callback_ctx);
+        case RAW_MSG_DISCONNECT:
+            USB_LOG_DEBUG("  -> Disconnect from peer 0x%08x\n", hdr.src_id);
+            if (peer) {
+                drop_peer(ctx, peer, false);
             }
             break;
     }
@@ -513,43 +1790,249 @@ int raw_comm_recv(raw_comm_ctx_t *ctx, uint8_t *buffer, size_t max_len) {
     return 0;
 }
 
-// Poll for events
-int raw_comm_poll(raw_comm_ctx_t *ctx, int timeout_ms) {
-    // Simple polling implementation
-    int elapsed = 0;
-    int interval = 100;  // 100ms poll interval
+// Borrow the next received data frame from any peer
+int raw_comm_recv_frame_from(raw_comm_ctx_t *ctx, usb_frame_t *view, uint32_t *peer_id) {
+    int err = 0;
+    
+    if (ctx->rx_borrowed) {
+        USB_LOG_ERROR("Previous receive frame not released\n");
+        return -1;
+    }
+    
+    // Pull messages off the transport until a frame is ready: unreliable
+    // peers' frames are lent out of rx_buffer by recv_one(), reliable
+    // peers' frames wait in order in their windows
+    raw_peer_t *peer = ready_peer(ctx);
+    for (int i = 0; i < RAW_POLL_BUDGET && !peer && !ctx->rx_borrowed; i++) {
+        bool consumed;
+        int ret = recv_one(ctx, view, &consumed);
+        if (!consumed) {
+            err = ret;
+            break;
+        }
+        peer = ready_peer(ctx);
+    }
+    
+    flush_acks(ctx);
     
-    while (elapsed < timeout_ms) {
-        uint8_t buf[1024];
-        int n = raw_comm_recv(ctx, buf, sizeof(buf));
+    if (!ctx->rx_borrowed) {
+        if (!peer) return err;
+        
+        // View straight into the reorder slot
+        const raw_rx_slot_t *slot = raw_window_peek(peer->window);
+        usb_frame_init(view, slot->data, peer->window->msg_size - RAW_FRAME_HEADROOM, 0);
+        view->len = slot->len;
+        view->slot = raw_window_index(peer->window, peer->window->rcv_read);
+        view->channel = slot->channel;
+        ctx->rx_borrowed = true;
+        ctx->rx_in_place = false;
+        ctx->rx_peer = peer;
+        
+        // Next call starts with the following peer
+        ctx->rx_next_peer = (int)(peer - ctx->peers->peers + 1) % RAW_PEER_MAX;
+    }
+    
+    if (peer_id) {
+        *peer_id = ctx->rx_peer->id;
+    }
+    
+    if (ctx->on_data) {
+        ctx->on_data(ctx->callback_ctx, view->data, view->len);
+    }
+    
+    return 1;
+}
+
+int raw_comm_recv_frame(raw_comm_ctx_t *ctx, usb_frame_t *view) {
+    return raw_comm_recv_frame_from(ctx, view, NULL);
+}
+
+// Return a borrowed frame
+void raw_comm_release_frame(raw_comm_ctx_t *ctx, usb_frame_t *frame) {
+    if (ctx->tx_borrowed && is_tx_frame(ctx, frame)) {
+        ctx->tx_borrowed = false;
+        reap_peer(ctx, ctx->tx_peer);
+    } else if (ctx->rx_borrowed) {
+        raw_peer_t *peer = ctx->rx_peer;
+        ctx->rx_borrowed = false;
+        ctx->rx_in_place = false;
         
-        if (n > 0) {
-            return n;  // Got data
+        // Reliable views free a window slot, which may reopen the window
+        if (frame->slot >= 0 && peer && peer->reliable) {
+            raw_window_consume(peer->window);
+            flush_ack(ctx, peer);
         }
+        reap_peer(ctx, peer);
+    }
+    
+    frame->base = frame->data = NULL;
+    frame->len = 0;
+    frame->slot = -1;
+}
+
+// Receive data from any connected peer
+int raw_comm_recv_from(raw_comm_ctx_t *ctx, uint8_t *buffer, size_t max_len, uint32_t *peer_id) {
+    usb_frame_t view;
+    
+    int ret = raw_comm_recv_frame_from(ctx, &view, peer_id);
+    if (ret <= 0) return ret;
+    
+    size_t copy_len = (view.len < max_len) ? view.len : max_len;
+    if (copy_len > 0) {
+        memcpy(buffer, view.data, copy_len);
+    }
+    
+    raw_comm_release_frame(ctx, &view);
+    return (int)copy_len;
+}
+
+int raw_comm_recv(raw_comm_ctx_t *ctx, uint8_t *buffer, size_t max_len) {
+    return raw_comm_recv_from(ctx, buffer, max_len, NULL);
+}
+
+// Type-C port monitor fired: act on the partner coming or going
+static void handle_typec_event(raw_comm_ctx_t *ctx) {
+    int changed = usb_typec_process(&ctx->typec);
+    if (!(changed & USB_TYPEC_EV_PARTNER)) return;
+    
+    if (ctx->typec.partner) {
+        USB_LOG_INFO("Type-C partner attached\n");
+        if (ctx->state == RAW_STATE_DETECTING) {
+            send_discovery(ctx);
+        }
+        resume_sessions(ctx, true);
+    } else {
+        USB_LOG_INFO("Type-C partner detached\n");
+        if (ctx->state == RAW_STATE_CONNECTED || ctx->state == RAW_STATE_HANDSHAKING) {
+            // Every peer was reached through this port; connected ones
+            // are suspended until the cable comes back
+            for (int i = 0; i < RAW_PEER_MAX; i++) {
+                raw_peer_t *peer = &ctx->peers->peers[i];
+                if (peer->id != 0 && peer->suspended_ms == 0) {
+                    drop_peer(ctx, peer, true);
+                }
+            }
+            ctx->state = RAW_STATE_DETECTING;
+            update_timer(ctx);
+        }
+    }
+}
+
+// Get the event loop descriptor
+int raw_comm_get_fd(raw_comm_ctx_t *ctx) {
+    return ctx->epoll_fd;
+}
+
+// Event loop core. Sleeps in epoll_wait() until the transport, the
+// protocol timer or a Type-C attribute fires instead of waking every
+// 100ms. Pending messages are processed here unless some connected peer
+// is unreliable, in which case they are left for raw_comm_recv().
+// Returns 1 once data is readable (send_peer: once its send window has
+// room), 0 on timeout or when the link came up, -1 on error.
+static int run_events(raw_comm_ctx_t *ctx, int timeout_ms, raw_peer_t *send_peer) {
+    if (ctx->epoll_fd < 0) return -1;
+    
+    int64_t deadline = now_ms() + timeout_ms;
+    
+    for (;;) {
+        int wait_ms = (int)(deadline - now_ms());
+        if (wait_ms < 0) wait_ms = 0;
         
-        if (ctx->state == RAW_STATE_CONNECTED) {
-            return 0;  // Connected, but no data
+        struct epoll_event events[RAW_POLL_MAX_EVENTS];
+        int n = epoll_wait(ctx->epoll_fd, events, RAW_POLL_MAX_EVENTS, wait_ms);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            USB_LOG_ERROR("epoll_wait: %s\n", strerror(errno));
+            return -1;
         }
+        if (n == 0) return 0;  // Timeout
         
-        usleep(interval * 1000);
-        elapsed += interval;
+        bool readable = false;
+        for (int i = 0; i < n; i++) {
+            uint32_t tag = (uint32_t)(events[i].data.u64 >> 32);
+            int fd = (int)(uint32_t)events[i].data.u64;
+            
+            switch (tag) {
+                case RAW_EV_TIMER: {
+                    uint64_t expirations;
+                    if (read(fd, &expirations, sizeof(expirations)) <= 0) break;
+                    // The timer runs faster while a session is suspended
+                    if (ctx->state == RAW_STATE_DETECTING) {
+                        if (now_ms() - ctx->discovery_ms >=
+                            RAW_DISCOVERY_INTERVAL_MS - RAW_RESUME_INTERVAL_MS / 2) {
+                            send_discovery(ctx);
+                        }
+                    } else if (ctx->state == RAW_STATE_CONNECTED) {
+                        service_windows(ctx);
+                    }
+                    resume_sessions(ctx, false);
+                    break;
+                }
+                case RAW_EV_FLUSH: {
+                    uint64_t expirations;
+                    if (read(fd, &expirations, sizeof(expirations)) > 0) {
+                        flush_batch(ctx);
+                    }
+                    break;
+                }
+                case RAW_EV_TYPEC:
+                    handle_typec_event(ctx);
+                    break;
+                case RAW_EV_TRANSPORT:
+                    readable = !ctx->transport->service || ctx->transport->service(ctx) > 0;
+                    break;
+            }
+        }
         
-        // Periodically re-send discovery if still detecting
-        if (ctx->state == RAW_STATE_DETECTING && (elapsed % 2000) == 0) {
-            uint8_t msg_buf[256];
-            char payload[64];
-            snprintf(payload, sizeof(payload), "DISCOVER:%08x", ctx->local_id);
+        if (send_peer && !send_peer->reliable) {
+            return -1;  // Link dropped while waiting for window space
+        }
+        
+        if (readable) {
+            bool was_connected = (ctx->state == RAW_STATE_CONNECTED);
+            
+            if (!send_peer && was_connected && has_unreliable(ctx)) {
+                return 1;  // Data ready for raw_comm_recv()
+            }
+            
+            // Unreliable data arriving while a send waits for window space
+            // has nobody to take it and is dropped
+            for (int i = 0; i < RAW_POLL_BUDGET; i++) {
+                bool consumed;
+                recv_one(ctx, NULL, &consumed);
+                if (!consumed) break;
+                if (!was_connected && ctx->state == RAW_STATE_CONNECTED) break;
+            }
+            flush_acks(ctx);
             
-            int msg_len = build_message(ctx, RAW_MSG_DISCOVERY,
-                                         (uint8_t *)payload, strlen(payload) + 1,
-                                         msg_buf, sizeof(msg_buf));
-            if (msg_len > 0) {
-                sysfs_send_message(ctx, msg_buf, msg_len);
+            if (!was_connected && ctx->state == RAW_STATE_CONNECTED) {
+                return 0;  // Link came up
             }
         }
+        
+        if (send_peer) {
+            if (!send_peer->reliable) return -1;
+            if (raw_window_can_send(send_peer->window)) return 1;
+        } else if (ready_peer(ctx)) {
+            return 1;
+        }
+        
+        if (now_ms() >= deadline) return 0;
+    }
+}
+
+// Poll for events
+int raw_comm_poll(raw_comm_ctx_t *ctx, int timeout_ms) {
+    if (ready_peer(ctx)) {
+        return 1;  // Frames already reassembled in order
+    }
+    
+    if (ctx->state == RAW_STATE_CONNECTED && has_unreliable(ctx) &&
+        (ctx->rx_frame_next < ctx->rx_frame_count || ctx->rx_off < ctx->rx_len)) {
+        return 1;  // Rest of a batch not read yet
     }
     
-    return 0;  // Timeout
+    return run_events(ctx, timeout_ms, NULL);
 }
 
 // Get connection state
@@ -557,7 +2040,38 @@ raw_conn_state_t raw_comm_get_state(raw_comm_ctx_t *ctx) {
     return ctx->state;
 }
 
-// Get peer ID
+// Get the primary peer's ID
 uint32_t raw_comm_get_peer_id(raw_comm_ctx_t *ctx) {
     return ctx->peer_id;
 }
+
+// List connected peers
+int raw_comm_get_peers(raw_comm_ctx_t *ctx, uint32_t *ids, int max) {
+    int count = 0;
+    
+    for (int i = 0; i < RAW_PEER_MAX; i++) {
+        const raw_peer_t *peer = &ctx->peers->peers[i];
+        if (peer->state != RAW_STATE_CONNECTED) continue;
+        if (count < max) {
+            ids[count] = peer->id;
+        }
+        count++;
+    }
+    return count;
+}
+
+const struct raw_peer *raw_comm_find_peer(raw_comm_ctx_t *ctx, uint32_t peer_id) {
+    return raw_peer_find(ctx->peers, peer_id);
+}
+
+void raw_comm_get_stats(raw_comm_ctx_t *ctx, usb_stats_t *out) {
+    usb_stats_snapshot(ctx->stats, out);
+}
+
+void raw_comm_set_stats(raw_comm_ctx_t *ctx, usb_stats_t *storage) {
+    usb_stats_t *next = storage ? storage : &ctx->stats_local;
+    if (next == ctx->stats) return;
+    
+    usb_stats_snapshot(ctx->stats, next);
+    ctx->stats = next;
+}
@@ -12,6 +12,15 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include "usb_frame.h"
+#include "usb_stats.h"
+#include "usb_typec.h"
+#include "usb_raw_parse.h"
+#include "usb_compress.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
 
 // Communication methods
 typedef enum {
@@ -31,11 +40,69 @@ typedef enum {
     RAW_STATE_ERROR
 } raw_conn_state_t;
 
-// Raw communication context
+struct raw_comm_ctx;
+struct raw_window;
+struct raw_peer;
+struct raw_peer_table;
+struct raw_runtime;
+
+// Transport backend: moves whole protocol messages between the two peers.
+// The protocol layer above is identical for every transport.
 typedef struct {
+    const char *name;
+    int  (*open)(struct raw_comm_ctx *ctx, const char *arg);
+    void (*close)(struct raw_comm_ctx *ctx);
+    int  (*send)(struct raw_comm_ctx *ctx, const uint8_t *msg, size_t len);
+    int  (*recv)(struct raw_comm_ctx *ctx, uint8_t *msg, size_t max_len, uint32_t *from_id);
+    int  (*get_fd)(struct raw_comm_ctx *ctx);  // Readable when recv may succeed
+    // Optional: run by the event loop when get_fd() fires, for transports
+    // that wake themselves up (e.g. paced sending). Returns 1 if recv may
+    // succeed, 0 if the wakeup was the transport's own.
+    int  (*service)(struct raw_comm_ctx *ctx);
+} raw_transport_ops_t;
+
+// Frame checksum algorithm (carried in raw_msg_header_t.flags)
+typedef enum {
+    RAW_CSUM_NONE = 0,      // Transport has its own link-level CRC
+    RAW_CSUM_CRC32C = 1     // CRC32C over header and payload
+} raw_csum_t;
+
+// Message size limits (header + payload). The link MTU is the smaller of
+// the two sides' configured MTUs; RAW_MTU_DEFAULT also applies to a peer
+// that announces none.
+#define RAW_MTU_MIN     256
+#define RAW_MTU_DEFAULT 1024
+#define RAW_MTU_MAX     (64 * 1024)
+
+// Shortest silence after which a connected peer is asked for a keepalive,
+// see raw_comm_set_keepalive()
+#define RAW_KEEPALIVE_MS_DEFAULT 20
+
+// Payload compression, see raw_comm_set_compression(). Payloads below
+// RAW_COMP_MIN_BYTES are sent as they are; one that does not shrink by at
+// least 1/16 turns compression off for the next 1, 2, 4, ... frames, up to
+// RAW_COMP_BYPASS_MAX.
+#define RAW_CODECS_BUILTIN  (USB_CODEC_BIT(USB_CODEC_LZ4))
+#define RAW_COMP_MIN_BYTES  64
+#define RAW_COMP_BYPASS_MAX 64
+
+// Raw communication context
+typedef struct raw_comm_ctx {
     raw_comm_method_t method;
     raw_conn_state_t state;
     
+    // Message transport (shared memory ring, /tmp files, ...)
+    const raw_transport_ops_t *transport;
+    void *transport_priv;
+    
+    // Event loop: epoll set over the transport fd, protocol timer and
+    // Type-C port monitor
+    int epoll_fd;
+    int timer_fd;
+    int timer_ms;                // Current timer period, 0 = disarmed
+    int flush_fd;                // One-shot timer bounding batch latency
+    usb_typec_t typec;           // Open if typec_port_path is set and exists
+    
     // Type-C sysfs paths
     char typec_port_path[256];
     char pd_path[256];
@@ -45,22 +112,76 @@ typedef struct {
     void *xhci_base;
     size_t xhci_size;
     int xhci_fd;
+    char dbc_path[256];          // sysfs dbc attribute, set by raw_comm_detect_method()
+    
+    // Communication buffers (frames are built and parsed in place here),
+    // mtu bytes each
+    uint8_t *tx_buffer;
+    uint8_t *rx_buffer;
+    size_t mtu;                  // Local MTU, set by raw_comm_set_mtu()
+    size_t rx_len;               // Bytes of the transport message in rx_buffer
+    size_t rx_off;               // Next protocol message within it not yet validated
+    raw_frame_ref_t rx_frames[RAW_PARSE_BATCH];  // Validated ahead of dispatch
+    int rx_frame_count;
+    int rx_frame_next;           // Next of rx_frames to dispatch
+    int rx_parse_error;          // RAW_PARSE_* of the message at rx_off, 0 = none
     
-    // Communication buffers
-    uint8_t tx_buffer[1024];
-    uint8_t rx_buffer[1024];
+    // Send aggregation: messages to a connected peer are packed back to
+    // back into one transport message of up to its link MTU. Receivers
+    // always walk a transport message by header length, so only the sender
+    // needs to enable it.
+    uint8_t *batch_buffer;       // mtu bytes
+    size_t batch_len;
+    int batch_count;
+    uint32_t batch_dst;          // Peer the pending batch is addressed to
+    int batch_delay_us;          // Longest a queued message waits, 0 = off
+    size_t batch_bytes;          // Flush threshold, 0 = link MTU
+    unsigned long batches_sent;
+    unsigned long batched_msgs;
+    bool tx_borrowed;            // Frame handed out by raw_comm_alloc_frame()
+    bool rx_borrowed;            // View handed out by raw_comm_recv_frame()
     
-    // Protocol state
+    // Protocol state. Sequence numbers, windows and negotiated options are
+    // kept per peer, see usb_raw_peer.h.
     uint32_t local_id;
-    uint32_t peer_id;
-    uint32_t seq_tx;
-    uint32_t seq_rx;
+    uint32_t peer_id;            // Primary peer, the default destination
+    struct raw_peer_table *peers;
+    bool listening;              // Accept discovery and handshakes from new peers
+    struct raw_peer *tx_peer;    // Destination of the allocated transmit frame
+    struct raw_peer *rx_peer;    // Sender of the lent receive view
+    bool rx_in_place;            // Lent view points into rx_buffer
+    int rx_next_peer;            // Round-robin start for in-order delivery
+    int64_t discovery_ms;        // Last discovery broadcast
+    int64_t resume_ms;           // Last resume attempt for suspended peers
+    int keepalive_ms;            // Liveness check floor, 0 = off
+    
+    // Counters, see usb_stats.h. Updated only by the thread driving the
+    // context; stats points at stats_local unless raw_comm_set_stats()
+    // moved them (e.g. into a shared stats page).
+    usb_stats_t stats_local;
+    usb_stats_t *stats;
+    
+    // Options offered in every handshake, see usb_raw_caps.h
+    int window_size;             // Reliable delivery window, 0 = unreliable
+    
+    // Frame checksum. Control messages always use CRC32C; data frames use
+    // the algorithm agreed in the handshake.
+    raw_csum_t csum_pref;        // Requested by raw_comm_set_checksum()
+    
+    // Payload compression. Data frames to a peer are compressed if either
+    // side asks for a codec the receiver has.
+    uint32_t codecs;             // USB_CODEC_BIT() set asked for, 0 = off
+    uint8_t *comp_buffer;        // Scratch for (de)compressing a frame, mtu bytes
+    uint8_t *rx_comp_buffer;     // Lent decompressed view, mtu bytes
     
     // Callbacks
     void (*on_connected)(void *ctx);
     void (*on_data)(void *ctx, const uint8_t *data, size_t len);
     void (*on_disconnected)(void *ctx);
     void *callback_ctx;
+    
+    // Threaded runtime driving this context, see usb_raw_runtime.h
+    struct raw_runtime *runtime;
 } raw_comm_ctx_t;
 
 // Protocol message types (over CC/PD)
@@ -68,6 +189,8 @@ typedef struct {
 #define RAW_MSG_DISCOVERY_ACK 0x02  // Discovery acknowledgment  
 #define RAW_MSG_HANDSHAKE   0x03  // Handshake initiation
 #define RAW_MSG_HANDSHAKE_ACK 0x04  // Handshake acknowledgment
+#define RAW_MSG_RESUME      0x05  // Resume a suspended session
+#define RAW_MSG_RESUME_ACK  0x06  // Session resumed
 #define RAW_MSG_DATA        0x10  // Data packet
 #define RAW_MSG_DATA_ACK    0x11  // Data acknowledgment
 #define RAW_MSG_KEEPALIVE   0x20  // Keep-alive ping
@@ -78,45 +201,209 @@ typedef struct __attribute__((packed)) {
     uint8_t  magic[4];    // "UCNP" - USB-C Net Protocol
     uint8_t  version;     // Protocol version
     uint8_t  msg_type;    // Message type
-    uint16_t length;      // Payload length
+    uint16_t flags;       // RAW_FLAG_*
+    uint32_t length;      // Payload length
     uint32_t src_id;      // Source identifier
     uint32_t dst_id;      // Destination identifier (0 = broadcast)
     uint32_t seq;         // Sequence number
-    uint16_t checksum;    // Simple checksum
-    uint16_t reserved;
+    uint32_t checksum;    // Over header (checksum = 0) and payload
 } raw_msg_header_t;
 
 #define RAW_MSG_MAGIC "UCNP"
-#define RAW_PROTOCOL_VERSION 1
+#define RAW_PROTOCOL_VERSION 4
+
+#define RAW_FLAG_CSUM_MASK 0x0003  // raw_csum_t of this message
+#define RAW_FLAG_KEEPALIVE 0x0004  // Data frame carrying a keepalive request
+#define RAW_FLAG_CODEC_MASK  0x0018  // usb_codec_t the data payload is compressed with
+#define RAW_FLAG_CODEC_SHIFT 3
+#define RAW_FLAG_CHANNEL_MASK  0x0F00  // Logical channel of a data frame
+#define RAW_FLAG_CHANNEL_SHIFT 8
+
+#define RAW_CHANNELS        16   // Logical channels multiplexed on a connection
+#define RAW_CHANNEL_DEFAULT 0    // Channel of the plain send calls
+
+#define RAW_FRAME_HEADROOM sizeof(raw_msg_header_t)
+
+// RAW_MSG_DATA_ACK payload
+typedef struct __attribute__((packed)) {
+    uint32_t cum_ack;     // Next in-order sequence expected
+    uint32_t window;      // Free receive slots from cum_ack
+    uint64_t sack;        // Bit i: cum_ack + 1 + i has been received
+} raw_sack_t;
+
+// RAW_MSG_KEEPALIVE payload. A peer that has been silent for a while is
+// asked to answer, either by a request of its own or, while data is being
+// sent to it anyway, by RAW_FLAG_KEEPALIVE on the next data frame (the
+// peer answers that with its next ACK, or an empty reply if unreliable).
+// An empty keepalive is a zero-window probe, answered with a DATA_ACK.
+typedef struct __attribute__((packed)) {
+    uint32_t flags;       // RAW_KEEPALIVE_*
+    uint64_t stamp_us;    // Requester's clock, echoed in the reply (0 = none)
+} raw_keepalive_t;
+
+#define RAW_KEEPALIVE_REQUEST 0x1
+#define RAW_KEEPALIVE_REPLY   0x2
+
+// RAW_MSG_RESUME / RAW_MSG_RESUME_ACK payload. A connection that is lost
+// (cable flap, ACK timeout) is suspended rather than forgotten for
+// RAW_RESUME_TIMEOUT_MS; presenting the ticket the peer issued in its
+// handshake capabilities picks it up again in one round trip, sequence numbers
+// and unacknowledged frames included.
+typedef struct __attribute__((packed)) {
+    uint32_t ticket;      // Issued by the receiver of this message
+    raw_sack_t ack;       // Sender's receive state (window 0 if unreliable)
+} raw_resume_t;
 
 // Initialize raw communication
 int raw_comm_init(raw_comm_ctx_t *ctx, const char *typec_port_path);
 
+// Initialize two contexts joined by an in-process shared memory ring
+// (loopback testing without any hardware). Cleans both up if the ring
+// cannot be set up.
+int raw_comm_init_pair(raw_comm_ctx_t *a, raw_comm_ctx_t *b);
+
+// As raw_comm_init_pair(), over a simulated link with the bandwidth,
+// latency, jitter, loss, reordering and outages link describes, e.g.
+// "rate=480M,delay=100us,loss=0.1%" (see usb_raw_sim.c)
+int raw_comm_init_sim_pair(raw_comm_ctx_t *a, raw_comm_ctx_t *b, const char *link);
+
 // Cleanup raw communication
 void raw_comm_cleanup(raw_comm_ctx_t *ctx);
 
+// Select the message transport: "shm" (default), "file", "vdm" or "dbc".
+// arg is transport specific (shm: segment name, NULL = derived from port;
+// vdm: path of the VDM passthrough device; dbc: "host", "target"/NULL or
+// a tty path). "sim" only comes in pairs, see raw_comm_init_sim_pair().
+int raw_comm_set_transport(raw_comm_ctx_t *ctx, const char *name, const char *arg);
+
+// Enable windowed reliable delivery for RAW_MSG_DATA with up to window
+// frames in flight (0 = fire-and-forget). Takes effect at the next
+// handshake and only with peers that enable it too.
+int raw_comm_set_window(raw_comm_ctx_t *ctx, int window);
+
+// Select the data frame checksum: "crc32c" (default) or "none". "none"
+// is used only if the peer asks for it too.
+int raw_comm_set_checksum(raw_comm_ctx_t *ctx, const char *name);
+
+// Ask for payload compression: a comma-separated list of codecs ("lz4"),
+// or "none" (default). Asking on one side is enough: data frames are
+// compressed in both directions with a codec the receiving side
+// announces it can decompress. Takes effect at the next handshake.
+int raw_comm_set_compression(raw_comm_ctx_t *ctx, const char *names);
+
+// Set the largest message (header + payload, RAW_MTU_MIN..RAW_MTU_MAX)
+// this side sends or accepts. Takes effect at the next handshake, where
+// the smaller of both sides' MTUs is agreed on.
+int raw_comm_set_mtu(raw_comm_ctx_t *ctx, size_t mtu);
+
+// Liveness checks: a connected peer that stays silent for twice its
+// round-trip timeout (at least min_ms, at most a second) is asked for a
+// keepalive, and after three unanswered requests its session is
+// suspended for resumption. min_ms = 0 turns the checks off.
+int raw_comm_set_keepalive(raw_comm_ctx_t *ctx, int min_ms);
+
+// Aggregate outgoing messages: a batch is sent once it holds flush_bytes
+// (0 = link MTU), delay_us after its first message, or on
+// raw_comm_flush(). delay_us = 0 sends every message on its own. The
+// delay is also asked of peers in the handshake; towards a peer the
+// longer of the two applies.
+int raw_comm_set_batching(raw_comm_ctx_t *ctx, int delay_us, size_t flush_bytes);
+
+// Send the pending batch now. Returns 0 or -1 on a transport error.
+int raw_comm_flush(raw_comm_ctx_t *ctx);
+
+// Largest payload raw_comm_send() accepts on the link to the primary peer
+size_t raw_comm_max_payload(raw_comm_ctx_t *ctx);
+
 // Detect available communication methods
 raw_comm_method_t raw_comm_detect_method(raw_comm_ctx_t *ctx);
 
-// Start listening for peer connection
+// Start listening for peer connections. A listening context keeps
+// accepting new peers (up to RAW_PEER_MAX) after the first has connected
+// and returns to discovery once the last one has left.
 int raw_comm_listen(raw_comm_ctx_t *ctx);
 
-// Connect to peer
+// Connect to peer. The first peer connected becomes the primary peer.
 int raw_comm_connect(raw_comm_ctx_t *ctx, uint32_t peer_id);
 
-// Send data
+// Send data to the primary peer. In reliable mode this blocks while the
+// window is full.
 int raw_comm_send(raw_comm_ctx_t *ctx, const uint8_t *data, size_t len);
 
-// Receive data (non-blocking)
+// Send data to a specific connected peer (0 = primary)
+int raw_comm_send_to(raw_comm_ctx_t *ctx, uint32_t peer_id, const uint8_t *data, size_t len);
+
+// As raw_comm_send_to(), on a logical channel (< RAW_CHANNELS). Channels
+// only label frames: they share the connection's window and ordering, and
+// the receiver sees the channel in usb_frame_t.channel. Scheduling between
+// them is up to the caller (see usb_raw_runtime.h).
+int raw_comm_send_channel(raw_comm_ctx_t *ctx, uint32_t peer_id, uint8_t channel,
+                          const uint8_t *data, size_t len);
+
+// Receive data from any peer (non-blocking)
 int raw_comm_recv(raw_comm_ctx_t *ctx, uint8_t *buffer, size_t max_len);
 
-// Poll for events
+// As raw_comm_recv(), also reporting the sender
+int raw_comm_recv_from(raw_comm_ctx_t *ctx, uint8_t *buffer, size_t max_len, uint32_t *peer_id);
+
+// Zero-copy data path. raw_comm_alloc_frame() hands out a frame pointing
+// into the context's transmit buffer (ctx->tx_buffer, allocated with the
+// context), with RAW_FRAME_HEADROOM in front of the payload; in reliable
+// mode it is the retransmission slot itself, after waiting for window
+// space. Fill data/len and pass it to raw_comm_send_frame(), which writes
+// the header in place (with frame->channel as the logical channel).
+// Caller-owned frames set up with usb_frame_init() work too, but reliable
+// mode has to keep a copy of them for retransmission.
+// Allocated frames go to the peer they were allocated for (see
+// raw_comm_alloc_frame_to(), 0 = primary); caller-owned frames go to the
+// primary peer.
+int raw_comm_alloc_frame(raw_comm_ctx_t *ctx, usb_frame_t *frame);
+int raw_comm_alloc_frame_to(raw_comm_ctx_t *ctx, uint32_t peer_id, usb_frame_t *frame);
+int raw_comm_send_frame(raw_comm_ctx_t *ctx, usb_frame_t *frame);
+
+// Borrow the next received data frame without copying. Returns 1 with
+// *view filled, 0 if none is pending, -1 on error. The view stays valid
+// until raw_comm_release_frame(); only one view is lent out at a time.
+// raw_comm_recv_frame_from() also reports the sender.
+int raw_comm_recv_frame(raw_comm_ctx_t *ctx, usb_frame_t *view);
+int raw_comm_recv_frame_from(raw_comm_ctx_t *ctx, usb_frame_t *view, uint32_t *peer_id);
+
+// Return a received view, or an allocated frame that will not be sent
+void raw_comm_release_frame(raw_comm_ctx_t *ctx, usb_frame_t *frame);
+
+// Wait up to timeout_ms for events. Discovery and handshake messages are
+// handled internally; once connected, returns 1 as soon as data is ready
+// for raw_comm_recv(). Returns 0 on timeout, -1 on error.
 int raw_comm_poll(raw_comm_ctx_t *ctx, int timeout_ms);
 
-// Get connection state
+// Pollable fd that becomes readable whenever raw_comm_poll() has work,
+// for embedding the context in an external poll/epoll loop
+int raw_comm_get_fd(raw_comm_ctx_t *ctx);
+
+// Get connection state (RAW_STATE_CONNECTED while any peer is)
 raw_conn_state_t raw_comm_get_state(raw_comm_ctx_t *ctx);
 
-// Get peer ID (after connection established)
+// Get the primary peer's ID (after connection established)
 uint32_t raw_comm_get_peer_id(raw_comm_ctx_t *ctx);
 
+// List connected peers. Fills up to max IDs and returns the number of
+// connected peers.
+int raw_comm_get_peers(raw_comm_ctx_t *ctx, uint32_t *ids, int max);
+
+// Connection state and statistics of one peer, NULL if unknown
+const struct raw_peer *raw_comm_find_peer(raw_comm_ctx_t *ctx, uint32_t peer_id);
+
+// Copy the context's counters. Safe from any thread while another drives
+// the context.
+void raw_comm_get_stats(raw_comm_ctx_t *ctx, usb_stats_t *out);
+
+// Keep the counters in caller-provided storage from now on (NULL = back to
+// the context's own), carrying the current values over. Call from the
+// thread driving the context; storage must outlive it.
+void raw_comm_set_stats(raw_comm_ctx_t *ctx, usb_stats_t *storage);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif // USB_RAW_COMM_H
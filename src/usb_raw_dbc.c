@@ -0,0 +1,632 @@
+// USB-C Software Network - xHCI Debug Capability Transport
+// Carries protocol messages over the xHCI Debug Capability (DbC): one
+// controller port turns into a USB device with a bulk IN/OUT pair, driven
+// by the controller's own transfer rings, so two hosts talk over a plain
+// USB 3 A-to-A or C-to-C cable at SuperSpeed rates without a gadget
+// controller.
+//
+// The two ends are not symmetric:
+//   target  Enables DbC through the xhci driver's sysfs "dbc" attribute.
+//           The kernel owns the DbC rings and exposes them as a tty
+//           (/dev/ttyDBC0), which is opened raw and non-blocking.
+//   host    Sees the target as a 1d6b:0010 debug device and drives its
+//           bulk endpoints through the async transfer engine
+//           (usb_xfer.h): a ring of IN transfers always submitted, one
+//           OUT slot per message, completions picked up from its eventfd.
+// Mapping the DbC registers directly would race the xhci driver, which
+// owns the extended capabilities; the kernel interface keeps the port
+// usable by the controller the rest of the time.
+//
+// Both ends see a byte stream, so every message goes out as a record
+//   u32 sync (RAW_DBC_SYNC), u32 length, message
+// little-endian. A receiver that loses framing (the tty layer drops bytes
+// when its buffer overflows) skips ahead to the next sync word; the
+// protocol checksum and ARQ deal with whatever was lost.
+//
+// The target's writes go through a TX buffer: the tty takes what fits and
+// EPOLLOUT on it, in the epoll set the event loop watches, resumes the
+// rest from service() or recv(). One chunk of the stream can hold many
+// records while recv() returns one, so an eventfd in the same set stays
+// readable while whole records are left over. The TX and RX sides may run
+// on different threads (usb_raw_runtime.h), so the TX buffer has its own
+// lock.
+
+#define _GNU_SOURCE
+#include "usb_raw_transport.h"
+#include "usb_xfer.h"
+#include "usb_pool.h"
+#include "usb_log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <endian.h>
+#include <glob.h>
+#include <poll.h>
+#include <pthread.h>
+#include <termios.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <libusb-1.0/libusb.h>
+
+#define RAW_DBC_VID         0x1D6Bu   // Linux DbC defaults (dbc_idVendor/idProduct)
+#define RAW_DBC_PID         0x0010u
+#define RAW_DBC_TTY         "/dev/ttyDBC0"
+#define RAW_DBC_SYSFS_GLOB  "/sys/bus/pci/devices/*/dbc"
+#define RAW_DBC_WAIT_MS     2000      // For the tty to appear after enabling
+
+#define RAW_DBC_SYNC        0x31434244u  // "DBC1"
+#define RAW_DBC_RECORD_HDR  8
+#define RAW_DBC_MSG_MAX     RAW_MTU_MAX
+#define RAW_DBC_RECORD_MAX  (RAW_DBC_RECORD_HDR + RAW_DBC_MSG_MAX)
+
+// Host side transfers: IN lengths must be a multiple of the 1024 byte
+// SuperSpeed packet, and one OUT slot holds a whole record
+#define RAW_DBC_XFER_BYTES  ((RAW_DBC_RECORD_MAX + 1023) & ~1023)
+#define RAW_DBC_XFER_DEPTH  16
+
+// A partial record plus one more chunk (an IN transfer or a tty read)
+#define RAW_DBC_RX_BUF      (RAW_DBC_RECORD_MAX + RAW_DBC_XFER_BYTES)
+#define RAW_DBC_TX_BUF      (4 * RAW_DBC_RECORD_MAX)
+
+typedef struct {
+    bool host;
+    int epoll_fd;                // Watched by the event loop
+
+    // Target: the DbC tty
+    int tty_fd;
+    char sysfs_path[256];        // dbc attribute to disable again ("" = leave it)
+
+    // Host: the debug device
+    libusb_context *usb;
+    libusb_device_handle *handle;
+    usb_xfer_engine_t xfer;
+
+    // Target TX buffer (tx_lock)
+    pthread_mutex_t tx_lock;
+    uint8_t *tx_buf;
+    size_t tx_off;
+    size_t tx_len;
+    bool watching_out;           // EPOLLOUT requested on tty_fd
+
+    // RX stream (receiving thread only)
+    uint8_t *rx_buf;
+    size_t rx_off;
+    size_t rx_len;
+    bool resyncing;
+    int ready_fd;                // eventfd, readable while rx_buf may hold a record
+    bool ready;
+
+    unsigned long tx_records;
+    unsigned long rx_records;
+    unsigned long resyncs;
+} raw_dbc_t;
+
+static void put_le32(uint8_t *p, uint32_t v) {
+    v = htole32(v);
+    memcpy(p, &v, sizeof(v));
+}
+
+static uint32_t get_le32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return le32toh(v);
+}
+
+int raw_dbc_find_controller(char *path, size_t size) {
+    glob_t g;
+    int ret = -1;
+
+    if (glob(RAW_DBC_SYSFS_GLOB, 0, NULL, &g) != 0) return -1;
+    for (size_t i = 0; i < g.gl_pathc && ret < 0; i++) {
+        if (access(g.gl_pathv[i], R_OK) == 0) {
+            snprintf(path, size, "%s", g.gl_pathv[i]);
+            ret = 0;
+        }
+    }
+    globfree(&g);
+    return ret;
+}
+
+// Sending
+
+// EPOLLOUT on the tty while bytes wait (tx_lock held)
+static void watch_out(raw_dbc_t *d, bool on) {
+    if (on == d->watching_out) return;
+
+    struct epoll_event ev = { .events = EPOLLIN | (on ? EPOLLOUT : 0) };
+    ev.data.fd = d->tty_fd;
+    if (epoll_ctl(d->epoll_fd, EPOLL_CTL_MOD, d->tty_fd, &ev) == 0) d->watching_out = on;
+}
+
+// Hand buffered bytes to the tty (tx_lock held)
+static void flush_tx(raw_dbc_t *d) {
+    while (d->tx_off < d->tx_len) {
+        ssize_t n = write(d->tty_fd, d->tx_buf + d->tx_off, d->tx_len - d->tx_off);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN) {
+                // The receiver resyncs on the next record
+                USB_LOG_WARN_RATELIMIT("DbC tty write: %s\n", strerror(errno));
+                d->tx_off = d->tx_len;
+            }
+            break;
+        }
+        d->tx_off += (size_t)n;
+    }
+    if (d->tx_off == d->tx_len) d->tx_off = d->tx_len = 0;
+    watch_out(d, d->tx_len > 0);
+}
+
+static int target_send(raw_dbc_t *d, const uint8_t *msg, size_t len) {
+    size_t need = RAW_DBC_RECORD_HDR + len;
+
+    pthread_mutex_lock(&d->tx_lock);
+    if (d->tx_len + need > RAW_DBC_TX_BUF) {
+        flush_tx(d);
+        if (d->tx_off > 0) {
+            memmove(d->tx_buf, d->tx_buf + d->tx_off, d->tx_len - d->tx_off);
+            d->tx_len -= d->tx_off;
+            d->tx_off = 0;
+        }
+        if (d->tx_len + need > RAW_DBC_TX_BUF) {
+            pthread_mutex_unlock(&d->tx_lock);
+            errno = EAGAIN;
+            return -1;
+        }
+    }
+
+    uint8_t *rec = d->tx_buf + d->tx_len;
+    put_le32(rec, RAW_DBC_SYNC);
+    put_le32(rec + 4, (uint32_t)len);
+    memcpy(rec + RAW_DBC_RECORD_HDR, msg, len);
+    d->tx_len += need;
+    d->tx_records++;
+    flush_tx(d);
+    pthread_mutex_unlock(&d->tx_lock);
+    return (int)len;
+}
+
+static int host_send(raw_dbc_t *d, const uint8_t *msg, size_t len) {
+    uint8_t *buf;
+    size_t cap;
+
+    int slot = usb_xfer_tx_acquire(&d->xfer, &buf, &cap, 0);
+    if (slot < 0) {
+        errno = EAGAIN;  // Every OUT transfer in flight (or the engine failed)
+        return -1;
+    }
+
+    put_le32(buf, RAW_DBC_SYNC);
+    put_le32(buf + 4, (uint32_t)len);
+    memcpy(buf + RAW_DBC_RECORD_HDR, msg, len);
+    if (usb_xfer_tx_submit(&d->xfer, slot, RAW_DBC_RECORD_HDR + len) < 0) return -1;
+    d->tx_records++;
+    return (int)len;
+}
+
+static int dbc_transport_send(raw_comm_ctx_t *ctx, const uint8_t *msg, size_t len) {
+    raw_dbc_t *d = ctx->transport_priv;
+    if (!d) return -1;
+
+    if (len == 0 || len > RAW_DBC_MSG_MAX) {
+        USB_LOG_WARN_RATELIMIT("Message of %zu bytes too large for DbC transport\n", len);
+        errno = EMSGSIZE;
+        return -1;
+    }
+
+    int ret = d->host ? host_send(d, msg, len) : target_send(d, msg, len);
+    if (ret > 0) USB_LOG_TRACE("  [TX] Sent %zu bytes via DbC\n", len);
+    return ret;
+}
+
+// Receiving
+
+static void set_ready(raw_dbc_t *d, bool on) {
+    if (on == d->ready) return;
+
+    uint64_t value = 1;
+    ssize_t n = on ? write(d->ready_fd, &value, sizeof(value))
+                   : read(d->ready_fd, &value, sizeof(value));
+    if (n == sizeof(value)) d->ready = on;
+}
+
+// Take the next whole record out of the RX stream. Returns its length,
+// or 0 if none has arrived completely.
+static int next_record(raw_comm_ctx_t *ctx, raw_dbc_t *d, uint8_t *msg, size_t max_len) {
+    while (d->rx_len - d->rx_off >= RAW_DBC_RECORD_HDR) {
+        const uint8_t *rec = d->rx_buf + d->rx_off;
+        uint32_t len = get_le32(rec + 4);
+
+        if (get_le32(rec) != RAW_DBC_SYNC || len == 0 || len > RAW_DBC_MSG_MAX) {
+            if (!d->resyncing) {
+                d->resyncs++;
+                usb_stat_add(&ctx->stats->rx_errors, 1);
+                USB_LOG_WARN_RATELIMIT("DbC: lost record framing, resyncing\n");
+            }
+            d->resyncing = true;
+            d->rx_off++;
+            continue;
+        }
+        if (d->rx_len - d->rx_off < RAW_DBC_RECORD_HDR + len) break;
+
+        d->resyncing = false;
+        d->rx_off += RAW_DBC_RECORD_HDR + len;
+        if (len > max_len) {
+            usb_stat_add(&ctx->stats->rx_errors, 1);
+            USB_LOG_WARN_RATELIMIT("DbC: %u byte message exceeds MTU, dropped\n", len);
+            continue;
+        }
+        memcpy(msg, rec + RAW_DBC_RECORD_HDR, len);
+        d->rx_records++;
+        set_ready(d, d->rx_len - d->rx_off >= RAW_DBC_RECORD_HDR);
+        return (int)len;
+    }
+
+    // Move the partial record to the front: a whole chunk fits behind it
+    if (d->rx_off > 0) {
+        memmove(d->rx_buf, d->rx_buf + d->rx_off, d->rx_len - d->rx_off);
+        d->rx_len -= d->rx_off;
+        d->rx_off = 0;
+    }
+    set_ready(d, false);
+    return 0;
+}
+
+// Append stream bytes. Returns 1 if some arrived, 0 if none, -1 if the
+// link is gone.
+static int target_fill(raw_dbc_t *d) {
+    ssize_t n = read(d->tty_fd, d->rx_buf + d->rx_len, RAW_DBC_RX_BUF - d->rx_len);
+    if (n > 0) {
+        d->rx_len += (size_t)n;
+        return 1;
+    }
+    if (n < 0 && (errno == EAGAIN || errno == EINTR)) return 0;
+    USB_LOG_ERROR("DbC tty: %s\n", n == 0 ? "hung up" : strerror(errno));
+    return -1;
+}
+
+static int host_fill(raw_dbc_t *d) {
+    usb_xfer_completion_t done;
+
+    int ret = usb_xfer_wait_rx(&d->xfer, &done, 0);
+    if (ret <= 0) {
+        if (ret < 0) USB_LOG_ERROR("DbC bulk IN: %s\n", libusb_error_name(d->xfer.last_error));
+        return ret;
+    }
+    memcpy(d->rx_buf + d->rx_len, done.data, done.len);
+    d->rx_len += done.len;
+    usb_xfer_release(&d->xfer, done.slot);
+    return 1;
+}
+
+static int dbc_transport_recv(raw_comm_ctx_t *ctx, uint8_t *msg, size_t max_len,
+                              uint32_t *from_id) {
+    raw_dbc_t *d = ctx->transport_priv;
+    if (!d) return -1;
+
+    // Also here: a reader that only calls recv never sees service()
+    if (!d->host) {
+        pthread_mutex_lock(&d->tx_lock);
+        flush_tx(d);
+        pthread_mutex_unlock(&d->tx_lock);
+    }
+
+    for (;;) {
+        int len = next_record(ctx, d, msg, max_len);
+        if (len > 0) {
+            raw_msg_header_t hdr;
+            *from_id = 0;
+            if ((size_t)len >= sizeof(hdr)) {
+                memcpy(&hdr, msg, sizeof(hdr));
+                *from_id = hdr.src_id;
+            }
+            USB_LOG_TRACE("  [RX] Received %d bytes via DbC from 0x%08x\n", len, *from_id);
+            return len;
+        }
+
+        int ret = d->host ? host_fill(d) : target_fill(d);
+        if (ret < 0) {
+            // Stop watching a link that went away instead of spinning on it
+            epoll_ctl(d->epoll_fd, EPOLL_CTL_DEL, d->host ? d->xfer.rx_fd : d->tty_fd, NULL);
+            return -1;
+        }
+        if (ret == 0) return 0;
+    }
+}
+
+static int dbc_transport_get_fd(raw_comm_ctx_t *ctx) {
+    raw_dbc_t *d = ctx->transport_priv;
+    return d ? d->epoll_fd : -1;
+}
+
+// The event loop wakes for EPOLLOUT too; only report data when recv has some
+static int dbc_transport_service(raw_comm_ctx_t *ctx) {
+    raw_dbc_t *d = ctx->transport_priv;
+    if (!d) return 0;
+
+    if (!d->host) {
+        pthread_mutex_lock(&d->tx_lock);
+        flush_tx(d);
+        pthread_mutex_unlock(&d->tx_lock);
+    }
+
+    struct pollfd pfd[2] = {
+        { .fd = d->host ? d->xfer.rx_fd : d->tty_fd, .events = POLLIN },
+        { .fd = d->ready_fd, .events = POLLIN },
+    };
+    return poll(pfd, 2, 0) > 0;
+}
+
+// Setup
+
+static void free_dbc(raw_dbc_t *d) {
+    if (d->host) {
+        usb_xfer_stop(&d->xfer);
+        if (d->handle) {
+            libusb_release_interface(d->handle, 0);
+            libusb_close(d->handle);
+        }
+        if (d->usb) libusb_exit(d->usb);
+    }
+    if (d->tty_fd >= 0) close(d->tty_fd);
+    if (d->ready_fd >= 0) close(d->ready_fd);
+    if (d->epoll_fd >= 0) close(d->epoll_fd);
+
+    // Give the port back to the xhci driver if we took it
+    if (d->sysfs_path[0]) {
+        int fd = open(d->sysfs_path, O_WRONLY | O_CLOEXEC);
+        if (fd >= 0) {
+            if (write(fd, "disable", 7) < 0) {
+                USB_LOG_WARN("Cannot disable DbC (%s): %s\n", d->sysfs_path, strerror(errno));
+            }
+            close(fd);
+        }
+    }
+
+    usb_slab_free(d->tx_buf, RAW_DBC_TX_BUF);
+    usb_slab_free(d->rx_buf, RAW_DBC_RX_BUF);
+    pthread_mutex_destroy(&d->tx_lock);
+    free(d);
+}
+
+static int watch_fd(raw_dbc_t *d, int fd) {
+    struct epoll_event ev = { .events = EPOLLIN };
+    ev.data.fd = fd;
+    if (epoll_ctl(d->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        USB_LOG_ERROR("DbC transport setup: %s\n", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+static raw_dbc_t *alloc_dbc(void) {
+    raw_dbc_t *d = calloc(1, sizeof(raw_dbc_t));
+    if (!d) return NULL;
+
+    pthread_mutex_init(&d->tx_lock, NULL);
+    d->tty_fd = -1;
+    d->xfer.rx_fd = -1;
+    d->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    d->ready_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    d->rx_buf = usb_slab_alloc(RAW_DBC_RX_BUF);
+    if (d->epoll_fd < 0 || d->ready_fd < 0 || !d->rx_buf || watch_fd(d, d->ready_fd) < 0) {
+        USB_LOG_ERROR("DbC transport setup: %s\n", strerror(errno));
+        free_dbc(d);
+        return NULL;
+    }
+    return d;
+}
+
+// Take over an open stream fd as the target end
+static int attach_tty(raw_dbc_t *d, int fd) {
+    d->tty_fd = fd;
+
+    struct termios tio;
+    if (tcgetattr(fd, &tio) == 0) {
+        cfmakeraw(&tio);
+        tcsetattr(fd, TCSANOW, &tio);
+    }
+
+    d->tx_buf = usb_slab_alloc(RAW_DBC_TX_BUF);
+    if (!d->tx_buf) return -1;
+    return watch_fd(d, fd);
+}
+
+// Enable DbC on the controller (if it is not already) and wait for its tty
+static int enable_dbc(raw_comm_ctx_t *ctx, raw_dbc_t *d) {
+    char path[sizeof(ctx->dbc_path)];
+    if (ctx->dbc_path[0]) {
+        snprintf(path, sizeof(path), "%s", ctx->dbc_path);
+    } else if (raw_dbc_find_controller(path, sizeof(path)) < 0) {
+        USB_LOG_ERROR("No xHCI controller with a Debug Capability (%s)\n", RAW_DBC_SYSFS_GLOB);
+        return -1;
+    }
+
+    char state[32] = "";
+    int fd = open(path, O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+        USB_LOG_ERROR("Cannot open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    ssize_t n = read(fd, state, sizeof(state) - 1);
+    state[n > 0 ? n : 0] = '\0';
+    state[strcspn(state, "\n")] = '\0';
+
+    if (strcmp(state, "disabled") == 0) {
+        if (pwrite(fd, "enable", 6, 0) < 0) {
+            USB_LOG_ERROR("Cannot enable DbC (%s): %s\n", path, strerror(errno));
+            close(fd);
+            return -1;
+        }
+        snprintf(d->sysfs_path, sizeof(d->sysfs_path), "%s", path);
+        USB_LOG_INFO("DbC enabled on %s\n", path);
+    } else {
+        USB_LOG_INFO("DbC already %s on %s\n", state, path);
+    }
+    close(fd);
+
+    for (int waited = 0; access(RAW_DBC_TTY, F_OK) != 0; waited += 10) {
+        if (waited >= RAW_DBC_WAIT_MS) {
+            USB_LOG_ERROR("%s did not appear after enabling DbC\n", RAW_DBC_TTY);
+            return -1;
+        }
+        usleep(10 * 1000);
+    }
+    return 0;
+}
+
+static int open_target(raw_comm_ctx_t *ctx, raw_dbc_t *d, const char *tty) {
+    if (!tty) {
+        if (enable_dbc(ctx, d) < 0) return -1;
+        tty = RAW_DBC_TTY;
+    }
+
+    int fd = open(tty, O_RDWR | O_NONBLOCK | O_NOCTTY | O_CLOEXEC);
+    if (fd < 0) {
+        USB_LOG_ERROR("Cannot open DbC tty %s: %s\n", tty, strerror(errno));
+        return -1;
+    }
+    if (attach_tty(d, fd) < 0) return -1;
+
+    USB_LOG_INFO("DbC transport: target on %s\n", tty);
+    return 0;
+}
+
+// Find the debug device's bulk pair (interface 0)
+static int find_endpoints(libusb_device_handle *handle, uint8_t *in, uint8_t *out) {
+    struct libusb_config_descriptor *config;
+    *in = *out = 0;
+
+    if (libusb_get_active_config_descriptor(libusb_get_device(handle), &config) != 0) return -1;
+    const struct libusb_interface *iface = &config->interface[0];
+    if (config->bNumInterfaces > 0 && iface->num_altsetting > 0) {
+        const struct libusb_interface_descriptor *desc = &iface->altsetting[0];
+        for (int i = 0; i < desc->bNumEndpoints; i++) {
+            const struct libusb_endpoint_descriptor *ep = &desc->endpoint[i];
+            if ((ep->bmAttributes & LIBUSB_TRANSFER_TYPE_MASK) != LIBUSB_TRANSFER_TYPE_BULK) continue;
+            if (ep->bEndpointAddress & LIBUSB_ENDPOINT_IN) {
+                *in = ep->bEndpointAddress;
+            } else {
+                *out = ep->bEndpointAddress;
+            }
+        }
+    }
+    libusb_free_config_descriptor(config);
+    return *in && *out ? 0 : -1;
+}
+
+static int open_host(raw_dbc_t *d) {
+    d->host = true;
+
+    int ret = libusb_init(&d->usb);
+    if (ret < 0) {
+        USB_LOG_ERROR("Failed to initialize libusb: %s\n", libusb_error_name(ret));
+        d->usb = NULL;
+        return -1;
+    }
+
+    d->handle = libusb_open_device_with_vid_pid(d->usb, RAW_DBC_VID, RAW_DBC_PID);
+    if (!d->handle) {
+        USB_LOG_ERROR("No DbC target attached (%04x:%04x)\n", RAW_DBC_VID, RAW_DBC_PID);
+        return -1;
+    }
+
+    // usb_debug binds the device as a serial port; take it back for the session
+    libusb_set_auto_detach_kernel_driver(d->handle, 1);
+    ret = libusb_claim_interface(d->handle, 0);
+    if (ret < 0) {
+        USB_LOG_ERROR("Cannot claim DbC interface: %s\n", libusb_error_name(ret));
+        libusb_close(d->handle);
+        d->handle = NULL;
+        return -1;
+    }
+
+    uint8_t ep_in, ep_out;
+    if (find_endpoints(d->handle, &ep_in, &ep_out) < 0) {
+        USB_LOG_ERROR("DbC target has no bulk IN/OUT pair\n");
+        return -1;
+    }
+    if (usb_xfer_start(&d->xfer, d->usb, d->handle, ep_in, ep_out,
+                       RAW_DBC_XFER_DEPTH, RAW_DBC_XFER_BYTES, NULL) < 0) {
+        return -1;
+    }
+    if (watch_fd(d, d->xfer.rx_fd) < 0) return -1;
+
+    USB_LOG_INFO("DbC transport: host, bulk IN 0x%02x / OUT 0x%02x, %d x %d byte transfers\n",
+                 ep_in, ep_out, RAW_DBC_XFER_DEPTH, RAW_DBC_XFER_BYTES);
+    return 0;
+}
+
+// arg: "host" drives an attached DbC target over libusb. "target" or
+// empty enables DbC here and uses its tty; any other value is a tty to use
+// as it is (DbC enabled by hand, or the host side through usb_debug).
+static int dbc_transport_open(raw_comm_ctx_t *ctx, const char *arg) {
+    raw_dbc_t *d = alloc_dbc();
+    if (!d) return -1;
+
+    int ret;
+    if (arg && strcmp(arg, "host") == 0) {
+        ret = open_host(d);
+    } else {
+        ret = open_target(ctx, d, arg && arg[0] && strcmp(arg, "target") != 0 ? arg : NULL);
+    }
+    if (ret < 0) {
+        free_dbc(d);
+        return -1;
+    }
+
+    ctx->transport_priv = d;
+    return 0;
+}
+
+static void dbc_transport_close(raw_comm_ctx_t *ctx) {
+    raw_dbc_t *d = ctx->transport_priv;
+    if (!d) return;
+
+    USB_LOG_DEBUG("DbC transport: %lu records sent, %lu received, %lu resyncs\n",
+                  d->tx_records, d->rx_records, d->resyncs);
+    free_dbc(d);
+    ctx->transport_priv = NULL;
+}
+
+const raw_transport_ops_t raw_transport_dbc = {
+    .name   = "dbc",
+    .open   = dbc_transport_open,
+    .close  = dbc_transport_close,
+    .send   = dbc_transport_send,
+    .recv   = dbc_transport_recv,
+    .get_fd = dbc_transport_get_fd,
+    .service = dbc_transport_service,
+};
+
+// Loopback pair: a stream socketpair stands in for the tty on both ends
+int raw_dbc_open_pair(raw_comm_ctx_t *a, raw_comm_ctx_t *b) {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, fds) < 0) {
+        USB_LOG_ERROR("DbC socketpair: %s\n", strerror(errno));
+        return -1;
+    }
+
+    raw_dbc_t *da = alloc_dbc();
+    raw_dbc_t *db = alloc_dbc();
+    bool ok = da && db;
+    if (da) ok = attach_tty(da, fds[0]) == 0 && ok;
+    else close(fds[0]);
+    if (db) ok = attach_tty(db, fds[1]) == 0 && ok;
+    else close(fds[1]);
+    if (!ok) {
+        if (da) free_dbc(da);
+        if (db) free_dbc(db);
+        return -1;
+    }
+
+    a->transport = &raw_transport_dbc;
+    a->transport_priv = da;
+    b->transport = &raw_transport_dbc;
+    b->transport_priv = db;
+    return 0;
+}
@@ -0,0 +1,370 @@
+// USB-C Software Network - /tmp File Transport
+// Each message is written to /tmp/usbc_net_comm.<sender_id>.<dst_id>.<n>
+// and picked up by its destination with a directory scan, oldest first.
+// Broadcasts (dst_id 0) are left in place for every other node to read
+// until their sender replaces them. Kept for compatibility with older
+// builds; the shared memory ring transport is the default.
+// An inotify watch on /tmp makes the transport pollable.
+//
+// With IO_URING each message file is opened, read or written, closed and
+// (when written) renamed by one linked submission, straight into a fixed
+// file slot and out of a registered buffer. A message read is unlinked
+// afterwards, only once the read has succeeded. The directory scan keeps
+// plain stat(): io_uring hands STATX to a worker thread, which costs more
+// than the system call it saves.
+//
+// This is a workaround: we use a known file path that both sides can access
+// In practice, this would use actual PD VDM or other hardware mechanism
+
+#include "usb_raw_transport.h"
+#include "usb_uring.h"
+#include "usb_log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <sys/inotify.h>
+
+static const char *SHARED_COMM_FILE = "/tmp/usbc_net_comm";
+
+#define FILE_SEEN_MAX 16  // Senders whose broadcasts are tracked
+#define FILE_URING_ENTRIES 32
+#define FILE_URING_SLOT 0     // Fixed file slot message files are opened into
+
+static const int file_uring_ops[] = {
+    IORING_OP_OPENAT, IORING_OP_READ_FIXED, IORING_OP_WRITE_FIXED, IORING_OP_CLOSE,
+    IORING_OP_RENAMEAT, -1
+};
+
+typedef struct {
+    int inotify_fd;
+    uint32_t next_n;             // Per-sender message counter
+    char last_broadcast[512];    // Our broadcast file still on disk
+    struct {
+        uint32_t sender;
+        uint32_t n;              // Last broadcast read from sender
+    } seen[FILE_SEEN_MAX];
+    int seen_next;
+    usb_uring_t tx_ring;         // One per direction, as RAW_THREADS sends and
+    usb_uring_t rx_ring;         // receives from two threads; fd -1 = syscalls
+} raw_file_t;
+
+static bool broadcast_seen(raw_file_t *f, uint32_t sender, uint32_t n) {
+    for (int i = 0; i < FILE_SEEN_MAX; i++) {
+        if (f->seen[i].sender == sender) return (int32_t)(n - f->seen[i].n) <= 0;
+    }
+    return false;
+}
+
+static void mark_broadcast_seen(raw_file_t *f, uint32_t sender, uint32_t n) {
+    for (int i = 0; i < FILE_SEEN_MAX; i++) {
+        if (f->seen[i].sender == sender) {
+            f->seen[i].n = n;
+            return;
+        }
+    }
+    f->seen[f->seen_next].sender = sender;
+    f->seen[f->seen_next].n = n;
+    f->seen_next = (f->seen_next + 1) % FILE_SEEN_MAX;
+}
+
+static bool time_before(const struct timespec *a, const struct timespec *b) {
+    return a->tv_sec < b->tv_sec || (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+static int file_transport_open(raw_comm_ctx_t *ctx, const char *arg) {
+    (void)arg;
+    raw_file_t *f = calloc(1, sizeof(raw_file_t));
+    if (!f) return -1;
+    
+    f->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (f->inotify_fd >= 0 &&
+        inotify_add_watch(f->inotify_fd, "/tmp", IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        USB_LOG_ERROR("inotify_add_watch /tmp: %s\n", strerror(errno));
+        close(f->inotify_fd);
+        f->inotify_fd = -1;
+    }
+    
+    usb_uring_init(&f->tx_ring, FILE_URING_ENTRIES, 1, RAW_MTU_MAX, 1, file_uring_ops);
+    usb_uring_init(&f->rx_ring, FILE_URING_ENTRIES, 1, RAW_MTU_MAX, 1, file_uring_ops);
+    if (f->tx_ring.fd < 0 || f->rx_ring.fd < 0) {
+        usb_uring_cleanup(&f->tx_ring);
+        usb_uring_cleanup(&f->rx_ring);
+    } else {
+        USB_LOG_INFO("File transport: using io_uring\n");
+    }
+    
+    ctx->transport_priv = f;
+    return 0;
+}
+
+static void file_transport_close(raw_comm_ctx_t *ctx) {
+    raw_file_t *f = ctx->transport_priv;
+    if (!f) return;
+    
+    if (f->inotify_fd >= 0) close(f->inotify_fd);
+    if (f->last_broadcast[0]) unlink(f->last_broadcast);
+    usb_uring_cleanup(&f->tx_ring);
+    usb_uring_cleanup(&f->rx_ring);
+    free(f);
+    ctx->transport_priv = NULL;
+}
+
+static int file_transport_get_fd(raw_comm_ctx_t *ctx) {
+    raw_file_t *f = ctx->transport_priv;
+    return f ? f->inotify_fd : -1;
+}
+
+static int write_message(const char *tmp_path, const char *path, const uint8_t *msg, size_t len) {
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) {
+        USB_LOG_ERROR("Failed to open comm file for writing: %s\n", strerror(errno));
+        return -1;
+    }
+    
+    ssize_t written = write(fd, msg, len);
+    close(fd);
+    
+    if (written != (ssize_t)len || rename(tmp_path, path) < 0) {
+        unlink(tmp_path);
+        return -1;
+    }
+    return (int)written;
+}
+
+// open -> write -> close -> rename as one linked submission: a step that
+// fails, a short write included, cancels the ones after it. The ring is
+// idle between calls, so there is always room for the chain.
+static int uring_write_message(usb_uring_t *ring, const char *tmp_path, const char *path,
+                               const uint8_t *msg, size_t len) {
+    struct io_uring_cqe cqe[4];
+    struct io_uring_sqe *sqe;
+    int res[4];
+    uint8_t *buf = usb_uring_buf(ring, 0);
+    
+    if (len > ring->buf_size) return -1;
+    memcpy(buf, msg, len);
+    
+    sqe = usb_uring_prep(ring, IORING_OP_OPENAT, AT_FDCWD, tmp_path, 0666, 0, 0);
+    sqe->open_flags = O_WRONLY | O_CREAT | O_TRUNC;  // No O_CLOEXEC on a direct descriptor
+    sqe->file_index = FILE_URING_SLOT + 1;
+    sqe->flags = IOSQE_IO_LINK;
+    sqe = usb_uring_prep(ring, IORING_OP_WRITE_FIXED, FILE_URING_SLOT, buf, (unsigned)len, 0, 1);
+    sqe->buf_index = 0;
+    sqe->flags = IOSQE_FIXED_FILE | IOSQE_IO_LINK;
+    sqe = usb_uring_prep(ring, IORING_OP_CLOSE, 0, NULL, 0, 0, 2);
+    sqe->file_index = FILE_URING_SLOT + 1;
+    sqe->flags = IOSQE_IO_LINK;
+    usb_uring_prep(ring, IORING_OP_RENAMEAT, AT_FDCWD, tmp_path, (unsigned)AT_FDCWD,
+                   (uint64_t)(uintptr_t)path, 3);
+    if (usb_uring_submit_wait(ring, 4, cqe) < 0) return -1;
+    
+    for (int i = 0; i < 4; i++) {
+        res[cqe[i].user_data] = cqe[i].res;
+    }
+    if (res[3] == 0) return res[1];
+    
+    if (res[0] < 0) {
+        USB_LOG_ERROR("Failed to open comm file for writing: %s\n", strerror(-res[0]));
+        return -1;
+    }
+    
+    // Opened but not closed: free the slot, then drop the partial file
+    if (res[2] < 0) {
+        sqe = usb_uring_prep(ring, IORING_OP_CLOSE, 0, NULL, 0, 0, 0);
+        sqe->file_index = FILE_URING_SLOT + 1;
+        usb_uring_submit_wait(ring, 1, NULL);
+    }
+    unlink(tmp_path);
+    return -1;
+}
+
+static int sysfs_send_message(raw_comm_ctx_t *ctx, const uint8_t *msg, size_t len) {
+    raw_file_t *f = ctx->transport_priv;
+    char path[512];
+    char tmp_path[520];
+    raw_msg_header_t hdr;
+    uint32_t dst_id = 0;
+    
+    if (!f) return -1;
+    
+    // A batch is addressed like its first message
+    if (len >= sizeof(hdr)) {
+        memcpy(&hdr, msg, sizeof(hdr));
+        dst_id = hdr.dst_id;
+    }
+    
+    // For now, use a temp file as shared memory for IPC
+    // In real implementation, this would go over USB PD VDM
+    snprintf(path, sizeof(path), "%s.%08x.%08x.%08x", SHARED_COMM_FILE,
+             ctx->local_id, dst_id, f->next_n++);
+    
+    // Renamed into place so a scan never sees a partial message
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    int written = f->tx_ring.fd >= 0 ? uring_write_message(&f->tx_ring, tmp_path, path, msg, len)
+                                     : write_message(tmp_path, path, msg, len);
+    if (written < 0) return -1;
+    
+    // Only the latest broadcast is kept around
+    if (dst_id == 0) {
+        if (f->last_broadcast[0]) unlink(f->last_broadcast);
+        strncpy(f->last_broadcast, path, sizeof(f->last_broadcast) - 1);
+    }
+    
+    USB_LOG_TRACE("  [TX] Sent %d bytes to %s\n", written, path);
+    return written;
+}
+
+// A message file found by a directory scan
+typedef struct {
+    char path[512];
+    struct timespec mtime;
+    uint32_t sender_id;
+    uint32_t dst_id;
+    uint32_t n;
+} file_msg_t;
+
+// Find the oldest message for us. Returns the number pending, -1 on error.
+static int scan_messages(raw_comm_ctx_t *ctx, raw_file_t *f, file_msg_t *best) {
+    DIR *dir = opendir("/tmp");
+    if (!dir) return -1;
+    
+    struct dirent *entry;
+    int pending = 0;
+    
+    // Look for comm files from other peers
+    while ((entry = readdir(dir)) != NULL) {
+        if (strncmp(entry->d_name, "usbc_net_comm.", 14) == 0) {
+            // Extract sender, destination and counter from filename
+            uint32_t sender_id, dst_id, n;
+            int name_len = 0;
+            if (sscanf(entry->d_name + 14, "%8x.%8x.%8x%n", &sender_id, &dst_id, &n,
+                       &name_len) != 3 || entry->d_name[14 + name_len] != '\0') {
+                continue;  // Older naming or a file still being written
+            }
+            
+            // Skip our own messages and those for other nodes
+            if (sender_id == ctx->local_id) continue;
+            if (dst_id != 0 && dst_id != ctx->local_id) continue;
+            if (dst_id == 0 && f && broadcast_seen(f, sender_id, n)) continue;
+            
+            char path[512];
+            snprintf(path, sizeof(path), "/tmp/%s", entry->d_name);
+            
+            struct stat st;
+            if (stat(path, &st) == 0) {
+                // Get the oldest message; the counter orders one sender's
+                // messages within the timestamp granularity
+                bool older = pending == 0 || time_before(&st.st_mtim, &best->mtime) ||
+                             (sender_id == best->sender_id && (int32_t)(n - best->n) < 0);
+                if (older) {
+                    strncpy(best->path, path, sizeof(best->path) - 1);
+                    best->path[sizeof(best->path) - 1] = '\0';
+                    best->mtime = st.st_mtim;
+                    best->sender_id = sender_id;
+                    best->dst_id = dst_id;
+                    best->n = n;
+                }
+                pending++;
+            }
+        }
+    }
+    closedir(dir);
+    
+    return pending;
+}
+
+// open -> read -> close as one linked submission. The close follows the
+// read whatever it returned (a short read is the normal case); nothing
+// runs if the open fails. An unlink cannot join the chain: linked to the
+// close, it would also run after a failed read and lose the message.
+static int uring_read_message(usb_uring_t *ring, const char *path, uint8_t *msg,
+                              size_t max_len) {
+    struct io_uring_cqe cqe[3];
+    struct io_uring_sqe *sqe;
+    int res[3];
+    uint8_t *buf = usb_uring_buf(ring, 0);
+    unsigned len = (unsigned)(max_len < ring->buf_size ? max_len : ring->buf_size);
+    
+    sqe = usb_uring_prep(ring, IORING_OP_OPENAT, AT_FDCWD, path, 0, 0, 0);
+    sqe->open_flags = O_RDONLY;
+    sqe->file_index = FILE_URING_SLOT + 1;
+    sqe->flags = IOSQE_IO_LINK;
+    sqe = usb_uring_prep(ring, IORING_OP_READ_FIXED, FILE_URING_SLOT, buf, len, 0, 1);
+    sqe->buf_index = 0;
+    sqe->flags = IOSQE_FIXED_FILE | IOSQE_IO_HARDLINK;
+    sqe = usb_uring_prep(ring, IORING_OP_CLOSE, 0, NULL, 0, 0, 2);
+    sqe->file_index = FILE_URING_SLOT + 1;
+    if (usb_uring_submit_wait(ring, 3, cqe) < 0) return -1;
+    
+    for (unsigned i = 0; i < 3; i++) {
+        res[cqe[i].user_data] = cqe[i].res;
+    }
+    if (res[0] < 0 || res[1] < 0) return -1;
+    
+    memcpy(msg, buf, (size_t)res[1]);
+    return res[1];
+}
+
+static int sysfs_recv_message(raw_comm_ctx_t *ctx, uint8_t *msg, size_t max_len, 
+                               uint32_t *from_id) {
+    raw_file_t *f = ctx->transport_priv;
+    file_msg_t best;
+    
+    int pending = scan_messages(ctx, f, &best);
+    
+    // The inotify fd stays readable while more messages wait. Once at most
+    // this one is left, clear pending events and scan again so none are
+    // missed.
+    if (pending >= 0 && pending <= 1 && f && f->inotify_fd >= 0) {
+        uint8_t events[4096];
+        while (read(f->inotify_fd, events, sizeof(events)) > 0) {
+        }
+        pending = scan_messages(ctx, f, &best);
+    }
+    
+    if (pending < 0) return -1;
+    if (pending == 0) {
+        return 0;  // No messages
+    }
+    
+    ssize_t n;
+    if (f && f->rx_ring.fd >= 0) {
+        n = uring_read_message(&f->rx_ring, best.path, msg, max_len);
+    } else {
+        int fd = open(best.path, O_RDONLY);
+        if (fd < 0) return -1;
+        
+        n = read(fd, msg, max_len);
+        close(fd);
+    }
+    if (n < 0) return -1;
+    
+    // Delete the message once it has been read; broadcasts are for everyone
+    if (best.dst_id != 0) unlink(best.path);
+    
+    if (best.dst_id == 0 && f) {
+        mark_broadcast_seen(f, best.sender_id, best.n);
+    }
+    
+    if (n > 0) {
+        *from_id = best.sender_id;
+        USB_LOG_TRACE("  [RX] Received %zd bytes from 0x%08x\n", n, best.sender_id);
+    }
+    
+    return (int)n;
+}
+
+const raw_transport_ops_t raw_transport_file = {
+    .name   = "file",
+    .open   = file_transport_open,
+    .close  = file_transport_close,
+    .send   = sysfs_send_message,
+    .recv   = sysfs_recv_message,
+    .get_fd = file_transport_get_fd,
+};
@@ -0,0 +1,190 @@
+// USB-C Software Network - Raw Protocol Batch Parser Implementation
+//
+// The first eight header bytes are magic, version, msg_type and flags.
+// Masked down to the first five they are the same in every valid header,
+// so one 64-bit lane compare checks both magic and version of a header.
+// The vector loops only report whether a group of headers passed; the
+// failing one is found and classified by the scalar code.
+
+#include "usb_raw_parse.h"
+#include "usb_raw_comm.h"
+#include "usb_crc32c.h"
+#include <string.h>
+#include <pthread.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define PARSE_HAVE_AVX2 1
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define PARSE_HAVE_NEON 1
+#endif
+
+// Index of the first of refs[0..n) whose leading bytes do not match, or n
+typedef int (*check_fn_t)(const uint8_t *buf, const raw_frame_ref_t *refs, int n);
+
+static pthread_once_t parse_once = PTHREAD_ONCE_INIT;
+static check_fn_t check_fn;
+static const char *parse_impl_name;
+static uint64_t lead_want;       // Magic and version as the first header word
+static uint64_t lead_mask;
+
+static uint64_t load64(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static int check_scalar(const uint8_t *buf, const raw_frame_ref_t *refs, int n) {
+    for (int i = 0; i < n; i++) {
+        if ((load64(buf + refs[i].offset) & lead_mask) != lead_want) return i;
+    }
+    return n;
+}
+
+#ifdef PARSE_HAVE_AVX2
+__attribute__((target("avx2")))
+static int check_avx2(const uint8_t *buf, const raw_frame_ref_t *refs, int n) {
+    const __m256i want = _mm256_set1_epi64x((long long)lead_want);
+    const __m256i mask = _mm256_set1_epi64x((long long)lead_mask);
+    int i = 0;
+
+    for (; i + 4 <= n; i += 4) {
+        __m128i idx = _mm_setr_epi32((int)refs[i].offset, (int)refs[i + 1].offset,
+                                     (int)refs[i + 2].offset, (int)refs[i + 3].offset);
+        __m256i lead = _mm256_i32gather_epi64((const long long *)buf, idx, 1);
+        __m256i eq = _mm256_cmpeq_epi64(_mm256_and_si256(lead, mask), want);
+        if (_mm256_movemask_pd(_mm256_castsi256_pd(eq)) != 0xF) {
+            return i + check_scalar(buf, refs + i, 4);
+        }
+    }
+    return i + check_scalar(buf, refs + i, n - i);
+}
+#endif
+
+#ifdef PARSE_HAVE_NEON
+static int check_neon(const uint8_t *buf, const raw_frame_ref_t *refs, int n) {
+    const uint64x2_t want = vdupq_n_u64(lead_want);
+    const uint64x2_t mask = vdupq_n_u64(lead_mask);
+    int i = 0;
+
+    for (; i + 4 <= n; i += 4) {
+        uint64x2_t a = vcombine_u64(vreinterpret_u64_u8(vld1_u8(buf + refs[i].offset)),
+                                    vreinterpret_u64_u8(vld1_u8(buf + refs[i + 1].offset)));
+        uint64x2_t b = vcombine_u64(vreinterpret_u64_u8(vld1_u8(buf + refs[i + 2].offset)),
+                                    vreinterpret_u64_u8(vld1_u8(buf + refs[i + 3].offset)));
+        uint64x2_t eq = vandq_u64(vceqq_u64(vandq_u64(a, mask), want),
+                                  vceqq_u64(vandq_u64(b, mask), want));
+        if (vminvq_u32(vreinterpretq_u32_u64(eq)) != UINT32_MAX) {
+            return i + check_scalar(buf, refs + i, 4);
+        }
+    }
+    return i + check_scalar(buf, refs + i, n - i);
+}
+#endif
+
+static void parse_select(void) {
+    uint8_t want[8] = { 0 };
+    uint8_t mask[8] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+
+    memcpy(want, RAW_MSG_MAGIC, 4);
+    want[4] = RAW_PROTOCOL_VERSION;
+    lead_want = load64(want);
+    lead_mask = load64(mask);
+
+#ifdef PARSE_HAVE_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        check_fn = check_avx2;
+        parse_impl_name = "avx2";
+        return;
+    }
+#endif
+
+#ifdef PARSE_HAVE_NEON
+    // Part of the AArch64 baseline
+    check_fn = check_neon;
+    parse_impl_name = "neon";
+#else
+    check_fn = check_scalar;
+    parse_impl_name = "scalar";
+#endif
+}
+
+// Error code of a header that failed the walk or the leading byte check
+static int classify(const uint8_t *msg, size_t avail) {
+    raw_msg_header_t hdr;
+
+    memcpy(&hdr, msg, sizeof(hdr));
+    if (memcmp(hdr.magic, RAW_MSG_MAGIC, 4) != 0) return RAW_PARSE_BAD_MAGIC;
+    if (hdr.version != RAW_PROTOCOL_VERSION) return RAW_PARSE_BAD_VERSION;
+    if (hdr.length > avail - sizeof(hdr)) return RAW_PARSE_BAD_LENGTH;
+    return 0;
+}
+
+int raw_parse_batch(const uint8_t *buf, size_t len, size_t start,
+                    raw_frame_ref_t *out, int max, size_t *next, int *error) {
+    const size_t hdr_len = sizeof(raw_msg_header_t);
+    size_t off = start;
+    int n = 0;
+
+    pthread_once(&parse_once, parse_select);
+    *error = 0;
+
+    // Delimit the messages by their length fields
+    while (n < max && off < len) {
+        if (len - off < hdr_len) {
+            *error = RAW_PARSE_SHORT;
+            break;
+        }
+
+        uint32_t length;
+        memcpy(&length, buf + off + offsetof(raw_msg_header_t, length), sizeof(length));
+        if (length > len - off - hdr_len) {
+            *error = RAW_PARSE_BAD_LENGTH;
+            break;
+        }
+
+        out[n].offset = (uint32_t)off;
+        out[n].length = length;
+        n++;
+        off += hdr_len + length;
+    }
+
+    // Magic and version of all of them. A header the walk stopped at is
+    // reported as bad magic or version first, as a single message would be.
+    int bad = check_fn(buf, out, n);
+    if (bad < n) {
+        n = bad;
+        *error = classify(buf + out[n].offset, len - out[n].offset);
+    } else if (*error == RAW_PARSE_BAD_LENGTH) {
+        *error = classify(buf + off, len - off);
+    }
+
+    // Checksums, over the header with the checksum field zeroed
+    for (int i = 0; i < n; i++) {
+        const uint8_t *msg = buf + out[i].offset;
+        raw_msg_header_t hdr;
+
+        memcpy(&hdr, msg, sizeof(hdr));
+        if ((hdr.flags & RAW_FLAG_CSUM_MASK) != RAW_CSUM_CRC32C) continue;
+
+        uint32_t expect = hdr.checksum;
+        hdr.checksum = 0;
+        uint32_t crc = usb_crc32c(0, &hdr, sizeof(hdr));
+        crc = usb_crc32c(crc, msg + hdr_len, out[i].length);
+        if (crc != expect) {
+            n = i;
+            *error = RAW_PARSE_BAD_CHECKSUM;
+            break;
+        }
+    }
+
+    *next = n > 0 ? out[n - 1].offset + hdr_len + out[n - 1].length : start;
+    return n;
+}
+
+const char *raw_parse_impl(void) {
+    pthread_once(&parse_once, parse_select);
+    return parse_impl_name;
+}
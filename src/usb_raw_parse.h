@@ -0,0 +1,53 @@
+// USB-C Software Network - Raw Protocol Batch Parser
+// Validates every protocol message of an aggregated transport message
+// before any of them is dispatched. A batch is checked in three passes:
+//   1. a scalar walk along the length fields, which delimit the records
+//      and so cannot be done in parallel
+//   2. the fixed leading bytes (magic and version) of all headers found,
+//      compared several headers at a time: AVX2 gathers on x86-64, NEON
+//      on AArch64, one 64-bit compare per header otherwise
+//   3. the CRC32C of each frame that carries one (see usb_crc32c.h)
+// The walk stops at the first message that fails; everything before it is
+// returned for dispatch, and the rest of the transport message is lost as
+// it cannot be delimited.
+
+#ifndef USB_RAW_PARSE_H
+#define USB_RAW_PARSE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define RAW_PARSE_BATCH 64  // Frames validated per raw_parse_batch() call
+
+// Validation failures, in the order they are checked
+#define RAW_PARSE_SHORT        -1  // Truncated header
+#define RAW_PARSE_BAD_MAGIC    -2
+#define RAW_PARSE_BAD_VERSION  -3
+#define RAW_PARSE_BAD_LENGTH   -4  // Payload runs past the transport message
+#define RAW_PARSE_BAD_CHECKSUM -5
+
+// A validated protocol message
+typedef struct {
+    uint32_t offset;             // Of the header within the buffer
+    uint32_t length;             // Payload length
+} raw_frame_ref_t;
+
+// Validate up to max messages of buf[start..len). Returns the number of
+// valid messages stored in out and sets *next to the offset following the
+// last of them. *error is 0 if the walk ended at len or after max
+// messages, otherwise the RAW_PARSE_* code of the message at *next.
+int raw_parse_batch(const uint8_t *buf, size_t len, size_t start,
+                    raw_frame_ref_t *out, int max, size_t *next, int *error);
+
+// Name of the header check in use ("avx2", "neon", "scalar")
+const char *raw_parse_impl(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // USB_RAW_PARSE_H
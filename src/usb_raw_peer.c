@@ -0,0 +1,77 @@
+// USB-C Software Network - Raw Peer Table Implementation
+
+#include "usb_raw_peer.h"
+#include <string.h>
+
+// Fibonacci hashing; local IDs are random but keep the mix cheap anyway
+static int bucket_of(uint32_t id) {
+    return (int)((id * 0x9E3779B1u) >> 27) & (RAW_PEER_HASH_SIZE - 1);
+}
+
+void raw_peer_table_init(raw_peer_table_t *table) {
+    memset(table, 0, sizeof(raw_peer_table_t));
+    memset(table->index, -1, sizeof(table->index));
+}
+
+raw_peer_t *raw_peer_find(raw_peer_table_t *table, uint32_t id) {
+    if (id == 0) return NULL;
+
+    for (int b = bucket_of(id), n = 0; n < RAW_PEER_HASH_SIZE;
+         b = (b + 1) & (RAW_PEER_HASH_SIZE - 1), n++) {
+        int i = table->index[b];
+        if (i < 0) return NULL;
+        if (table->peers[i].id == id) return &table->peers[i];
+    }
+    return NULL;
+}
+
+raw_peer_t *raw_peer_add(raw_peer_table_t *table, uint32_t id) {
+    raw_peer_t *peer = raw_peer_find(table, id);
+    if (peer || id == 0) return peer;
+    if (table->count >= RAW_PEER_MAX) return NULL;
+
+    int slot = 0;
+    while (table->peers[slot].id != 0) slot++;
+
+    int b = bucket_of(id);
+    while (table->index[b] >= 0) {
+        b = (b + 1) & (RAW_PEER_HASH_SIZE - 1);
+    }
+
+    peer = &table->peers[slot];
+    memset(peer, 0, sizeof(raw_peer_t));
+    peer->id = id;
+    table->index[b] = (int8_t)slot;
+    table->count++;
+    return peer;
+}
+
+void raw_peer_remove(raw_peer_table_t *table, raw_peer_t *peer) {
+    int slot = (int)(peer - table->peers);
+    int b = bucket_of(peer->id);
+
+    while (table->index[b] != slot) {
+        if (table->index[b] < 0) return;  // Not in the table
+        b = (b + 1) & (RAW_PEER_HASH_SIZE - 1);
+    }
+
+    // Backward-shift deletion: pull later members of the probe run into
+    // the hole so lookups never stop early at it
+    int hole = b;
+    for (int next = (hole + 1) & (RAW_PEER_HASH_SIZE - 1);
+         table->index[next] >= 0;
+         next = (next + 1) & (RAW_PEER_HASH_SIZE - 1)) {
+        int home = bucket_of(table->peers[table->index[next]].id);
+        // Movable unless its home bucket lies cyclically in (hole, next]
+        bool stays = (hole <= next) ? (home > hole && home <= next)
+                                    : (home > hole || home <= next);
+        if (!stays) {
+            table->index[hole] = table->index[next];
+            hole = next;
+        }
+    }
+    table->index[hole] = -1;
+
+    memset(peer, 0, sizeof(raw_peer_t));
+    table->count--;
+}
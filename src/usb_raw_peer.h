@@ -0,0 +1,87 @@
+// USB-C Software Network - Raw Peer Table
+// Connection state for every peer a raw communication context talks to.
+// Peers are indexed by ID in a small open-addressing hash table, so the
+// receive path finds the sender of each message in O(1) however many
+// boards share the hub or daisy chain.
+//
+// Entries live in a fixed array: a raw_peer_t pointer stays valid until
+// the peer is removed, and a removed entry reads as disconnected.
+
+#ifndef USB_RAW_PEER_H
+#define USB_RAW_PEER_H
+
+#include "usb_raw_comm.h"
+
+#define RAW_PEER_MAX        16    // Peers tracked per context
+#define RAW_PEER_HASH_SIZE  32    // Hash slots, power of two > RAW_PEER_MAX
+
+typedef struct raw_peer {
+    uint32_t id;                 // 0 = free entry
+    raw_conn_state_t state;      // DETECTING (discovered), HANDSHAKING or CONNECTED
+                                 // (DISCONNECTED while suspended)
+
+    // Sequence numbers, restarted by every handshake (kept by a resume)
+    uint32_t seq_tx;             // Next RAW_MSG_DATA sequence number
+    uint32_t seq_rx;             // Next RAW_MSG_DATA sequence expected
+
+    // Negotiated with this peer through the capability blocks of the
+    // handshake (usb_raw_caps.h), see raw_comm_set_window/checksum/mtu()
+    struct raw_window *window;   // Reliable delivery state, NULL if unreliable
+    bool reliable;
+    int peer_window_size;        // Window offered in the peer's handshake
+    raw_csum_t peer_csum;        // Checksum requested by the peer
+    raw_csum_t csum;             // In effect for data frames
+    size_t peer_mtu;             // MTU offered by the peer
+    size_t link_mtu;             // In effect for this connection
+    uint32_t peer_batch_us;      // Batch delay the peer asked for
+    uint32_t peer_features;      // RAW_FEAT_* from the peer's capabilities
+
+    // Session resumption, see raw_resume_t
+    uint32_t ticket_local;       // Issued to the peer in our capabilities
+    uint32_t ticket_peer;        // Issued by the peer, 0 = cannot resume
+    int64_t suspended_ms;        // When the link was lost, 0 = not suspended
+
+    // Liveness, see raw_comm_set_keepalive()
+    int64_t last_rx_ms;          // CLOCK_MONOTONIC time of the last message
+    int64_t last_tx_ms;          // Last data frame sent to the peer
+    int64_t ka_srtt_us;          // Keepalive round trip, 0 = no sample yet
+    int64_t ka_rttvar_us;
+    int64_t ka_probe_ms;         // Last request while the peer is silent
+    int ka_probes;               // Requests since the peer was last heard
+    bool ka_piggyback;           // Ask on the next data frame
+    bool ka_reply;               // Answer a piggybacked request
+
+    // Payload compression, see raw_comm_set_compression()
+    uint32_t peer_codecs;        // The peer can decompress
+    uint32_t peer_codecs_wanted; // ... and asked for
+    usb_codec_t codec;           // For data frames to the peer
+    bool comp_pending;           // Next data header marks a compressed payload
+    int comp_skip;               // Frames left to send uncompressed
+    int comp_backoff;            // Length of the next bypass
+
+    // Statistics
+    unsigned long tx_frames;
+    unsigned long tx_bytes;
+    unsigned long rx_frames;
+    unsigned long rx_bytes;
+} raw_peer_t;
+
+typedef struct raw_peer_table {
+    raw_peer_t peers[RAW_PEER_MAX];
+    int8_t index[RAW_PEER_HASH_SIZE];  // Entry in peers[], -1 = empty
+    int count;
+} raw_peer_table_t;
+
+// Empty the table
+void raw_peer_table_init(raw_peer_table_t *table);
+
+// Look up a peer, NULL if unknown
+raw_peer_t *raw_peer_find(raw_peer_table_t *table, uint32_t id);
+
+// Look up a peer, adding a zeroed entry if unknown. NULL if the table is full.
+raw_peer_t *raw_peer_add(raw_peer_table_t *table, uint32_t id);
+
+// Remove a peer. The caller releases its window first.
+void raw_peer_remove(raw_peer_table_t *table, raw_peer_t *peer);
+
+#endif // USB_RAW_PEER_H
@@ -0,0 +1,575 @@
+// USB-C Software Network - Threaded Raw Communication Runtime Implementation
+//
+// The runtime slips a queue-backed transport between the protocol and the
+// real one (raw_comm_swap_transport()): the control thread's sends land in
+// link_tx and its receives come from link_rx, whose eventfd the context's
+// event loop watches in place of the real transport's fd. Only the RX and
+// TX threads touch the real transport, each through its own direction, so
+// they never need a lock between them.
+
+#define _GNU_SOURCE
+#include "usb_raw_runtime.h"
+#include "usb_raw_transport.h"
+#include "usb_raw_peer.h"
+#include "usb_raw_window.h"
+#include "usb_log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#define RAW_RUNTIME_TX_RETRY_MS   100  // Longest a message waits for a full transport
+#define RAW_RUNTIME_TX_BACKOFF_US 50
+#define RAW_RUNTIME_BACKOFF_MS    1    // Control thread re-check while a queue is full
+#define RAW_RUNTIME_IDLE_POLL_MS  10   // Transports without a readiness fd
+#define RAW_RUNTIME_LINK_RESERVE  8    // link_tx slots kept for ACKs and retransmissions
+
+// Why the control thread stopped taking application payloads
+typedef enum {
+    SUBMIT_IDLE = 0,             // Channel queues drained
+    SUBMIT_HOLD,                 // No peer connected yet
+    SUBMIT_WINDOW,               // Send window full (for this priority), waiting for ACKs
+    SUBMIT_LINK                  // link_tx nearly full, waiting for the TX thread
+} submit_state_t;
+
+static int64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void ring_fd(int fd) {
+    uint64_t one = 1;
+    if (write(fd, &one, sizeof(one)) < 0) {
+        USB_LOG_ERROR("runtime eventfd: %s\n", strerror(errno));
+    }
+}
+
+// Queue-backed transport seen by the protocol on the control thread
+
+static int queue_transport_send(raw_comm_ctx_t *ctx, const uint8_t *msg, size_t len) {
+    raw_runtime_t *rt = ctx->runtime;
+
+    if (len > rt->link_tx.slot_size) return -1;
+
+    usb_queue_slot_t *slot = usb_queue_reserve(&rt->link_tx);
+    if (!slot) {
+        errno = EAGAIN;
+        return -1;  // Same as a full transport ring: retransmission recovers
+    }
+
+    memcpy(slot->data, msg, len);
+    slot->len = len;
+    usb_queue_commit(&rt->link_tx, slot);
+    return (int)len;
+}
+
+static int queue_transport_recv(raw_comm_ctx_t *ctx, uint8_t *msg, size_t max_len,
+                                uint32_t *from_id) {
+    raw_runtime_t *rt = ctx->runtime;
+
+    usb_queue_slot_t *slot = usb_queue_peek(&rt->link_rx);
+    if (!slot) return 0;
+
+    size_t copy_len = (slot->len < max_len) ? slot->len : max_len;
+    memcpy(msg, slot->data, copy_len);
+    *from_id = slot->peer_id;
+    usb_queue_release(&rt->link_rx, slot);
+    return (int)copy_len;
+}
+
+static int queue_transport_get_fd(raw_comm_ctx_t *ctx) {
+    raw_runtime_t *rt = ctx->runtime;
+    return rt->link_rx.data_fd;
+}
+
+static const raw_transport_ops_t queue_transport = {
+    .name   = "runtime",
+    .send   = queue_transport_send,
+    .recv   = queue_transport_recv,
+    .get_fd = queue_transport_get_fd,
+};
+
+// RX thread: real transport -> link_rx
+static void *rx_main(void *arg) {
+    raw_runtime_t *rt = arg;
+    raw_comm_ctx_t *ctx = rt->ctx;
+    int fd = rt->link->get_fd ? rt->link->get_fd(ctx) : -1;
+    usb_queue_slot_t *slot = NULL;
+
+    // The reserved slot is kept across waits: this is the only producer, so
+    // holding it back blocks nobody
+    while (!atomic_load(&rt->link_stop)) {
+        if (!slot) slot = usb_queue_reserve(&rt->link_rx);
+        if (!slot) {
+            if (usb_queue_wait_space(&rt->link_rx, -1, rt->link_stop_fd) < 0) break;
+            continue;
+        }
+
+        uint32_t from_id = 0;
+        int n = rt->link->recv(ctx, slot->data, rt->link_rx.slot_size, &from_id);
+        if (n > 0) {
+            slot->len = (size_t)n;
+            slot->peer_id = from_id;
+            usb_queue_commit(&rt->link_rx, slot);
+            slot = NULL;
+            continue;
+        }
+
+        struct pollfd pfd[2] = {
+            { .fd = fd, .events = POLLIN },
+            { .fd = rt->link_stop_fd, .events = POLLIN },
+        };
+        if (poll(pfd, 2, (fd >= 0 && n == 0) ? -1 : RAW_RUNTIME_IDLE_POLL_MS) < 0 &&
+            errno != EINTR) {
+            USB_LOG_ERROR("runtime RX poll: %s\n", strerror(errno));
+            break;
+        }
+    }
+
+    if (slot) usb_queue_abort(&rt->link_rx, slot);
+    return NULL;
+}
+
+// Send the oldest message in link_tx, retrying for a while if the
+// transport is full
+static void send_head(raw_runtime_t *rt, bool retry) {
+    usb_queue_slot_t *slot = usb_queue_peek(&rt->link_tx);
+    if (!slot) return;
+
+    int64_t deadline = 0;
+    for (int attempt = 0; ; attempt++) {
+        errno = 0;
+        if (rt->link->send(rt->ctx, slot->data, slot->len) >= 0 || errno != EAGAIN) break;
+
+        if (attempt == 0) {
+            atomic_fetch_add(&rt->link_tx_full, 1);
+            deadline = now_ms() + RAW_RUNTIME_TX_RETRY_MS;
+        }
+        if (!retry || now_ms() >= deadline) {
+            atomic_fetch_add(&rt->link_tx_dropped, 1);
+            break;
+        }
+        if (attempt < 16) {
+            sched_yield();
+        } else {
+            usleep(RAW_RUNTIME_TX_BACKOFF_US);
+        }
+    }
+
+    usb_queue_release(&rt->link_tx, slot);
+}
+
+// TX thread: link_tx -> real transport
+static void *tx_main(void *arg) {
+    raw_runtime_t *rt = arg;
+
+    while (!atomic_load(&rt->link_stop)) {
+        if (usb_queue_wait_data(&rt->link_tx, -1, rt->link_stop_fd) < 0) break;
+        send_head(rt, true);
+    }
+
+    // Whatever the control thread queued before it stopped
+    while (usb_queue_peek(&rt->link_tx)) {
+        send_head(rt, false);
+    }
+    return NULL;
+}
+
+// Move delivered payloads into app_rx. Returns true if app_rx is full.
+static bool deliver(raw_runtime_t *rt) {
+    raw_comm_ctx_t *ctx = rt->ctx;
+
+    do {
+        usb_queue_slot_t *slot = usb_queue_reserve(&rt->app_rx);
+        if (!slot) return true;
+
+        usb_frame_t view;
+        uint32_t from_id = 0;
+        if (raw_comm_recv_frame_from(ctx, &view, &from_id) <= 0) {
+            usb_queue_abort(&rt->app_rx, slot);
+            break;
+        }
+
+        slot->len = (view.len < rt->app_rx.slot_size) ? view.len : rt->app_rx.slot_size;
+        slot->peer_id = from_id;
+        slot->channel = view.channel;
+        memcpy(slot->data, view.data, slot->len);
+        raw_comm_release_frame(ctx, &view);
+        usb_queue_commit(&rt->app_rx, slot);
+        atomic_fetch_add(&rt->rx_msgs, 1);
+    } while (raw_comm_poll(ctx, 0) > 0);
+
+    return false;
+}
+
+// Next payload to send within a priority level (deficit round robin),
+// NULL if all its channels are empty. A channel sends while its head fits
+// in its deficit; its turn passes on once it does not after one quantum.
+static raw_runtime_channel_t *schedule_level(raw_runtime_t *rt, raw_runtime_level_t *lv,
+                                             usb_queue_slot_t **slot) {
+    for (int i = 0; i <= lv->count; i++) {
+        raw_runtime_channel_t *ch = &rt->channels[rt->order[lv->first + lv->cur]];
+        usb_queue_slot_t *head = usb_queue_peek(&ch->queue);
+
+        if (head) {
+            if (head->len > ch->deficit && !lv->topped) {
+                ch->deficit += (size_t)ch->weight * ch->queue.slot_size;
+                lv->topped = true;
+            }
+            if (head->len <= ch->deficit) {
+                *slot = head;
+                return ch;
+            }
+        } else {
+            ch->deficit = 0;  // No credit saved up while idle
+        }
+
+        lv->cur = (lv->cur + 1) % lv->count;
+        lv->topped = false;
+    }
+    return NULL;
+}
+
+// Whether a payload of a channel at level may take a slot of win: all but
+// the most urgent level leave the reserve free
+static bool window_open(const raw_window_t *win, int level) {
+    int limit = win->size < win->peer_window ? win->size : win->peer_window;
+
+    if (level > 0) {
+        limit -= (RAW_RUNTIME_WINDOW_RESERVE < win->size / 2) ? RAW_RUNTIME_WINDOW_RESERVE :
+                 win->size / 2;
+    }
+    return raw_window_in_flight(win) < limit;
+}
+
+// Hand queued application payloads to the protocol, most urgent channel
+// first, while it can take them without blocking. *watch is set to the
+// number of priority levels whose queues should wake the control thread.
+static submit_state_t submit(raw_runtime_t *rt, int *watch) {
+    raw_comm_ctx_t *ctx = rt->ctx;
+
+    *watch = 0;
+    for (;;) {
+        usb_queue_slot_t *slot = NULL;
+        raw_runtime_channel_t *ch = NULL;
+        int level = 0;
+        while (level < rt->level_count &&
+               (ch = schedule_level(rt, &rt->levels[level], &slot)) == NULL) {
+            level++;
+        }
+        if (!ch) {
+            *watch = rt->level_count;
+            return SUBMIT_IDLE;
+        }
+
+        if (ctx->state != RAW_STATE_CONNECTED) return SUBMIT_HOLD;
+
+        const raw_peer_t *peer = raw_comm_find_peer(ctx, slot->peer_id ? slot->peer_id : ctx->peer_id);
+        if (!peer || peer->state != RAW_STATE_CONNECTED) {
+            atomic_fetch_add(&rt->tx_dropped, 1);
+            usb_queue_release(&ch->queue, slot);
+            continue;
+        }
+        if (peer->reliable && !window_open(peer->window, level)) {
+            // More urgent channels may still use the reserve
+            *watch = level;
+            return SUBMIT_WINDOW;
+        }
+        if (usb_queue_depth(&rt->link_tx) - usb_queue_count(&rt->link_tx) < RAW_RUNTIME_LINK_RESERVE) {
+            return SUBMIT_LINK;
+        }
+
+        uint8_t channel = (uint8_t)(ch - rt->channels);
+        if (raw_comm_send_channel(ctx, slot->peer_id, channel, slot->data, slot->len) >= 0) {
+            atomic_fetch_add(&rt->tx_msgs, 1);
+            atomic_fetch_add(&ch->tx_msgs, 1);
+        } else {
+            atomic_fetch_add(&rt->tx_dropped, 1);
+        }
+        ch->deficit -= slot->len;
+        usb_queue_release(&ch->queue, slot);
+    }
+}
+
+// Control thread: protocol state machine and the application queues
+static void *control_main(void *arg) {
+    raw_runtime_t *rt = arg;
+    raw_comm_ctx_t *ctx = rt->ctx;
+
+    while (!atomic_load(&rt->stop)) {
+        int ready = raw_comm_poll(ctx, 0);
+        if (ready < 0) {
+            USB_LOG_ERROR("Raw runtime: event loop failed, stopping\n");
+            atomic_store(&rt->state, RAW_STATE_ERROR);
+            break;
+        }
+
+        bool rx_full = (ready > 0) && deliver(rt);
+        int watch;
+        submit_state_t tx = submit(rt, &watch);
+
+        atomic_store(&rt->state, (int)ctx->state);
+        atomic_store(&rt->peer_id, ctx->peer_id);
+
+        // Sleep until the protocol, the application or stop needs us. A fd
+        // that cannot be acted on is left out so it does not spin the loop.
+        struct pollfd pfd[2 + RAW_CHANNELS];
+        int nfds = 0;
+        pfd[nfds++] = (struct pollfd){ .fd = rt->stop_fd, .events = POLLIN };
+        if (!rx_full) {
+            pfd[nfds++] = (struct pollfd){ .fd = raw_comm_get_fd(ctx), .events = POLLIN };
+        }
+        int watched = watch > 0 ? rt->levels[watch - 1].first + rt->levels[watch - 1].count : 0;
+        for (int i = 0; i < watched; i++) {
+            pfd[nfds++] = (struct pollfd){ .fd = rt->channels[rt->order[i]].queue.data_fd,
+                                           .events = POLLIN };
+        }
+        int timeout = (rx_full || tx == SUBMIT_LINK) ? RAW_RUNTIME_BACKOFF_MS : -1;
+
+        if (poll(pfd, (nfds_t)nfds, timeout) < 0 && errno != EINTR) {
+            USB_LOG_ERROR("runtime control poll: %s\n", strerror(errno));
+            break;
+        }
+    }
+    return NULL;
+}
+
+static void setup_thread(pthread_t thread, const char *name, int cpu) {
+    pthread_setname_np(thread, name);
+    if (cpu < 0) return;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    int err = pthread_setaffinity_np(thread, sizeof(set), &set);
+    if (err) {
+        USB_LOG_ERROR("Cannot pin %s thread to CPU %d: %s\n", name, cpu, strerror(err));
+    } else {
+        USB_LOG_INFO("Raw runtime: %s thread pinned to CPU %d\n", name, cpu);
+    }
+}
+
+void raw_runtime_opts_init(raw_runtime_opts_t *opts) {
+    opts->queue_depth = RAW_RUNTIME_QUEUE_DEFAULT;
+    opts->cpu_rx = -1;
+    opts->cpu_tx = -1;
+    opts->cpu_control = -1;
+    memset(opts->channels, 0, sizeof(opts->channels));
+    opts->channels[RAW_CHANNEL_DEFAULT].weight = 1;
+}
+
+// Group the used channels into priority levels, most urgent first
+static int setup_channels(raw_runtime_t *rt, const raw_runtime_opts_t *opts, int depth,
+                          size_t payload) {
+    int used = 0;
+
+    for (int i = 0; i < RAW_CHANNELS; i++) {
+        const raw_channel_opts_t *co = &opts->channels[i];
+        if (co->weight <= 0) continue;
+        if (co->priority < 0) {
+            USB_LOG_ERROR("Raw runtime: channel %d has negative priority %d\n", i, co->priority);
+            return -1;
+        }
+        if (usb_queue_init(&rt->channels[i].queue, depth, payload) < 0) return -1;
+        rt->channels[i].weight = co->weight;
+        rt->channels[i].priority = co->priority;
+
+        // Insertion by priority, keeping channel order within a priority
+        int pos = used++;
+        while (pos > 0 && rt->channels[rt->order[pos - 1]].priority > co->priority) {
+            rt->order[pos] = rt->order[pos - 1];
+            pos--;
+        }
+        rt->order[pos] = (uint8_t)i;
+    }
+    if (used == 0) {
+        USB_LOG_ERROR("Raw runtime: no channel in use\n");
+        return -1;
+    }
+
+    for (int i = 0; i < used; i++) {
+        raw_runtime_level_t *last = rt->level_count > 0 ? &rt->levels[rt->level_count - 1] : NULL;
+        if (last && rt->channels[rt->order[i]].priority ==
+                    rt->channels[rt->order[last->first]].priority) {
+            last->count++;
+        } else {
+            rt->levels[rt->level_count++] = (raw_runtime_level_t){ .first = i, .count = 1 };
+        }
+    }
+    return 0;
+}
+
+int raw_runtime_start(raw_runtime_t *rt, raw_comm_ctx_t *ctx, const raw_runtime_opts_t *opts) {
+    raw_runtime_opts_t defaults;
+
+    if (!opts) {
+        raw_runtime_opts_init(&defaults);
+        opts = &defaults;
+    }
+
+    memset(rt, 0, sizeof(raw_runtime_t));
+    rt->stop_fd = rt->link_stop_fd = -1;
+    if (!ctx->transport || ctx->runtime) {
+        USB_LOG_ERROR("Raw runtime: context has no transport or is already running\n");
+        return -1;
+    }
+
+    int depth = opts->queue_depth > 0 ? opts->queue_depth : RAW_RUNTIME_QUEUE_DEFAULT;
+    size_t payload = ctx->mtu - RAW_FRAME_HEADROOM;
+    if (usb_queue_init(&rt->link_rx, depth, ctx->mtu) < 0 ||
+        usb_queue_init(&rt->link_tx, depth, ctx->mtu) < 0 ||
+        usb_queue_init(&rt->app_rx, depth, payload) < 0 ||
+        setup_channels(rt, opts, depth, payload) < 0) {
+        raw_runtime_stop(rt);
+        return -1;
+    }
+
+    rt->stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    rt->link_stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (rt->stop_fd < 0 || rt->link_stop_fd < 0) {
+        USB_LOG_ERROR("runtime eventfd: %s\n", strerror(errno));
+        raw_runtime_stop(rt);
+        return -1;
+    }
+
+    rt->ctx = ctx;
+    ctx->runtime = rt;
+    atomic_store(&rt->state, (int)ctx->state);
+    atomic_store(&rt->peer_id, ctx->peer_id);
+    rt->link = raw_comm_swap_transport(ctx, &queue_transport);
+
+    struct {
+        pthread_t *thread;
+        void *(*main)(void *);
+        const char *name;
+        int cpu;
+    } threads[] = {
+        { &rt->rx_thread,      rx_main,      "raw-rx",  opts->cpu_rx },
+        { &rt->tx_thread,      tx_main,      "raw-tx",  opts->cpu_tx },
+        { &rt->control_thread, control_main, "raw-ctl", opts->cpu_control },
+    };
+
+    for (int i = 0; i < 3; i++) {
+        int err = pthread_create(threads[i].thread, NULL, threads[i].main, rt);
+        if (err != 0) {
+            USB_LOG_ERROR("Failed to start %s thread: %s\n", threads[i].name, strerror(err));
+            raw_runtime_stop(rt);
+            return -1;
+        }
+        rt->threads++;
+        setup_thread(*threads[i].thread, threads[i].name, threads[i].cpu);
+    }
+
+    USB_LOG_INFO("Raw runtime: RX, TX and control threads started (%d-message queues)\n",
+                 usb_queue_depth(&rt->app_rx));
+    for (int i = 0; i < rt->level_count; i++) {
+        for (int j = 0; j < rt->levels[i].count; j++) {
+            const raw_runtime_channel_t *ch = &rt->channels[rt->order[rt->levels[i].first + j]];
+            USB_LOG_DEBUG("Raw runtime: channel %u, priority %d, weight %d\n",
+                          rt->order[rt->levels[i].first + j], ch->priority, ch->weight);
+        }
+    }
+    return 0;
+}
+
+void raw_runtime_stop(raw_runtime_t *rt) {
+    if (rt->threads >= 3) {
+        atomic_store(&rt->stop, true);
+        ring_fd(rt->stop_fd);
+        pthread_join(rt->control_thread, NULL);
+    }
+    if (rt->threads >= 1) {
+        atomic_store(&rt->link_stop, true);
+        ring_fd(rt->link_stop_fd);
+        if (rt->threads >= 2) pthread_join(rt->tx_thread, NULL);
+        pthread_join(rt->rx_thread, NULL);
+    }
+    rt->threads = 0;
+
+    if (rt->ctx) {
+        raw_comm_swap_transport(rt->ctx, rt->link);
+        rt->ctx->runtime = NULL;
+        rt->ctx = NULL;
+    }
+
+    usb_queue_free(&rt->link_rx);
+    usb_queue_free(&rt->link_tx);
+    usb_queue_free(&rt->app_rx);
+    for (int i = 0; i < RAW_CHANNELS; i++) {
+        usb_queue_free(&rt->channels[i].queue);
+    }
+    if (rt->stop_fd >= 0) close(rt->stop_fd);
+    if (rt->link_stop_fd >= 0) close(rt->link_stop_fd);
+    rt->stop_fd = rt->link_stop_fd = -1;
+}
+
+int raw_runtime_send_channel(raw_runtime_t *rt, uint32_t peer_id, uint8_t channel,
+                             const uint8_t *data, size_t len, int timeout_ms) {
+    if (channel >= RAW_CHANNELS || rt->channels[channel].weight <= 0) {
+        USB_LOG_ERROR("Cannot send: channel %u not in use\n", channel);
+        return -1;
+    }
+
+    usb_queue_t *q = &rt->channels[channel].queue;
+    if (len > q->slot_size) {
+        USB_LOG_WARN_RATELIMIT("Cannot send: %zu bytes exceeds %zu byte payload limit\n",
+                               len, q->slot_size);
+        return -1;
+    }
+
+    int64_t deadline = now_ms() + timeout_ms;
+    usb_queue_slot_t *slot;
+    while ((slot = usb_queue_reserve(q)) == NULL) {
+        int wait_ms = -1;
+        if (timeout_ms >= 0) {
+            wait_ms = (int)(deadline - now_ms());
+            if (wait_ms < 0) wait_ms = 0;
+        }
+        int ret = usb_queue_wait_space(q, wait_ms, rt->stop_fd);
+        if (ret <= 0) return ret;
+    }
+
+    memcpy(slot->data, data, len);
+    slot->len = len;
+    slot->peer_id = peer_id;
+    usb_queue_commit(q, slot);
+    return (int)len;
+}
+
+int raw_runtime_send(raw_runtime_t *rt, uint32_t peer_id, const uint8_t *data, size_t len,
+                     int timeout_ms) {
+    return raw_runtime_send_channel(rt, peer_id, RAW_CHANNEL_DEFAULT, data, len, timeout_ms);
+}
+
+int raw_runtime_recv_channel(raw_runtime_t *rt, uint8_t *buffer, size_t max_len,
+                             uint32_t *peer_id, uint8_t *channel, int timeout_ms) {
+    int ret = usb_queue_wait_data(&rt->app_rx, timeout_ms, rt->stop_fd);
+    if (ret <= 0) return ret;
+
+    usb_queue_slot_t *slot = usb_queue_peek(&rt->app_rx);
+    size_t copy_len = (slot->len < max_len) ? slot->len : max_len;
+    memcpy(buffer, slot->data, copy_len);
+    if (peer_id) *peer_id = slot->peer_id;
+    if (channel) *channel = slot->channel;
+    usb_queue_release(&rt->app_rx, slot);
+    return (int)copy_len;
+}
+
+int raw_runtime_recv(raw_runtime_t *rt, uint8_t *buffer, size_t max_len, uint32_t *peer_id,
+                     int timeout_ms) {
+    return raw_runtime_recv_channel(rt, buffer, max_len, peer_id, NULL, timeout_ms);
+}
+
+raw_conn_state_t raw_runtime_get_state(raw_runtime_t *rt) {
+    return (raw_conn_state_t)atomic_load(&rt->state);
+}
+
+uint32_t raw_runtime_get_peer_id(raw_runtime_t *rt) {
+    return atomic_load(&rt->peer_id);
+}
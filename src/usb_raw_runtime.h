@@ -0,0 +1,149 @@
+// USB-C Software Network - Threaded Raw Communication Runtime
+// Runs a raw communication context on three threads so that sending and
+// receiving no longer take turns on the caller's thread:
+//
+//   RX thread       - the only caller of the transport's recv(); moves
+//                     transport messages into a queue as they arrive
+//   TX thread       - the only caller of the transport's send(); rides out
+//                     a full transport ring without stalling the protocol
+//   control thread  - owns the raw_comm context: discovery, handshakes,
+//                     timers, ACKs and retransmissions, and moves payloads
+//                     between the application queues and the protocol
+//
+// The threads talk through bounded lock-free queues (usb_queue.h). The
+// application hands payloads to raw_runtime_send() from any number of
+// threads and takes delivered payloads from raw_runtime_recv() on one.
+//
+// Payloads can be sent on several logical channels (RAW_CHANNELS), each
+// with its own queue. The control thread serves them in strict priority
+// order; channels of equal priority share the link by weight (deficit
+// round robin, weight full-size payloads per round). Channels below the
+// most urgent priority also leave RAW_RUNTIME_WINDOW_RESERVE slots of a
+// reliable window free, so that a bulk transfer filling the window does
+// not make the next urgent message wait for ACKs. It still follows the
+// frames already in flight, so on a slow link a smaller window bounds its
+// latency.
+// Configure the context (transport, MTU, window, checksum, batching)
+// before starting the runtime and stop it before raw_comm_cleanup().
+
+#ifndef USB_RAW_RUNTIME_H
+#define USB_RAW_RUNTIME_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include "usb_raw_comm.h"
+#include "usb_queue.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define RAW_RUNTIME_QUEUE_DEFAULT 256   // Messages per queue
+#define RAW_RUNTIME_WINDOW_RESERVE 2    // Window slots only the most urgent channels use
+
+typedef struct {
+    int weight;                  // Share among equal priorities, 0 = channel not used
+    int priority;                // 0 = most urgent
+} raw_channel_opts_t;
+
+typedef struct {
+    int queue_depth;             // Messages per queue, 0 = RAW_RUNTIME_QUEUE_DEFAULT
+    int cpu_rx;                  // CPU to pin each thread to, -1 = any
+    int cpu_tx;
+    int cpu_control;
+    raw_channel_opts_t channels[RAW_CHANNELS];  // Each used one costs a queue
+} raw_runtime_opts_t;
+
+typedef struct {
+    usb_queue_t queue;           // Application -> control: payloads (MPSC)
+    int weight;
+    int priority;
+    size_t deficit;              // Bytes it may still send this round
+    usb_stat_t tx_msgs;          // Payloads handed to the protocol
+} raw_runtime_channel_t;
+
+// Channels of one priority, served round robin
+typedef struct {
+    int first;                   // Index of the first in raw_runtime_t.order
+    int count;
+    int cur;                     // Channel whose turn it is
+    bool topped;                 // ... and it has had its quantum this turn
+} raw_runtime_level_t;
+
+typedef struct raw_runtime {
+    raw_comm_ctx_t *ctx;
+    const raw_transport_ops_t *link;  // Transport below the runtime
+
+    usb_queue_t link_rx;         // RX thread -> control: transport messages
+    usb_queue_t link_tx;         // control -> TX thread: transport messages
+    usb_queue_t app_rx;          // Control -> application: payloads
+
+    raw_runtime_channel_t channels[RAW_CHANNELS];
+    uint8_t order[RAW_CHANNELS];  // Used channels by priority
+    raw_runtime_level_t levels[RAW_CHANNELS];
+    int level_count;
+
+    pthread_t rx_thread;
+    pthread_t tx_thread;
+    pthread_t control_thread;
+    int threads;                 // Started so far, in the order above
+
+    // The control thread stops first so that its last messages are still
+    // sent, then the link threads
+    int stop_fd;
+    int link_stop_fd;
+    atomic_bool stop;
+    atomic_bool link_stop;
+
+    // Published by the control thread
+    _Atomic(int) state;          // raw_conn_state_t
+    _Atomic(uint32_t) peer_id;
+
+    // Statistics
+    usb_stat_t tx_msgs;          // Payloads handed to the protocol
+    usb_stat_t rx_msgs;          // Payloads delivered to the application
+    usb_stat_t tx_dropped;       // Payloads for a peer that has gone
+    usb_stat_t link_tx_full;     // Transport ring full, send retried
+    usb_stat_t link_tx_dropped;  // Given up after RAW_RUNTIME_TX_RETRY_MS
+} raw_runtime_t;
+
+// Fill opts with defaults: no CPU pinning, default queue depth, only
+// RAW_CHANNEL_DEFAULT in use
+void raw_runtime_opts_init(raw_runtime_opts_t *opts);
+
+// Take over ctx and start the threads (opts NULL = defaults)
+int raw_runtime_start(raw_runtime_t *rt, raw_comm_ctx_t *ctx, const raw_runtime_opts_t *opts);
+
+// Stop the threads and hand the transport back to ctx
+void raw_runtime_stop(raw_runtime_t *rt);
+
+// Queue a payload for a connected peer (0 = primary), waiting up to
+// timeout_ms (-1 = forever) for queue space. Payloads are held while no
+// peer is connected. Returns len, 0 on timeout, -1 on error.
+int raw_runtime_send(raw_runtime_t *rt, uint32_t peer_id, const uint8_t *data, size_t len,
+                     int timeout_ms);
+
+// As raw_runtime_send(), on a channel set up in the options
+int raw_runtime_send_channel(raw_runtime_t *rt, uint32_t peer_id, uint8_t channel,
+                             const uint8_t *data, size_t len, int timeout_ms);
+
+// Take the next delivered payload, waiting up to timeout_ms (-1 =
+// forever). Single consumer. Returns its length (truncated to max_len),
+// 0 on timeout, -1 once stopped.
+int raw_runtime_recv(raw_runtime_t *rt, uint8_t *buffer, size_t max_len, uint32_t *peer_id,
+                     int timeout_ms);
+
+// As raw_runtime_recv(), also reporting the channel the payload came on.
+// Payloads of all channels are delivered in the order they arrived.
+int raw_runtime_recv_channel(raw_runtime_t *rt, uint8_t *buffer, size_t max_len,
+                             uint32_t *peer_id, uint8_t *channel, int timeout_ms);
+
+// Connection state and primary peer as last seen by the control thread
+raw_conn_state_t raw_runtime_get_state(raw_runtime_t *rt);
+uint32_t raw_runtime_get_peer_id(raw_runtime_t *rt);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // USB_RAW_RUNTIME_H
@@ -0,0 +1,466 @@
+// USB-C Software Network - Shared Memory Ring Transport
+// Two single-producer/single-consumer byte rings in one shared segment,
+// one per direction. Messages are stored as [u32 length][payload] records
+// padded to 8 bytes; a record that would straddle the end of the ring is
+// preceded by a padding marker and placed at offset 0 instead.
+//
+// A full ring makes send fail instead of overwriting, so nothing is lost.
+// The consumer checks each record against the ring bounds before using
+// it, as the other process can write anything there, and drops messages
+// longer than the caller's buffer (both counted as rx_errors).
+//
+// Wakeups: the producer rings the consumer's doorbell only when the
+// consumer had drained everything before this record (it may be about
+// to sleep). head/tail use seq_cst so that either the consumer sees the
+// new head or the producer sees the caught-up tail and rings.
+//
+// Segments:
+//   named  - shm_open("/<name>") with FIFO doorbells beside it in
+//            /dev/shm, so two unrelated processes on one host can attach
+//   pair   - memfd segment + eventfd doorbells for in-process loopback
+
+#define _GNU_SOURCE
+#include "usb_raw_transport.h"
+#include "usb_log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+
+#define RAW_SHM_MAGIC        0x55435348u  // "UCSH"
+#define RAW_SHM_RING_SIZE    (1u << 20)   // Bytes per direction, power of two
+#define RAW_SHM_REC_ALIGN    8
+#define RAW_SHM_PAD_MARK     0xFFFFFFFFu
+#define RAW_SHM_DATA_OFFSET  4096
+
+enum {
+    SHM_STATE_BLANK = 0,
+    SHM_STATE_INIT,
+    SHM_STATE_READY,
+    SHM_STATE_ATTACHING     // A process is claiming a side (attach lock)
+};
+
+typedef struct {
+    _Atomic uint64_t head __attribute__((aligned(64)));  // Producer position
+    _Atomic uint64_t tail __attribute__((aligned(64)));  // Consumer position
+} raw_shm_ring_ctrl_t;
+
+// Segment header, at offset 0 of the shared mapping
+typedef struct {
+    _Atomic uint32_t state;
+    uint32_t magic;
+    uint32_t ring_size;
+    uint32_t reserved;
+    _Atomic uint32_t side_pid[2];    // Attached process per side (0 = free)
+    _Atomic uint32_t side_id[2];     // local_id of each side
+    raw_shm_ring_ctrl_t ring[2];     // ring[i] is written by side i
+} raw_shm_segment_t;
+
+_Static_assert(sizeof(raw_shm_segment_t) <= RAW_SHM_DATA_OFFSET,
+               "segment header must fit before the ring data");
+
+// Per-context transport state
+typedef struct {
+    raw_shm_segment_t *seg;
+    size_t map_size;
+    int side;
+    uint32_t mask;
+    raw_shm_ring_ctrl_t *tx;
+    raw_shm_ring_ctrl_t *rx;
+    uint8_t *tx_data;
+    uint8_t *rx_data;
+    int tx_bell;                     // Peer's doorbell (we ring it)
+    int rx_bell;                     // Our doorbell (peer rings it)
+    bool named;
+    char name[96];
+} raw_shm_t;
+
+static inline uint64_t rec_size(size_t len) {
+    return (sizeof(uint32_t) + len + RAW_SHM_REC_ALIGN - 1) & ~(uint64_t)(RAW_SHM_REC_ALIGN - 1);
+}
+
+static void bell_path(char *out, size_t outlen, const char *name, int side) {
+    snprintf(out, outlen, "/dev/shm/%s.bell%d", name, side);
+}
+
+static void ring_bell(int fd) {
+    uint64_t one = 1;
+    // A full eventfd/FIFO already guarantees a pending wakeup
+    if (write(fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        USB_LOG_ERROR("shm doorbell: %s\n", strerror(errno));
+    }
+}
+
+static void drain_bell(int fd) {
+    uint8_t buf[64];
+    while (read(fd, buf, sizeof(buf)) > 0) {
+    }
+}
+
+static bool pid_alive(uint32_t pid) {
+    return pid != 0 && (kill((pid_t)pid, 0) == 0 || errno == EPERM);
+}
+
+static void attach_side(raw_comm_ctx_t *ctx, raw_shm_t *shm, int side) {
+    shm->side = side;
+    shm->mask = shm->seg->ring_size - 1;
+    shm->tx = &shm->seg->ring[side];
+    shm->rx = &shm->seg->ring[side ^ 1];
+    shm->tx_data = (uint8_t *)shm->seg + RAW_SHM_DATA_OFFSET + (size_t)side * shm->seg->ring_size;
+    shm->rx_data = (uint8_t *)shm->seg + RAW_SHM_DATA_OFFSET + (size_t)(side ^ 1) * shm->seg->ring_size;
+    atomic_store(&shm->seg->side_id[side], ctx->local_id);
+    ctx->transport_priv = shm;
+}
+
+// Initialise the segment header exactly once across all attachers
+static void init_segment(raw_shm_segment_t *seg) {
+    uint32_t expected = SHM_STATE_BLANK;
+    if (atomic_compare_exchange_strong(&seg->state, &expected, SHM_STATE_INIT)) {
+        seg->magic = RAW_SHM_MAGIC;
+        seg->ring_size = RAW_SHM_RING_SIZE;
+        atomic_store(&seg->state, SHM_STATE_READY);
+        return;
+    }
+    while (atomic_load(&seg->state) == SHM_STATE_INIT) {
+        sched_yield();
+    }
+}
+
+// Claim a free side; sides left behind by dead processes are reclaimed.
+// When no live peer is attached the rings only hold stale messages from a
+// previous session, so they are reset. Runs under the attach lock so a
+// peer attaching at the same time cannot start sending mid-reset.
+static int claim_side(raw_shm_segment_t *seg) {
+    uint32_t self = (uint32_t)getpid();
+    uint32_t ready = SHM_STATE_READY;
+
+    while (!atomic_compare_exchange_weak(&seg->state, &ready, SHM_STATE_ATTACHING)) {
+        ready = SHM_STATE_READY;
+        sched_yield();
+    }
+
+    int side = -1;
+    for (int i = 0; i < 2 && side < 0; i++) {
+        uint32_t owner = atomic_load(&seg->side_pid[i]);
+        if (owner != 0 && (owner == self || pid_alive(owner))) continue;
+        side = i;
+    }
+
+    if (side >= 0) {
+        uint32_t peer = atomic_load(&seg->side_pid[side ^ 1]);
+        if (!pid_alive(peer)) {
+            atomic_store(&seg->side_pid[side ^ 1], 0);
+            for (int i = 0; i < 2; i++) {
+                atomic_store(&seg->ring[i].head, 0);
+                atomic_store(&seg->ring[i].tail, 0);
+            }
+        }
+        atomic_store(&seg->side_pid[side], self);
+    }
+
+    atomic_store(&seg->state, SHM_STATE_READY);
+    return side;
+}
+
+// Open (or create) a named segment and claim a free side
+static int shm_open_named(raw_comm_ctx_t *ctx, const char *name) {
+    raw_shm_t *shm = calloc(1, sizeof(raw_shm_t));
+    if (!shm) return -1;
+
+    shm->named = true;
+    shm->tx_bell = shm->rx_bell = -1;
+    snprintf(shm->name, sizeof(shm->name), "%s", name);
+
+    char shm_name[112];
+    snprintf(shm_name, sizeof(shm_name), "/%s", shm->name);
+
+    int fd = shm_open(shm_name, O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+    if (fd < 0) {
+        USB_LOG_ERROR("shm_open(%s) failed: %s\n", shm_name, strerror(errno));
+        free(shm);
+        return -1;
+    }
+
+    shm->map_size = RAW_SHM_DATA_OFFSET + 2 * (size_t)RAW_SHM_RING_SIZE;
+    struct stat st;
+    if (fstat(fd, &st) < 0 || ((size_t)st.st_size < shm->map_size &&
+                               ftruncate(fd, (off_t)shm->map_size) < 0)) {
+        USB_LOG_ERROR("Cannot size shm segment %s: %s\n", shm_name, strerror(errno));
+        close(fd);
+        free(shm);
+        return -1;
+    }
+
+    shm->seg = mmap(NULL, shm->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (shm->seg == MAP_FAILED) {
+        USB_LOG_ERROR("mmap shm segment: %s\n", strerror(errno));
+        free(shm);
+        return -1;
+    }
+
+    init_segment(shm->seg);
+    if (shm->seg->magic != RAW_SHM_MAGIC || shm->seg->ring_size != RAW_SHM_RING_SIZE) {
+        USB_LOG_ERROR("shm segment %s has an incompatible layout\n", shm_name);
+        munmap(shm->seg, shm->map_size);
+        free(shm);
+        return -1;
+    }
+
+    int side = claim_side(shm->seg);
+    if (side < 0) {
+        USB_LOG_ERROR("shm segment %s already has two peers attached\n", shm_name);
+        munmap(shm->seg, shm->map_size);
+        free(shm);
+        return -1;
+    }
+
+    // FIFOs opened O_RDWR never block and are pollable from both processes
+    for (int i = 0; i < 2; i++) {
+        char path[160];
+        bell_path(path, sizeof(path), shm->name, i);
+        if (mkfifo(path, 0666) < 0 && errno != EEXIST) {
+            USB_LOG_ERROR("mkfifo(%s) failed: %s\n", path, strerror(errno));
+        }
+        int bfd = open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+        if (bfd < 0) {
+            USB_LOG_ERROR("Cannot open doorbell %s: %s\n", path, strerror(errno));
+            if (shm->rx_bell >= 0) close(shm->rx_bell);
+            if (shm->tx_bell >= 0) close(shm->tx_bell);
+            atomic_store(&shm->seg->side_pid[side], 0);
+            munmap(shm->seg, shm->map_size);
+            free(shm);
+            return -1;
+        }
+        // bell<i> wakes side i
+        if (i == side) shm->rx_bell = bfd;
+        else shm->tx_bell = bfd;
+    }
+
+    attach_side(ctx, shm, side);
+    USB_LOG_INFO("Shared memory transport: /dev/shm%s side %d (%u KiB per direction)\n",
+                 shm_name, side, RAW_SHM_RING_SIZE / 1024);
+    return 0;
+}
+
+static int shm_transport_open(raw_comm_ctx_t *ctx, const char *arg) {
+    char name[96];
+
+    if (arg && arg[0]) {
+        snprintf(name, sizeof(name), "%s", arg);
+    } else if (ctx->typec_port_path[0]) {
+        const char *base = strrchr(ctx->typec_port_path, '/');
+        snprintf(name, sizeof(name), "usbc_net_ring.%.64s", base ? base + 1 : ctx->typec_port_path);
+    } else {
+        snprintf(name, sizeof(name), "usbc_net_ring");
+    }
+
+    return shm_open_named(ctx, name);
+}
+
+static void shm_transport_close(raw_comm_ctx_t *ctx) {
+    raw_shm_t *shm = ctx->transport_priv;
+    if (!shm) return;
+
+    if (shm->named) {
+        atomic_store(&shm->seg->side_pid[shm->side], 0);
+        // Last one out removes the segment and doorbells
+        if (atomic_load(&shm->seg->side_pid[shm->side ^ 1]) == 0) {
+            char path[160];
+            snprintf(path, sizeof(path), "/%s", shm->name);
+            shm_unlink(path);
+            for (int i = 0; i < 2; i++) {
+                bell_path(path, sizeof(path), shm->name, i);
+                unlink(path);
+            }
+        }
+    }
+
+    if (shm->tx_bell >= 0) close(shm->tx_bell);
+    if (shm->rx_bell >= 0) close(shm->rx_bell);
+    munmap(shm->seg, shm->map_size);
+    free(shm);
+    ctx->transport_priv = NULL;
+}
+
+static int shm_transport_send(raw_comm_ctx_t *ctx, const uint8_t *msg, size_t len) {
+    raw_shm_t *shm = ctx->transport_priv;
+    if (!shm) return -1;
+
+    uint32_t size = shm->mask + 1;
+    uint64_t need = rec_size(len);
+    if (len >= RAW_SHM_PAD_MARK || need > size / 2) {
+        USB_LOG_WARN_RATELIMIT("Message of %zu bytes too large for shm ring\n", len);
+        return -1;
+    }
+
+    uint64_t start = atomic_load_explicit(&shm->tx->head, memory_order_relaxed);
+    uint64_t tail = atomic_load_explicit(&shm->tx->tail, memory_order_acquire);
+    uint64_t off = start & shm->mask;
+    uint64_t contiguous = size - off;
+    uint64_t pad = (contiguous < need) ? contiguous : 0;
+
+    if (size - (start - tail) < need + pad) {
+        errno = EAGAIN;
+        return -1;  // Ring full; caller retries after the peer drains it
+    }
+
+    uint64_t pos = start;
+    if (pad) {
+        uint32_t mark = RAW_SHM_PAD_MARK;
+        memcpy(shm->tx_data + off, &mark, sizeof(mark));
+        pos += pad;
+        off = 0;
+    }
+
+    uint32_t rec_len = (uint32_t)len;
+    memcpy(shm->tx_data + off, &rec_len, sizeof(rec_len));
+    memcpy(shm->tx_data + off + sizeof(rec_len), msg, len);
+
+    atomic_store(&shm->tx->head, pos + need);
+    if (atomic_load(&shm->tx->tail) == start) {
+        ring_bell(shm->tx_bell);
+    }
+
+    USB_LOG_TRACE("  [TX] Sent %zu bytes via shm ring\n", len);
+    return (int)len;
+}
+
+static int shm_transport_recv(raw_comm_ctx_t *ctx, uint8_t *msg, size_t max_len,
+                              uint32_t *from_id) {
+    raw_shm_t *shm = ctx->transport_priv;
+    if (!shm) return -1;
+
+    uint32_t size = shm->mask + 1;
+    uint64_t tail = atomic_load_explicit(&shm->rx->tail, memory_order_relaxed);
+    uint64_t head = atomic_load(&shm->rx->head);
+
+    for (;;) {
+        if (tail == head) {
+            // Empty: clear the doorbell, then re-check to close the race
+            drain_bell(shm->rx_bell);
+            head = atomic_load(&shm->rx->head);
+            if (tail == head) return 0;
+        }
+
+        uint64_t pos = tail;
+        uint64_t off = pos & shm->mask;
+        uint32_t rec_len;
+        memcpy(&rec_len, shm->rx_data + off, sizeof(rec_len));
+
+        if (rec_len == RAW_SHM_PAD_MARK) {
+            pos += size - off;
+            off = 0;
+            if (pos < head) memcpy(&rec_len, shm->rx_data, sizeof(rec_len));
+        }
+
+        // The other process writes this memory: a record has to end before
+        // the end of the ring and within what was published. If not, the
+        // framing is lost; skip everything up to the producer's head,
+        // where its next record starts.
+        if (pos >= head || rec_len > size - off - sizeof(rec_len) ||
+            rec_size(rec_len) > head - pos) {
+            usb_stat_add(&ctx->stats->rx_errors, 1);
+            USB_LOG_WARN_RATELIMIT("shm ring: corrupt record at %" PRIu64 ", %" PRIu64
+                                   " bytes discarded\n", tail, head - tail);
+            tail = head;
+            atomic_store(&shm->rx->tail, tail);
+            continue;
+        }
+
+        tail = pos + rec_size(rec_len);
+        if (rec_len > max_len) {
+            usb_stat_add(&ctx->stats->rx_errors, 1);
+            USB_LOG_WARN_RATELIMIT("shm ring: %u byte message exceeds %zu, dropped\n",
+                                   rec_len, max_len);
+            atomic_store(&shm->rx->tail, tail);
+            continue;
+        }
+
+        memcpy(msg, shm->rx_data + off + sizeof(rec_len), rec_len);
+        atomic_store(&shm->rx->tail, tail);
+
+        *from_id = atomic_load_explicit(&shm->seg->side_id[shm->side ^ 1], memory_order_relaxed);
+        USB_LOG_TRACE("  [RX] Received %u bytes via shm ring from 0x%08x\n", rec_len, *from_id);
+        return (int)rec_len;
+    }
+}
+
+static int shm_transport_get_fd(raw_comm_ctx_t *ctx) {
+    raw_shm_t *shm = ctx->transport_priv;
+    return shm ? shm->rx_bell : -1;
+}
+
+const raw_transport_ops_t raw_transport_shm = {
+    .name   = "shm",
+    .open   = shm_transport_open,
+    .close  = shm_transport_close,
+    .send   = shm_transport_send,
+    .recv   = shm_transport_recv,
+    .get_fd = shm_transport_get_fd,
+};
+
+// Anonymous ring pair for in-process loopback
+int raw_shm_open_pair(raw_comm_ctx_t *a, raw_comm_ctx_t *b) {
+    size_t map_size = RAW_SHM_DATA_OFFSET + 2 * (size_t)RAW_SHM_RING_SIZE;
+
+    int fd = memfd_create("usbc_net_ring", MFD_CLOEXEC);
+    if (fd < 0) {
+        USB_LOG_ERROR("memfd_create: %s\n", strerror(errno));
+        return -1;
+    }
+    if (ftruncate(fd, (off_t)map_size) < 0) {
+        USB_LOG_ERROR("ftruncate memfd: %s\n", strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    raw_shm_t *s[2] = { calloc(1, sizeof(raw_shm_t)), calloc(1, sizeof(raw_shm_t)) };
+    int bell[2] = { eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC), eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC) };
+    raw_comm_ctx_t *ctxs[2] = { a, b };
+
+    if (!s[0] || !s[1] || bell[0] < 0 || bell[1] < 0) {
+        USB_LOG_ERROR("shm pair setup: %s\n", strerror(errno));
+        goto fail;
+    }
+
+    for (int i = 0; i < 2; i++) {
+        s[i]->map_size = map_size;
+        s[i]->seg = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (s[i]->seg == MAP_FAILED) {
+            s[i]->seg = NULL;
+            USB_LOG_ERROR("mmap memfd: %s\n", strerror(errno));
+            goto fail;
+        }
+    }
+    close(fd);
+    fd = -1;
+
+    init_segment(s[0]->seg);
+    for (int i = 0; i < 2; i++) {
+        s[i]->rx_bell = (i == 0) ? bell[0] : dup(bell[1]);
+        s[i]->tx_bell = (i == 0) ? bell[1] : dup(bell[0]);
+        atomic_store(&s[i]->seg->side_pid[i], (uint32_t)getpid());
+        ctxs[i]->transport = &raw_transport_shm;
+        attach_side(ctxs[i], s[i], i);
+    }
+    return 0;
+
+fail:
+    for (int i = 0; i < 2; i++) {
+        if (s[i] && s[i]->seg) munmap(s[i]->seg, map_size);
+        free(s[i]);
+        if (bell[i] >= 0) close(bell[i]);
+    }
+    if (fd >= 0) close(fd);
+    return -1;
+}
@@ -0,0 +1,521 @@
+// USB-C Software Network - Simulated Link Transport
+// Joins two contexts in one process over a link with the behaviour of a
+// real one, so that windowing, batching and reconnects can be measured
+// without hardware. The link is described by a comma-separated list of
+// settings (RAW_SIM_LINK), every one optional:
+//
+//   rate=480M        bandwidth in bit/s (k, M, G), 0 = unlimited
+//   delay=100us      one-way latency (ns, us, ms, s; plain numbers are us)
+//   jitter=20us      up to this much extra latency per message, uniform
+//   loss=0.1%        messages lost on the wire
+//   reorder=1%       messages held back for another delay (at least
+//                    RAW_SIM_REORDER_MIN_NS) so later ones overtake them
+//   outage=5s/300ms  link down for the last 300 ms of every 5 s
+//   queue=1M         bytes queued for the wire before send takes no more
+//   seed=1           random number seed, for reproducible loss patterns
+//
+// Each direction is a queue of messages ordered by delivery time. A
+// message occupies the wire for len / rate after the one before it and
+// arrives delay (+ jitter) after that; without reordering, jitter never
+// lets a message overtake another. The receiver's readiness fd is a
+// timerfd armed for the earliest message, so an idle link costs nothing
+// and a delivery wakes the event loop right on time. Senders and
+// receivers may be on different threads (usb_raw_runtime.h), so every
+// direction has its own lock.
+
+#define _GNU_SOURCE
+#include "usb_raw_transport.h"
+#include "usb_log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/timerfd.h>
+
+#define RAW_SIM_QUEUE_DEFAULT  (1u << 20)  // Bytes, like a shm ring
+#define RAW_SIM_REORDER_MIN_NS 100000      // Hold-back of a reordered message with no delay
+#define RAW_SIM_HEAP_MIN       64
+
+typedef struct {
+    int64_t deliver_ns;
+    uint64_t seq;                // Tie-break: equal delivery times stay in order
+    uint32_t from_id;
+    uint32_t len;
+    uint8_t data[];
+} raw_sim_msg_t;
+
+typedef struct {
+    int64_t rate_bps;            // 0 = unlimited
+    int64_t delay_ns;
+    int64_t jitter_ns;
+    double loss;
+    double reorder;
+    int64_t outage_period_ns;    // 0 = never down
+    int64_t outage_ns;
+    size_t queue_bytes;
+    uint64_t seed;
+} raw_sim_params_t;
+
+// One direction of the link, written by one side and read by the other
+typedef struct {
+    pthread_mutex_t lock;
+    raw_sim_msg_t **heap;        // Min-heap on (deliver_ns, seq)
+    int count;
+    int cap;
+    size_t queued_bytes;
+    uint64_t next_seq;
+    int64_t wire_free_ns;        // When the wire has sent everything queued
+    int64_t last_deliver_ns;     // Latest in-order delivery so far
+    int64_t armed_ns;            // timer_fd expiry, 0 = disarmed
+    int timer_fd;                // Readiness fd of the receiving side
+    uint64_t rng;
+
+    unsigned long sent;
+    unsigned long lost;
+    unsigned long reordered;
+    unsigned long outage_drops;
+} raw_sim_dir_t;
+
+struct raw_sim_link;
+
+// Per-context transport state
+typedef struct {
+    struct raw_sim_link *link;
+    int side;                    // Sends into dir[side], receives from dir[side ^ 1]
+} raw_sim_end_t;
+
+typedef struct raw_sim_link {
+    raw_sim_params_t params;
+    int64_t start_ns;
+    raw_sim_dir_t dir[2];
+    raw_sim_end_t end[2];
+    _Atomic int refs;
+} raw_sim_link_t;
+
+static int64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// splitmix64
+static uint64_t next_random(uint64_t *state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+// Uniform in [0, 1)
+static double random_unit(uint64_t *state) {
+    return (double)(next_random(state) >> 11) * 0x1.0p-53;
+}
+
+// Settings
+
+// Number with an optional unit suffix, returned in *unit
+static int parse_scaled(const char *value, double *out, const char **unit) {
+    char *end;
+    errno = 0;
+    *out = strtod(value, &end);
+    if (end == value || errno != 0 || *out < 0) return -1;
+    *unit = end;
+    return 0;
+}
+
+static int parse_time(const char *value, int64_t *ns) {
+    static const struct { const char *unit; double scale; } units[] = {
+        { "ns", 1 }, { "us", 1e3 }, { "", 1e3 }, { "ms", 1e6 }, { "s", 1e9 },
+    };
+    double v;
+    const char *unit;
+
+    if (parse_scaled(value, &v, &unit) < 0) return -1;
+    for (size_t i = 0; i < sizeof(units) / sizeof(units[0]); i++) {
+        if (strcmp(unit, units[i].unit) == 0) {
+            *ns = (int64_t)(v * units[i].scale);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// k/M/G: decimal for rates, binary for sizes
+static int parse_quantity(const char *value, double base, double *out) {
+    const char *unit;
+    if (parse_scaled(value, out, &unit) < 0) return -1;
+
+    switch (unit[0]) {
+        case '\0': return 0;
+        case 'k': case 'K': *out *= base; break;
+        case 'M': *out *= base * base; break;
+        case 'G': *out *= base * base * base; break;
+        default: return -1;
+    }
+    return unit[1] == '\0' ? 0 : -1;
+}
+
+// "0.5%" or a fraction
+static int parse_fraction(const char *value, double *out) {
+    const char *unit;
+    if (parse_scaled(value, out, &unit) < 0) return -1;
+    if (strcmp(unit, "%") == 0) {
+        *out /= 100.0;
+    } else if (unit[0]) {
+        return -1;
+    }
+    return *out <= 1.0 ? 0 : -1;
+}
+
+static int parse_setting(raw_sim_params_t *p, const char *key, const char *value) {
+    double v;
+
+    if (strcmp(key, "rate") == 0) {
+        if (parse_quantity(value, 1000.0, &v) < 0) return -1;
+        p->rate_bps = (int64_t)v;
+    } else if (strcmp(key, "delay") == 0) {
+        return parse_time(value, &p->delay_ns);
+    } else if (strcmp(key, "jitter") == 0) {
+        return parse_time(value, &p->jitter_ns);
+    } else if (strcmp(key, "loss") == 0) {
+        return parse_fraction(value, &p->loss);
+    } else if (strcmp(key, "reorder") == 0) {
+        return parse_fraction(value, &p->reorder);
+    } else if (strcmp(key, "outage") == 0) {
+        // period/length
+        char period[32];
+        const char *slash = strchr(value, '/');
+        if (!slash || (size_t)(slash - value) >= sizeof(period)) return -1;
+        memcpy(period, value, (size_t)(slash - value));
+        period[slash - value] = '\0';
+        if (parse_time(period, &p->outage_period_ns) < 0 ||
+            parse_time(slash + 1, &p->outage_ns) < 0 ||
+            p->outage_ns >= p->outage_period_ns) {
+            return -1;
+        }
+    } else if (strcmp(key, "queue") == 0) {
+        if (parse_quantity(value, 1024.0, &v) < 0 || v < 1) return -1;
+        p->queue_bytes = (size_t)v;
+    } else if (strcmp(key, "seed") == 0) {
+        char *end;
+        p->seed = strtoull(value, &end, 0);
+        return *end == '\0' ? 0 : -1;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+static int parse_link(raw_sim_params_t *p, const char *spec) {
+    char buf[256];
+    char *save = NULL;
+
+    memset(p, 0, sizeof(*p));
+    p->queue_bytes = RAW_SIM_QUEUE_DEFAULT;
+    p->seed = 1;
+    if (!spec) return 0;
+
+    if (strlen(spec) >= sizeof(buf)) {
+        USB_LOG_ERROR("Simulated link settings too long\n");
+        return -1;
+    }
+    strcpy(buf, spec);
+    for (char *tok = strtok_r(buf, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+        while (*tok == ' ') tok++;
+        if (!*tok) continue;
+        char *eq = strchr(tok, '=');
+        if (eq) *eq = '\0';
+        if (!eq || parse_setting(p, tok, eq + 1) < 0) {
+            if (eq) *eq = '=';
+            USB_LOG_ERROR("Invalid simulated link setting '%s'\n", tok);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Delivery queue
+
+static bool msg_before(const raw_sim_msg_t *a, const raw_sim_msg_t *b) {
+    return a->deliver_ns < b->deliver_ns || (a->deliver_ns == b->deliver_ns && a->seq < b->seq);
+}
+
+static int heap_push(raw_sim_dir_t *d, raw_sim_msg_t *msg) {
+    if (d->count == d->cap) {
+        int cap = d->cap ? d->cap * 2 : RAW_SIM_HEAP_MIN;
+        raw_sim_msg_t **heap = realloc(d->heap, (size_t)cap * sizeof(*heap));
+        if (!heap) return -1;
+        d->heap = heap;
+        d->cap = cap;
+    }
+
+    int i = d->count++;
+    while (i > 0 && msg_before(msg, d->heap[(i - 1) / 2])) {
+        d->heap[i] = d->heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    d->heap[i] = msg;
+    return 0;
+}
+
+static raw_sim_msg_t *heap_pop(raw_sim_dir_t *d) {
+    raw_sim_msg_t *top = d->heap[0];
+    raw_sim_msg_t *last = d->heap[--d->count];
+
+    int i = 0;
+    for (;;) {
+        int child = 2 * i + 1;
+        if (child >= d->count) break;
+        if (child + 1 < d->count && msg_before(d->heap[child + 1], d->heap[child])) child++;
+        if (!msg_before(d->heap[child], last)) break;
+        d->heap[i] = d->heap[child];
+        i = child;
+    }
+    if (d->count > 0) d->heap[i] = last;
+    return top;
+}
+
+// Make the receiver's timer fire no later than the earliest delivery. A
+// stale, earlier expiry is left alone: it only costs the receiver a look.
+static void arm_timer(raw_sim_dir_t *d) {
+    if (d->count == 0) return;
+
+    int64_t at = d->heap[0]->deliver_ns;
+    if (d->armed_ns != 0 && d->armed_ns <= at) return;
+
+    struct itimerspec its = { 0 };
+    its.it_value.tv_sec = at / 1000000000;
+    its.it_value.tv_nsec = at % 1000000000;
+    if (timerfd_settime(d->timer_fd, TFD_TIMER_ABSTIME, &its, NULL) < 0) {
+        USB_LOG_ERROR("Simulated link timer: %s\n", strerror(errno));
+        return;
+    }
+    d->armed_ns = at;
+}
+
+// True if a message is due; otherwise the timer is reset to the next one
+// (dir locked)
+static bool message_due(raw_sim_dir_t *d, int64_t now) {
+    if (d->count > 0 && d->heap[0]->deliver_ns <= now) return true;
+
+    uint64_t expirations;
+    if (read(d->timer_fd, &expirations, sizeof(expirations)) > 0 || d->armed_ns <= now) {
+        d->armed_ns = 0;
+    }
+    arm_timer(d);
+    return false;
+}
+
+static bool link_down(const raw_sim_link_t *link, int64_t now) {
+    const raw_sim_params_t *p = &link->params;
+    return p->outage_period_ns > 0 &&
+           (now - link->start_ns) % p->outage_period_ns >= p->outage_period_ns - p->outage_ns;
+}
+
+// Transport ops
+
+static int sim_transport_send(raw_comm_ctx_t *ctx, const uint8_t *msg, size_t len) {
+    raw_sim_end_t *end = ctx->transport_priv;
+    if (!end) return -1;
+
+    raw_sim_link_t *link = end->link;
+    const raw_sim_params_t *p = &link->params;
+    raw_sim_dir_t *d = &link->dir[end->side];
+    int64_t now = now_ns();
+
+    pthread_mutex_lock(&d->lock);
+    if (link_down(link, now)) {
+        d->outage_drops++;
+        pthread_mutex_unlock(&d->lock);
+        return (int)len;
+    }
+    if (d->queued_bytes + len > p->queue_bytes) {
+        pthread_mutex_unlock(&d->lock);
+        errno = EAGAIN;
+        return -1;  // Wire backlog full; caller retries after it drains
+    }
+
+    // Serialise behind what is already on the wire
+    int64_t start = d->wire_free_ns > now ? d->wire_free_ns : now;
+    d->wire_free_ns = start + (p->rate_bps > 0 ? (int64_t)len * 8 * 1000000000 / p->rate_bps : 0);
+    d->sent++;
+
+    if (p->loss > 0 && random_unit(&d->rng) < p->loss) {
+        d->lost++;
+        pthread_mutex_unlock(&d->lock);
+        return (int)len;
+    }
+
+    int64_t deliver = d->wire_free_ns + p->delay_ns;
+    if (p->jitter_ns > 0) {
+        deliver += (int64_t)(random_unit(&d->rng) * (double)p->jitter_ns);
+    }
+    if (p->reorder > 0 && random_unit(&d->rng) < p->reorder) {
+        deliver += p->delay_ns > RAW_SIM_REORDER_MIN_NS ? p->delay_ns : RAW_SIM_REORDER_MIN_NS;
+        d->reordered++;
+    } else {
+        if (deliver < d->last_deliver_ns) deliver = d->last_deliver_ns;
+        d->last_deliver_ns = deliver;
+    }
+
+    raw_sim_msg_t *m = malloc(sizeof(raw_sim_msg_t) + len);
+    if (!m) {
+        pthread_mutex_unlock(&d->lock);
+        errno = ENOMEM;
+        return -1;
+    }
+    m->deliver_ns = deliver;
+    m->seq = d->next_seq++;
+    m->from_id = ctx->local_id;
+    m->len = (uint32_t)len;
+    memcpy(m->data, msg, len);
+    if (heap_push(d, m) < 0) {
+        pthread_mutex_unlock(&d->lock);
+        free(m);
+        errno = ENOMEM;
+        return -1;
+    }
+    d->queued_bytes += len;
+    arm_timer(d);
+    pthread_mutex_unlock(&d->lock);
+
+    USB_LOG_TRACE("  [TX] Sent %zu bytes via simulated link\n", len);
+    return (int)len;
+}
+
+static int sim_transport_recv(raw_comm_ctx_t *ctx, uint8_t *msg, size_t max_len,
+                              uint32_t *from_id) {
+    raw_sim_end_t *end = ctx->transport_priv;
+    if (!end) return -1;
+
+    raw_sim_dir_t *d = &end->link->dir[end->side ^ 1];
+
+    pthread_mutex_lock(&d->lock);
+    if (!message_due(d, now_ns())) {
+        pthread_mutex_unlock(&d->lock);
+        return 0;
+    }
+    raw_sim_msg_t *m = heap_pop(d);
+    d->queued_bytes -= m->len;
+    pthread_mutex_unlock(&d->lock);
+
+    size_t copy_len = m->len < max_len ? m->len : max_len;
+    memcpy(msg, m->data, copy_len);
+    *from_id = m->from_id;
+    free(m);
+
+    USB_LOG_TRACE("  [RX] Received %zu bytes via simulated link from 0x%08x\n", copy_len, *from_id);
+    return (int)copy_len;
+}
+
+static int sim_transport_get_fd(raw_comm_ctx_t *ctx) {
+    raw_sim_end_t *end = ctx->transport_priv;
+    return end ? end->link->dir[end->side ^ 1].timer_fd : -1;
+}
+
+// The timer fires for the earliest message, which may have been taken
+// already by a recv() in between
+static int sim_transport_service(raw_comm_ctx_t *ctx) {
+    raw_sim_end_t *end = ctx->transport_priv;
+    if (!end) return 0;
+
+    raw_sim_dir_t *d = &end->link->dir[end->side ^ 1];
+    pthread_mutex_lock(&d->lock);
+    bool due = message_due(d, now_ns());
+    pthread_mutex_unlock(&d->lock);
+    return due;
+}
+
+static void free_link(raw_sim_link_t *link) {
+    for (int i = 0; i < 2; i++) {
+        raw_sim_dir_t *d = &link->dir[i];
+        for (int j = 0; j < d->count; j++) free(d->heap[j]);
+        free(d->heap);
+        if (d->timer_fd >= 0) close(d->timer_fd);
+        pthread_mutex_destroy(&d->lock);
+    }
+    free(link);
+}
+
+static void sim_transport_close(raw_comm_ctx_t *ctx) {
+    raw_sim_end_t *end = ctx->transport_priv;
+    if (!end) return;
+
+    raw_sim_link_t *link = end->link;
+    const raw_sim_dir_t *d = &link->dir[end->side];
+    USB_LOG_INFO("Simulated link: %lu messages sent, %lu lost, %lu reordered, "
+                 "%lu dropped in outages\n", d->sent, d->lost, d->reordered, d->outage_drops);
+
+    ctx->transport_priv = NULL;
+    if (atomic_fetch_sub(&link->refs, 1) == 1) {
+        free_link(link);
+    }
+}
+
+// Only ever opened in pairs, see raw_sim_open_pair()
+static int sim_transport_open(raw_comm_ctx_t *ctx, const char *arg) {
+    (void)ctx;
+    (void)arg;
+    USB_LOG_ERROR("The simulated link joins two contexts in one process (BENCH_TRANSPORT=sim)\n");
+    return -1;
+}
+
+const raw_transport_ops_t raw_transport_sim = {
+    .name    = "sim",
+    .open    = sim_transport_open,
+    .close   = sim_transport_close,
+    .send    = sim_transport_send,
+    .recv    = sim_transport_recv,
+    .get_fd  = sim_transport_get_fd,
+    .service = sim_transport_service,
+};
+
+int raw_sim_open_pair(raw_comm_ctx_t *a, raw_comm_ctx_t *b, const char *spec) {
+    raw_sim_link_t *link = calloc(1, sizeof(raw_sim_link_t));
+    if (!link) return -1;
+
+    if (parse_link(&link->params, spec) < 0) {
+        free(link);
+        return -1;
+    }
+
+    link->start_ns = now_ns();
+    raw_comm_ctx_t *ctxs[2] = { a, b };
+    bool ok = true;
+    for (int i = 0; i < 2; i++) {
+        raw_sim_dir_t *d = &link->dir[i];
+        pthread_mutex_init(&d->lock, NULL);
+        d->rng = link->params.seed * 2 + (uint64_t)i;
+        d->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        ok = ok && d->timer_fd >= 0;
+    }
+    if (!ok) {
+        USB_LOG_ERROR("Simulated link timer: %s\n", strerror(errno));
+        free_link(link);
+        return -1;
+    }
+
+    atomic_store(&link->refs, 2);
+    for (int i = 0; i < 2; i++) {
+        link->end[i].link = link;
+        link->end[i].side = i;
+        ctxs[i]->transport = &raw_transport_sim;
+        ctxs[i]->transport_priv = &link->end[i];
+    }
+
+    const raw_sim_params_t *p = &link->params;
+    char rate[32] = "unlimited";
+    if (p->rate_bps > 0) snprintf(rate, sizeof(rate), "%.1f Mbit/s", (double)p->rate_bps / 1e6);
+    USB_LOG_INFO("Simulated link: %s, delay %.1f us, jitter %.1f us, "
+                 "loss %.3f%%, reorder %.3f%%\n", rate, (double)p->delay_ns / 1e3,
+                 (double)p->jitter_ns / 1e3, p->loss * 100.0, p->reorder * 100.0);
+    if (p->outage_period_ns > 0) {
+        USB_LOG_INFO("Simulated link: down for %.0f ms every %.0f ms\n",
+                     (double)p->outage_ns / 1e6, (double)p->outage_period_ns / 1e6);
+    }
+    return 0;
+}
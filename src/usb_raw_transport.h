@@ -0,0 +1,52 @@
+// USB-C Software Network - Raw Communication Transports
+// Internal interface between the protocol layer (usb_raw_comm.c) and
+// the transport backends that move whole messages between peers.
+
+#ifndef USB_RAW_TRANSPORT_H
+#define USB_RAW_TRANSPORT_H
+
+#include "usb_raw_comm.h"
+
+// Shared memory SPSC ring per direction (POSIX shm + doorbell fds)
+extern const raw_transport_ops_t raw_transport_shm;
+
+// Legacy one-file-per-message transport under /tmp
+extern const raw_transport_ops_t raw_transport_file;
+
+// USB PD unstructured VDMs through a VDM passthrough device
+extern const raw_transport_ops_t raw_transport_vdm;
+
+// xHCI Debug Capability: kernel DbC tty (target) or libusb bulk (host)
+extern const raw_transport_ops_t raw_transport_dbc;
+
+// Simulated link with bandwidth, latency, loss, ... (in-process pairs only)
+extern const raw_transport_ops_t raw_transport_sim;
+
+// Join two contexts with an anonymous (memfd + eventfd) ring pair
+int raw_shm_open_pair(raw_comm_ctx_t *a, raw_comm_ctx_t *b);
+
+// Join two contexts with a VDM link (SOCK_SEQPACKET socketpair)
+int raw_vdm_open_pair(raw_comm_ctx_t *a, raw_comm_ctx_t *b);
+
+// Use an open VDM device fd (non-blocking, one VDM per read/write; taken
+// over, also on failure)
+int raw_vdm_open_fd(raw_comm_ctx_t *ctx, int fd);
+
+// Join two contexts with a DbC byte stream (SOCK_STREAM socketpair)
+int raw_dbc_open_pair(raw_comm_ctx_t *a, raw_comm_ctx_t *b);
+
+// Join two contexts with a simulated link described by spec (see
+// usb_raw_sim.c; NULL or "" = an ideal link)
+int raw_sim_open_pair(raw_comm_ctx_t *a, raw_comm_ctx_t *b, const char *spec);
+
+// Find the sysfs dbc attribute of an xHCI controller. Returns 0 with path
+// filled, -1 if no controller exposes one.
+int raw_dbc_find_controller(char *path, size_t size);
+
+// Put ops between the protocol and the open transport without closing
+// it: the event loop watches ops->get_fd() from now on and ops is called
+// for every message. Returns the previous ops, to be swapped back later.
+const raw_transport_ops_t *raw_comm_swap_transport(raw_comm_ctx_t *ctx,
+                                                   const raw_transport_ops_t *ops);
+
+#endif // USB_RAW_TRANSPORT_H
@@ -0,0 +1,613 @@
+// USB-C Software Network - USB PD Vendor Defined Message Transport
+// Carries protocol messages over the CC line as unstructured VDMs. A PD
+// data message holds at most 7 data objects: the VDM header and up to 6
+// VDOs, so each VDM moves 24 bytes of a message. Messages are split into
+// fragments, the VDM header says where each belongs, and the receiver
+// glues them back together in order.
+//
+// Device interface: every read() or write() on the VDM device is one
+// message, the VDM header followed by 1-6 VDOs as 32-bit little-endian
+// words (CC order). This is what a port manager passthrough (TCPM, UCSI
+// or cros_ec vendor driver) exposes; the loopback pair is a
+// SOCK_SEQPACKET socketpair with the same framing. Structured VDMs and
+// other SVIDs belong to the PD stack and are ignored.
+//
+// VDM header (unstructured, PD 3.x 6.4.4.1):
+//   31..16  SVID (RAW_VDM_SVID)
+//   15      VDM type, 0 = unstructured
+//   14      first fragment of a message
+//   13      last fragment of a message
+//   12      message uses compact headers
+//   11..2   fragment index
+//   1..0    unused bytes in the last VDO (last fragment only)
+//
+// Compact headers: PD moves ~300 kbit/s, so the 28 byte raw_msg_header_t
+// alone would cost more than a VDM. Each header of a (possibly batched)
+// message is re-encoded as
+//   u8 msg_type, u8 cflags, u16 length, u32 seq,
+//   [u32 src_id, u32 dst_id]   when cflags has VDM_C_IDS
+//   [u8 channel]               when cflags has VDM_C_CHANNEL
+//   [u32 checksum]             when the checksum bits are not NONE
+// with magic and version implied: 8 bytes for an unchecked data frame.
+// cflags keeps the checksum and codec bits where raw_msg_header_t.flags
+// has them; the keepalive request moves to VDM_C_KEEPALIVE, and a frame
+// off the default channel gets the channel byte.
+// The link is point to point, so ids are sent only when they change, with
+// every control message and every VDM_C_IDS_EVERY records otherwise; the
+// receiver reuses the last ones it saw.
+// Messages that do not fit the compact form go out unchanged.
+//
+// Pipelining: the port sends one VDM at a time (each waits for GoodCRC),
+// so fragments queue here and are handed to the device only while less
+// than RAW_VDM_PIPELINE VDMs of wire time are ahead of it. That keeps the
+// port's queue from swallowing the ARQ's timing and leaves room for the
+// PD stack's own messages within tSenderResponse. A timerfd resumes
+// sending; it shares an epoll set with the device fd, which is the fd
+// the event loop watches, and is serviced by service() and recv(). The TX and RX sides may run on different
+// threads (usb_raw_runtime.h), so the fragment queue has its own lock.
+
+#define _GNU_SOURCE
+#include "usb_raw_transport.h"
+#include "usb_log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <endian.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+
+#define RAW_VDM_SVID        0x1D6Bu   // Vendor ID the VDMs are sent under
+#define RAW_VDM_VDOS        6         // Data objects after the VDM header
+#define RAW_VDM_FRAG_BYTES  (RAW_VDM_VDOS * 4)
+#define RAW_VDM_FRAG_MAX    1024      // Fragment index is 10 bits
+#define RAW_VDM_MSG_MAX     (RAW_VDM_FRAG_MAX * RAW_VDM_FRAG_BYTES)
+#define RAW_VDM_TX_BACKLOG  128       // Fragments queued before send pushes back
+
+// Wire time at 300 kbit/s BMC: preamble, SOP, PD header, CRC, EOP, the
+// GoodCRC reply and inter-frame gaps, plus 40 bits per data object
+#define RAW_VDM_BASE_US     1100
+#define RAW_VDM_OBJ_US      133
+#define RAW_VDM_FULL_US     (RAW_VDM_BASE_US + (RAW_VDM_VDOS + 1) * RAW_VDM_OBJ_US)
+#define RAW_VDM_PIPELINE    4         // VDMs handed to the port ahead of the wire
+
+#define VDM_HDR_STRUCTURED  (1u << 15)
+#define VDM_HDR_SOM         (1u << 14)
+#define VDM_HDR_EOM         (1u << 13)
+#define VDM_HDR_COMPACT     (1u << 12)
+#define VDM_HDR_INDEX_SHIFT 2
+#define VDM_HDR_INDEX_MASK  0x3FFu
+#define VDM_HDR_PAD_MASK    0x3u
+
+#define VDM_C_IDS           0x04      // Compact cflags: src_id and dst_id follow
+#define VDM_C_KEEPALIVE     0x20      // RAW_FLAG_KEEPALIVE
+#define VDM_C_CHANNEL       0x40      // Channel byte follows
+#define VDM_C_AS_IS         (RAW_FLAG_CSUM_MASK | RAW_FLAG_CODEC_MASK)  // Same bits in flags
+#define VDM_C_FIXED         8         // Compact record without optional fields
+#define VDM_C_IDS_EVERY     64        // Resend ids at least this often
+
+// Ids last carried in compact form
+typedef struct {
+    bool valid;
+    int age;                     // Compact records since
+    uint32_t src_id;
+    uint32_t dst_id;
+} raw_vdm_ids_t;
+
+typedef struct {
+    uint32_t words[1 + RAW_VDM_VDOS];
+    uint8_t count;               // Words used, header included
+} raw_vdm_frag_t;
+
+typedef struct {
+    int dev_fd;
+    int timer_fd;
+    int epoll_fd;                // dev_fd + timer_fd, watched by the event loop
+
+    // TX fragment queue (tx_lock)
+    pthread_mutex_t tx_lock;
+    raw_vdm_frag_t txq[RAW_VDM_FRAG_MAX];
+    int tx_head;
+    int tx_count;
+    int64_t wire_busy_until_us;  // When the port is estimated to go idle
+    uint8_t tx_wire[RAW_VDM_MSG_MAX];
+    raw_vdm_ids_t tx_ids;
+
+    // RX reassembly (receiving thread only)
+    uint8_t rx_wire[RAW_VDM_MSG_MAX];
+    size_t rx_len;
+    int rx_next_index;           // -1 = no message in progress
+    bool rx_compact;
+    raw_vdm_ids_t rx_ids;
+
+    unsigned long tx_vdms;
+    unsigned long rx_vdms;
+    unsigned long rx_dropped;    // Messages lost to missing fragments
+} raw_vdm_t;
+
+static int64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void put_le16(uint8_t *p, uint16_t v) {
+    v = htole16(v);
+    memcpy(p, &v, sizeof(v));
+}
+
+static void put_le32(uint8_t *p, uint32_t v) {
+    v = htole32(v);
+    memcpy(p, &v, sizeof(v));
+}
+
+static uint16_t get_le16(const uint8_t *p) {
+    uint16_t v;
+    memcpy(&v, p, sizeof(v));
+    return le16toh(v);
+}
+
+static uint32_t get_le32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return le32toh(v);
+}
+
+// Compact headers
+
+static bool control_type(uint8_t type) {
+    return type != RAW_MSG_DATA && type != RAW_MSG_DATA_ACK;
+}
+
+// Re-encode every header of msg, advancing *ids. Returns the encoded
+// length, or -1 if a header has no compact form (the message is then sent
+// as it is).
+static int encode_compact(raw_vdm_ids_t *ids, const uint8_t *msg, size_t len, uint8_t *out) {
+    size_t off = 0, o = 0;
+
+    while (off < len) {
+        raw_msg_header_t hdr;
+        if (len - off < sizeof(hdr)) return -1;
+        memcpy(&hdr, msg + off, sizeof(hdr));
+
+        if (memcmp(hdr.magic, RAW_MSG_MAGIC, 4) != 0 || hdr.version != RAW_PROTOCOL_VERSION ||
+            (hdr.flags & ~(VDM_C_AS_IS | RAW_FLAG_KEEPALIVE | RAW_FLAG_CHANNEL_MASK)) != 0 ||
+            hdr.length > UINT16_MAX ||
+            hdr.length > len - off - sizeof(hdr)) {
+            return -1;
+        }
+
+        bool with_ids = !ids->valid || hdr.src_id != ids->src_id || hdr.dst_id != ids->dst_id ||
+                        ids->age >= VDM_C_IDS_EVERY || control_type(hdr.msg_type);
+        bool csum = (hdr.flags & RAW_FLAG_CSUM_MASK) != RAW_CSUM_NONE;
+        uint8_t channel = (uint8_t)((hdr.flags & RAW_FLAG_CHANNEL_MASK) >> RAW_FLAG_CHANNEL_SHIFT);
+        uint8_t cflags = (uint8_t)(hdr.flags & VDM_C_AS_IS);
+        if (with_ids) cflags |= VDM_C_IDS;
+        if (hdr.flags & RAW_FLAG_KEEPALIVE) cflags |= VDM_C_KEEPALIVE;
+        if (channel) cflags |= VDM_C_CHANNEL;
+
+        out[o] = hdr.msg_type;
+        out[o + 1] = cflags;
+        put_le16(out + o + 2, (uint16_t)hdr.length);
+        put_le32(out + o + 4, hdr.seq);
+        o += VDM_C_FIXED;
+        if (with_ids) {
+            put_le32(out + o, hdr.src_id);
+            put_le32(out + o + 4, hdr.dst_id);
+            o += 8;
+            ids->src_id = hdr.src_id;
+            ids->dst_id = hdr.dst_id;
+            ids->valid = true;
+            ids->age = 0;
+        } else {
+            ids->age++;
+        }
+        if (channel) {
+            out[o++] = channel;
+        }
+        if (csum) {
+            put_le32(out + o, hdr.checksum);
+            o += 4;
+        }
+        memcpy(out + o, msg + off + sizeof(hdr), hdr.length);
+        o += hdr.length;
+        off += sizeof(hdr) + hdr.length;
+    }
+    return (int)o;
+}
+
+// Expand compact records back into full headers. Returns the message
+// length, or -1 if it is malformed, refers to ids never seen or does not
+// fit max_len.
+static int decode_compact(raw_vdm_ids_t *ids, const uint8_t *in, size_t len, uint8_t *out,
+                          size_t max_len) {
+    size_t off = 0, o = 0;
+
+    while (off < len) {
+        if (len - off < VDM_C_FIXED) return -1;
+
+        raw_msg_header_t hdr;
+        memset(&hdr, 0, sizeof(hdr));
+        memcpy(hdr.magic, RAW_MSG_MAGIC, 4);
+        hdr.version = RAW_PROTOCOL_VERSION;
+        hdr.msg_type = in[off];
+        uint8_t cflags = in[off + 1];
+        hdr.flags = cflags & VDM_C_AS_IS;
+        if (cflags & VDM_C_KEEPALIVE) hdr.flags |= RAW_FLAG_KEEPALIVE;
+        hdr.length = get_le16(in + off + 2);
+        hdr.seq = get_le32(in + off + 4);
+        off += VDM_C_FIXED;
+
+        if (cflags & VDM_C_IDS) {
+            if (len - off < 8) return -1;
+            ids->src_id = get_le32(in + off);
+            ids->dst_id = get_le32(in + off + 4);
+            ids->valid = true;
+            off += 8;
+        } else if (!ids->valid) {
+            return -1;
+        }
+        hdr.src_id = ids->src_id;
+        hdr.dst_id = ids->dst_id;
+
+        if (cflags & VDM_C_CHANNEL) {
+            if (len - off < 1 || in[off] >= RAW_CHANNELS) return -1;
+            hdr.flags |= (uint16_t)(in[off] << RAW_FLAG_CHANNEL_SHIFT);
+            off++;
+        }
+
+        if ((hdr.flags & RAW_FLAG_CSUM_MASK) != RAW_CSUM_NONE) {
+            if (len - off < 4) return -1;
+            hdr.checksum = get_le32(in + off);
+            off += 4;
+        }
+
+        if (len - off < hdr.length || max_len - o < sizeof(hdr) + hdr.length) return -1;
+        memcpy(out + o, &hdr, sizeof(hdr));
+        memcpy(out + o + sizeof(hdr), in + off, hdr.length);
+        o += sizeof(hdr) + hdr.length;
+        off += hdr.length;
+    }
+    return (int)o;
+}
+
+// Sending (tx_lock held)
+
+static void arm_timer(raw_vdm_t *v, int64_t delay_us) {
+    struct itimerspec its = { { 0, 0 }, { 0, 0 } };
+    if (delay_us < 1) delay_us = 1;
+    its.it_value.tv_sec = delay_us / 1000000;
+    its.it_value.tv_nsec = (delay_us % 1000000) * 1000;
+    timerfd_settime(v->timer_fd, 0, &its, NULL);
+}
+
+// Hand queued fragments to the port while the pipeline has room
+static void pump(raw_vdm_t *v) {
+    int64_t now = now_us();
+    if (v->wire_busy_until_us < now) v->wire_busy_until_us = now;
+
+    while (v->tx_count > 0) {
+        int64_t ahead = v->wire_busy_until_us - now;
+        if (ahead >= RAW_VDM_PIPELINE * RAW_VDM_FULL_US) {
+            arm_timer(v, ahead - (RAW_VDM_PIPELINE - 1) * RAW_VDM_FULL_US);
+            return;
+        }
+
+        raw_vdm_frag_t *frag = &v->txq[v->tx_head];
+        if (write(v->dev_fd, frag->words, (size_t)frag->count * 4) < 0) {
+            if (errno == EAGAIN || errno == ENOBUFS || errno == EINTR) {
+                arm_timer(v, RAW_VDM_FULL_US);  // Port queue full
+                return;
+            }
+            // The receiver drops the rest of this message at the gap
+            USB_LOG_WARN_RATELIMIT("VDM write: %s\n", strerror(errno));
+        } else {
+            v->wire_busy_until_us += RAW_VDM_BASE_US + frag->count * RAW_VDM_OBJ_US;
+            v->tx_vdms++;
+        }
+        v->tx_head = (v->tx_head + 1) % RAW_VDM_FRAG_MAX;
+        v->tx_count--;
+    }
+}
+
+// Queue a wire message as fragments
+static void enqueue(raw_vdm_t *v, const uint8_t *wire, size_t len, bool compact) {
+    int frags = (int)((len + RAW_VDM_FRAG_BYTES - 1) / RAW_VDM_FRAG_BYTES);
+
+    for (int i = 0; i < frags; i++) {
+        raw_vdm_frag_t *frag = &v->txq[(v->tx_head + v->tx_count) % RAW_VDM_FRAG_MAX];
+        size_t off = (size_t)i * RAW_VDM_FRAG_BYTES;
+        size_t n = len - off < RAW_VDM_FRAG_BYTES ? len - off : RAW_VDM_FRAG_BYTES;
+        int vdos = (int)((n + 3) / 4);
+        uint32_t hdr = RAW_VDM_SVID << 16 | (uint32_t)i << VDM_HDR_INDEX_SHIFT;
+
+        if (i == 0) hdr |= VDM_HDR_SOM;
+        if (i == frags - 1) hdr |= VDM_HDR_EOM | (uint32_t)(vdos * 4 - n);
+        if (compact) hdr |= VDM_HDR_COMPACT;
+
+        memset(frag->words, 0, sizeof(frag->words));
+        frag->words[0] = htole32(hdr);
+        memcpy(&frag->words[1], wire + off, n);  // VDO bytes are already in CC order
+        frag->count = (uint8_t)(1 + vdos);
+        v->tx_count++;
+    }
+}
+
+static int vdm_transport_send(raw_comm_ctx_t *ctx, const uint8_t *msg, size_t len) {
+    raw_vdm_t *v = ctx->transport_priv;
+    if (!v) return -1;
+
+    if (len == 0 || len > RAW_VDM_MSG_MAX) {
+        USB_LOG_WARN_RATELIMIT("Message of %zu bytes too large for VDM transport\n", len);
+        errno = EMSGSIZE;
+        return -1;
+    }
+
+    pthread_mutex_lock(&v->tx_lock);
+
+    // Encode first: compact messages are usually far smaller. The ids
+    // only advance once the compact form is actually queued.
+    raw_vdm_ids_t ids = v->tx_ids;
+    int clen = encode_compact(&ids, msg, len, v->tx_wire);
+    bool compact = clen > 0;
+    const uint8_t *wire = compact ? v->tx_wire : msg;
+    size_t wire_len = compact ? (size_t)clen : len;
+    int frags = (int)((wire_len + RAW_VDM_FRAG_BYTES - 1) / RAW_VDM_FRAG_BYTES);
+
+    // A message always fits an empty queue; otherwise bound what waits
+    if (v->tx_count > 0 && v->tx_count + frags > RAW_VDM_TX_BACKLOG) {
+        pump(v);
+        pthread_mutex_unlock(&v->tx_lock);
+        errno = EAGAIN;
+        return -1;
+    }
+    if (compact) v->tx_ids = ids;
+
+    enqueue(v, wire, wire_len, compact);
+    pump(v);
+    pthread_mutex_unlock(&v->tx_lock);
+
+    USB_LOG_TRACE("  [TX] Queued %zu bytes as %d VDMs%s\n", len, frags, compact ? " (compact)" : "");
+    return (int)len;
+}
+
+// Receiving
+
+// Add one VDM to the message being reassembled. Returns 1 when it
+// completed a message, 0 otherwise.
+static int rx_fragment(raw_comm_ctx_t *ctx, raw_vdm_t *v, const uint8_t *buf, size_t n) {
+    if (n < 8 || n % 4 != 0) return 0;
+
+    uint32_t hdr = get_le32(buf);
+    if ((hdr >> 16) != RAW_VDM_SVID || (hdr & VDM_HDR_STRUCTURED)) return 0;
+    v->rx_vdms++;
+
+    int index = (int)((hdr >> VDM_HDR_INDEX_SHIFT) & VDM_HDR_INDEX_MASK);
+    size_t bytes = n - 4;
+
+    if (hdr & VDM_HDR_SOM) {
+        if (v->rx_next_index > 0) v->rx_dropped++;  // The last one never finished
+        v->rx_len = 0;
+        v->rx_next_index = 0;
+        v->rx_compact = (hdr & VDM_HDR_COMPACT) != 0;
+    }
+    if (index != v->rx_next_index) {
+        // Missing fragment: skip to the next message start
+        if (v->rx_next_index > 0) {
+            v->rx_dropped++;
+            usb_stat_add(&ctx->stats->rx_errors, 1);
+            USB_LOG_WARN_RATELIMIT("VDM: fragment %d missing, message dropped\n", v->rx_next_index);
+        }
+        v->rx_next_index = -1;
+        return 0;
+    }
+
+    if (hdr & VDM_HDR_EOM) {
+        size_t pad = hdr & VDM_HDR_PAD_MASK;
+        bytes = bytes > pad ? bytes - pad : 0;
+    } else if (bytes != RAW_VDM_FRAG_BYTES) {
+        v->rx_next_index = -1;  // Only the last fragment may be short
+        return 0;
+    }
+
+    memcpy(v->rx_wire + v->rx_len, buf + 4, bytes);
+    v->rx_len += bytes;
+    v->rx_next_index++;
+
+    if (!(hdr & VDM_HDR_EOM)) {
+        // The index cannot wrap: a longer message was never sent
+        if (v->rx_next_index >= RAW_VDM_FRAG_MAX) v->rx_next_index = -1;
+        return 0;
+    }
+    v->rx_next_index = -1;
+    return 1;
+}
+
+// Pacing timer: resume sending queued fragments
+static void service_timer(raw_vdm_t *v) {
+    uint64_t expirations;
+    if (read(v->timer_fd, &expirations, sizeof(expirations)) > 0) {
+        pthread_mutex_lock(&v->tx_lock);
+        pump(v);
+        pthread_mutex_unlock(&v->tx_lock);
+    }
+}
+
+static int vdm_transport_recv(raw_comm_ctx_t *ctx, uint8_t *msg, size_t max_len,
+                              uint32_t *from_id) {
+    raw_vdm_t *v = ctx->transport_priv;
+    if (!v) return -1;
+
+    // Also here: a reader that only calls recv never sees service()
+    service_timer(v);
+
+    for (;;) {
+        uint8_t buf[(1 + RAW_VDM_VDOS) * 4];
+        ssize_t n = read(v->dev_fd, buf, sizeof(buf));
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+            // Stop watching a device that went away instead of spinning on it
+            USB_LOG_ERROR("VDM device: %s\n", n == 0 ? "closed" : strerror(errno));
+            epoll_ctl(v->epoll_fd, EPOLL_CTL_DEL, v->dev_fd, NULL);
+            return -1;
+        }
+        if (n < 0) return 0;
+
+        if (rx_fragment(ctx, v, buf, (size_t)n) == 0) continue;
+
+        int len;
+        if (v->rx_compact) {
+            len = decode_compact(&v->rx_ids, v->rx_wire, v->rx_len, msg, max_len);
+        } else {
+            len = v->rx_len <= max_len ? (int)v->rx_len : -1;
+            if (len > 0) memcpy(msg, v->rx_wire, v->rx_len);
+        }
+        if (len < (int)sizeof(raw_msg_header_t)) {
+            v->rx_dropped++;
+            usb_stat_add(&ctx->stats->rx_errors, 1);
+            USB_LOG_WARN_RATELIMIT("VDM: undecodable %zu byte message dropped\n", v->rx_len);
+            continue;
+        }
+
+        raw_msg_header_t hdr;
+        memcpy(&hdr, msg, sizeof(hdr));
+        *from_id = hdr.src_id;
+        USB_LOG_TRACE("  [RX] Received %d bytes via VDM from 0x%08x\n", len, *from_id);
+        return len;
+    }
+}
+
+static int vdm_transport_get_fd(raw_comm_ctx_t *ctx) {
+    raw_vdm_t *v = ctx->transport_priv;
+    return v ? v->epoll_fd : -1;
+}
+
+// The timer shares get_fd() with the device, so a sender that never
+// receives still gets its queue drained by the event loop
+static int vdm_transport_service(raw_comm_ctx_t *ctx) {
+    raw_vdm_t *v = ctx->transport_priv;
+    if (!v) return 0;
+
+    service_timer(v);
+
+    struct pollfd pfd = { .fd = v->dev_fd, .events = POLLIN };
+    return poll(&pfd, 1, 0) > 0;
+}
+
+// Setup
+
+static void free_vdm(raw_vdm_t *v) {
+    if (v->epoll_fd >= 0) close(v->epoll_fd);
+    if (v->timer_fd >= 0) close(v->timer_fd);
+    if (v->dev_fd >= 0) close(v->dev_fd);
+    pthread_mutex_destroy(&v->tx_lock);
+    free(v);
+}
+
+// Wrap an open device fd (taken over, also on failure)
+static raw_vdm_t *attach_fd(int dev_fd) {
+    raw_vdm_t *v = calloc(1, sizeof(raw_vdm_t));
+    if (!v) {
+        close(dev_fd);
+        return NULL;
+    }
+    pthread_mutex_init(&v->tx_lock, NULL);
+    v->dev_fd = dev_fd;
+    v->rx_next_index = -1;
+    v->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    v->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+
+    struct epoll_event ev = { .events = EPOLLIN };
+    bool ok = v->timer_fd >= 0 && v->epoll_fd >= 0;
+    ev.data.fd = dev_fd;
+    ok = ok && epoll_ctl(v->epoll_fd, EPOLL_CTL_ADD, dev_fd, &ev) == 0;
+    ev.data.fd = v->timer_fd;
+    ok = ok && epoll_ctl(v->epoll_fd, EPOLL_CTL_ADD, v->timer_fd, &ev) == 0;
+    if (!ok) {
+        USB_LOG_ERROR("VDM transport setup: %s\n", strerror(errno));
+        free_vdm(v);
+        return NULL;
+    }
+    return v;
+}
+
+static int vdm_transport_open(raw_comm_ctx_t *ctx, const char *arg) {
+    if (!arg || !arg[0]) {
+        USB_LOG_ERROR("VDM transport needs a VDM device (RAW_VDM_DEVICE)\n");
+        return -1;
+    }
+
+    int fd = open(arg, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) {
+        USB_LOG_ERROR("Cannot open VDM device %s: %s\n", arg, strerror(errno));
+        return -1;
+    }
+
+    raw_vdm_t *v = attach_fd(fd);
+    if (!v) return -1;
+    ctx->transport_priv = v;
+
+    if (ctx->mtu > RAW_VDM_MSG_MAX) {
+        USB_LOG_WARN("VDM transport carries at most %d byte messages (MTU %zu)\n",
+                     RAW_VDM_MSG_MAX, ctx->mtu);
+    }
+    USB_LOG_INFO("VDM transport: %s (SVID 0x%04x, %d bytes per VDM)\n",
+                 arg, RAW_VDM_SVID, RAW_VDM_FRAG_BYTES);
+    return 0;
+}
+
+static void vdm_transport_close(raw_comm_ctx_t *ctx) {
+    raw_vdm_t *v = ctx->transport_priv;
+    if (!v) return;
+
+    USB_LOG_DEBUG("VDM transport: %lu VDMs sent, %lu received, %lu messages dropped\n",
+                  v->tx_vdms, v->rx_vdms, v->rx_dropped);
+    free_vdm(v);
+    ctx->transport_priv = NULL;
+}
+
+const raw_transport_ops_t raw_transport_vdm = {
+    .name   = "vdm",
+    .open   = vdm_transport_open,
+    .close  = vdm_transport_close,
+    .send   = vdm_transport_send,
+    .recv   = vdm_transport_recv,
+    .get_fd = vdm_transport_get_fd,
+    .service = vdm_transport_service,
+};
+
+// Attach to a VDM device that is already open, e.g. one handed over by a
+// port manager
+int raw_vdm_open_fd(raw_comm_ctx_t *ctx, int fd) {
+    raw_vdm_t *v = attach_fd(fd);
+    if (!v) return -1;
+
+    ctx->transport = &raw_transport_vdm;
+    ctx->transport_priv = v;
+    return 0;
+}
+
+// Loopback pair: a SOCK_SEQPACKET socketpair keeps one VDM per datagram
+int raw_vdm_open_pair(raw_comm_ctx_t *a, raw_comm_ctx_t *b) {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, fds) < 0) {
+        USB_LOG_ERROR("VDM socketpair: %s\n", strerror(errno));
+        return -1;
+    }
+
+    if (raw_vdm_open_fd(a, fds[0]) < 0) {
+        close(fds[1]);
+        return -1;
+    }
+    if (raw_vdm_open_fd(b, fds[1]) < 0) {
+        free_vdm(a->transport_priv);
+        a->transport_priv = NULL;
+        return -1;
+    }
+    return 0;
+}
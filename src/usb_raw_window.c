@@ -0,0 +1,323 @@
+// USB-C Software Network - Sliding Window Reliable Delivery Implementation
+
+#include "usb_raw_window.h"
+#include "usb_pool.h"
+#include <string.h>
+
+// Serial number arithmetic: true if a precedes b
+static bool seq_before(uint32_t a, uint32_t b) {
+    return (int32_t)(a - b) < 0;
+}
+
+int raw_window_index(const raw_window_t *win, uint32_t seq) {
+    return (int)(seq & (uint32_t)(win->slots - 1));
+}
+
+// Allocate slot buffers and reset
+int raw_window_init(raw_window_t *win, int max_size, size_t msg_size) {
+    int slots = 1;
+
+    if (max_size > RAW_WINDOW_MAX) max_size = RAW_WINDOW_MAX;
+    while (slots < max_size) slots <<= 1;
+
+    // A full message copy per transmit slot, a payload per receive slot
+    size_t payload_size = msg_size - RAW_FRAME_HEADROOM;
+    size_t arena_bytes = (size_t)slots * (msg_size + payload_size);
+    uint8_t *arena = usb_slab_alloc(arena_bytes);
+    if (!arena) return -1;
+
+    memset(win, 0, sizeof(raw_window_t));
+    win->slots = slots;
+    win->msg_size = msg_size;
+    win->arena = arena;
+    win->arena_bytes = arena_bytes;
+
+    for (int i = 0; i < slots; i++) {
+        win->tx[i].msg = arena + (size_t)i * msg_size;
+        win->rx[i].data = arena + (size_t)slots * msg_size + (size_t)i * payload_size;
+    }
+
+    raw_window_reset(win, max_size);
+    return 0;
+}
+
+void raw_window_free(raw_window_t *win) {
+    usb_slab_free(win->arena, win->arena_bytes);
+    win->arena = NULL;
+    win->slots = 0;
+}
+
+// Reset to an empty window, keeping the slot buffers
+void raw_window_reset(raw_window_t *win, int size) {
+    raw_window_t keep = *win;
+
+    memset(win, 0, sizeof(raw_window_t));
+    win->slots = keep.slots;
+    win->msg_size = keep.msg_size;
+    win->arena = keep.arena;
+    win->arena_bytes = keep.arena_bytes;
+    for (int i = 0; i < keep.slots; i++) {
+        win->tx[i].msg = keep.tx[i].msg;
+        win->rx[i].data = keep.rx[i].data;
+    }
+
+    if (size < 1) size = 1;
+    if (size > win->slots) size = win->slots;
+
+    win->size = size;
+    win->peer_window = size;
+    win->rto_us = RAW_RTO_INITIAL_US;
+}
+
+int raw_window_in_flight(const raw_window_t *win) {
+    return (int)(win->snd_nxt - win->snd_una);
+}
+
+bool raw_window_can_send(const raw_window_t *win) {
+    int in_flight = raw_window_in_flight(win);
+    return in_flight < win->size && in_flight < win->peer_window;
+}
+
+raw_tx_slot_t *raw_window_tx_slot(raw_window_t *win) {
+    return &win->tx[raw_window_index(win, win->snd_nxt)];
+}
+
+void raw_window_tx_commit(raw_window_t *win, size_t len, int64_t now_us) {
+    raw_tx_slot_t *slot = raw_window_tx_slot(win);
+
+    slot->len = len;
+    slot->sent_us = now_us;
+    slot->retries = 0;
+    slot->in_use = true;
+    slot->sacked = false;
+    slot->fast_rtx = false;
+    win->snd_nxt++;
+}
+
+// Update SRTT/RTTVAR/RTO from one measurement (RFC 6298)
+static void rtt_sample(raw_window_t *win, int64_t r) {
+    if (r < 0) return;
+
+    win->rtt_samples++;
+    win->last_rtt_us = r;
+
+    if (!win->rtt_valid) {
+        win->srtt_us = r;
+        win->rttvar_us = r / 2;
+        win->rtt_valid = true;
+    } else {
+        int64_t delta = win->srtt_us > r ? win->srtt_us - r : r - win->srtt_us;
+        win->rttvar_us = (3 * win->rttvar_us + delta) / 4;
+        win->srtt_us = (7 * win->srtt_us + r) / 8;
+    }
+
+    int64_t rto = win->srtt_us + 4 * win->rttvar_us;
+    if (rto < RAW_RTO_MIN_US) rto = RAW_RTO_MIN_US;
+    if (rto > RAW_RTO_MAX_US) rto = RAW_RTO_MAX_US;
+    win->rto_us = rto;
+}
+
+// Process an incoming ACK
+int raw_window_on_ack(raw_window_t *win, const raw_sack_t *ack, int64_t now_us) {
+    uint32_t cum = ack->cum_ack;
+    int newly = 0;
+    int64_t sample = -1;
+
+    // Acknowledges something never sent: stale or bogus
+    if (seq_before(win->snd_nxt, cum)) {
+        return 0;
+    }
+
+    // Cumulative part
+    while (seq_before(win->snd_una, cum)) {
+        raw_tx_slot_t *slot = &win->tx[raw_window_index(win, win->snd_una)];
+        if (slot->in_use) {
+            // Karn: only frames sent exactly once give a usable RTT, and a
+            // frame SACKed earlier was already sampled then
+            if (!slot->sacked) {
+                newly++;
+                if (slot->retries == 0) sample = now_us - slot->sent_us;
+            }
+            slot->in_use = false;
+        }
+        win->snd_una++;
+    }
+
+    // Selective part
+    for (int i = 0; i < 64; i++) {
+        if (!(ack->sack & (1ULL << i))) continue;
+
+        uint32_t seq = cum + 1 + (uint32_t)i;
+        if (!seq_before(seq, win->snd_nxt)) break;
+
+        raw_tx_slot_t *slot = &win->tx[raw_window_index(win, seq)];
+        if (slot->in_use && !slot->sacked) {
+            slot->sacked = true;
+            newly++;
+            if (slot->retries == 0) sample = now_us - slot->sent_us;
+        }
+    }
+
+    // Start the probe clock when the window closes
+    if (ack->window == 0 && win->peer_window > 0) {
+        win->probe_us = now_us;
+    }
+    win->peer_window = (int)ack->window;
+
+    if (sample >= 0) {
+        rtt_sample(win, sample);
+    }
+
+    return newly;
+}
+
+// Next frame due for retransmission
+raw_tx_slot_t *raw_window_next_rtx(raw_window_t *win, int64_t now_us, bool *dead) {
+    int sacked_after = 0;
+
+    *dead = false;
+
+    for (uint32_t seq = win->snd_una; seq_before(seq, win->snd_nxt); seq++) {
+        if (win->tx[raw_window_index(win, seq)].sacked) sacked_after++;
+    }
+
+    for (uint32_t seq = win->snd_una; seq_before(seq, win->snd_nxt); seq++) {
+        raw_tx_slot_t *slot = &win->tx[raw_window_index(win, seq)];
+
+        if (slot->sacked) {
+            sacked_after--;
+            continue;
+        }
+        if (!slot->in_use) continue;
+
+        // Later frames got through: this one was lost, don't wait for the RTO
+        if (!slot->fast_rtx && sacked_after >= RAW_DUP_THRESH) {
+            slot->fast_rtx = true;
+            slot->retries++;
+            slot->sent_us = now_us;
+            win->fast_retransmits++;
+            return slot;
+        }
+
+        // Exponential backoff per frame
+        int64_t rto = win->rto_us << (slot->retries < 8 ? slot->retries : 8);
+        if (rto > RAW_RTO_MAX_US) rto = RAW_RTO_MAX_US;
+
+        if (now_us - slot->sent_us >= rto) {
+            if (slot->retries >= RAW_MAX_RETRIES) {
+                *dead = true;
+                return NULL;
+            }
+            slot->retries++;
+            slot->sent_us = now_us;
+            win->retransmits++;
+            return slot;
+        }
+    }
+
+    return NULL;
+}
+
+// Resume after a link loss
+void raw_window_resume(raw_window_t *win, const raw_sack_t *ack, int64_t now_us) {
+    // Nothing sent before the loss gives a usable RTT sample
+    for (uint32_t seq = win->snd_una; seq_before(seq, win->snd_nxt); seq++) {
+        win->tx[raw_window_index(win, seq)].retries = 1;
+    }
+    raw_window_on_ack(win, ack, now_us);
+
+    // The path may have changed with the cable
+    win->rtt_valid = false;
+    win->rto_us = RAW_RTO_INITIAL_US;
+    win->probe_us = now_us;
+
+    for (uint32_t seq = win->snd_una; seq_before(seq, win->snd_nxt); seq++) {
+        raw_tx_slot_t *slot = &win->tx[raw_window_index(win, seq)];
+        slot->retries = 0;
+        slot->fast_rtx = false;
+        slot->sent_us = now_us - RAW_RTO_MAX_US;
+    }
+}
+
+bool raw_window_probe_due(raw_window_t *win, int64_t now_us) {
+    if (win->peer_window > 0 || raw_window_in_flight(win) > 0) return false;
+    if (now_us - win->probe_us < win->rto_us) return false;
+
+    win->probe_us = now_us;
+    return true;
+}
+
+bool raw_window_needs_timer(const raw_window_t *win) {
+    return raw_window_in_flight(win) > 0 || win->peer_window == 0;
+}
+
+// Accept a received frame
+int raw_window_on_data(raw_window_t *win, uint32_t seq, uint8_t channel,
+                       const uint8_t *data, size_t len) {
+    // Always answer, so a sender whose ACK was lost moves on
+    win->ack_pending = true;
+
+    if (seq_before(seq, win->rcv_next)) {
+        win->duplicates++;
+        return 0;
+    }
+
+    if (seq - win->rcv_read >= (uint32_t)win->size) {
+        return -1;
+    }
+
+    raw_rx_slot_t *slot = &win->rx[raw_window_index(win, seq)];
+    if (slot->present) {
+        win->duplicates++;
+        return 0;
+    }
+
+    if (len > win->msg_size - RAW_FRAME_HEADROOM) len = win->msg_size - RAW_FRAME_HEADROOM;
+    memcpy(slot->data, data, len);
+    slot->len = len;
+    slot->channel = channel;
+    slot->present = true;
+
+    // Advance past everything now contiguous
+    while (win->rcv_next - win->rcv_read < (uint32_t)win->size &&
+           win->rx[raw_window_index(win, win->rcv_next)].present) {
+        win->rcv_next++;
+    }
+
+    return 1;
+}
+
+// Describe the receive state
+void raw_window_build_ack(raw_window_t *win, raw_sack_t *ack) {
+    ack->cum_ack = win->rcv_next;
+    ack->window = (uint32_t)win->size - (win->rcv_next - win->rcv_read);
+    ack->sack = 0;
+
+    for (int i = 0; i < 64; i++) {
+        uint32_t seq = win->rcv_next + 1 + (uint32_t)i;
+        if (seq - win->rcv_read >= (uint32_t)win->size) break;
+        if (win->rx[raw_window_index(win, seq)].present) {
+            ack->sack |= 1ULL << i;
+        }
+    }
+
+    win->zero_window_sent = (ack->window == 0);
+    win->ack_pending = false;
+}
+
+const raw_rx_slot_t *raw_window_peek(const raw_window_t *win) {
+    if (win->rcv_read == win->rcv_next) return NULL;
+    return &win->rx[raw_window_index(win, win->rcv_read)];
+}
+
+void raw_window_consume(raw_window_t *win) {
+    if (win->rcv_read == win->rcv_next) return;
+
+    win->rx[raw_window_index(win, win->rcv_read)].present = false;
+    win->rcv_read++;
+
+    // The sender is stalled on our last advertisement: reopen the window
+    if (win->zero_window_sent) {
+        win->ack_pending = true;
+    }
+}
@@ -0,0 +1,147 @@
+// USB-C Software Network - Sliding Window Reliable Delivery
+// Selective-repeat ARQ for RAW_MSG_DATA.
+//
+// The sender keeps up to `size` frames in flight and holds a copy of each
+// until it is acknowledged. The receiver answers with RAW_MSG_DATA_ACK
+// carrying a cumulative ACK (next in-order sequence expected) plus a
+// bitmap of frames received beyond it, so a single loss only costs one
+// retransmission. Frames are retransmitted when their RTO expires (RTT
+// estimated per RFC 6298, Karn's rule for retransmitted frames) or as
+// soon as RAW_DUP_THRESH later frames have been selectively acknowledged.
+// A receiver that runs out of slots advertises a zero window; the sender
+// then probes with RAW_MSG_KEEPALIVE until the window reopens.
+//
+// Slot buffers are sized for the link MTU and allocated once by
+// raw_window_init(); resets between connections reuse them.
+//
+// This module only keeps the window state; usb_raw_comm.c moves the
+// messages.
+
+#ifndef USB_RAW_WINDOW_H
+#define USB_RAW_WINDOW_H
+
+#include "usb_raw_comm.h"
+
+#define RAW_WINDOW_MAX      64    // Bounded by the 64-bit SACK bitmap
+#define RAW_WINDOW_DEFAULT  32
+
+#define RAW_RTO_INITIAL_US  200000
+#define RAW_RTO_MIN_US      10000
+#define RAW_RTO_MAX_US      2000000
+#define RAW_DUP_THRESH      3     // SACKed successors before a fast retransmit
+#define RAW_MAX_RETRIES     8     // Consecutive timeouts before the link is declared dead
+
+// Unacknowledged frame, stored exactly as sent
+typedef struct {
+    uint8_t *msg;                // msg_size bytes
+    size_t len;
+    int64_t sent_us;
+    int retries;
+    bool in_use;
+    bool sacked;
+    bool fast_rtx;               // Already fast-retransmitted once
+} raw_tx_slot_t;
+
+// Received frame waiting for in-order delivery
+typedef struct {
+    uint8_t *data;               // msg_size - RAW_FRAME_HEADROOM bytes
+    size_t len;
+    uint8_t channel;             // Logical channel it arrived on
+    bool present;
+} raw_rx_slot_t;
+
+typedef struct raw_window {
+    int size;
+    int slots;                   // Allocated slots (power of two >= size)
+    size_t msg_size;             // Largest message a tx slot holds
+    uint8_t *arena;              // Backing store of all slot buffers (a slab)
+    size_t arena_bytes;
+
+    // Sender: [snd_una, snd_nxt) is in flight
+    uint32_t snd_una;
+    uint32_t snd_nxt;
+    int peer_window;             // Receiver's advertised free slots
+    int64_t probe_us;            // Last zero-window probe
+    raw_tx_slot_t tx[RAW_WINDOW_MAX];
+
+    // RTT estimation
+    int64_t srtt_us;
+    int64_t rttvar_us;
+    int64_t rto_us;
+    bool rtt_valid;
+
+    // Receiver: [rcv_read, rcv_next) is received in order but not yet read
+    uint32_t rcv_next;
+    uint32_t rcv_read;
+    raw_rx_slot_t rx[RAW_WINDOW_MAX];
+    bool ack_pending;
+    bool zero_window_sent;
+
+    // Statistics
+    unsigned long retransmits;
+    unsigned long fast_retransmits;
+    unsigned long duplicates;
+    unsigned long rtt_samples;   // RTT measurements taken
+    int64_t last_rtt_us;         // The latest of them
+} raw_window_t;
+
+// Allocate slot buffers for up to max_size frames of msg_size bytes
+// (header included) and reset. Returns 0 or -1 on allocation failure.
+int raw_window_init(raw_window_t *win, int max_size, size_t msg_size);
+
+// Release the slot buffers
+void raw_window_free(raw_window_t *win);
+
+// Reset to an empty window (sequence numbers restart at 0). size is
+// clamped to the allocated slots.
+void raw_window_reset(raw_window_t *win, int size);
+
+// Slot index of a sequence number
+int raw_window_index(const raw_window_t *win, uint32_t seq);
+
+// Frames in flight
+int raw_window_in_flight(const raw_window_t *win);
+
+// True if another frame may be sent now
+bool raw_window_can_send(const raw_window_t *win);
+
+// Slot for the next sequence number (snd_nxt); fill msg/len, then commit
+raw_tx_slot_t *raw_window_tx_slot(raw_window_t *win);
+void raw_window_tx_commit(raw_window_t *win, size_t len, int64_t now_us);
+
+// Process an incoming ACK. Returns the number of frames newly acknowledged.
+int raw_window_on_ack(raw_window_t *win, const raw_sack_t *ack, int64_t now_us);
+
+// Next frame due for retransmission at now_us, or NULL. The slot's timers
+// are updated as if it has been resent. *dead is set once a frame has
+// exceeded RAW_MAX_RETRIES.
+raw_tx_slot_t *raw_window_next_rtx(raw_window_t *win, int64_t now_us, bool *dead);
+
+// Pick up a connection again after the link was lost, given the peer's
+// receive state: frames it has are released, the rest are due for
+// retransmission at once with fresh retry counts, and RTT estimation
+// starts over
+void raw_window_resume(raw_window_t *win, const raw_sack_t *ack, int64_t now_us);
+
+// True if the peer has advertised a zero window for an RTO and should be
+// probed for a window update (the update itself may have been lost)
+bool raw_window_probe_due(raw_window_t *win, int64_t now_us);
+
+// True while a timer is needed (frames in flight or a zero window)
+bool raw_window_needs_timer(const raw_window_t *win);
+
+// Accept a received frame on a logical channel. Returns 1 if stored, 0
+// for a duplicate, -1 if outside the receive window.
+int raw_window_on_data(raw_window_t *win, uint32_t seq, uint8_t channel,
+                       const uint8_t *data, size_t len);
+
+// Fill the ACK describing the receive state and clear ack_pending
+void raw_window_build_ack(raw_window_t *win, raw_sack_t *ack);
+
+// Next in-order frame ready for delivery, or NULL
+const raw_rx_slot_t *raw_window_peek(const raw_window_t *win);
+
+// Release the frame returned by raw_window_peek()
+void raw_window_consume(raw_window_t *win);
+
+#endif // USB_RAW_WINDOW_H
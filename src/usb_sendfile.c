@@ -0,0 +1,913 @@
+// USB-C Software Network - File Transfer Implementation
+//
+// Every message starts with a file_msg_t. FILE_OP_OFFER describes the
+// file, FILE_OP_DATA carries one chunk and FILE_OP_DONE closes a round.
+// The receiver answers an offer or a DONE with its status: FILE_OP_MISSING
+// bitmaps for the stretches that still have chunks missing (a stretch
+// missing all of them as a bare count, so a new file costs one message),
+// then FILE_OP_STATUS with the total. Answers carry the round they belong
+// to and the sender drops stale ones. A request whose answer does not
+// come is sent again; as the status only depends on what is on disk, a
+// repeated one does no harm.
+
+#define _GNU_SOURCE
+#include "usb_sendfile.h"
+#include "usb_log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define FILE_POLL_MS 200             // Receiver receive slice
+#define FILE_STATUS_MS 1000          // Sender wait for a status
+#define FILE_STATUS_RETRIES 10
+#define FILE_CONNECT_MS 30000        // Sender wait for the receiver to answer the offer
+#define FILE_RAW_CONNECT_S 60
+#define FILE_RETRY_US 50             // Back-off while the raw transport ring is full
+#define FILE_CHECKPOINT_MS 2000      // Resume bitmap saved this often while data arrives
+#define FILE_LINGER_MS 3000          // Receiver keeps answering this long after finishing
+#define FILE_PROGRESS_MS 1000
+#define FILE_NAME_MAX 255
+
+// Message operations
+#define FILE_OP_OFFER   1            // Sender: file_offer_t, then the file name
+#define FILE_OP_DATA    2            // Sender: chunk index, then the chunk
+#define FILE_OP_DONE    3            // Sender: round sent, asks for the status
+#define FILE_OP_MISSING 4            // Receiver: bitmap of count chunks from index
+#define FILE_OP_STATUS  5            // Receiver: round answered, index chunks missing
+#define FILE_OP_ABORT   6            // Receiver: cannot take the file, reason follows
+
+#define FILE_FLAG_ALL      0x01      // MISSING: all count chunks, no bitmap
+#define FILE_FLAG_NO_OFFER 0x02      // ABORT: no file open (receiver restarted), offer again
+
+typedef struct __attribute__((packed)) {
+    uint8_t  op;                     // FILE_OP_*
+    uint8_t  flags;                  // FILE_FLAG_*
+    uint16_t round;
+    uint32_t count;
+    uint64_t index;
+} file_msg_t;
+
+typedef struct __attribute__((packed)) {
+    uint64_t size;
+    uint64_t mtime_ns;               // With size, tells a resumable file from a new one
+    uint32_t chunk_size;
+} file_offer_t;
+
+// Sidecar file: this header, then the chunk bitmap as 64-bit words
+typedef struct {
+    char magic[4];                   // FILE_RESUME_MAGIC
+    uint32_t version;
+    uint64_t size;
+    uint64_t mtime_ns;
+    uint32_t chunk_size;
+    uint32_t reserved;
+} file_resume_t;
+
+#define FILE_RESUME_MAGIC "UCFR"
+#define FILE_RESUME_VERSION 1
+
+typedef struct {
+    usb_net_device_t *device;
+    bool raw;                        // Raw transport instead of the bulk endpoints
+    size_t max_payload;
+    uint8_t *scratch;                // max_payload bytes to build messages in
+} file_link_t;
+
+// A received message, lent out of the transport until file_release()
+typedef struct {
+    file_msg_t msg;                  // op 0 if too short to be one
+    const uint8_t *data;             // What follows the header
+    size_t len;
+    usb_frame_t view;                // Raw transport
+    int slot;                        // Bulk endpoints
+} file_rx_t;
+
+typedef struct {
+    file_link_t *link;
+    const uint8_t *map;              // The whole file, mapped
+    uint64_t size;
+    uint32_t chunk_size;
+    uint64_t chunks;
+    uint64_t *need;                  // Chunks to send this round
+    uint64_t missing;                // As last reported by the receiver
+    uint16_t round;
+    uint64_t tx_chunks;
+    uint64_t tx_bytes;
+    int64_t start_ms;
+    int64_t progress_ms;
+} file_sender_t;
+
+typedef struct {
+    file_link_t *link;
+    char path[512];
+    char resume_path[520];
+    int fd;
+    int resume_fd;
+    uint64_t size;
+    uint64_t mtime_ns;
+    uint32_t chunk_size;
+    uint64_t chunks;
+    uint64_t *have;                  // Chunks on disk
+    uint64_t received;               // Bits set in have
+    bool dirty;                      // have changed since the last checkpoint
+    bool complete;
+    uint64_t rx_bytes;
+    int64_t start_ms;
+    int64_t checkpoint_ms;
+    int64_t progress_ms;
+    int64_t linger_ms;               // Exit time once complete
+} file_receiver_t;
+
+static volatile sig_atomic_t file_stop = 0;
+
+static void file_signal_handler(int sig) {
+    (void)sig;
+    file_stop = 1;
+}
+
+static int64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static double mbps(uint64_t bytes, int64_t ms) {
+    return ms > 0 ? (double)bytes * 8.0 / ((double)ms * 1000.0) : 0.0;
+}
+
+// Bitmaps
+
+static uint64_t map_words(uint64_t bits) {
+    return (bits + 63) / 64;
+}
+
+static bool bit_get(const uint64_t *map, uint64_t i) {
+    return (map[i / 64] >> (i % 64)) & 1;
+}
+
+static void bit_set(uint64_t *map, uint64_t i) {
+    map[i / 64] |= 1ULL << (i % 64);
+}
+
+static void bit_set_range(uint64_t *map, uint64_t first, uint64_t count) {
+    for (; count > 0 && first % 64 != 0; first++, count--) {
+        bit_set(map, first);
+    }
+    for (; count >= 64; first += 64, count -= 64) {
+        map[first / 64] = UINT64_MAX;
+    }
+    for (; count > 0; first++, count--) {
+        bit_set(map, first);
+    }
+}
+
+// Transport
+
+static int file_send(file_link_t *l, const file_msg_t *msg, const void *data, size_t len) {
+    usb_frame_t frame;
+
+    if (l->raw) {
+        raw_comm_ctx_t *ctx = &l->device->raw_ctx;
+        int64_t deadline = now_ms() + USB_TIMEOUT_MS;
+
+        // Unreliable mode hands a full transport ring back as EAGAIN
+        for (;;) {
+            if (raw_comm_alloc_frame(ctx, &frame) < 0) return -1;
+            memcpy(frame.data, msg, sizeof(file_msg_t));
+            if (len > 0) memcpy(frame.data + sizeof(file_msg_t), data, len);
+            frame.len = sizeof(file_msg_t) + len;
+            if (raw_comm_send_frame(ctx, &frame) >= 0) return 0;
+            if (errno != EAGAIN || now_ms() >= deadline || file_stop) return -1;
+            usleep(FILE_RETRY_US);
+        }
+    }
+
+    if (usb_net_alloc_frame(l->device, &frame, USB_TIMEOUT_MS) < 0) {
+        USB_LOG_ERROR("File: no transfer slot within %d ms\n", USB_TIMEOUT_MS);
+        return -1;
+    }
+    memcpy(frame.data, msg, sizeof(file_msg_t));
+    if (len > 0) memcpy(frame.data + sizeof(file_msg_t), data, len);
+    frame.len = sizeof(file_msg_t) + len;
+    return usb_net_send_frame(l->device, &frame, PKT_DATA) < 0 ? -1 : 0;
+}
+
+static void take_msg(file_rx_t *rx, const uint8_t *data, size_t len) {
+    if (data && len >= sizeof(file_msg_t)) {
+        memcpy(&rx->msg, data, sizeof(file_msg_t));
+        rx->data = data + sizeof(file_msg_t);
+        rx->len = len - sizeof(file_msg_t);
+    } else {
+        memset(&rx->msg, 0, sizeof(file_msg_t));
+        rx->data = NULL;
+        rx->len = 0;
+    }
+}
+
+// Wait up to timeout_ms for a message. Returns 1 with *rx to be released
+// by file_release(), 0 on timeout, -1 on error.
+static int file_recv(file_link_t *l, file_rx_t *rx, int timeout_ms) {
+    if (l->raw) {
+        raw_comm_ctx_t *ctx = &l->device->raw_ctx;
+        int64_t deadline = now_ms() + timeout_ms;
+
+        // Batched answers must not wait for the flush timer
+        if (raw_comm_flush(ctx) < 0) return -1;
+        for (;;) {
+            int ret = raw_comm_recv_frame(ctx, &rx->view);
+            if (ret < 0) return -1;
+            if (ret > 0) break;
+
+            int left = (int)(deadline - now_ms());
+            if (left <= 0 || file_stop) return 0;
+            if (raw_comm_poll(ctx, left) < 0) return -1;
+        }
+        take_msg(rx, rx->view.data, rx->view.len);
+        return 1;
+    }
+
+    usb_xfer_engine_t *xfer = &l->device->xfer;
+    usb_xfer_completion_t done;
+    int ret = usb_xfer_wait_rx(xfer, &done, timeout_ms);
+    if (ret < 0) {
+        USB_LOG_ERROR("Bulk read error: %s\n", libusb_error_name(xfer->last_error));
+        return -1;
+    }
+    if (ret == 0) return 0;
+
+    const packet_header_t *hdr = (const packet_header_t *)done.data;
+    int left = done.len - (int)sizeof(packet_header_t);
+    rx->slot = done.slot;
+    if (left < 0 || hdr->magic != PACKET_MAGIC || hdr->type != PKT_DATA || hdr->length > left) {
+        take_msg(rx, NULL, 0);
+    } else {
+        take_msg(rx, done.data + sizeof(packet_header_t), hdr->length);
+    }
+    return 1;
+}
+
+static void file_release(file_link_t *l, file_rx_t *rx) {
+    if (l->raw) {
+        raw_comm_release_frame(&l->device->raw_ctx, &rx->view);
+    } else {
+        usb_xfer_release(&l->device->xfer, rx->slot);
+    }
+}
+
+// Bring up the configured transport and wait for the other side
+static int file_connect(file_link_t *l, usb_net_device_t *device) {
+    const char *transport = device->config.file_transport[0] ? device->config.file_transport : "usb";
+
+    memset(l, 0, sizeof(file_link_t));
+    l->device = device;
+    if (strcmp(transport, "raw") == 0) {
+        l->raw = true;
+    } else if (strcmp(transport, "usb") != 0) {
+        USB_LOG_ERROR("Unknown FILE_TRANSPORT '%s' (usb or raw)\n", transport);
+        return -1;
+    }
+
+    if (!l->raw) {
+        if (usb_net_wait_for_peer(device, "peer") < 0) return -1;
+        if (!device->xfer.running) {
+            USB_LOG_ERROR("File transfer requires the async transfer engine\n");
+            return -1;
+        }
+        l->max_payload = (size_t)device->config.usb_mtu;
+    } else {
+        if (usb_net_raw_setup(device) < 0) return -1;
+
+        USB_LOG_INFO("Waiting for raw peer connection...\n");
+        for (int i = 0; i < FILE_RAW_CONNECT_S && !file_stop; i++) {
+            raw_comm_poll(&device->raw_ctx, 1000);
+            if (raw_comm_get_state(&device->raw_ctx) == RAW_STATE_CONNECTED) break;
+        }
+        if (raw_comm_get_state(&device->raw_ctx) != RAW_STATE_CONNECTED) {
+            USB_LOG_ERROR("No raw peer after %d seconds\n", FILE_RAW_CONNECT_S);
+            raw_comm_cleanup(&device->raw_ctx);
+            return -1;
+        }
+        l->max_payload = raw_comm_max_payload(&device->raw_ctx);
+        USB_LOG_INFO("Connected to peer 0x%08x\n", raw_comm_get_peer_id(&device->raw_ctx));
+    }
+
+    if (l->max_payload < sizeof(file_msg_t) + sizeof(file_offer_t) + 64) {
+        USB_LOG_ERROR("Link payload of %zu bytes is too small for file transfer\n", l->max_payload);
+    } else if (!(l->scratch = malloc(l->max_payload))) {
+        USB_LOG_ERROR("Failed to allocate file transfer buffer\n");
+    } else {
+        return 0;
+    }
+    if (l->raw) raw_comm_cleanup(&device->raw_ctx);
+    return -1;
+}
+
+static void file_disconnect(file_link_t *l) {
+    if (l->raw) {
+        raw_comm_flush(&l->device->raw_ctx);
+        raw_comm_cleanup(&l->device->raw_ctx);
+    }
+    free(l->scratch);
+    l->scratch = NULL;
+}
+
+static void file_setup_signals(void) {
+    struct sigaction sa;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = file_signal_handler;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    file_stop = 0;
+}
+
+// Sender
+
+// Add the chunks of a MISSING message to the next round
+static void merge_missing(file_sender_t *s, const file_msg_t *msg, const uint8_t *data, size_t len) {
+    if (msg->index >= s->chunks) return;
+    uint64_t count = msg->count;
+    if (count > s->chunks - msg->index) count = s->chunks - msg->index;
+
+    if (msg->flags & FILE_FLAG_ALL) {
+        bit_set_range(s->need, msg->index, count);
+        return;
+    }
+    if (msg->index % 64 != 0) return;  // Bitmaps always start on a word
+
+    uint64_t words = map_words(count);
+    if (words > len / sizeof(uint64_t)) words = len / sizeof(uint64_t);
+    for (uint64_t k = 0; k < words; k++) {
+        uint64_t w;
+        memcpy(&w, data + k * sizeof(uint64_t), sizeof(w));
+        if (k == words - 1 && count % 64 != 0 && words == map_words(count)) {
+            w &= (1ULL << (count % 64)) - 1;
+        }
+        s->need[msg->index / 64 + k] |= w;
+    }
+}
+
+// Send a request (the offer or a DONE) until the receiver answers it with
+// its status. Returns 0 once nothing is missing, 1 if chunks are, -2 if
+// the receiver wants the offer again, -1 on error or no answer.
+static int request_status(file_sender_t *s, const file_msg_t *req, const void *data, size_t len,
+                          int attempts) {
+    for (int i = 0; i < attempts && !file_stop; i++) {
+        if (file_send(s->link, req, data, len) < 0) return -1;
+
+        int64_t deadline = now_ms() + FILE_STATUS_MS;
+        while (!file_stop) {
+            int left = (int)(deadline - now_ms());
+            if (left <= 0) break;
+
+            file_rx_t rx;
+            int ret = file_recv(s->link, &rx, left);
+            if (ret < 0) return -1;
+            if (ret == 0) break;
+
+            const file_msg_t *msg = &rx.msg;
+            int result = 2;  // Keep waiting
+            if (msg->op == FILE_OP_ABORT && (msg->flags & FILE_FLAG_NO_OFFER)) {
+                result = -2;
+            } else if (msg->op == FILE_OP_ABORT) {
+                USB_LOG_ERROR("Receiver refused the file: %.*s\n", (int)rx.len, (const char *)rx.data);
+                result = -1;
+            } else if (msg->round != s->round) {
+                // Answer to an earlier request
+            } else if (msg->op == FILE_OP_MISSING) {
+                merge_missing(s, msg, rx.data, rx.len);
+            } else if (msg->op == FILE_OP_STATUS) {
+                s->missing = msg->index;
+                result = msg->index > 0 ? 1 : 0;
+            }
+            file_release(s->link, &rx);
+            if (result != 2) return result;
+        }
+    }
+
+    if (!file_stop) {
+        USB_LOG_ERROR("Receiver not answering\n");
+    }
+    return -1;
+}
+
+static void send_progress(file_sender_t *s, bool force) {
+    int64_t now = now_ms();
+    if (!force && now - s->progress_ms < FILE_PROGRESS_MS) return;
+
+    s->progress_ms = now;
+    USB_LOG_INFO("Sent %llu chunks (%.1f MB), %.1f Mbit/s\n", (unsigned long long)s->tx_chunks,
+                 (double)s->tx_bytes / 1e6, mbps(s->tx_bytes, now - s->start_ms));
+}
+
+// Stream every chunk of the round straight out of the mapping
+static int send_round(file_sender_t *s) {
+    uint64_t words = map_words(s->chunks);
+
+    for (uint64_t w = 0; w < words && !file_stop; w++) {
+        while (s->need[w] != 0 && !file_stop) {
+            uint64_t chunk = w * 64 + (uint64_t)__builtin_ctzll(s->need[w]);
+            s->need[w] &= s->need[w] - 1;
+
+            uint64_t offset = chunk * s->chunk_size;
+            size_t len = (size_t)(s->size - offset < s->chunk_size ? s->size - offset : s->chunk_size);
+            file_msg_t msg = { .op = FILE_OP_DATA, .round = s->round, .index = chunk };
+            if (file_send(s->link, &msg, s->map + offset, len) < 0) {
+                USB_LOG_ERROR("Failed to send chunk %llu\n", (unsigned long long)chunk);
+                return -1;
+            }
+            s->tx_chunks++;
+            s->tx_bytes += len;
+            send_progress(s, false);
+        }
+    }
+    return file_stop ? -1 : 0;
+}
+
+int usb_sendfile_run_send(usb_net_device_t *device) {
+    const char *path = device->config.file_path;
+    file_sender_t s;
+    file_link_t link;
+    struct stat st;
+
+    if (!path[0]) {
+        USB_LOG_ERROR("No file to send (FILE_PATH or --file)\n");
+        return -1;
+    }
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        USB_LOG_ERROR("Cannot open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    if (fstat(fd, &st) < 0) {
+        USB_LOG_ERROR("Cannot stat %s: %s\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    if (!S_ISREG(st.st_mode)) {
+        USB_LOG_ERROR("Cannot send %s: not a regular file\n", path);
+        close(fd);
+        return -1;
+    }
+
+    memset(&s, 0, sizeof(s));
+    s.size = (uint64_t)st.st_size;
+    if (s.size > 0) {
+        void *map = mmap(NULL, (size_t)s.size, PROT_READ, MAP_SHARED, fd, 0);
+        if (map == MAP_FAILED) {
+            USB_LOG_ERROR("Cannot map %s: %s\n", path, strerror(errno));
+            close(fd);
+            return -1;
+        }
+        madvise(map, (size_t)s.size, MADV_SEQUENTIAL);
+        s.map = map;
+    }
+    close(fd);
+
+    USB_LOG_INFO("\n=== Running in SEND-FILE mode ===\n");
+    file_setup_signals();
+
+    int ret = -1;
+    if (file_connect(&link, device) < 0) goto out_unmap;
+    s.link = &link;
+    s.chunk_size = (uint32_t)(link.max_payload - sizeof(file_msg_t));
+    s.chunks = s.size ? (s.size - 1) / s.chunk_size + 1 : 0;
+    s.need = calloc(map_words(s.chunks) + 1, sizeof(uint64_t));
+    if (!s.need) {
+        USB_LOG_ERROR("Failed to allocate the chunk bitmap\n");
+        goto out_disconnect;
+    }
+
+    // The offer: file_offer_t and the name without its directory
+    const char *name = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+    size_t name_len = strnlen(name, FILE_NAME_MAX);
+    if (name_len > s.chunk_size - sizeof(file_offer_t)) name_len = s.chunk_size - sizeof(file_offer_t);
+    file_offer_t offer = {
+        .size = s.size,
+        .mtime_ns = (uint64_t)st.st_mtim.tv_sec * 1000000000ULL + (uint64_t)st.st_mtim.tv_nsec,
+        .chunk_size = s.chunk_size,
+    };
+    memcpy(link.scratch, &offer, sizeof(offer));
+    memcpy(link.scratch + sizeof(offer), name, name_len);
+
+    USB_LOG_INFO("Offering %s: %llu bytes in %llu chunks of %u\n", path,
+                 (unsigned long long)s.size, (unsigned long long)s.chunks, s.chunk_size);
+    s.start_ms = s.progress_ms = now_ms();
+
+    do {
+        // The offer opens the first round; the answer says what to send
+        memset(s.need, 0, map_words(s.chunks) * sizeof(uint64_t));
+        file_msg_t req = { .op = FILE_OP_OFFER, .round = ++s.round };
+        ret = request_status(&s, &req, link.scratch, sizeof(offer) + name_len,
+                             FILE_CONNECT_MS / FILE_STATUS_MS);
+        if (ret == 1) {
+            USB_LOG_INFO("Receiver is missing %llu of %llu chunks\n",
+                         (unsigned long long)s.missing, (unsigned long long)s.chunks);
+        }
+
+        while (ret == 1) {
+            if (send_round(&s) < 0) {
+                ret = -1;
+                break;
+            }
+            req = (file_msg_t){ .op = FILE_OP_DONE, .round = ++s.round };
+            ret = request_status(&s, &req, NULL, 0, FILE_STATUS_RETRIES);
+            if (ret == 1) {
+                USB_LOG_INFO("Round %u: receiver still missing %llu chunks\n", s.round,
+                             (unsigned long long)s.missing);
+            }
+        }
+
+        if (ret == -2) {
+            USB_LOG_INFO("Receiver has no transfer open, offering again\n");
+        }
+    } while (ret == -2 && !file_stop);
+
+    if (ret == 0) {
+        int64_t ms = now_ms() - s.start_ms;
+        send_progress(&s, true);
+        USB_LOG_INFO("Sent %s in %.1f s (%.1f Mbit/s)\n", path, (double)ms / 1000.0,
+                     mbps(s.tx_bytes, ms));
+    }
+
+    free(s.need);
+out_disconnect:
+    file_disconnect(&link);
+out_unmap:
+    if (s.map) munmap((void *)s.map, (size_t)s.size);
+    return ret < 0 ? -1 : 0;
+}
+
+// Receiver
+
+static int send_abort(file_link_t *l, uint16_t round, uint8_t flags, const char *reason) {
+    file_msg_t msg = { .op = FILE_OP_ABORT, .flags = flags, .round = round };
+    return file_send(l, &msg, reason, strlen(reason));
+}
+
+// Save the bitmap, after the chunks it lists are on disk
+static void checkpoint(file_receiver_t *r) {
+    if (!r->dirty || r->resume_fd < 0) return;
+
+    size_t bytes = (size_t)map_words(r->chunks) * sizeof(uint64_t);
+    if (fdatasync(r->fd) < 0 ||
+        pwrite(r->resume_fd, r->have, bytes, sizeof(file_resume_t)) != (ssize_t)bytes) {
+        USB_LOG_WARN_RATELIMIT("Cannot save %s: %s\n", r->resume_path, strerror(errno));
+        return;
+    }
+    r->dirty = false;
+    r->checkpoint_ms = now_ms();
+}
+
+static void close_file(file_receiver_t *r) {
+    if (r->fd >= 0) {
+        checkpoint(r);
+        close(r->fd);
+    }
+    if (r->resume_fd >= 0) close(r->resume_fd);
+    free(r->have);
+    r->have = NULL;
+    r->fd = r->resume_fd = -1;
+}
+
+// Pick up the bitmap of an earlier attempt at the same file
+static bool load_resume(file_receiver_t *r) {
+    file_resume_t hdr;
+    size_t bytes = (size_t)map_words(r->chunks) * sizeof(uint64_t);
+
+    r->resume_fd = open(r->resume_path, O_RDWR | O_CLOEXEC);
+    if (r->resume_fd < 0) return false;
+
+    if (pread(r->resume_fd, &hdr, sizeof(hdr), 0) != (ssize_t)sizeof(hdr) ||
+        memcmp(hdr.magic, FILE_RESUME_MAGIC, 4) != 0 || hdr.version != FILE_RESUME_VERSION ||
+        hdr.size != r->size || hdr.mtime_ns != r->mtime_ns || hdr.chunk_size != r->chunk_size ||
+        pread(r->resume_fd, r->have, bytes, sizeof(hdr)) != (ssize_t)bytes) {
+        close(r->resume_fd);
+        r->resume_fd = -1;
+        return false;
+    }
+
+    // Bits past the last chunk would count as chunks received
+    if (r->chunks % 64 != 0) {
+        r->have[r->chunks / 64] &= (1ULL << (r->chunks % 64)) - 1;
+    }
+    for (uint64_t w = 0; w < map_words(r->chunks); w++) {
+        r->received += (uint64_t)__builtin_popcountll(r->have[w]);
+    }
+    return true;
+}
+
+static int create_resume(file_receiver_t *r) {
+    file_resume_t hdr = {
+        .version = FILE_RESUME_VERSION,
+        .size = r->size,
+        .mtime_ns = r->mtime_ns,
+        .chunk_size = r->chunk_size,
+    };
+    size_t bytes = (size_t)map_words(r->chunks) * sizeof(uint64_t);
+
+    memcpy(hdr.magic, FILE_RESUME_MAGIC, 4);
+    r->resume_fd = open(r->resume_path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (r->resume_fd < 0 ||
+        pwrite(r->resume_fd, &hdr, sizeof(hdr), 0) != (ssize_t)sizeof(hdr) ||
+        pwrite(r->resume_fd, r->have, bytes, sizeof(hdr)) != (ssize_t)bytes) {
+        return -1;
+    }
+    return 0;
+}
+
+// Where the offered file goes: FILE_PATH, inside it if it is a directory,
+// or the sender's name in the working directory if it is not set
+static int dest_path(file_receiver_t *r, const uint8_t *name, size_t name_len) {
+    const char *dest = r->link->device->config.file_path;
+    char base[FILE_NAME_MAX + 1];
+    struct stat st;
+
+    if (name_len > FILE_NAME_MAX) name_len = FILE_NAME_MAX;
+    memcpy(base, name, name_len);
+    base[name_len] = '\0';
+    bool base_ok = name_len > 0 && strlen(base) == name_len && !strchr(base, '/') &&
+                   strcmp(base, ".") != 0 && strcmp(base, "..") != 0;
+
+    int n;
+    if (dest[0] && !(stat(dest, &st) == 0 && S_ISDIR(st.st_mode))) {
+        n = snprintf(r->path, sizeof(r->path), "%s", dest);
+    } else if (!base_ok) {
+        return -1;
+    } else if (dest[0]) {
+        n = snprintf(r->path, sizeof(r->path), "%s/%s", dest, base);
+    } else {
+        n = snprintf(r->path, sizeof(r->path), "%s", base);
+    }
+    if (n < 0 || (size_t)n >= sizeof(r->path)) return -1;
+
+    snprintf(r->resume_path, sizeof(r->resume_path), "%s%s", r->path, USB_FILE_RESUME_SUFFIX);
+    return 0;
+}
+
+// Open and preallocate the destination for an offer. On failure *reason
+// says why, for the sender.
+static int open_file(file_receiver_t *r, const file_offer_t *offer, const uint8_t *name,
+                     size_t name_len, const char **reason) {
+    char old_path[sizeof(r->path)];
+
+    snprintf(old_path, sizeof(old_path), "%s", r->path);
+    if (dest_path(r, name, name_len) < 0) {
+        *reason = "invalid file name";
+        return -1;
+    }
+
+    // The same offer again (its answer was lost, or the sender restarted)
+    if (r->fd >= 0 && strcmp(old_path, r->path) == 0 && r->size == offer->size &&
+        r->mtime_ns == offer->mtime_ns && r->chunk_size == offer->chunk_size) {
+        return 0;
+    }
+
+    close_file(r);
+    r->size = offer->size;
+    r->mtime_ns = offer->mtime_ns;
+    r->chunk_size = offer->chunk_size;
+    r->chunks = r->size ? (r->size - 1) / r->chunk_size + 1 : 0;
+    r->received = r->rx_bytes = 0;
+    r->dirty = r->complete = false;
+    r->have = calloc(map_words(r->chunks) + 1, sizeof(uint64_t));
+    if (!r->have) {
+        *reason = "out of memory";
+        return -1;
+    }
+
+    r->fd = open(r->path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (r->fd < 0) {
+        USB_LOG_ERROR("Cannot open %s: %s\n", r->path, strerror(errno));
+        *reason = "cannot open the destination";
+        return -1;
+    }
+
+    bool resumed = load_resume(r);
+    if (!resumed && (ftruncate(r->fd, 0) < 0 || create_resume(r) < 0)) {
+        USB_LOG_ERROR("Cannot start %s: %s\n", r->resume_path, strerror(errno));
+        *reason = "cannot write the destination";
+        return -1;
+    }
+
+    // Reserve the space up front: no ENOSPC halfway, and little fragmentation
+    if (r->size > 0 && fallocate(r->fd, 0, 0, (off_t)r->size) < 0) {
+        if ((errno != EOPNOTSUPP && errno != ENOSYS) || ftruncate(r->fd, (off_t)r->size) < 0) {
+            USB_LOG_ERROR("Cannot allocate %llu bytes for %s: %s\n",
+                          (unsigned long long)r->size, r->path, strerror(errno));
+            *reason = "no space for the file";
+            return -1;
+        }
+    }
+
+    USB_LOG_INFO("Receiving %s: %llu bytes in %llu chunks of %u", r->path,
+                 (unsigned long long)r->size, (unsigned long long)r->chunks, r->chunk_size);
+    if (resumed) {
+        USB_LOG_INFO(", resuming with %llu already here", (unsigned long long)r->received);
+    }
+    USB_LOG_INFO("\n");
+    r->start_ms = r->checkpoint_ms = r->progress_ms = now_ms();
+    return 0;
+}
+
+// Answer a round: MISSING for every stretch with chunks missing, then STATUS
+static int send_status(file_receiver_t *r, uint16_t round) {
+    file_link_t *l = r->link;
+    uint64_t seg_words = (l->max_payload - sizeof(file_msg_t)) / sizeof(uint64_t);
+    uint64_t seg_bits = seg_words * 64;
+    uint64_t missing = 0;
+    uint64_t run_first = 0, run_count = 0;  // Stretches missing everything, merged
+    uint64_t bits[64];
+
+    for (uint64_t seg = 0; seg < r->chunks; seg += seg_bits) {
+        uint64_t n = r->chunks - seg < seg_bits ? r->chunks - seg : seg_bits;
+        uint64_t words = map_words(n);
+        uint64_t miss = 0;
+
+        // Build the missing bitmap in scratch, a block of words at a time
+        for (uint64_t k = 0; k < words; k++) {
+            uint64_t w = ~r->have[seg / 64 + k];
+            if (k == words - 1 && n % 64 != 0) w &= (1ULL << (n % 64)) - 1;
+            bits[k % 64] = w;
+            miss += (uint64_t)__builtin_popcountll(w);
+            if (k % 64 == 63 || k == words - 1) {
+                memcpy(l->scratch + (k - k % 64) * sizeof(uint64_t), bits,
+                       (k % 64 + 1) * sizeof(uint64_t));
+            }
+        }
+
+        bool all = miss == n;
+        if (run_count > 0 && (!all || run_count + n > UINT32_MAX)) {
+            file_msg_t msg = { .op = FILE_OP_MISSING, .flags = FILE_FLAG_ALL, .round = round,
+                               .count = (uint32_t)run_count, .index = run_first };
+            if (file_send(l, &msg, NULL, 0) < 0) return -1;
+            run_count = 0;
+        }
+        if (all) {
+            if (run_count == 0) run_first = seg;
+            run_count += n;
+        } else if (miss > 0) {
+            file_msg_t msg = { .op = FILE_OP_MISSING, .round = round, .count = (uint32_t)n,
+                               .index = seg };
+            if (file_send(l, &msg, l->scratch, (size_t)words * sizeof(uint64_t)) < 0) return -1;
+        }
+        missing += miss;
+    }
+    if (run_count > 0) {
+        file_msg_t msg = { .op = FILE_OP_MISSING, .flags = FILE_FLAG_ALL, .round = round,
+                           .count = (uint32_t)run_count, .index = run_first };
+        if (file_send(l, &msg, NULL, 0) < 0) return -1;
+    }
+
+    file_msg_t status = { .op = FILE_OP_STATUS, .round = round, .index = missing };
+    return file_send(l, &status, NULL, 0);
+}
+
+static void finish_file(file_receiver_t *r) {
+    int64_t ms = now_ms() - r->start_ms;
+
+    if (fdatasync(r->fd) < 0) {
+        USB_LOG_WARN("Cannot flush %s: %s\n", r->path, strerror(errno));
+    }
+    close(r->resume_fd);
+    r->resume_fd = -1;
+    unlink(r->resume_path);
+    r->dirty = false;
+    r->complete = true;
+    r->linger_ms = now_ms() + FILE_LINGER_MS;
+    USB_LOG_INFO("Received %s: %llu bytes, %.1f MB this run in %.1f s (%.1f Mbit/s)\n", r->path,
+                 (unsigned long long)r->size, (double)r->rx_bytes / 1e6, (double)ms / 1000.0,
+                 mbps(r->rx_bytes, ms));
+}
+
+static int on_data(file_receiver_t *r, const file_rx_t *rx) {
+    uint64_t chunk = rx->msg.index;
+    if (r->fd < 0 || r->complete || chunk >= r->chunks) return 0;
+
+    uint64_t offset = chunk * r->chunk_size;
+    size_t len = (size_t)(r->size - offset < r->chunk_size ? r->size - offset : r->chunk_size);
+    if (rx->len != len) {
+        USB_LOG_WARN_RATELIMIT("Chunk %llu has %zu bytes, expected %zu\n",
+                               (unsigned long long)chunk, rx->len, len);
+        return 0;
+    }
+    if (bit_get(r->have, chunk)) return 0;  // Sent again, already here
+
+    if (pwrite(r->fd, rx->data, len, (off_t)offset) != (ssize_t)len) {
+        USB_LOG_ERROR("Cannot write %s: %s\n", r->path, strerror(errno));
+        return -1;
+    }
+    bit_set(r->have, chunk);
+    r->received++;
+    r->rx_bytes += len;
+    r->dirty = true;
+    return 0;
+}
+
+// Handle one message. Returns -1 if the transfer cannot go on.
+static int receive_one(file_receiver_t *r, const file_rx_t *rx) {
+    const file_msg_t *msg = &rx->msg;
+    const char *reason = NULL;
+
+    switch (msg->op) {
+        case FILE_OP_OFFER: {
+            file_offer_t offer;
+            if (rx->len < sizeof(offer)) break;
+            memcpy(&offer, rx->data, sizeof(offer));
+
+            if (offer.chunk_size == 0 || offer.chunk_size > r->link->max_payload - sizeof(file_msg_t)) {
+                reason = "chunk size does not fit the link";
+            } else if (open_file(r, &offer, rx->data + sizeof(offer), rx->len - sizeof(offer),
+                                 &reason) == 0) {
+                if (send_status(r, msg->round) < 0) return -1;
+                if (r->received == r->chunks && !r->complete) finish_file(r);
+                break;
+            }
+            send_abort(r->link, msg->round, 0, reason);
+            close_file(r);
+            return -1;
+        }
+
+        case FILE_OP_DATA:
+            if (on_data(r, rx) < 0) {
+                send_abort(r->link, msg->round, 0, "write failed");
+                return -1;
+            }
+            break;
+
+        case FILE_OP_DONE:
+            if (r->fd < 0) {
+                if (send_abort(r->link, msg->round, FILE_FLAG_NO_OFFER, "no transfer open") < 0) {
+                    return -1;
+                }
+                break;
+            }
+            checkpoint(r);
+            if (send_status(r, msg->round) < 0) return -1;
+            if (r->received == r->chunks && !r->complete) finish_file(r);
+            break;
+
+        default:
+            break;  // Not a file transfer message
+    }
+    return 0;
+}
+
+int usb_sendfile_run_recv(usb_net_device_t *device) {
+    file_receiver_t r;
+    file_link_t link;
+
+    USB_LOG_INFO("\n=== Running in RECV-FILE mode ===\n");
+    file_setup_signals();
+    if (file_connect(&link, device) < 0) return -1;
+
+    memset(&r, 0, sizeof(r));
+    r.link = &link;
+    r.fd = r.resume_fd = -1;
+    USB_LOG_INFO("Waiting for a file (Ctrl+C to stop)\n");
+
+    int ret = 0;
+    while (!file_stop && !(r.complete && now_ms() >= r.linger_ms)) {
+        file_rx_t rx;
+        int got = file_recv(&link, &rx, FILE_POLL_MS);
+        if (got < 0) {
+            ret = -1;
+            break;
+        }
+        if (got > 0) {
+            ret = receive_one(&r, &rx);
+            file_release(&link, &rx);
+            if (ret < 0) break;
+        }
+
+        int64_t now = now_ms();
+        if (r.fd >= 0 && !r.complete && now - r.checkpoint_ms >= FILE_CHECKPOINT_MS) {
+            checkpoint(&r);
+        }
+        if (r.fd >= 0 && !r.complete && r.dirty && now - r.progress_ms >= FILE_PROGRESS_MS) {
+            r.progress_ms = now;
+            USB_LOG_INFO("Received %llu of %llu chunks (%.1f%%), %.1f Mbit/s\n",
+                         (unsigned long long)r.received, (unsigned long long)r.chunks,
+                         100.0 * (double)r.received / (double)r.chunks,
+                         mbps(r.rx_bytes, now - r.start_ms));
+        }
+    }
+
+    if (!r.complete && r.fd >= 0) {
+        USB_LOG_INFO("Stopped with %llu of %llu chunks; run again to resume\n",
+                     (unsigned long long)r.received, (unsigned long long)r.chunks);
+        if (ret == 0) ret = -1;
+    }
+    close_file(&r);
+    file_disconnect(&link);
+    return ret;
+}
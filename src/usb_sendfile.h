@@ -0,0 +1,32 @@
+// USB-C Software Network - File Transfer
+// Streams a file to the other side: --mode send-file on one end, --mode
+// recv-file on the other, over the bulk endpoints or a raw transport
+// (FILE_TRANSPORT).
+//
+// The file goes in fixed-size chunks, one per message, as many in flight
+// as the transfer pipeline or the raw window allows. The sender maps the
+// file and copies each chunk from the page cache straight into a transfer
+// slot; the receiver writes it in place with pwrite() into a file
+// preallocated at its full size, so chunks may be written in any order.
+//
+// Chunks are sent in rounds. After each round the receiver answers with
+// a bitmap of the chunks it is still missing, and the next round sends
+// just those, which also repairs losses on an unreliable link. The
+// receiver keeps its bitmap in a sidecar file (<destination>.resume),
+// written after the data it covers is on disk, so when either side is
+// restarted the transfer resumes where it stopped.
+
+#ifndef USB_SENDFILE_H
+#define USB_SENDFILE_H
+
+#include "usb_net_core.h"
+
+#define USB_FILE_RESUME_SUFFIX ".resume"
+
+// Send FILE_PATH, first waiting for the receiver to answer
+int usb_sendfile_run_send(usb_net_device_t *device);
+
+// Receive one file into FILE_PATH (a directory keeps the sender's name)
+int usb_sendfile_run_recv(usb_net_device_t *device);
+
+#endif // USB_SENDFILE_H
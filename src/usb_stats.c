@@ -0,0 +1,173 @@
+// USB-C Software Network - Link Statistics
+
+#include "usb_stats.h"
+#include "usb_log.h"
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define STATS_WORDS (sizeof(usb_stats_t) / sizeof(usb_stat_t))
+
+void usb_stats_reset(usb_stats_t *stats) {
+    usb_stat_t *words = (usb_stat_t *)stats;
+    for (size_t i = 0; i < STATS_WORDS; i++) {
+        atomic_init(&words[i], 0);
+    }
+}
+
+void usb_stats_snapshot(const usb_stats_t *src, usb_stats_t *dst) {
+    const usb_stat_t *from = (const usb_stat_t *)src;
+    usb_stat_t *to = (usb_stat_t *)dst;
+    for (size_t i = 0; i < STATS_WORDS; i++) {
+        usb_stat_set(&to[i], usb_stat_read(&from[i]));
+    }
+}
+
+uint64_t usb_stats_hist_percentile(const usb_stats_t *stats, double p) {
+    uint64_t buckets[USB_STATS_HIST_BUCKETS];
+    uint64_t total = 0;
+    for (int i = 0; i < USB_STATS_HIST_BUCKETS; i++) {
+        buckets[i] = usb_stat_read(&stats->latency.buckets[i]);
+        total += buckets[i];
+    }
+    if (total == 0) return 0;
+
+    // Nearest rank, reported as the bucket's upper bound
+    uint64_t rank = (uint64_t)(p * (double)total + 0.999999);
+    if (rank == 0) rank = 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < USB_STATS_HIST_BUCKETS; i++) {
+        seen += buckets[i];
+        if (seen >= rank) return 1ULL << i;
+    }
+    return 1ULL << (USB_STATS_HIST_BUCKETS - 1);
+}
+
+void usb_stats_print(FILE *fp, const char *prefix, const usb_stats_t *stats) {
+    static const struct {
+        const char *name;
+        size_t offset;
+    } fields[] = {
+        {"tx_packets", offsetof(usb_stats_t, tx_packets)},
+        {"tx_bytes", offsetof(usb_stats_t, tx_bytes)},
+        {"tx_errors", offsetof(usb_stats_t, tx_errors)},
+        {"rx_packets", offsetof(usb_stats_t, rx_packets)},
+        {"rx_bytes", offsetof(usb_stats_t, rx_bytes)},
+        {"rx_errors", offsetof(usb_stats_t, rx_errors)},
+        {"rx_short", offsetof(usb_stats_t, rx_short)},
+        {"rx_bad_magic", offsetof(usb_stats_t, rx_bad_magic)},
+        {"rx_bad_version", offsetof(usb_stats_t, rx_bad_version)},
+        {"rx_bad_length", offsetof(usb_stats_t, rx_bad_length)},
+        {"rx_bad_checksum", offsetof(usb_stats_t, rx_bad_checksum)},
+        {"rx_unchecked", offsetof(usb_stats_t, rx_unchecked)},
+        {"rx_foreign", offsetof(usb_stats_t, rx_foreign)},
+        {"rx_bad_compressed", offsetof(usb_stats_t, rx_bad_compressed)},
+        {"retransmits", offsetof(usb_stats_t, retransmits)},
+        {"rx_duplicates", offsetof(usb_stats_t, rx_duplicates)},
+        {"keepalives", offsetof(usb_stats_t, keepalives)},
+        {"peer_timeouts", offsetof(usb_stats_t, peer_timeouts)},
+        {"tx_compressed", offsetof(usb_stats_t, tx_compressed)},
+        {"tx_comp_saved", offsetof(usb_stats_t, tx_comp_saved)},
+        {"tx_in_flight", offsetof(usb_stats_t, tx_in_flight)},
+        {"rx_queued", offsetof(usb_stats_t, rx_queued)},
+    };
+
+    for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+        const usb_stat_t *stat = (const usb_stat_t *)((const char *)stats + fields[i].offset);
+        fprintf(fp, "%s.%s %llu\n", prefix, fields[i].name,
+                (unsigned long long)usb_stat_read(stat));
+    }
+
+    uint64_t count = usb_stat_read(&stats->latency.count);
+    uint64_t sum = usb_stat_read(&stats->latency.sum_us);
+    fprintf(fp, "%s.latency_count %llu\n", prefix, (unsigned long long)count);
+    fprintf(fp, "%s.latency_avg_us %llu\n", prefix,
+            (unsigned long long)(count ? sum / count : 0));
+    fprintf(fp, "%s.latency_p50_us %llu\n", prefix,
+            (unsigned long long)usb_stats_hist_percentile(stats, 0.50));
+    fprintf(fp, "%s.latency_p99_us %llu\n", prefix,
+            (unsigned long long)usb_stats_hist_percentile(stats, 0.99));
+}
+
+usb_stats_page_t *usb_stats_page_create(const char *name) {
+    shm_unlink(name);
+    int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0) {
+        USB_LOG_ERROR("Failed to create stats page %s: %s\n", name, strerror(errno));
+        return NULL;
+    }
+
+    if (ftruncate(fd, sizeof(usb_stats_page_t)) < 0) {
+        USB_LOG_ERROR("Failed to size stats page %s: %s\n", name, strerror(errno));
+        close(fd);
+        shm_unlink(name);
+        return NULL;
+    }
+
+    usb_stats_page_t *page = mmap(NULL, sizeof(usb_stats_page_t), PROT_READ | PROT_WRITE,
+                                  MAP_SHARED, fd, 0);
+    close(fd);
+    if (page == MAP_FAILED) {
+        USB_LOG_ERROR("Failed to map stats page %s: %s\n", name, strerror(errno));
+        shm_unlink(name);
+        return NULL;
+    }
+
+    usb_stats_reset(&page->usb);
+    usb_stats_reset(&page->raw);
+    page->version = USB_STATS_VERSION;
+    page->size = sizeof(usb_stats_page_t);
+    page->pid = (int32_t)getpid();
+    page->reserved = 0;
+
+    // The magic goes last so a reader never accepts a half set up page
+    atomic_thread_fence(memory_order_release);
+    memcpy(page->magic, USB_STATS_MAGIC, sizeof(page->magic));
+    return page;
+}
+
+void usb_stats_page_destroy(usb_stats_page_t *page, const char *name) {
+    if (!page) return;
+    munmap(page, sizeof(usb_stats_page_t));
+    shm_unlink(name);
+}
+
+const usb_stats_page_t *usb_stats_page_open(const char *name) {
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) {
+        USB_LOG_ERROR("Failed to open stats page %s: %s\n", name, strerror(errno));
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(usb_stats_page_t)) {
+        USB_LOG_ERROR("Stats page %s is too small\n", name);
+        close(fd);
+        return NULL;
+    }
+
+    const usb_stats_page_t *page = mmap(NULL, sizeof(usb_stats_page_t), PROT_READ,
+                                        MAP_SHARED, fd, 0);
+    close(fd);
+    if (page == MAP_FAILED) {
+        USB_LOG_ERROR("Failed to map stats page %s: %s\n", name, strerror(errno));
+        return NULL;
+    }
+
+    if (memcmp(page->magic, USB_STATS_MAGIC, sizeof(page->magic)) != 0 ||
+        page->version != USB_STATS_VERSION || page->size != sizeof(usb_stats_page_t)) {
+        USB_LOG_ERROR("Stats page %s has an unknown layout\n", name);
+        munmap((void *)page, sizeof(usb_stats_page_t));
+        return NULL;
+    }
+    atomic_thread_fence(memory_order_acquire);
+    return page;
+}
+
+void usb_stats_page_close(const usb_stats_page_t *page) {
+    if (page) munmap((void *)page, sizeof(usb_stats_page_t));
+}
@@ -0,0 +1,146 @@
+// USB-C Software Network - Link Statistics
+// Counters kept by the datapath and readable from any thread or process
+// while it runs.
+//
+// Every counter has exactly one writing thread (the thread driving a raw
+// context; the caller's thread or the transfer event thread for the
+// libusb path), so an update is a relaxed load and store, with no locked
+// instruction and no shared cache line bouncing between writers. Readers
+// see each counter atomically; a snapshot is not a consistent cut across
+// counters.
+//
+// A stats page (usb_stats_page_create) is a POSIX shared memory object
+// holding the counters themselves: contexts pointed at it update it in
+// place, and an external tool maps it read-only (usb-c-net --mode stats,
+// or any program that knows the layout below) without any cost to the
+// datapath.
+
+#ifndef USB_STATS_H
+#define USB_STATS_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdatomic.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef _Atomic(uint64_t) usb_stat_t;
+
+// Bucket i counts samples below 2^i microseconds (and at least 2^(i-1));
+// the last bucket takes everything longer
+#define USB_STATS_HIST_BUCKETS 24
+
+typedef struct {
+    usb_stat_t count;
+    usb_stat_t sum_us;
+    usb_stat_t buckets[USB_STATS_HIST_BUCKETS];
+} usb_stats_hist_t;
+
+typedef struct {
+    // Wire level: transport messages (raw) or bulk transfers (libusb)
+    usb_stat_t tx_packets;
+    usb_stat_t tx_bytes;
+    usb_stat_t tx_errors;        // Send failures, including a full transport ring
+    usb_stat_t rx_packets;
+    usb_stat_t rx_bytes;
+    usb_stat_t rx_errors;        // Receive failures
+
+    // Received messages rejected by the header checks
+    usb_stat_t rx_short;         // Shorter than a header
+    usb_stat_t rx_bad_magic;
+    usb_stat_t rx_bad_version;
+    usb_stat_t rx_bad_length;    // Header length beyond the received bytes
+    usb_stat_t rx_bad_checksum;
+    usb_stat_t rx_unchecked;     // No checksum from a peer that did not agree to that
+    usb_stat_t rx_foreign;       // Addressed to another node
+    usb_stat_t rx_bad_compressed;  // Payload that failed to decompress
+
+    // Reliable delivery
+    usb_stat_t retransmits;      // Timeout and fast retransmissions
+    usb_stat_t rx_duplicates;
+
+    // Liveness
+    usb_stat_t keepalives;       // Keepalive requests sent, explicit or piggybacked
+    usb_stat_t peer_timeouts;    // Peers dropped for staying silent
+
+    // Payload compression
+    usb_stat_t tx_compressed;    // Data frames sent compressed
+    usb_stat_t tx_comp_saved;    // Payload bytes those saved
+
+    // Queue depths, sampled
+    usb_stat_t tx_in_flight;     // Sent, not yet acknowledged or completed
+    usb_stat_t rx_queued;        // Received, not yet read
+
+    // Round trip of reliable data frames (raw) or OUT transfer completion
+    // time (libusb)
+    usb_stats_hist_t latency;
+} usb_stats_t;
+
+// Shared memory layout, versioned for external readers
+#define USB_STATS_MAGIC   "USBCSTAT"
+#define USB_STATS_VERSION 3
+
+typedef struct {
+    char magic[8];               // USB_STATS_MAGIC, not NUL terminated
+    uint32_t version;
+    uint32_t size;               // sizeof(usb_stats_page_t)
+    int32_t pid;                 // Writer process
+    uint32_t reserved;
+    usb_stats_t usb;             // libusb bulk path
+    usb_stats_t raw;             // Raw protocol context
+} usb_stats_page_t;
+
+// Single-writer update: only the owning thread may call these
+static inline void usb_stat_add(usb_stat_t *stat, uint64_t n) {
+    atomic_store_explicit(stat, atomic_load_explicit(stat, memory_order_relaxed) + n,
+                          memory_order_relaxed);
+}
+
+static inline void usb_stat_set(usb_stat_t *stat, uint64_t value) {
+    atomic_store_explicit(stat, value, memory_order_relaxed);
+}
+
+static inline uint64_t usb_stat_read(const usb_stat_t *stat) {
+    return atomic_load_explicit(stat, memory_order_relaxed);
+}
+
+static inline void usb_stats_hist_add(usb_stats_hist_t *hist, uint64_t us) {
+    int bucket = us ? 64 - __builtin_clzll(us) : 0;
+    if (bucket >= USB_STATS_HIST_BUCKETS) bucket = USB_STATS_HIST_BUCKETS - 1;
+
+    usb_stat_add(&hist->count, 1);
+    usb_stat_add(&hist->sum_us, us);
+    usb_stat_add(&hist->buckets[bucket], 1);
+}
+
+// Zero a block of counters (before any thread updates it)
+void usb_stats_reset(usb_stats_t *stats);
+
+// Copy every counter of src into dst
+void usb_stats_snapshot(const usb_stats_t *src, usb_stats_t *dst);
+
+// Upper bound in microseconds of the bucket holding percentile p (0-1)
+uint64_t usb_stats_hist_percentile(const usb_stats_t *stats, double p);
+
+// Print a snapshot as "prefix.name value" lines
+void usb_stats_print(FILE *fp, const char *prefix, const usb_stats_t *stats);
+
+// Create (replacing any stale one) and map the shared stats page
+usb_stats_page_t *usb_stats_page_create(const char *name);
+
+// Unmap the page and remove its name
+void usb_stats_page_destroy(usb_stats_page_t *page, const char *name);
+
+// Map an existing page read-only. NULL if absent or of another version.
+const usb_stats_page_t *usb_stats_page_open(const char *name);
+
+// Unmap a page returned by usb_stats_page_open()
+void usb_stats_page_close(const usb_stats_page_t *page);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // USB_STATS_H
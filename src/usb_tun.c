@@ -0,0 +1,410 @@
+// USB-C Software Network - TUN/TAP Interface Backend Implementation
+//
+// Data path:
+//   TUN -> USB: frames are read straight into the payload area of a free
+//               OUT transfer slot; the packet header is written in place
+//               in the slot's headroom and the slot is submitted.
+//   USB -> TUN: completed IN buffers are written to the TUN device from
+//               the payload offset and the slot is resubmitted.
+// No frame is copied through an intermediate buffer in either direction.
+// With USB_BATCH_SIZE set, consecutive frames are packed back to back
+// (header, payload, header, payload, ...) into one OUT transfer until the
+// next frame might not fit or the TUN queue runs dry; the receiver always
+// walks every record in an IN buffer. With IO_URING the frames of one IN
+// buffer are written with a single submission instead of a write() each.
+// Reads stay one system call per frame: where a frame lands in the OUT
+// slot depends on the length of the one before it.
+// Each direction runs on its own thread so the link is used full duplex.
+
+#include "usb_tun.h"
+#include "usb_uring.h"
+#include "usb_log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <linux/if_tun.h>
+#include <linux/if_ether.h>
+
+#define TUN_CLONE_DEVICE "/dev/net/tun"
+#define TUN_POLL_MS 200
+#define TUN_URING_DEPTH 64  // Frame writes per io_uring submission
+
+static const int tun_uring_ops[] = { IORING_OP_WRITE, -1 };
+
+static volatile sig_atomic_t tun_stop = 0;
+
+static void tun_signal_handler(int sig) {
+    (void)sig;
+    tun_stop = 1;
+}
+
+// Issue an interface ioctl on a throwaway AF_INET socket
+static int tun_ifreq_ioctl(unsigned long req, struct ifreq *ifr) {
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0) return -1;
+
+    int ret = ioctl(sock, req, ifr);
+    int saved = errno;
+    close(sock);
+    errno = saved;
+    return ret;
+}
+
+// Open TUN/TAP interface
+int usb_tun_open(usb_tun_t *tun, const char *name, bool tap, int mtu) {
+    struct ifreq ifr;
+
+    memset(tun, 0, sizeof(usb_tun_t));
+    tun->fd = -1;
+    tun->tap = tap;
+
+    int fd = open(TUN_CLONE_DEVICE, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) {
+        USB_LOG_ERROR("Cannot open %s: %s\n", TUN_CLONE_DEVICE, strerror(errno));
+        return -1;
+    }
+
+    memset(&ifr, 0, sizeof(ifr));
+    ifr.ifr_flags = (tap ? IFF_TAP : IFF_TUN) | IFF_NO_PI;
+    strncpy(ifr.ifr_name, (name && name[0]) ? name : "usbc%d", IFNAMSIZ - 1);
+
+    if (ioctl(fd, TUNSETIFF, &ifr) < 0) {
+        USB_LOG_ERROR("TUNSETIFF failed: %s\n", strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    tun->fd = fd;
+    strncpy(tun->name, ifr.ifr_name, IFNAMSIZ - 1);
+
+    // TAP frames carry an Ethernet header inside the same link MTU
+    tun->mtu = tap ? mtu - ETH_HLEN : mtu;
+
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, tun->name, IFNAMSIZ - 1);
+    ifr.ifr_mtu = tun->mtu;
+    if (tun_ifreq_ioctl(SIOCSIFMTU, &ifr) < 0) {
+        USB_LOG_ERROR("Cannot set MTU %d on %s: %s\n", tun->mtu, tun->name, strerror(errno));
+    }
+
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, tun->name, IFNAMSIZ - 1);
+    if (tun_ifreq_ioctl(SIOCGIFFLAGS, &ifr) == 0) {
+        ifr.ifr_flags |= IFF_UP | IFF_RUNNING;
+        if (tun_ifreq_ioctl(SIOCSIFFLAGS, &ifr) < 0) {
+            USB_LOG_ERROR("Cannot bring up %s: %s\n", tun->name, strerror(errno));
+        }
+    }
+
+    USB_LOG_INFO("%s interface %s created (MTU %d)\n", tap ? "TAP" : "TUN", tun->name, tun->mtu);
+    return 0;
+}
+
+// Assign IPv4 address
+int usb_tun_set_address(usb_tun_t *tun, const char *cidr) {
+    char addr[64];
+    int prefix = 24;
+    struct ifreq ifr;
+    struct sockaddr_in *sin = (struct sockaddr_in *)&ifr.ifr_addr;
+
+    strncpy(addr, cidr, sizeof(addr) - 1);
+    addr[sizeof(addr) - 1] = '\0';
+
+    char *slash = strchr(addr, '/');
+    if (slash) {
+        *slash = '\0';
+        prefix = atoi(slash + 1);
+    }
+
+    if (prefix < 0 || prefix > 32) {
+        USB_LOG_ERROR("Invalid prefix length in %s\n", cidr);
+        return -1;
+    }
+
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, tun->name, IFNAMSIZ - 1);
+    sin->sin_family = AF_INET;
+    if (inet_pton(AF_INET, addr, &sin->sin_addr) != 1) {
+        USB_LOG_ERROR("Invalid IPv4 address: %s\n", addr);
+        return -1;
+    }
+
+    if (tun_ifreq_ioctl(SIOCSIFADDR, &ifr) < 0) {
+        USB_LOG_ERROR("Cannot set address on %s: %s\n", tun->name, strerror(errno));
+        return -1;
+    }
+
+    sin->sin_addr.s_addr = htonl(prefix ? 0xFFFFFFFFu << (32 - prefix) : 0);
+    if (tun_ifreq_ioctl(SIOCSIFNETMASK, &ifr) < 0) {
+        USB_LOG_ERROR("Cannot set netmask on %s: %s\n", tun->name, strerror(errno));
+        return -1;
+    }
+
+    USB_LOG_INFO("Assigned %s/%d to %s\n", addr, prefix, tun->name);
+    return 0;
+}
+
+// Close interface
+void usb_tun_close(usb_tun_t *tun) {
+    if (tun->fd >= 0) {
+        close(tun->fd);
+        tun->fd = -1;
+    }
+}
+
+typedef struct {
+    usb_net_device_t *device;
+    usb_tun_t *tun;
+    pthread_t thread;
+    volatile sig_atomic_t stop;  // Link lost: stop without ending TUN mode
+    unsigned long frames;
+} tun_uplink_t;
+
+// TUN -> USB: read frames directly into OUT transfer slots
+static void *tun_uplink_main(void *arg) {
+    tun_uplink_t *up = arg;
+    usb_xfer_engine_t *xfer = &up->device->xfer;
+    struct pollfd pfd = { .fd = up->tun->fd, .events = POLLIN };
+    uint8_t *buf = NULL;
+    size_t cap = 0;
+    size_t fill = 0;             // Bytes packed into the current slot
+    size_t record_max = sizeof(packet_header_t) + (size_t)up->device->config.usb_mtu;
+    int slot = -1;
+
+    while (!tun_stop && !up->stop) {
+        int pr = poll(&pfd, 1, TUN_POLL_MS);
+        if (pr < 0) {
+            if (errno == EINTR) continue;
+            USB_LOG_ERROR("TUN poll: %s\n", strerror(errno));
+            break;
+        }
+        if (pr == 0) continue;
+
+        for (int i = 0; i < USB_TUN_BATCH && !tun_stop && !up->stop; i++) {
+            if (slot < 0) {
+                slot = usb_xfer_tx_acquire(xfer, &buf, &cap, USB_TIMEOUT_MS);
+                if (slot < 0) {
+                    if (xfer->last_error) up->stop = 1;
+                    break;  // Link stalled; the kernel queues or drops meanwhile
+                }
+            }
+
+            uint8_t *rec = buf + fill;
+            ssize_t n = read(up->tun->fd, rec + sizeof(packet_header_t),
+                             cap - fill - sizeof(packet_header_t));
+            if (n < 0) {
+                if (errno != EAGAIN && errno != EINTR) {
+                    USB_LOG_ERROR("TUN read: %s\n", strerror(errno));
+                    tun_stop = 1;
+                }
+                break;  // Keep the slot for the next wakeup
+            }
+
+            usb_net_fill_header(up->device, (packet_header_t *)rec, PKT_DATA, (int)n);
+            fill += sizeof(packet_header_t) + (size_t)n;
+            up->frames++;
+
+            // Keep packing while a full-size frame still fits
+            if (cap - fill >= record_max) continue;
+
+            int ret = usb_xfer_tx_submit(xfer, slot, fill);
+            slot = -1;
+            fill = 0;
+            if (ret < 0) {
+                if (xfer->last_error) up->stop = 1;
+                break;
+            }
+        }
+
+        // Queue drained: send what has been packed so far
+        if (slot >= 0 && fill > 0) {
+            int ret = usb_xfer_tx_submit(xfer, slot, fill);
+            slot = -1;
+            fill = 0;
+            if (ret < 0 && xfer->last_error) up->stop = 1;
+        }
+    }
+
+    if (slot >= 0) {
+        usb_xfer_tx_abort(xfer, slot);
+    }
+    return NULL;
+}
+
+static int start_uplink(tun_uplink_t *up) {
+    up->stop = 0;
+    if (pthread_create(&up->thread, NULL, tun_uplink_main, up) != 0) {
+        USB_LOG_ERROR("Failed to start TUN uplink thread: %s\n", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+static void stop_uplink(tun_uplink_t *up) {
+    up->stop = 1;
+    pthread_join(up->thread, NULL);
+}
+
+// The peer went away (cable flap, peer reboot): keep the TUN interface up
+// and claim the peer again when it re-enumerates
+static int reconnect_peer(usb_net_device_t *device, tun_uplink_t *up) {
+    USB_LOG_INFO("Peer disconnected, waiting for it to return...\n");
+    stop_uplink(up);
+    usb_net_close_peer(device);
+
+    if (usb_net_wait_for_peer(device, "peer") < 0) return -1;
+    if (!device->xfer.running) {
+        USB_LOG_ERROR("TUN mode requires the async transfer engine\n");
+        return -1;
+    }
+    return start_uplink(up);
+}
+
+// Write the queued frames and wait for them all, as they point into the
+// IN slot about to be released. They are hard linked, so they go out in
+// order even if one has to wait, and a failed one does not stop the rest.
+static void flush_writes(usb_uring_t *ring, struct io_uring_sqe *last, unsigned n) {
+    struct io_uring_cqe cqe[TUN_URING_DEPTH];
+
+    last->flags &= (uint8_t)~IOSQE_IO_HARDLINK;
+    if (usb_uring_submit_wait(ring, n, cqe) < 0) return;
+    for (unsigned i = 0; i < n; i++) {
+        if (cqe[i].res < 0 && cqe[i].res != -EAGAIN) {
+            USB_LOG_WARN_RATELIMIT("TUN write: %s\n", strerror(-cqe[i].res));
+        }
+    }
+}
+
+// Run TUN bridge mode
+int usb_tun_run(usb_net_device_t *device) {
+    usb_tun_t tun;
+    tun_uplink_t uplink;
+    usb_uring_t ring;
+    unsigned long rx_frames = 0, rx_dropped = 0, reconnects = 0;
+    bool uplink_running = true;
+
+    USB_LOG_INFO("\n=== Running in TUN mode ===\n");
+    USB_LOG_INFO("Waiting for peer device to connect...\n\n");
+
+    if (usb_net_wait_for_peer(device, "peer") < 0) {
+        return -1;
+    }
+
+    if (!device->xfer.running) {
+        USB_LOG_ERROR("TUN mode requires the async transfer engine\n");
+        return -1;
+    }
+
+    if (usb_tun_open(&tun, device->config.tun_name, device->config.tun_tap,
+                     device->config.usb_mtu) < 0) {
+        return -1;
+    }
+
+    if (device->config.tun_address[0]) {
+        usb_tun_set_address(&tun, device->config.tun_address);
+    }
+
+    if (usb_uring_init(&ring, TUN_URING_DEPTH, 0, 0, 1, tun_uring_ops) == 0) {
+        if (usb_uring_set_file(&ring, 0, tun.fd) == 0) {
+            USB_LOG_INFO("TUN writes through io_uring\n");
+        } else {
+            usb_uring_cleanup(&ring);
+        }
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = tun_signal_handler;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    tun_stop = 0;
+
+    uplink.device = device;
+    uplink.tun = &tun;
+    uplink.frames = 0;
+    if (start_uplink(&uplink) < 0) {
+        usb_uring_cleanup(&ring);
+        usb_tun_close(&tun);
+        return -1;
+    }
+
+    USB_LOG_INFO("Bridging %s <-> bulk IN 0x%02x / OUT 0x%02x (Ctrl+C to stop)\n",
+                 tun.name, device->endpoint_in, device->endpoint_out);
+
+    // USB -> TUN: write payloads straight out of the IN slot buffers
+    while (!tun_stop) {
+        usb_xfer_completion_t done;
+        int ret = usb_xfer_wait_rx(&device->xfer, &done, TUN_POLL_MS);
+        if (ret < 0) {
+            if (device->xfer.last_error == LIBUSB_ERROR_NO_DEVICE && !tun_stop) {
+                if (reconnect_peer(device, &uplink) < 0) {
+                    uplink_running = false;
+                    break;
+                }
+                reconnects++;
+                continue;
+            }
+            USB_LOG_ERROR("Bulk read error: %s\n", libusb_error_name(device->xfer.last_error));
+            break;
+        }
+        if (ret == 0) continue;
+
+        // One record per frame, several if the peer packs transfers
+        int off = 0;
+        struct io_uring_sqe *sqe = NULL;
+        unsigned queued = 0;
+        do {
+            const packet_header_t *hdr = (const packet_header_t *)(done.data + off);
+            int left = done.len - off - (int)sizeof(packet_header_t);
+            if (left < 0 || hdr->magic != PACKET_MAGIC || hdr->type != PKT_DATA ||
+                hdr->length > left) {
+                if (left < 0) {
+                    usb_stat_add(&device->stats->rx_short, 1);
+                } else if (hdr->magic != PACKET_MAGIC) {
+                    usb_stat_add(&device->stats->rx_bad_magic, 1);
+                } else if (hdr->length > left) {
+                    usb_stat_add(&device->stats->rx_bad_length, 1);
+                }
+                rx_dropped++;
+                break;  // The next record cannot be located
+            }
+            const uint8_t *frame = (const uint8_t *)hdr + sizeof(packet_header_t);
+            if (ring.fd >= 0) {
+                if (queued == TUN_URING_DEPTH) {
+                    flush_writes(&ring, sqe, queued);
+                    queued = 0;
+                }
+                sqe = usb_uring_prep(&ring, IORING_OP_WRITE, 0, frame, hdr->length, 0, 0);
+                sqe->flags = IOSQE_FIXED_FILE | IOSQE_IO_HARDLINK;
+                queued++;
+            } else if (write(tun.fd, frame, hdr->length) < 0 && errno != EAGAIN) {
+                USB_LOG_WARN_RATELIMIT("TUN write: %s\n", strerror(errno));
+            }
+            rx_frames++;
+            off += (int)sizeof(packet_header_t) + hdr->length;
+        } while (off < done.len);
+
+        if (queued > 0) flush_writes(&ring, sqe, queued);
+        usb_xfer_release(&device->xfer, done.slot);
+    }
+
+    tun_stop = 1;
+    if (uplink_running) stop_uplink(&uplink);
+    usb_uring_cleanup(&ring);
+    usb_tun_close(&tun);
+
+    USB_LOG_INFO("\nTUN mode stopped: %lu frames sent, %lu received, %lu dropped, %lu reconnects\n",
+                 uplink.frames, rx_frames, rx_dropped, reconnects);
+    return 0;
+}
@@ -0,0 +1,35 @@
+// USB-C Software Network - TUN/TAP Interface Backend
+// Creates a kernel network interface and shuttles its frames to and
+// from the bulk endpoints, so ordinary IP traffic (ping, iperf, ssh)
+// runs over the USB-C link.
+
+#ifndef USB_TUN_H
+#define USB_TUN_H
+
+#include <stdbool.h>
+#include <net/if.h>
+#include "usb_net_core.h"
+
+// Frames pulled from the TUN device per wakeup before yielding
+#define USB_TUN_BATCH 32
+
+typedef struct {
+    int fd;
+    char name[IFNAMSIZ];
+    bool tap;
+    int mtu;
+} usb_tun_t;
+
+// Create (or attach to) a TUN/TAP interface, set its MTU and bring it up
+int usb_tun_open(usb_tun_t *tun, const char *name, bool tap, int mtu);
+
+// Assign an IPv4 address given as "a.b.c.d/prefix"
+int usb_tun_set_address(usb_tun_t *tun, const char *cidr);
+
+// Close the interface (non-persistent interfaces are removed by the kernel)
+void usb_tun_close(usb_tun_t *tun);
+
+// Bridge the interface to the peer's bulk endpoints until interrupted
+int usb_tun_run(usb_net_device_t *device);
+
+#endif // USB_TUN_H
@@ -0,0 +1,311 @@
+// USB-C Software Network - Type-C Port Monitor Implementation
+//
+// Attribute fds are watched edge-triggered: kernfs keeps reporting
+// POLLPRI until the attribute is read again, and a read that fails (the
+// port going away under us) would otherwise spin the caller's loop.
+// Every notification re-reads all attributes and the partner directory,
+// so a burst of events costs one refresh.
+
+#define _GNU_SOURCE
+#include "usb_typec.h"
+#include "usb_log.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+
+#define TYPEC_UEVENT_BUF 4096
+#define TYPEC_UEVENT_KERNEL 1        // Multicast group of kernel uevents
+
+static const char *attr_names[USB_TYPEC_ATTR_MAX] = {
+    "data_role", "power_role", "power_operation_mode"
+};
+
+static int64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Keep the bracketed choice of "[host] device", or the whole value
+static void parse_value(const char *raw, char *out, size_t outlen) {
+    const char *start = strchr(raw, '[');
+    const char *end = start ? strchr(start, ']') : NULL;
+    size_t len;
+
+    if (end) {
+        start++;
+        len = (size_t)(end - start);
+    } else {
+        start = raw;
+        len = strcspn(raw, "\r\n");
+    }
+    if (len >= outlen) len = outlen - 1;
+    memcpy(out, start, len);
+    out[len] = '\0';
+}
+
+// pread() from 0 returns the current value and re-arms POLLPRI
+static bool read_attr(usb_typec_t *tc, int attr, char *out, size_t outlen) {
+    char buf[128];
+
+    if (tc->attr_fd[attr] < 0) return false;
+    ssize_t n = pread(tc->attr_fd[attr], buf, sizeof(buf) - 1, 0);
+    if (n < 0) return false;
+    buf[n] = '\0';
+    parse_value(buf, out, outlen);
+    return true;
+}
+
+static bool check_partner(const usb_typec_t *tc) {
+    char path[sizeof(tc->port_path) + 16];
+    struct stat st;
+
+    snprintf(path, sizeof(path), "%s-partner", tc->port_path);
+    return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+// Re-read the whole port, returning what changed
+static int refresh(usb_typec_t *tc) {
+    int changed = 0;
+
+    for (int i = 0; i < USB_TYPEC_ATTR_MAX; i++) {
+        char value[sizeof(tc->value[0])];
+        if (read_attr(tc, i, value, sizeof(value)) && strcmp(value, tc->value[i]) != 0) {
+            memcpy(tc->value[i], value, sizeof(value));
+            changed |= USB_TYPEC_EV_DATA_ROLE << i;
+        }
+    }
+
+    bool partner = check_partner(tc);
+    if (partner != tc->partner) {
+        tc->partner = partner;
+        changed |= USB_TYPEC_EV_PARTNER;
+    }
+
+    if (changed) tc->changes++;
+    return changed;
+}
+
+// Kernel uevents: "ACTION@DEVPATH" followed by NUL separated KEY=VALUE
+// pairs. True if one concerns this port or something on it (partner,
+// cable, their alternate modes).
+static bool uevent_matches(const usb_typec_t *tc, const char *msg, size_t len) {
+    size_t name_len = strlen(tc->port_name);
+    bool typec = false;
+    bool ours = false;
+
+    for (size_t off = 0; off < len; off += strlen(msg + off) + 1) {
+        const char *kv = msg + off;
+        if (strcmp(kv, "SUBSYSTEM=typec") == 0) {
+            typec = true;
+        } else if (strncmp(kv, "DEVPATH=", 8) == 0) {
+            for (const char *p = kv + 8; (p = strstr(p, tc->port_name)) != NULL; p += name_len) {
+                char next = p[name_len];
+                if (p[-1] == '/' && (next == '\0' || next == '/' || next == '-')) {
+                    ours = true;
+                    break;
+                }
+            }
+        }
+    }
+    return typec && ours;
+}
+
+// Drain the uevent socket. True if some event was for this port.
+static bool drain_uevents(usb_typec_t *tc) {
+    char buf[TYPEC_UEVENT_BUF];
+    bool relevant = false;
+
+    for (;;) {
+        ssize_t n = recv(tc->uevent_fd, buf, sizeof(buf) - 1, 0);
+        if (n < 0) {
+            // Overflowed: events were lost, so look at the port anyway
+            if (errno == ENOBUFS) relevant = true;
+            if (errno == EINTR || errno == ENOBUFS) continue;
+            break;
+        }
+        if (n == 0) break;
+        buf[n] = '\0';
+        if (uevent_matches(tc, buf, (size_t)n)) relevant = true;
+    }
+    return relevant;
+}
+
+static int open_uevent_socket(void) {
+    int fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
+    if (fd < 0) return -1;
+
+    struct sockaddr_nl addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = TYPEC_UEVENT_KERNEL;
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void watch(usb_typec_t *tc, int fd, uint32_t events) {
+    struct epoll_event ev = { .events = events, .data.fd = fd };
+    if (epoll_ctl(tc->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        USB_LOG_WARN("Type-C monitor: epoll_ctl: %s\n", strerror(errno));
+    }
+}
+
+int usb_typec_open(usb_typec_t *tc, const char *port_path) {
+    struct stat st;
+
+    memset(tc, 0, sizeof(usb_typec_t));
+    tc->epoll_fd = -1;
+    tc->uevent_fd = -1;
+    for (int i = 0; i < USB_TYPEC_ATTR_MAX; i++) {
+        tc->attr_fd[i] = -1;
+    }
+
+    if (!port_path || !port_path[0] || stat(port_path, &st) != 0 || !S_ISDIR(st.st_mode)) {
+        USB_LOG_ERROR("Type-C port not found: %s\n", port_path && port_path[0] ? port_path : "(none)");
+        return -1;
+    }
+
+    tc->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (tc->epoll_fd < 0) {
+        USB_LOG_ERROR("Type-C monitor: epoll_create1: %s\n", strerror(errno));
+        return -1;
+    }
+
+    strncpy(tc->port_path, port_path, sizeof(tc->port_path) - 1);
+    size_t len = strlen(tc->port_path);
+    while (len > 1 && tc->port_path[len - 1] == '/') {
+        tc->port_path[--len] = '\0';
+    }
+    const char *name = strrchr(tc->port_path, '/');
+    strncpy(tc->port_name, name ? name + 1 : tc->port_path, sizeof(tc->port_name) - 1);
+
+    for (int i = 0; i < USB_TYPEC_ATTR_MAX; i++) {
+        char path[sizeof(tc->port_path) + 32];
+        snprintf(path, sizeof(path), "%s/%s", tc->port_path, attr_names[i]);
+        tc->attr_fd[i] = open(path, O_RDONLY | O_CLOEXEC);
+        if (tc->attr_fd[i] >= 0) {
+            watch(tc, tc->attr_fd[i], EPOLLPRI | EPOLLERR | EPOLLET);
+        }
+    }
+
+    tc->uevent_fd = open_uevent_socket();
+    if (tc->uevent_fd >= 0) {
+        watch(tc, tc->uevent_fd, EPOLLIN);
+    } else {
+        USB_LOG_DEBUG("Type-C monitor: no uevent socket (%s), partner follows role changes\n",
+                      strerror(errno));
+    }
+
+    // Also the initial read sysfs wants before it signals POLLPRI
+    refresh(tc);
+    tc->changes = 0;
+
+    USB_LOG_DEBUG("Type-C monitor on %s: partner %s, data role %s, power role %s\n",
+                  tc->port_path, tc->partner ? "present" : "absent",
+                  tc->value[USB_TYPEC_DATA_ROLE][0] ? tc->value[USB_TYPEC_DATA_ROLE] : "?",
+                  tc->value[USB_TYPEC_POWER_ROLE][0] ? tc->value[USB_TYPEC_POWER_ROLE] : "?");
+    return 0;
+}
+
+void usb_typec_close(usb_typec_t *tc) {
+    if (!tc->port_path[0]) return;
+
+    for (int i = 0; i < USB_TYPEC_ATTR_MAX; i++) {
+        if (tc->attr_fd[i] >= 0) close(tc->attr_fd[i]);
+        tc->attr_fd[i] = -1;
+    }
+    if (tc->uevent_fd >= 0) close(tc->uevent_fd);
+    if (tc->epoll_fd >= 0) close(tc->epoll_fd);
+    tc->uevent_fd = -1;
+    tc->epoll_fd = -1;
+    tc->port_path[0] = '\0';
+}
+
+int usb_typec_get_fd(const usb_typec_t *tc) {
+    return tc->port_path[0] ? tc->epoll_fd : -1;
+}
+
+int usb_typec_process(usb_typec_t *tc) {
+    if (!tc->port_path[0]) return 0;
+
+    struct epoll_event events[USB_TYPEC_ATTR_MAX + 1];
+    int n = epoll_wait(tc->epoll_fd, events, USB_TYPEC_ATTR_MAX + 1, 0);
+    bool pending = false;
+
+    for (int i = 0; i < n; i++) {
+        if (events[i].data.fd == tc->uevent_fd) {
+            pending |= drain_uevents(tc);
+        } else {
+            pending = true;  // An attribute changed
+        }
+    }
+    if (!pending) return 0;
+
+    tc->events++;
+    return refresh(tc);
+}
+
+int usb_typec_wait(usb_typec_t *tc, int timeout_ms) {
+    if (!tc->port_path[0]) return -1;
+
+    struct pollfd pfd = { .fd = tc->epoll_fd, .events = POLLIN };
+    int ret = poll(&pfd, 1, timeout_ms);
+    if (ret < 0) {
+        if (errno == EINTR) return 0;
+        USB_LOG_ERROR("Type-C monitor: poll: %s\n", strerror(errno));
+        return -1;
+    }
+    return ret == 0 ? 0 : usb_typec_process(tc);
+}
+
+const char *usb_typec_get(const usb_typec_t *tc, usb_typec_attr_t attr) {
+    return (attr >= 0 && attr < USB_TYPEC_ATTR_MAX) ? tc->value[attr] : "";
+}
+
+// Role attributes take a write of the new role; the port reports the
+// result through the same attribute once the PD swap has gone through
+int usb_typec_set_role(usb_typec_t *tc, usb_typec_attr_t attr, const char *role, int timeout_ms) {
+    if (attr != USB_TYPEC_DATA_ROLE && attr != USB_TYPEC_POWER_ROLE) {
+        USB_LOG_ERROR("Type-C: %d is not a role attribute\n", attr);
+        return -1;
+    }
+    if (!tc->port_path[0]) return -1;
+
+    int64_t start = now_ms();
+    usb_typec_process(tc);
+    if (strcmp(tc->value[attr], role) == 0) return 0;
+
+    char path[sizeof(tc->port_path) + 32];
+    snprintf(path, sizeof(path), "%s/%s", tc->port_path, attr_names[attr]);
+    int fd = open(path, O_WRONLY | O_CLOEXEC);
+    if (fd < 0 || write(fd, role, strlen(role)) < 0) {
+        USB_LOG_INFO("Cannot request %s '%s': %s\n", attr_names[attr], role, strerror(errno));
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    close(fd);
+
+    for (;;) {
+        int waited = (int)(now_ms() - start);
+        if (strcmp(tc->value[attr], role) == 0) return waited;
+        if (waited >= timeout_ms) return -2;
+
+        int slice = timeout_ms - waited;
+        if (slice > USB_TYPEC_RECHECK_MS) slice = USB_TYPEC_RECHECK_MS;
+        int ret = usb_typec_wait(tc, slice);
+        if (ret < 0) return -1;
+        if (ret == 0) refresh(tc);  // Nothing signalled: look anyway
+    }
+}
@@ -0,0 +1,91 @@
+// USB-C Software Network - Type-C Port Monitor
+// Follows a Type-C port's roles and partner by change notification
+// instead of opening sysfs files and sleeping.
+//
+// The data_role, power_role and power_operation_mode attributes stay
+// open for the life of the monitor; they are re-read with pread() from
+// offset 0, which also re-arms the POLLPRI the class driver raises with
+// sysfs_notify() on every change. Partner attach and detach come from
+// kernel uevents on a NETLINK_KOBJECT_UEVENT socket (the source udev
+// itself listens to), filtered by the port's name; the -partner directory
+// is only stat()ed when an event says something changed. Without a
+// uevent socket the role notifications double as partner notifications,
+// as roles change whenever a partner comes or goes.
+//
+// All of these sit behind one epoll fd, so a caller's event loop watches
+// a single descriptor and calls usb_typec_process() when it is readable.
+
+#ifndef USB_TYPEC_H
+#define USB_TYPEC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Attributes kept open
+typedef enum {
+    USB_TYPEC_DATA_ROLE = 0,     // "[host] device"
+    USB_TYPEC_POWER_ROLE,        // "[source] sink"
+    USB_TYPEC_POWER_MODE,        // power_operation_mode, e.g. "usb_power_delivery"
+    USB_TYPEC_ATTR_MAX
+} usb_typec_attr_t;
+
+// usb_typec_process() change bits
+#define USB_TYPEC_EV_PARTNER     0x01
+#define USB_TYPEC_EV_DATA_ROLE   0x02
+#define USB_TYPEC_EV_POWER_ROLE  0x04
+#define USB_TYPEC_EV_POWER_MODE  0x08
+
+#define USB_TYPEC_RECHECK_MS 100  // Re-read while waiting, for drivers that never notify
+
+typedef struct {
+    char port_path[256];         // e.g. /sys/class/typec/port0, empty = not open
+    char port_name[64];          // Last path component, matched in uevents
+    int epoll_fd;
+    int attr_fd[USB_TYPEC_ATTR_MAX];  // -1 = attribute missing
+    int uevent_fd;               // -1 = no uevent socket
+
+    // Cached state, refreshed by usb_typec_process()
+    bool partner;
+    char value[USB_TYPEC_ATTR_MAX][32];  // Current value (the bracketed choice), "" = unknown
+
+    unsigned long events;        // Notifications handled
+    unsigned long changes;       // ... that changed the cached state
+} usb_typec_t;
+
+// Open the monitor on a port directory and read the current state.
+// Returns 0 (missing attributes are left out) or -1 if the port does not
+// exist.
+int usb_typec_open(usb_typec_t *tc, const char *port_path);
+
+// Close every descriptor. Safe on a zeroed or already closed monitor.
+void usb_typec_close(usb_typec_t *tc);
+
+// Readable when usb_typec_process() has something to look at
+int usb_typec_get_fd(const usb_typec_t *tc);
+
+// Handle pending notifications and refresh the cached state. Does not
+// block. Returns the USB_TYPEC_EV_* bits that changed.
+int usb_typec_process(usb_typec_t *tc);
+
+// Wait up to timeout_ms for a change. Returns the USB_TYPEC_EV_* bits
+// that changed, 0 on timeout, -1 on error.
+int usb_typec_wait(usb_typec_t *tc, int timeout_ms);
+
+// Current value of an attribute as cached, "" if unknown
+const char *usb_typec_get(const usb_typec_t *tc, usb_typec_attr_t attr);
+
+// Request a role ("host"/"device" or "source"/"sink") and wait up to
+// timeout_ms for the port to report it. Returns the milliseconds the swap
+// took, -1 if the request was refused, or -2 if the port has not switched
+// within timeout_ms.
+int usb_typec_set_role(usb_typec_t *tc, usb_typec_attr_t attr, const char *role, int timeout_ms);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // USB_TYPEC_H
@@ -0,0 +1,341 @@
+// USB-C Software Network - io_uring I/O Engine Implementation
+//
+// The SQ index array is filled with the identity once, so SQE slot i is
+// always ring entry i and queueing is just filling sqes[tail & mask].
+// SQEs are handed out ahead of the kernel's tail and published together
+// by usb_uring_submit_wait(), which also makes the batch the unit that
+// the ring lends to the kernel: a caller never has more queued than the
+// ring holds, and the completion queue (twice the size) never overflows.
+
+#define _GNU_SOURCE
+#include "usb_uring.h"
+#include "usb_pool.h"
+#include "usb_log.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+
+static bool uring_enabled;
+static unsigned uring_sqpoll_ms;
+static int uring_sqpoll_fd = -1;  // Ring whose poll thread later rings share
+
+static int sys_setup(unsigned entries, struct io_uring_params *p) {
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_register(int fd, unsigned opcode, const void *arg, unsigned nr_args) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+void usb_uring_configure(bool enabled, int sqpoll_idle_ms) {
+    uring_enabled = enabled;
+    uring_sqpoll_ms = sqpoll_idle_ms > 0 ? (unsigned)sqpoll_idle_ms : 0;
+}
+
+bool usb_uring_enabled(void) {
+    return uring_enabled;
+}
+
+static int map_rings(usb_uring_t *ring, const struct io_uring_params *p) {
+    ring->sq_ring_size = p->sq_off.array + p->sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = p->cq_off.cqes + p->cq_entries * sizeof(struct io_uring_cqe);
+    if (p->features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_ring_size > ring->sq_ring_size) ring->sq_ring_size = ring->cq_ring_size;
+        ring->cq_ring_size = ring->sq_ring_size;
+    }
+
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ring == MAP_FAILED) {
+        ring->sq_ring = NULL;
+        return -1;
+    }
+    if (p->features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_ring = ring->sq_ring;
+    } else {
+        ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE,
+                             MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ring == MAP_FAILED) {
+            ring->cq_ring = NULL;
+            return -1;
+        }
+    }
+    ring->sqes_size = p->sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        ring->sqes = NULL;
+        return -1;
+    }
+
+    uint8_t *sq = ring->sq_ring;
+    uint8_t *cq = ring->cq_ring;
+    ring->sq_head = (unsigned *)(sq + p->sq_off.head);
+    ring->sq_tail = (unsigned *)(sq + p->sq_off.tail);
+    ring->sq_flags = (unsigned *)(sq + p->sq_off.flags);
+    ring->sq_array = (unsigned *)(sq + p->sq_off.array);
+    ring->sq_mask = *(unsigned *)(sq + p->sq_off.ring_mask);
+    ring->sq_entries = p->sq_entries;
+    ring->cq_head = (unsigned *)(cq + p->cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + p->cq_off.tail);
+    ring->cq_mask = *(unsigned *)(cq + p->cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + p->cq_off.cqes);
+
+    for (unsigned i = 0; i < ring->sq_entries; i++) {
+        ring->sq_array[i] = i;
+    }
+    ring->sqe_head = ring->sqe_tail = *ring->sq_tail;
+    return 0;
+}
+
+static int probe_ops(usb_uring_t *ring, const int *ops) {
+    size_t size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = calloc(1, size);
+
+    if (!probe) return -1;
+    if (sys_register(ring->fd, IORING_REGISTER_PROBE, probe, 256) < 0) {
+        free(probe);
+        return -1;
+    }
+    for (unsigned i = 0; i < probe->ops_len && i < 256; i++) {
+        if (probe->ops[i].flags & IO_URING_OP_SUPPORTED) {
+            ring->ops_supported[i / 64] |= 1ULL << (i % 64);
+        }
+    }
+    free(probe);
+
+    for (; ops && *ops >= 0; ops++) {
+        if (*ops >= 256 || !(ring->ops_supported[*ops / 64] & (1ULL << (*ops % 64)))) {
+            USB_LOG_DEBUG("io_uring: kernel lacks operation %d\n", *ops);
+            errno = EOPNOTSUPP;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int register_resources(usb_uring_t *ring, unsigned buf_count, size_t buf_size,
+                              unsigned files) {
+    if (buf_count > 0) {
+        struct iovec *iov = calloc(buf_count, sizeof(struct iovec));
+        ring->buf_size = (buf_size + USB_POOL_ALIGN - 1) & ~(size_t)(USB_POOL_ALIGN - 1);
+        ring->bufs_bytes = ring->buf_size * buf_count;
+        ring->bufs = usb_slab_alloc(ring->bufs_bytes);
+        if (!iov || !ring->bufs) {
+            free(iov);
+            return -1;
+        }
+        ring->buf_count = buf_count;
+
+        for (unsigned i = 0; i < buf_count; i++) {
+            iov[i].iov_base = usb_uring_buf(ring, i);
+            iov[i].iov_len = ring->buf_size;
+        }
+        int ret = sys_register(ring->fd, IORING_REGISTER_BUFFERS, iov, buf_count);
+        free(iov);
+        if (ret < 0) return -1;
+    }
+
+    if (files > 0) {
+        int *fds = malloc(files * sizeof(int));
+        if (!fds) return -1;
+        for (unsigned i = 0; i < files; i++) {
+            fds[i] = -1;
+        }
+        int ret = sys_register(ring->fd, IORING_REGISTER_FILES, fds, files);
+        free(fds);
+        if (ret < 0) return -1;
+        ring->files = files;
+    }
+    return 0;
+}
+
+int usb_uring_init(usb_uring_t *ring, unsigned entries, unsigned buf_count, size_t buf_size,
+                   unsigned files, const int *ops) {
+    struct io_uring_params p;
+
+    memset(ring, 0, sizeof(usb_uring_t));
+    ring->fd = -1;
+    if (!uring_enabled) return -1;
+
+    // Completions are only reaped in usb_uring_submit_wait(), so the task
+    // need not be interrupted to run them (5.19+, dropped if refused)
+    unsigned flags = IORING_SETUP_CLAMP | IORING_SETUP_COOP_TASKRUN;
+    int attach_fd = __atomic_load_n(&uring_sqpoll_fd, __ATOMIC_ACQUIRE);
+    if (uring_sqpoll_ms > 0) {
+        // Every ring of the process shares one poll thread: a thread per
+        // ring would keep as many CPUs busy
+        flags = IORING_SETUP_CLAMP | IORING_SETUP_SQPOLL;
+        if (attach_fd >= 0) flags |= IORING_SETUP_ATTACH_WQ;
+    }
+    for (;;) {
+        memset(&p, 0, sizeof(p));
+        p.flags = flags;
+        p.sq_thread_idle = uring_sqpoll_ms;
+        p.wq_fd = (flags & IORING_SETUP_ATTACH_WQ) ? (unsigned)attach_fd : 0;
+        ring->fd = sys_setup(entries, &p);
+        if (ring->fd >= 0) break;
+
+        int err = errno;
+        if (flags & IORING_SETUP_ATTACH_WQ) {
+            flags &= ~IORING_SETUP_ATTACH_WQ;  // That ring is gone, start a new thread
+        } else if (err == EINVAL && (flags & IORING_SETUP_COOP_TASKRUN)) {
+            flags &= ~IORING_SETUP_COOP_TASKRUN;
+        } else if ((err == EPERM || err == EINVAL) && (flags & IORING_SETUP_SQPOLL)) {
+            USB_LOG_WARN("io_uring: SQPOLL refused (%s), submitting from the caller\n", strerror(err));
+            flags &= ~IORING_SETUP_SQPOLL;
+        } else {
+            USB_LOG_WARN("io_uring unavailable: %s\n", strerror(err));
+            return -1;
+        }
+    }
+    ring->setup_flags = flags;
+    if ((flags & IORING_SETUP_SQPOLL) && !(flags & IORING_SETUP_ATTACH_WQ)) {
+        __atomic_store_n(&uring_sqpoll_fd, ring->fd, __ATOMIC_RELEASE);
+    }
+
+    if (map_rings(ring, &p) < 0 || probe_ops(ring, ops) < 0 ||
+        register_resources(ring, buf_count, buf_size, files) < 0) {
+        USB_LOG_WARN("io_uring setup failed: %s\n", strerror(errno));
+        usb_uring_cleanup(ring);
+        return -1;
+    }
+
+    USB_LOG_DEBUG("io_uring: %u entries, %u buffers of %zu bytes, %u files%s\n",
+                  ring->sq_entries, ring->buf_count, ring->buf_size, ring->files,
+                  (flags & IORING_SETUP_SQPOLL) ? ", SQPOLL" : "");
+    return 0;
+}
+
+void usb_uring_cleanup(usb_uring_t *ring) {
+    if (ring->fd >= 0 && ring->enters > 0) {
+        USB_LOG_DEBUG("io_uring: %lu operations in %lu system calls\n", ring->submitted, ring->enters);
+    }
+    if (ring->sqes) munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ring && ring->cq_ring != ring->sq_ring) munmap(ring->cq_ring, ring->cq_ring_size);
+    if (ring->sq_ring) munmap(ring->sq_ring, ring->sq_ring_size);
+    if (ring->fd >= 0) {
+        int fd = ring->fd;
+        __atomic_compare_exchange_n(&uring_sqpoll_fd, &fd, -1, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+        close(ring->fd);  // Also drops the registered buffers and files
+    }
+    if (ring->bufs) usb_slab_free(ring->bufs, ring->bufs_bytes);
+    memset(ring, 0, sizeof(usb_uring_t));
+    ring->fd = -1;
+}
+
+int usb_uring_set_file(usb_uring_t *ring, unsigned index, int fd) {
+    struct io_uring_files_update update = { .offset = index, .fds = (uint64_t)(uintptr_t)&fd };
+
+    if (index >= ring->files) return -1;
+    return sys_register(ring->fd, IORING_REGISTER_FILES_UPDATE, &update, 1) < 0 ? -1 : 0;
+}
+
+struct io_uring_sqe *usb_uring_prep(usb_uring_t *ring, int op, int fd, const void *addr,
+                                    unsigned len, uint64_t off, uint64_t user_data) {
+    unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    if (ring->sqe_tail - head >= ring->sq_entries) return NULL;
+
+    struct io_uring_sqe *sqe = &ring->sqes[ring->sqe_tail & ring->sq_mask];
+    ring->sqe_tail++;
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = (uint8_t)op;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)addr;
+    sqe->len = len;
+    sqe->off = off;
+    sqe->user_data = user_data;
+    return sqe;
+}
+
+unsigned usb_uring_queued(const usb_uring_t *ring) {
+    return ring->sqe_tail - ring->sqe_head;
+}
+
+// Move up to n - got completions to cqes[got...]. Returns the new got.
+static unsigned reap(usb_uring_t *ring, struct io_uring_cqe *cqes, unsigned got, unsigned n) {
+    unsigned head = *ring->cq_head;
+    unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+    while (head != tail && got < n) {
+        if (cqes) cqes[got] = ring->cqes[head & ring->cq_mask];
+        head++;
+        got++;
+    }
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    return got;
+}
+
+// Take back the operations the kernel has not picked up, so that a later
+// call does not submit them after the caller has given up on their
+// buffers. Only without SQPOLL, where the kernel reads the ring in
+// io_uring_enter() alone.
+static void drop_unsubmitted(usb_uring_t *ring) {
+    unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+
+    ring->submitted -= ring->sqe_tail - head;
+    __atomic_store_n(ring->sq_tail, head, __ATOMIC_RELEASE);
+    ring->sqe_head = ring->sqe_tail = head;
+}
+
+int usb_uring_submit_wait(usb_uring_t *ring, unsigned n, struct io_uring_cqe *cqes) {
+    bool sqpoll = ring->setup_flags & IORING_SETUP_SQPOLL;
+    unsigned to_submit = ring->sqe_tail - ring->sqe_head;
+    unsigned got = 0;
+
+    if (to_submit > 0) {
+        __atomic_store_n(ring->sq_tail, ring->sqe_tail, __ATOMIC_RELEASE);
+        ring->sqe_head = ring->sqe_tail;
+        ring->submitted += to_submit;
+    }
+
+    // The poll thread takes the batch from the ring; it only needs a
+    // system call to wake up after idling, and the results often come
+    // back before it is worth sleeping for them
+    if (sqpoll) {
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (to_submit > 0 &&
+            (__atomic_load_n(ring->sq_flags, __ATOMIC_RELAXED) & IORING_SQ_NEED_WAKEUP)) {
+            if (sys_enter(ring->fd, 0, 0, IORING_ENTER_SQ_WAKEUP) < 0) return -1;
+            ring->enters++;
+        }
+        to_submit = 0;
+        for (int i = 0; i < USB_URING_SPIN && got < n; i++) {
+            got = reap(ring, cqes, got, n);
+        }
+    }
+
+    for (;;) {
+        got = reap(ring, cqes, got, n);
+        if (got >= n && to_submit == 0) return 0;
+
+        unsigned wait = got < n ? n - got : 0;
+        int ret = sys_enter(ring->fd, to_submit, wait, wait ? IORING_ENTER_GETEVENTS : 0);
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+            USB_LOG_ERROR("io_uring_enter: %s\n", strerror(errno));
+            if (to_submit > 0) drop_unsubmitted(ring);
+            return -1;
+        }
+        ring->enters++;
+
+        // The kernel may take fewer than offered (e.g. short of memory
+        // for them) and then returns without waiting: offer the rest again
+        if (to_submit > 0) {
+            if (ret == 0) {
+                USB_LOG_ERROR("io_uring_enter: none of %u operations submitted\n", to_submit);
+                drop_unsubmitted(ring);
+                return -1;
+            }
+            to_submit -= (unsigned)ret < to_submit ? (unsigned)ret : to_submit;
+        }
+    }
+}
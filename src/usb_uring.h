@@ -0,0 +1,111 @@
+// USB-C Software Network - io_uring I/O Engine
+// A small synchronous front end to io_uring for the paths that used to
+// make a run of small blocking syscalls per message: the /tmp file
+// transport and TUN frame writes. A caller
+// queues a batch of operations, often linked so that each runs only if
+// the one before succeeded (open -> write -> close -> rename), and waits
+// for all of them with one io_uring_enter(); with IO_URING_SQPOLL a
+// kernel thread picks the batch up and even that call is usually saved.
+//
+// Each ring has its own registered buffers (from usb_slab_alloc(), so
+// they pin a few hugepages rather than many small pages) and a table of
+// fixed files, either descriptors the caller registers once or slots
+// that an IORING_OP_OPENAT fills directly, so that a file opened, used and
+// closed within one batch never gets a descriptor at all.
+//
+// Talks to the kernel through the system calls and <linux/io_uring.h>
+// (5.19 or later headers); no liburing. Off unless IO_URING is set
+// (usb_uring_configure()); when it is, usb_uring_init() still fails on
+// kernels without the operations a caller asks for, and callers then
+// keep their plain syscall path.
+
+#ifndef USB_URING_H
+#define USB_URING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <linux/io_uring.h>
+
+#define USB_URING_SPIN 256  // CQ checks before sleeping in io_uring_enter() (SQPOLL)
+
+typedef struct {
+    int fd;                      // -1 = not set up
+    unsigned setup_flags;        // IORING_SETUP_* in use
+
+    // Submission queue, shared with the kernel
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_flags;
+    unsigned *sq_array;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    struct io_uring_sqe *sqes;
+    unsigned sqe_head;           // First SQE not yet published to the kernel
+    unsigned sqe_tail;           // Next SQE to hand out
+
+    // Completion queue
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;               // == sq_ring with IORING_FEAT_SINGLE_MMAP
+    size_t cq_ring_size;
+    size_t sqes_size;
+
+    uint8_t *bufs;               // Registered buffers, buf_count of buf_size
+    size_t buf_size;
+    unsigned buf_count;
+    size_t bufs_bytes;
+    unsigned files;              // Fixed file table size
+
+    uint64_t ops_supported[4];   // IORING_OP_* bits from the probe
+
+    unsigned long submitted;     // Operations passed to the kernel
+    unsigned long enters;        // ... and io_uring_enter() calls it took
+} usb_uring_t;
+
+// Process-wide switch, from IO_URING and IO_URING_SQPOLL: enabled turns
+// the engine on, sqpoll_idle_ms > 0 gives every ring a submission thread
+// that sleeps after that long without work
+void usb_uring_configure(bool enabled, int sqpoll_idle_ms);
+
+bool usb_uring_enabled(void);
+
+// Set up a ring of at least entries SQEs with buf_count registered
+// buffers of buf_size bytes and a table of files fixed file slots, all
+// empty. ops lists the IORING_OP_* the caller needs, ended by -1. Returns
+// 0, or -1 if the engine is off, io_uring is unavailable or lacks one of
+// the operations (ring left with fd -1, safe to clean up).
+int usb_uring_init(usb_uring_t *ring, unsigned entries, unsigned buf_count, size_t buf_size,
+                   unsigned files, const int *ops);
+
+// Tear down; safe on a ring whose init failed
+void usb_uring_cleanup(usb_uring_t *ring);
+
+// Put fd in fixed file slot index (-1 empties it). Returns 0 or -1.
+int usb_uring_set_file(usb_uring_t *ring, unsigned index, int fd);
+
+// Registered buffer index
+static inline uint8_t *usb_uring_buf(const usb_uring_t *ring, unsigned index) {
+    return ring->bufs + (size_t)index * ring->buf_size;
+}
+
+// Queue an operation: fd, addr, len and off have their io_uring_sqe
+// meaning for op. Returns the zeroed-then-filled SQE for the caller to
+// add flags or op fields to, or NULL while the batch fills the ring.
+struct io_uring_sqe *usb_uring_prep(usb_uring_t *ring, int op, int fd, const void *addr,
+                                    unsigned len, uint64_t off, uint64_t user_data);
+
+// Operations queued and not yet submitted
+unsigned usb_uring_queued(const usb_uring_t *ring);
+
+// Submit everything queued and wait for n completions, copied to cqes in
+// completion order (cqes may be NULL). Returns 0, or -1 if the ring
+// failed; a failed operation is only reported in its res.
+int usb_uring_submit_wait(usb_uring_t *ring, unsigned n, struct io_uring_cqe *cqes);
+
+#endif // USB_URING_H
@@ -0,0 +1,497 @@
+// USB-C Software Network - Asynchronous Bulk Transfer Engine Implementation
+//
+// Locking: eng->lock protects the queues, counters and the stop flag.
+// libusb_submit_transfer() and libusb_cancel_transfer() are called with it
+// held, so that no transfer is submitted once stop is set and none is
+// cancelled while it is being resubmitted. Callbacks take the lock too
+// (in_callback() resubmits under it). This cannot deadlock: libusb holds
+// none of its internal transfer locks while it runs a callback (only the
+// event handling lock, which submit and cancel do not take), so the order
+// is always eng->lock, then libusb's transfer locks. Take no other lock
+// while holding eng->lock.
+
+#include "usb_xfer.h"
+#include "usb_log.h"
+#include "usb_pool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/eventfd.h>
+
+#define USB_XFER_TX_TIMEOUT_MS 5000
+#define USB_XFER_EVENT_POLL_US 100000
+
+// Compute an absolute CLOCK_MONOTONIC deadline timeout_ms from now
+static void deadline_from_now(struct timespec *ts, int timeout_ms) {
+    clock_gettime(CLOCK_MONOTONIC, ts);
+    ts->tv_sec += timeout_ms / 1000;
+    ts->tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+    if (ts->tv_nsec >= 1000000000L) {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000L;
+    }
+}
+
+static int64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+// Refresh the queue depth gauges. Called with eng->lock held.
+static void sample_queues(usb_xfer_engine_t *eng) {
+    usb_stat_set(&eng->stats->tx_in_flight, (uint64_t)(eng->depth - eng->tx_free_count));
+    usb_stat_set(&eng->stats->rx_queued, (uint64_t)eng->rx_count);
+}
+
+// Make rx_fd readable: a completion was queued or a fatal error seen.
+// Called with eng->lock held.
+static void ring_rx_fd(usb_xfer_engine_t *eng) {
+    uint64_t one = 1;
+    if (write(eng->rx_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        USB_LOG_ERROR("xfer eventfd: %s\n", strerror(errno));
+    }
+}
+
+// Map a transfer status to a libusb error code (0 = not fatal)
+static int status_to_error(enum libusb_transfer_status status) {
+    switch (status) {
+        case LIBUSB_TRANSFER_NO_DEVICE: return LIBUSB_ERROR_NO_DEVICE;
+        case LIBUSB_TRANSFER_STALL:     return LIBUSB_ERROR_PIPE;
+        case LIBUSB_TRANSFER_ERROR:     return LIBUSB_ERROR_IO;
+        default:                        return 0;
+    }
+}
+
+// Hand a slot to libusb, or refuse with LIBUSB_ERROR_INTERRUPTED once the
+// engine is stopping. Runs under eng->lock, so that in_flight is only set
+// for a transfer libusb really owns and usb_xfer_stop() cancels every one
+// of them: none can be submitted behind its back.
+static int submit_slot_locked(usb_xfer_engine_t *eng, usb_xfer_slot_t *slot) {
+    if (eng->stop) return LIBUSB_ERROR_INTERRUPTED;
+
+    slot->in_flight = true;
+    slot->submit_us = now_us();
+    eng->in_flight++;
+
+    int ret = libusb_submit_transfer(slot->transfer);
+    if (ret < 0) {
+        slot->in_flight = false;
+        eng->in_flight--;
+        bool out = slot == &eng->out_slots[slot->index];
+        usb_stat_add(out ? &eng->stats->tx_errors : &eng->stats->rx_errors, 1);
+    }
+    return ret;
+}
+
+static int submit_slot(usb_xfer_engine_t *eng, usb_xfer_slot_t *slot) {
+    pthread_mutex_lock(&eng->lock);
+    int ret = submit_slot_locked(eng, slot);
+    pthread_mutex_unlock(&eng->lock);
+    return ret;
+}
+
+// Stop submitting and cancel everything in flight. The event thread (or
+// event_thread_main() run inline) then reaps the cancellations.
+static void cancel_all(usb_xfer_engine_t *eng) {
+    pthread_mutex_lock(&eng->lock);
+    eng->stop = 1;
+    for (int i = 0; i < eng->depth; i++) {
+        if (eng->in_slots[i].in_flight) libusb_cancel_transfer(eng->in_slots[i].transfer);
+        if (eng->out_slots[i].in_flight) libusb_cancel_transfer(eng->out_slots[i].transfer);
+    }
+    pthread_cond_broadcast(&eng->rx_ready);
+    pthread_cond_broadcast(&eng->tx_ready);
+    pthread_mutex_unlock(&eng->lock);
+}
+
+// IN completion: queue the buffer for the caller, or resubmit on soft errors
+static void in_callback(struct libusb_transfer *transfer) {
+    usb_xfer_slot_t *slot = transfer->user_data;
+    usb_xfer_engine_t *eng = slot->owner;
+
+    pthread_mutex_lock(&eng->lock);
+    slot->in_flight = false;
+    eng->in_flight--;
+
+    if (transfer->status == LIBUSB_TRANSFER_COMPLETED) {
+        int tail = (eng->rx_head + eng->rx_count) % eng->depth;
+        eng->rx_queue[tail] = slot->index;
+        eng->rx_count++;
+        usb_stat_add(&eng->stats->rx_packets, 1);
+        usb_stat_add(&eng->stats->rx_bytes, (uint64_t)transfer->actual_length);
+        sample_queues(eng);
+        if (eng->rx_count == 1) ring_rx_fd(eng);
+        pthread_cond_signal(&eng->rx_ready);
+    } else if (transfer->status != LIBUSB_TRANSFER_CANCELLED) {
+        usb_stat_add(&eng->stats->rx_errors, 1);
+        int err = status_to_error(transfer->status);
+        if (err) {
+            eng->last_error = err;
+            ring_rx_fd(eng);
+            pthread_cond_broadcast(&eng->rx_ready);
+            pthread_cond_broadcast(&eng->tx_ready);
+        } else {
+            submit_slot_locked(eng, slot);  // Timeout or overflow: drop and retry
+        }
+    }
+    pthread_mutex_unlock(&eng->lock);
+}
+
+// OUT completion: recycle the slot
+static void out_callback(struct libusb_transfer *transfer) {
+    usb_xfer_slot_t *slot = transfer->user_data;
+    usb_xfer_engine_t *eng = slot->owner;
+
+    pthread_mutex_lock(&eng->lock);
+    slot->in_flight = false;
+    eng->in_flight--;
+    eng->tx_free[eng->tx_free_count++] = slot->index;
+    sample_queues(eng);
+
+    if (transfer->status == LIBUSB_TRANSFER_COMPLETED) {
+        usb_stat_add(&eng->stats->tx_packets, 1);
+        usb_stat_add(&eng->stats->tx_bytes, (uint64_t)transfer->actual_length);
+        usb_stats_hist_add(&eng->stats->latency, (uint64_t)(now_us() - slot->submit_us));
+    } else if (transfer->status != LIBUSB_TRANSFER_CANCELLED) {
+        usb_stat_add(&eng->stats->tx_errors, 1);
+        int err = status_to_error(transfer->status);
+        if (err) {
+            eng->last_error = err;
+            ring_rx_fd(eng);
+            pthread_cond_broadcast(&eng->rx_ready);
+        } else {
+            USB_LOG_WARN_RATELIMIT("Bulk write did not complete (status %d)\n", transfer->status);
+        }
+    }
+    pthread_cond_signal(&eng->tx_ready);
+    pthread_mutex_unlock(&eng->lock);
+}
+
+static void *event_thread_main(void *arg) {
+    usb_xfer_engine_t *eng = arg;
+
+    for (;;) {
+        pthread_mutex_lock(&eng->lock);
+        bool done = eng->stop && eng->in_flight == 0;
+        pthread_mutex_unlock(&eng->lock);
+        if (done) break;
+
+        struct timeval tv = { 0, USB_XFER_EVENT_POLL_US };
+        libusb_handle_events_timeout_completed(eng->ctx, &tv, NULL);
+    }
+
+    return NULL;
+}
+
+static uint8_t *alloc_buffer(usb_xfer_engine_t *eng) {
+    if (eng->dev_mem) {
+        uint8_t *buf = libusb_dev_mem_alloc(eng->handle, eng->buffer_size);
+        if (buf) return buf;
+        // Only use device memory when every slot can have it
+        return NULL;
+    }
+
+    // One hugepage-backed slab for every IN and OUT buffer of the engine
+    size_t stride = (eng->buffer_size + USB_POOL_ALIGN - 1) & ~(size_t)(USB_POOL_ALIGN - 1);
+    if (!eng->slab) {
+        eng->slab_bytes = (size_t)eng->depth * 2 * stride;
+        eng->slab = usb_slab_alloc(eng->slab_bytes);
+        if (!eng->slab) return NULL;
+    }
+    return eng->slab + (size_t)eng->slab_used++ * stride;
+}
+
+static void free_slot(usb_xfer_engine_t *eng, usb_xfer_slot_t *slot) {
+    if (slot->transfer) {
+        libusb_free_transfer(slot->transfer);
+        slot->transfer = NULL;
+    }
+    if (slot->buffer) {
+        if (eng->dev_mem) {
+            libusb_dev_mem_free(eng->handle, slot->buffer, slot->capacity);
+        }
+        slot->buffer = NULL;
+    }
+}
+
+static int alloc_slots(usb_xfer_engine_t *eng) {
+    for (int i = 0; i < eng->depth; i++) {
+        usb_xfer_slot_t *slots[2] = { &eng->in_slots[i], &eng->out_slots[i] };
+        for (int k = 0; k < 2; k++) {
+            usb_xfer_slot_t *slot = slots[k];
+            slot->index = i;
+            slot->owner = eng;
+            slot->capacity = eng->buffer_size;
+            slot->buffer = alloc_buffer(eng);
+            slot->transfer = libusb_alloc_transfer(0);
+            if (!slot->buffer || !slot->transfer) {
+                return -1;
+            }
+        }
+
+        libusb_fill_bulk_transfer(eng->in_slots[i].transfer, eng->handle, eng->endpoint_in,
+                                  eng->in_slots[i].buffer, (int)eng->buffer_size,
+                                  in_callback, &eng->in_slots[i], 0);
+        libusb_fill_bulk_transfer(eng->out_slots[i].transfer, eng->handle, eng->endpoint_out,
+                                  eng->out_slots[i].buffer, 0,
+                                  out_callback, &eng->out_slots[i], USB_XFER_TX_TIMEOUT_MS);
+        // Terminate transfers that are an exact multiple of wMaxPacketSize
+        eng->out_slots[i].transfer->flags = LIBUSB_TRANSFER_ADD_ZERO_PACKET;
+
+        eng->tx_free[eng->tx_free_count++] = i;
+    }
+    return 0;
+}
+
+static void free_slots(usb_xfer_engine_t *eng) {
+    for (int i = 0; i < eng->depth; i++) {
+        free_slot(eng, &eng->in_slots[i]);
+        free_slot(eng, &eng->out_slots[i]);
+    }
+    usb_slab_free(eng->slab, eng->slab_bytes);
+    eng->slab = NULL;
+    eng->slab_used = 0;
+    eng->tx_free_count = 0;
+}
+
+// Start the transfer engine
+int usb_xfer_start(usb_xfer_engine_t *eng, libusb_context *ctx,
+                   libusb_device_handle *handle,
+                   uint8_t endpoint_in, uint8_t endpoint_out,
+                   int depth, size_t buffer_size, usb_stats_t *stats) {
+    memset(eng, 0, sizeof(usb_xfer_engine_t));
+    eng->stats = stats ? stats : &eng->stats_local;
+
+    if (depth <= 0) depth = USB_XFER_DEFAULT_DEPTH;
+    if (depth > USB_XFER_MAX_DEPTH) depth = USB_XFER_MAX_DEPTH;
+
+    eng->ctx = ctx;
+    eng->handle = handle;
+    eng->endpoint_in = endpoint_in;
+    eng->endpoint_out = endpoint_out;
+    eng->depth = depth;
+    eng->buffer_size = buffer_size;
+
+    pthread_condattr_t cattr;
+    pthread_condattr_init(&cattr);
+    pthread_condattr_setclock(&cattr, CLOCK_MONOTONIC);
+    pthread_mutex_init(&eng->lock, NULL);
+    pthread_cond_init(&eng->rx_ready, &cattr);
+    pthread_cond_init(&eng->tx_ready, &cattr);
+    pthread_condattr_destroy(&cattr);
+
+    eng->rx_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (eng->rx_fd < 0) {
+        USB_LOG_ERROR("Failed to create xfer eventfd: %s\n", strerror(errno));
+        goto fail_sync;
+    }
+
+    // Prefer usbfs-mapped buffers (zero-copy DMA); fall back to heap memory
+    eng->dev_mem = true;
+    if (alloc_slots(eng) < 0) {
+        free_slots(eng);
+        eng->dev_mem = false;
+        if (alloc_slots(eng) < 0) {
+            USB_LOG_ERROR("Failed to allocate %d transfer slots\n", depth);
+            free_slots(eng);
+            goto fail_sync;
+        }
+    }
+
+    for (int i = 0; i < depth; i++) {
+        int ret = submit_slot(eng, &eng->in_slots[i]);
+        if (ret < 0) {
+            USB_LOG_ERROR("Failed to submit IN transfer: %s\n", libusb_error_name(ret));
+            cancel_all(eng);
+            event_thread_main(eng);  // Drain the cancellations inline
+            free_slots(eng);
+            goto fail_sync;
+        }
+    }
+
+    int err = pthread_create(&eng->event_thread, NULL, event_thread_main, eng);
+    if (err != 0) {
+        USB_LOG_ERROR("Failed to start USB event thread: %s\n", strerror(err));
+        cancel_all(eng);
+        event_thread_main(eng);
+        free_slots(eng);
+        goto fail_sync;
+    }
+
+    eng->running = true;
+    USB_LOG_INFO("Async transfer engine started: %d IN + %d OUT transfers of %zu bytes%s\n",
+                 depth, depth, buffer_size, eng->dev_mem ? " (usbfs zero-copy)" : "");
+    return 0;
+
+fail_sync:
+    if (eng->rx_fd >= 0) close(eng->rx_fd);
+    eng->rx_fd = -1;
+    pthread_cond_destroy(&eng->rx_ready);
+    pthread_cond_destroy(&eng->tx_ready);
+    pthread_mutex_destroy(&eng->lock);
+    return -1;
+}
+
+// Stop the transfer engine
+void usb_xfer_stop(usb_xfer_engine_t *eng) {
+    if (!eng->running) return;
+
+    cancel_all(eng);
+    libusb_interrupt_event_handler(eng->ctx);
+    pthread_join(eng->event_thread, NULL);
+
+    free_slots(eng);
+    close(eng->rx_fd);
+    eng->rx_fd = -1;
+    pthread_cond_destroy(&eng->rx_ready);
+    pthread_cond_destroy(&eng->tx_ready);
+    pthread_mutex_destroy(&eng->lock);
+    eng->running = false;
+}
+
+// Wait for a completed IN transfer
+int usb_xfer_wait_rx(usb_xfer_engine_t *eng, usb_xfer_completion_t *out, int timeout_ms) {
+    struct timespec deadline;
+    deadline_from_now(&deadline, timeout_ms);
+
+    pthread_mutex_lock(&eng->lock);
+    while (eng->rx_count == 0 && !eng->last_error && !eng->stop) {
+        if (pthread_cond_timedwait(&eng->rx_ready, &eng->lock, &deadline) == ETIMEDOUT) {
+            break;
+        }
+    }
+
+    int ret = 0;
+    if (eng->rx_count > 0) {
+        int idx = eng->rx_queue[eng->rx_head];
+        eng->rx_head = (eng->rx_head + 1) % eng->depth;
+        eng->rx_count--;
+        sample_queues(eng);
+        if (eng->rx_count == 0) {
+            uint64_t value;
+            while (read(eng->rx_fd, &value, sizeof(value)) > 0) {
+            }
+        }
+
+        out->slot = idx;
+        out->data = eng->in_slots[idx].buffer;
+        out->len = eng->in_slots[idx].transfer->actual_length;
+        ret = 1;
+    } else if (eng->last_error) {
+        ret = -1;
+    }
+    pthread_mutex_unlock(&eng->lock);
+
+    return ret;
+}
+
+// Release a received buffer and resubmit its transfer
+void usb_xfer_release(usb_xfer_engine_t *eng, int slot) {
+    if (slot < 0 || slot >= eng->depth) return;
+
+    int ret = submit_slot(eng, &eng->in_slots[slot]);
+    if (ret < 0 && ret != LIBUSB_ERROR_INTERRUPTED) {
+        USB_LOG_WARN_RATELIMIT("Failed to resubmit IN transfer: %s\n", libusb_error_name(ret));
+        pthread_mutex_lock(&eng->lock);
+        eng->last_error = ret;
+        pthread_mutex_unlock(&eng->lock);
+    }
+}
+
+// Acquire a free OUT slot
+int usb_xfer_tx_acquire(usb_xfer_engine_t *eng, uint8_t **buffer, size_t *capacity,
+                        int timeout_ms) {
+    struct timespec deadline;
+    deadline_from_now(&deadline, timeout_ms);
+
+    pthread_mutex_lock(&eng->lock);
+    while (eng->tx_free_count == 0 && !eng->last_error && !eng->stop) {
+        if (pthread_cond_timedwait(&eng->tx_ready, &eng->lock, &deadline) == ETIMEDOUT) {
+            break;
+        }
+    }
+
+    int slot = -1;
+    if (eng->tx_free_count > 0 && !eng->last_error) {
+        slot = eng->tx_free[--eng->tx_free_count];
+        *buffer = eng->out_slots[slot].buffer;
+        *capacity = eng->out_slots[slot].capacity;
+    }
+    pthread_mutex_unlock(&eng->lock);
+
+    return slot;
+}
+
+// Count free OUT slots
+int usb_xfer_tx_free(usb_xfer_engine_t *eng) {
+    if (!eng->running) return 0;
+
+    pthread_mutex_lock(&eng->lock);
+    int n = eng->last_error ? 0 : eng->tx_free_count;
+    pthread_mutex_unlock(&eng->lock);
+
+    return n;
+}
+
+// Return an unused OUT slot
+void usb_xfer_tx_abort(usb_xfer_engine_t *eng, int slot) {
+    if (slot < 0 || slot >= eng->depth) return;
+
+    pthread_mutex_lock(&eng->lock);
+    eng->tx_free[eng->tx_free_count++] = slot;
+    pthread_cond_signal(&eng->tx_ready);
+    pthread_mutex_unlock(&eng->lock);
+}
+
+// Submit an acquired OUT slot
+int usb_xfer_tx_submit(usb_xfer_engine_t *eng, int slot, size_t len) {
+    usb_xfer_slot_t *s = &eng->out_slots[slot];
+
+    if (len > s->capacity) {
+        USB_LOG_ERROR("Transfer of %zu bytes exceeds slot size %zu\n", len, s->capacity);
+        pthread_mutex_lock(&eng->lock);
+        eng->tx_free[eng->tx_free_count++] = slot;
+        usb_stat_add(&eng->stats->tx_errors, 1);
+        pthread_mutex_unlock(&eng->lock);
+        return -1;
+    }
+
+    s->transfer->length = (int)len;
+    int ret = submit_slot(eng, s);
+    if (ret < 0) {
+        if (ret != LIBUSB_ERROR_INTERRUPTED) {
+            USB_LOG_WARN_RATELIMIT("Bulk write submit error: %s\n", libusb_error_name(ret));
+        }
+        pthread_mutex_lock(&eng->lock);
+        eng->tx_free[eng->tx_free_count++] = slot;
+        if (ret == LIBUSB_ERROR_NO_DEVICE) eng->last_error = ret;
+        pthread_mutex_unlock(&eng->lock);
+        return -1;
+    }
+
+    return (int)len;
+}
+
+// Copy and submit
+int usb_xfer_send(usb_xfer_engine_t *eng, const uint8_t *data, size_t len, int timeout_ms) {
+    uint8_t *buf;
+    size_t cap;
+
+    int slot = usb_xfer_tx_acquire(eng, &buf, &cap, timeout_ms);
+    if (slot < 0) {
+        return -1;
+    }
+
+    if (len > cap) {
+        usb_xfer_tx_submit(eng, slot, len);  // Reports the error and frees the slot
+        return -1;
+    }
+
+    memcpy(buf, data, len);
+    return usb_xfer_tx_submit(eng, slot, len);
+}
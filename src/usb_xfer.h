@@ -0,0 +1,128 @@
+// USB-C Software Network - Asynchronous Bulk Transfer Engine
+// Keeps a queue of in-flight libusb bulk transfers per endpoint so the
+// link never sits idle waiting for a single synchronous round trip.
+//
+// IN transfers are kept submitted at all times. When one completes, its
+// buffer is handed to the caller through a completion queue and only
+// resubmitted once the caller releases it. OUT transfers come from a
+// fixed pool of slots; a slot is recycled when its transfer completes.
+// All libusb callbacks run on a dedicated event thread.
+//
+// Transfer counters (usb_stats.h) are updated under the engine lock, so
+// the event thread and the submitting threads never race on them.
+
+#ifndef USB_XFER_H
+#define USB_XFER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <libusb-1.0/libusb.h>
+#include "usb_stats.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define USB_XFER_DEFAULT_DEPTH 8
+#define USB_XFER_MAX_DEPTH     64
+
+// One transfer slot (IN or OUT)
+typedef struct {
+    struct libusb_transfer *transfer;
+    uint8_t *buffer;
+    size_t capacity;
+    bool in_flight;
+    int64_t submit_us;   // OUT: when the transfer was submitted
+    int index;
+    void *owner;         // Back-pointer to the usb_xfer_engine_t
+} usb_xfer_slot_t;
+
+// A finished IN transfer handed to the caller
+typedef struct {
+    uint8_t *data;       // Points into the engine-owned slot buffer
+    int len;             // Bytes received
+    int slot;            // Slot index, pass back to usb_xfer_release()
+} usb_xfer_completion_t;
+
+// Transfer engine state
+typedef struct {
+    libusb_context *ctx;
+    libusb_device_handle *handle;
+    uint8_t endpoint_in;
+    uint8_t endpoint_out;
+    int depth;
+    size_t buffer_size;
+    bool dev_mem;               // Buffers come from libusb_dev_mem_alloc()
+    uint8_t *slab;              // Otherwise every buffer is carved from one slab
+    size_t slab_bytes;
+    int slab_used;              // Buffers carved so far
+
+    usb_xfer_slot_t in_slots[USB_XFER_MAX_DEPTH];
+    usb_xfer_slot_t out_slots[USB_XFER_MAX_DEPTH];
+
+    // IN completion queue (slot indices, FIFO)
+    int rx_queue[USB_XFER_MAX_DEPTH];
+    int rx_head;
+    int rx_count;
+
+    // Free OUT slots (stack of slot indices)
+    int tx_free[USB_XFER_MAX_DEPTH];
+    int tx_free_count;
+
+    int in_flight;              // Transfers currently owned by libusb
+    int last_error;             // Last fatal libusb error (0 = none)
+
+    usb_stats_t stats_local;
+    usb_stats_t *stats;         // Caller's counters or stats_local
+
+    pthread_mutex_t lock;
+    pthread_cond_t rx_ready;
+    pthread_cond_t tx_ready;
+    int rx_fd;                  // eventfd, readable while completions are queued or on error
+    pthread_t event_thread;
+    volatile int stop;
+    bool running;
+} usb_xfer_engine_t;
+
+// Allocate slots and start the event thread. depth <= 0 selects the default.
+// Transfers are counted into stats (NULL = the engine's own counters),
+// which must outlive the engine.
+int usb_xfer_start(usb_xfer_engine_t *eng, libusb_context *ctx,
+                   libusb_device_handle *handle,
+                   uint8_t endpoint_in, uint8_t endpoint_out,
+                   int depth, size_t buffer_size, usb_stats_t *stats);
+
+// Cancel all transfers, join the event thread and free buffers
+void usb_xfer_stop(usb_xfer_engine_t *eng);
+
+// Wait up to timeout_ms for a completed IN transfer (0 = poll; pair with rx_fd).
+// Returns 1 on success, 0 on timeout, -1 on a fatal error.
+int usb_xfer_wait_rx(usb_xfer_engine_t *eng, usb_xfer_completion_t *out, int timeout_ms);
+
+// Return a received buffer to the engine and resubmit its transfer
+void usb_xfer_release(usb_xfer_engine_t *eng, int slot);
+
+// Acquire a free OUT slot buffer to fill in place.
+// Returns the slot index, or -1 on timeout or fatal error.
+int usb_xfer_tx_acquire(usb_xfer_engine_t *eng, uint8_t **buffer, size_t *capacity,
+                        int timeout_ms);
+
+// OUT slots free right now (0 once a fatal error has been seen)
+int usb_xfer_tx_free(usb_xfer_engine_t *eng);
+
+// Return an acquired OUT slot without submitting it
+void usb_xfer_tx_abort(usb_xfer_engine_t *eng, int slot);
+
+// Submit len bytes of an acquired OUT slot
+int usb_xfer_tx_submit(usb_xfer_engine_t *eng, int slot, size_t len);
+
+// Copy data into a free OUT slot and submit it. Returns len or -1.
+int usb_xfer_send(usb_xfer_engine_t *eng, const uint8_t *data, size_t len, int timeout_ms);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // USB_XFER_H
@@ -0,0 +1,31 @@
+// USB-C Software Network - Library Interface
+// libusbcnet is everything usb-c-net runs on except its command line
+// front end: the raw communication stack (usb_raw_comm.h), its threaded
+// runtime (usb_raw_runtime.h) and the libusb device layer
+// (usb_net_core.h). Applications link it, shared or static, and drive
+// the transport in-process instead of talking to a usb-c-net process.
+// The headers build as C and C++; usbcnet.hpp adds thin RAII wrappers.
+//
+// The shared library exports raw_comm_*, raw_runtime_*, usb_net_*,
+// usb_log_* and the usb_stats_t helpers (src/usbcnet.map). The other
+// headers it installs come along for the types these use.
+//
+// Contexts and devices are allocated by the caller, so the layout of
+// raw_comm_ctx_t, raw_runtime_t and usb_net_device_t is part of the ABI:
+// a change to one, or to a function signature, goes with a new
+// USBCNET_VERSION_MAJOR and so a new SONAME. Minor versions only add.
+
+#ifndef USBCNET_H
+#define USBCNET_H
+
+#include "usb_net_core.h"
+#include "usb_raw_comm.h"
+#include "usb_raw_runtime.h"
+#include "usb_log.h"
+
+// CMakeLists.txt takes the library version from these
+#define USBCNET_VERSION_MAJOR 0
+#define USBCNET_VERSION_MINOR 1
+#define USBCNET_VERSION_PATCH 0
+
+#endif // USBCNET_H
@@ -0,0 +1,214 @@
+// USB-C Software Network - C++ Interface
+// Thin RAII wrappers over the C API in usbcnet.h for the C++ protocol
+// layer: each class owns one C object, cleans it up in its destructor,
+// can be moved but not copied, and takes buffers as std::span. Methods
+// return what the C function they wrap returns (-1 on error, with the
+// reason logged); only constructors, which cannot, throw
+// std::runtime_error. get() hands out the C object for everything the
+// wrappers leave out.
+//
+// The C objects live on the heap, so moving a wrapper never moves the
+// context a runtime or another thread is using. A Runtime must be
+// destroyed before the RawContext it runs.
+
+#ifndef USBCNET_HPP
+#define USBCNET_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <stdexcept>
+#include <utility>
+#include "usbcnet.h"
+
+namespace usbcnet {
+
+// Raw communication context (usb_raw_comm.h), driven by the caller's
+// thread through poll() or handed to a Runtime
+class RawContext {
+public:
+    // raw_comm_init(); typec_port_path may be nullptr
+    explicit RawContext(const char *typec_port_path = nullptr) : ctx_(new raw_comm_ctx_t{}) {
+        if (raw_comm_init(ctx_.get(), typec_port_path) < 0) {
+            ctx_.reset();
+            throw std::runtime_error("raw_comm_init failed");
+        }
+    }
+
+    // Two contexts joined in this process by a shared memory ring
+    static std::pair<RawContext, RawContext> pair() {
+        RawContext a{Uninit{}}, b{Uninit{}};
+        if (raw_comm_init_pair(a.ctx_.get(), b.ctx_.get()) < 0) {
+            a.discard();
+            b.discard();
+            throw std::runtime_error("raw_comm_init_pair failed");
+        }
+        return {std::move(a), std::move(b)};
+    }
+
+    // Two contexts joined by a simulated link, e.g. "rate=480M,delay=100us"
+    static std::pair<RawContext, RawContext> sim_pair(const char *link) {
+        RawContext a{Uninit{}}, b{Uninit{}};
+        if (raw_comm_init_sim_pair(a.ctx_.get(), b.ctx_.get(), link) < 0) {
+            a.discard();
+            b.discard();
+            throw std::runtime_error("raw_comm_init_sim_pair failed");
+        }
+        return {std::move(a), std::move(b)};
+    }
+
+    RawContext(RawContext &&) noexcept = default;
+    RawContext &operator=(RawContext &&) noexcept = default;
+
+    raw_comm_ctx_t *get() const noexcept { return ctx_.get(); }
+
+    int set_transport(const char *name, const char *arg = nullptr) {
+        return raw_comm_set_transport(get(), name, arg);
+    }
+    int set_window(int window) { return raw_comm_set_window(get(), window); }
+    int set_checksum(const char *name) { return raw_comm_set_checksum(get(), name); }
+    int set_compression(const char *names) { return raw_comm_set_compression(get(), names); }
+    int set_mtu(std::size_t mtu) { return raw_comm_set_mtu(get(), mtu); }
+    int set_keepalive(int min_ms) { return raw_comm_set_keepalive(get(), min_ms); }
+    int set_batching(int delay_us, std::size_t flush_bytes = 0) {
+        return raw_comm_set_batching(get(), delay_us, flush_bytes);
+    }
+
+    int listen() { return raw_comm_listen(get()); }
+    int connect(std::uint32_t peer_id) { return raw_comm_connect(get(), peer_id); }
+    int poll(int timeout_ms) { return raw_comm_poll(get(), timeout_ms); }
+    int flush() { return raw_comm_flush(get()); }
+    int fd() { return raw_comm_get_fd(get()); }
+
+    int send(std::span<const std::uint8_t> data, std::uint32_t peer_id = 0) {
+        return raw_comm_send_to(get(), peer_id, data.data(), data.size());
+    }
+    int send(std::uint8_t channel, std::span<const std::uint8_t> data, std::uint32_t peer_id = 0) {
+        return raw_comm_send_channel(get(), peer_id, channel, data.data(), data.size());
+    }
+    // Non-blocking, peer_id may be nullptr
+    int recv(std::span<std::uint8_t> buffer, std::uint32_t *peer_id = nullptr) {
+        return raw_comm_recv_from(get(), buffer.data(), buffer.size(), peer_id);
+    }
+
+    raw_conn_state_t state() { return raw_comm_get_state(get()); }
+    std::uint32_t peer_id() { return raw_comm_get_peer_id(get()); }
+    std::size_t max_payload() { return raw_comm_max_payload(get()); }
+    // usb_stats_t holds atomics, so it is filled in rather than returned
+    void stats(usb_stats_t &out) { raw_comm_get_stats(get(), &out); }
+
+private:
+    struct Cleanup {
+        void operator()(raw_comm_ctx_t *ctx) const noexcept {
+            raw_comm_cleanup(ctx);
+            delete ctx;
+        }
+    };
+
+    // For the pair factories, which initialize both contexts at once and
+    // clean them up themselves if that fails
+    struct Uninit {};
+    explicit RawContext(Uninit) : ctx_(new raw_comm_ctx_t{}) {}
+    void discard() noexcept { delete ctx_.release(); }
+
+    std::unique_ptr<raw_comm_ctx_t, Cleanup> ctx_;
+};
+
+// Threaded runtime (usb_raw_runtime.h): takes the context over for its
+// lifetime, send() from any thread, recv() from one
+class Runtime {
+public:
+    explicit Runtime(RawContext &ctx, const raw_runtime_opts_t *opts = nullptr)
+        : rt_(new raw_runtime_t{}) {
+        // raw_runtime_start() cleans up after itself when it fails
+        if (raw_runtime_start(rt_.get(), ctx.get(), opts) < 0) {
+            delete rt_.release();
+            throw std::runtime_error("raw_runtime_start failed");
+        }
+    }
+
+    Runtime(Runtime &&) noexcept = default;
+    Runtime &operator=(Runtime &&) noexcept = default;
+
+    raw_runtime_t *get() const noexcept { return rt_.get(); }
+
+    // Waits up to timeout_ms (-1 = forever) for queue space
+    int send(std::span<const std::uint8_t> data, std::uint32_t peer_id = 0, int timeout_ms = -1) {
+        return raw_runtime_send(get(), peer_id, data.data(), data.size(), timeout_ms);
+    }
+    int send(std::uint8_t channel, std::span<const std::uint8_t> data, std::uint32_t peer_id = 0,
+             int timeout_ms = -1) {
+        return raw_runtime_send_channel(get(), peer_id, channel, data.data(), data.size(),
+                                        timeout_ms);
+    }
+    // Waits up to timeout_ms (-1 = forever); peer_id and channel may be nullptr
+    int recv(std::span<std::uint8_t> buffer, std::uint32_t *peer_id = nullptr, int timeout_ms = -1,
+             std::uint8_t *channel = nullptr) {
+        return raw_runtime_recv_channel(get(), buffer.data(), buffer.size(), peer_id, channel,
+                                        timeout_ms);
+    }
+
+    raw_conn_state_t state() { return raw_runtime_get_state(get()); }
+    std::uint32_t peer_id() { return raw_runtime_get_peer_id(get()); }
+
+private:
+    struct Stop {
+        void operator()(raw_runtime_t *rt) const noexcept {
+            raw_runtime_stop(rt);
+            delete rt;
+        }
+    };
+
+    std::unique_ptr<raw_runtime_t, Stop> rt_;
+};
+
+// libusb device layer (usb_net_core.h)
+class Device {
+public:
+    // usb_net_init(), then usb_net_load_config() if config_path is given
+    explicit Device(const char *config_path = nullptr) : dev_(new usb_net_device_t{}) {
+        if (usb_net_init(dev_.get()) < 0) {
+            delete dev_.release();
+            throw std::runtime_error("usb_net_init failed");
+        }
+        if (config_path && usb_net_load_config(dev_.get(), config_path) < 0) {
+            dev_.reset();
+            throw std::runtime_error("usb_net_load_config failed");
+        }
+    }
+
+    Device(Device &&) noexcept = default;
+    Device &operator=(Device &&) noexcept = default;
+
+    usb_net_device_t *get() const noexcept { return dev_.get(); }
+
+    int open(std::uint16_t vendor_id, std::uint16_t product_id) {
+        return usb_net_open_device(get(), vendor_id, product_id);
+    }
+    int wait_for_peer(const char *what = "peer") { return usb_net_wait_for_peer(get(), what); }
+
+    int send(std::span<const std::uint8_t> data) {
+        return usb_net_send(get(), data.data(), static_cast<int>(data.size()));
+    }
+    int recv(std::span<std::uint8_t> buffer) {
+        return usb_net_recv(get(), buffer.data(), static_cast<int>(buffer.size()));
+    }
+
+    // usb_stats_t holds atomics, so it is filled in rather than returned
+    void stats(usb_stats_t &out) { usb_net_get_stats(get(), &out); }
+
+private:
+    struct Cleanup {
+        void operator()(usb_net_device_t *dev) const noexcept {
+            usb_net_cleanup(dev);
+            delete dev;
+        }
+    };
+
+    std::unique_ptr<usb_net_device_t, Cleanup> dev_;
+};
+
+} // namespace usbcnet
+
+#endif // USBCNET_HPP
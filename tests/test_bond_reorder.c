@@ -0,0 +1,135 @@
+// Bond reorder buffer: in-order frames, a gap held and filled, a gap
+// given up on after reorder_ms, a jump too far ahead to hold, and the
+// peer restarting its numbering
+
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "usb_bond.h"
+#include "test_util.h"
+
+static usb_bond_t bond;
+static int tun_peer;
+
+static void input(uint32_t seq) {
+    uint8_t frame[8];
+    memcpy(frame, &seq, sizeof(seq));
+    memset(frame + 4, (int)(seq & 0xFF), 4);
+    usb_bond_reorder_input(&bond, seq, frame, sizeof(frame));
+}
+
+// Frames written to the interface since the last call match want
+static bool delivered(const uint32_t *want, int count) {
+    bool ok = true;
+    int n = 0;
+    uint8_t frame[16];
+    ssize_t len;
+    while ((len = recv(tun_peer, frame, sizeof(frame), MSG_DONTWAIT)) > 0) {
+        uint32_t seq;
+        memcpy(&seq, frame, sizeof(seq));
+        if (len != 8 || n >= count || seq != want[n]) ok = false;
+        n++;
+    }
+    if (n != count) fprintf(stderr, "%d frames delivered, expected %d\n", n, count);
+    return ok && n == count;
+}
+
+#define DELIVERED(...) delivered((const uint32_t[]){ __VA_ARGS__ }, \
+                                 (int)(sizeof((const uint32_t[]){ __VA_ARGS__ }) / sizeof(uint32_t)))
+#define NOTHING_DELIVERED() delivered(NULL, 0)
+
+static void drain(void) {
+    uint8_t frame[16];
+    while (recv(tun_peer, frame, sizeof(frame), MSG_DONTWAIT) > 0) {
+    }
+}
+
+static void sleep_ms(int ms) {
+    struct timespec ts = { 0, ms * 1000000L };
+    nanosleep(&ts, NULL);
+}
+
+int main(void) {
+    int fds[2];
+    CHECK(socketpair(AF_UNIX, SOCK_DGRAM, 0, fds) == 0);
+    bond.tun.fd = fds[0];
+    tun_peer = fds[1];
+    bond.reorder_ms = 20;
+    CHECK(usb_pool_init(&bond.pending_pool, 64, 16, 0) == 0);
+
+    // The first frame sets next_seq
+    for (uint32_t seq = 100; seq < 105; seq++) input(seq);
+    CHECK(DELIVERED(100, 101, 102, 103, 104));
+    CHECK(bond.next_seq == 105 && bond.rx_frames == 5);
+
+    // Held behind a gap until it fills
+    input(107);
+    input(106);
+    CHECK(NOTHING_DELIVERED());
+    CHECK(bond.pending_count == 2 && bond.reordered == 2);
+    usb_bond_reorder_expire(&bond);  // Not held long enough yet
+    CHECK(NOTHING_DELIVERED());
+    input(105);
+    CHECK(DELIVERED(105, 106, 107));
+    CHECK(bond.pending_count == 0 && bond.next_seq == 108);
+
+    // A gap not filled in time is skipped, and its frame is late after
+    input(110);
+    input(109);
+    input(110);  // Duplicate
+    CHECK(bond.late == 1);
+    sleep_ms(bond.reorder_ms + 5);
+    usb_bond_reorder_expire(&bond);
+    CHECK(DELIVERED(109, 110));
+    CHECK(bond.lost == 1 && bond.next_seq == 111);
+    input(108);
+    CHECK(NOTHING_DELIVERED());
+    CHECK(bond.late == 2);
+
+    // Too far ahead to hold: the held frames are released and the gaps
+    // before them and before the new frame are given up on
+    input(113);
+    input(111 + USB_BOND_REORDER_MAX + 50);
+    CHECK(DELIVERED(113, 111 + USB_BOND_REORDER_MAX + 50));
+    CHECK(bond.pending_count == 0);
+    CHECK(bond.lost == 1 + 2 + (USB_BOND_REORDER_MAX + 50 - 3));
+    CHECK(bond.next_seq == 112 + USB_BOND_REORDER_MAX + 50);
+
+    // A restart further back than the ring resynchronises by itself, and
+    // drops what was held for the old numbering
+    uint32_t next = bond.next_seq;
+    input(next + 2);
+    input(5);
+    input(6);
+    CHECK(DELIVERED(5, 6));
+    CHECK(bond.pending_count == 0 && bond.next_seq == 7);
+
+    // Less than the ring back looks like late frames...
+    unsigned long frames = bond.rx_frames;
+    for (uint32_t seq = 7; seq < 50; seq++) input(seq);
+    CHECK(bond.next_seq == 50 && bond.rx_frames == frames + 43);
+    drain();
+    unsigned long late = bond.late;
+    input(0);
+    input(1);
+    CHECK(NOTHING_DELIVERED());
+    CHECK(bond.late == late + 2);
+
+    // ... so the reconnect resets the state, held frames included
+    input(52);
+    CHECK(bond.pending_count == 1);
+    usb_bond_reorder_reset(&bond);
+    CHECK(bond.pending_count == 0 && !bond.synced);
+    input(0);
+    input(1);
+    input(2);
+    CHECK(DELIVERED(0, 1, 2));
+    CHECK(bond.next_seq == 3);
+
+    usb_bond_reorder_reset(&bond);
+    usb_pool_destroy(&bond.pending_pool);
+    close(fds[0]);
+    close(fds[1]);
+    TEST_DONE();
+}
@@ -0,0 +1,118 @@
+// LZ4 block round trips over compressible, incompressible and edge-size
+// inputs, decoding of hand-built blocks, and rejection of malformed and
+// oversized ones
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "usb_compress.h"
+#include "test_util.h"
+
+#define MAX_INPUT 70000
+
+static uint8_t input[MAX_INPUT];
+static uint8_t packed[MAX_INPUT + MAX_INPUT / 255 + 16];
+static uint8_t output[MAX_INPUT];
+
+// Compress and decompress len bytes of input; returns the compressed size
+static size_t round_trip(size_t len, const char *what) {
+    size_t clen = usb_compress(USB_CODEC_LZ4, input, len, packed, sizeof(packed));
+    if (len > 0 && clen == 0) {
+        fprintf(stderr, "%s (%zu bytes): compression failed\n", what, len);
+        test_failures++;
+        return 0;
+    }
+
+    int dlen = usb_decompress(USB_CODEC_LZ4, packed, clen, output, len);
+    if (dlen != (int)len || memcmp(output, input, len) != 0) {
+        fprintf(stderr, "%s (%zu bytes): round trip gave %d bytes\n", what, len, dlen);
+        test_failures++;
+    }
+
+    // One byte less room than the original takes must be refused
+    if (len > 0) {
+        CHECK(usb_decompress(USB_CODEC_LZ4, packed, clen, output, len - 1) == -1);
+    }
+    return clen;
+}
+
+static void fill_random(size_t len, uint32_t seed) {
+    for (size_t i = 0; i < len; i++) {
+        seed = seed * 1664525u + 1013904223u;
+        input[i] = (uint8_t)(seed >> 24);
+    }
+}
+
+int main(void) {
+    // Compressible: runs, a repeating short pattern, text-like data
+    memset(input, 0, MAX_INPUT);
+    CHECK(round_trip(MAX_INPUT, "zeros") < MAX_INPUT / 100);
+    for (size_t i = 0; i < MAX_INPUT; i++) input[i] = (uint8_t)("abc"[i % 3]);
+    CHECK(round_trip(MAX_INPUT, "abc pattern") < MAX_INPUT / 100);
+    static const char words[] = "the quick brown fox jumps over the lazy dog ";
+    for (size_t i = 0; i < MAX_INPUT; i++) input[i] = (uint8_t)words[(i * 7 / 5) % (sizeof(words) - 1)];
+    CHECK(round_trip(MAX_INPUT, "text") < MAX_INPUT / 2);
+
+    // Incompressible, and every short length around the match limits
+    fill_random(MAX_INPUT, 1);
+    round_trip(MAX_INPUT, "random");
+    CHECK(usb_compress(USB_CODEC_LZ4, input, 4096, packed, 4095) == 0);
+    for (size_t len = 0; len <= 40; len++) {
+        fill_random(len, (uint32_t)len);
+        round_trip(len, "short random");
+        memset(input, 'x', len);
+        round_trip(len, "short run");
+    }
+
+    // Hand-built blocks: literals only, and an overlapping match
+    static const uint8_t lit_only[] = { 0x50, 'h', 'e', 'l', 'l', 'o' };
+    CHECK(usb_decompress(USB_CODEC_LZ4, lit_only, sizeof(lit_only), output, 5) == 5);
+    CHECK(memcmp(output, "hello", 5) == 0);
+    static const uint8_t overlap[] = { 0x35, 'a', 'b', 'c', 0x03, 0x00, 0x10, 'z' };
+    CHECK(usb_decompress(USB_CODEC_LZ4, overlap, sizeof(overlap), output, sizeof(output)) == 13);
+    CHECK(memcmp(output, "abcabcabcabcz", 13) == 0);
+
+    // Malformed blocks
+    static const uint8_t empty[] = { 0 };
+    CHECK(usb_decompress(USB_CODEC_LZ4, empty, 0, output, sizeof(output)) == -1);
+    static const uint8_t lit_past_end[] = { 0x50, 'h', 'e' };
+    CHECK(usb_decompress(USB_CODEC_LZ4, lit_past_end, sizeof(lit_past_end), output, sizeof(output)) == -1);
+    static const uint8_t offset_zero[] = { 0x10, 'a', 0x00, 0x00 };
+    CHECK(usb_decompress(USB_CODEC_LZ4, offset_zero, sizeof(offset_zero), output, sizeof(output)) == -1);
+    static const uint8_t offset_before_start[] = { 0x10, 'a', 0x02, 0x00 };
+    CHECK(usb_decompress(USB_CODEC_LZ4, offset_before_start, sizeof(offset_before_start),
+                         output, sizeof(output)) == -1);
+    static const uint8_t truncated_offset[] = { 0x10, 'a', 0x01 };
+    CHECK(usb_decompress(USB_CODEC_LZ4, truncated_offset, sizeof(truncated_offset),
+                         output, sizeof(output)) == -1);
+    static const uint8_t unterminated_length[] = { 0xF0, 0xFF, 0xFF };
+    CHECK(usb_decompress(USB_CODEC_LZ4, unterminated_length, sizeof(unterminated_length),
+                         output, sizeof(output)) == -1);
+    static const uint8_t match_too_long[] = { 0x1F, 'a', 0x01, 0x00, 0xFF, 0xFF, 0x00 };
+    CHECK(usb_decompress(USB_CODEC_LZ4, match_too_long, sizeof(match_too_long), output, 100) == -1);
+
+    // Every truncation of a valid block fails cleanly or decodes a prefix,
+    // never more than the original
+    fill_random(2048, 7);
+    for (size_t i = 0; i < 2048; i++) input[i] = (uint8_t)(input[i] & 0x0F);
+    size_t clen = usb_compress(USB_CODEC_LZ4, input, 2048, packed, sizeof(packed));
+    CHECK(clen > 0);
+    for (size_t cut = 0; cut < clen; cut++) {
+        int n = usb_decompress(USB_CODEC_LZ4, packed, cut, output, 2048);
+        CHECK(n <= 2048);
+        if (n > 0) CHECK(memcmp(output, input, (size_t)n) == 0);
+    }
+
+    // Codec lists
+    uint32_t codecs = 0xFF;
+    char names[32];
+    CHECK(usb_codec_parse_list("none", &codecs) == 0 && codecs == 0);
+    CHECK(usb_codec_parse_list("lz4", &codecs) == 0 && codecs == USB_CODEC_BIT(USB_CODEC_LZ4));
+    CHECK(usb_codec_parse_list("lz4,zstd", &codecs) == -1);
+    usb_codec_format_list(USB_CODEC_BIT(USB_CODEC_LZ4), names, sizeof(names));
+    CHECK(strcmp(names, "lz4") == 0);
+    usb_codec_format_list(0, names, sizeof(names));
+    CHECK(strcmp(names, "none") == 0);
+
+    TEST_DONE();
+}
@@ -0,0 +1,126 @@
+// C++ wrapper (usbcnet.hpp) against the shared library: a shared memory
+// pair driven by poll(), a simulated link under two Runtimes, and the
+// constructors throwing on failure
+
+#include <chrono>
+#include <cstring>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include "usbcnet.hpp"
+#include "test_util.h"
+
+static_assert(!std::is_copy_constructible_v<usbcnet::RawContext>);
+static_assert(std::is_nothrow_move_constructible_v<usbcnet::RawContext>);
+static_assert(std::is_nothrow_move_constructible_v<usbcnet::Runtime>);
+static_assert(std::is_nothrow_move_constructible_v<usbcnet::Device>);
+
+static bool connected(usbcnet::RawContext &a, usbcnet::RawContext &b) {
+    return a.state() == RAW_STATE_CONNECTED && b.state() == RAW_STATE_CONNECTED;
+}
+
+static void test_pair() {
+    auto [a, b] = usbcnet::RawContext::pair();
+    CHECK(a.listen() == 0 && b.listen() == 0);
+    for (int i = 0; i < 1000 && !connected(a, b); i++) {
+        a.poll(2);
+        b.poll(2);
+    }
+    CHECK(connected(a, b));
+
+    // Moving the wrapper leaves the context where it was
+    raw_comm_ctx_t *ctx = a.get();
+    usbcnet::RawContext moved = std::move(a);
+    CHECK(moved.get() == ctx);
+
+    static const std::uint8_t msg[] = "hello over the ring";
+    CHECK(moved.send(msg) == (int)sizeof(msg));
+    std::vector<std::uint8_t> buf(moved.max_payload());
+    std::uint32_t from = 0;
+    int n = 0;
+    for (int i = 0; i < 1000 && n <= 0; i++) {
+        b.poll(2);
+        moved.poll(0);
+        n = b.recv(buf, &from);
+    }
+    CHECK(n == (int)sizeof(msg) && std::memcmp(buf.data(), msg, sizeof(msg)) == 0);
+    CHECK(from == moved.peer_id() || from == b.peer_id());
+
+    usb_stats_t stats;
+    b.stats(stats);
+    CHECK(usb_stat_read(&stats.rx_packets) >= 1);
+}
+
+static void test_runtime() {
+    auto [a, b] = usbcnet::RawContext::sim_pair("rate=100M,delay=100us");
+    CHECK(a.set_window(16) == 0 && b.set_window(16) == 0);
+    CHECK(a.listen() == 0 && b.listen() == 0);
+
+    const int channels = 4;
+    raw_runtime_opts_t opts;
+    raw_runtime_opts_init(&opts);
+    for (int ch = 0; ch < channels; ch++) opts.channels[ch].weight = 1;
+    usbcnet::Runtime ra(a, &opts), rb(b, &opts);
+    for (int i = 0; i < 1000 && (ra.state() != RAW_STATE_CONNECTED ||
+                                 rb.state() != RAW_STATE_CONNECTED); i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    }
+    CHECK(ra.state() == RAW_STATE_CONNECTED && rb.state() == RAW_STATE_CONNECTED);
+
+    const int count = 500;
+    const std::size_t payload = 512;
+    std::thread tx([&] {
+        std::vector<std::uint8_t> msg(payload);
+        for (int i = 0; i < count; i++) {
+            msg[0] = (std::uint8_t)i;
+            if (ra.send(std::uint8_t(i % channels), msg, 0, 2000) < 0) break;
+        }
+    });
+
+    // Channels are scheduled against each other, so only the payloads of
+    // each one arrive in the order they were sent
+    std::vector<std::uint8_t> buf(payload);
+    int next[channels] = { 0, 1, 2, 3 };
+    int got = 0;
+    for (; got < count; got++) {
+        std::uint8_t channel = 0xFF;
+        int n = rb.recv(buf, nullptr, 2000, &channel);
+        if (n != (int)payload || channel >= channels || buf[0] != (std::uint8_t)next[channel]) break;
+        next[channel] += channels;
+    }
+    tx.join();
+    CHECK(got == count);
+}
+
+static void test_errors() {
+    bool thrown = false;
+    try {
+        auto p = usbcnet::RawContext::sim_pair("rate=bogus");
+    } catch (const std::runtime_error &) {
+        thrown = true;
+    }
+    CHECK(thrown);
+
+    // Needs libusb to initialize, which a build machine may not allow
+    try {
+        usbcnet::Device device;
+    } catch (const std::runtime_error &) {
+        std::printf("usb_net_init failed, skipping the Device checks\n");
+        return;
+    }
+
+    thrown = false;
+    try {
+        usbcnet::Device device("/nonexistent/usbcnet-test.env");
+    } catch (const std::runtime_error &) {
+        thrown = true;
+    }
+    CHECK(thrown);
+}
+
+int main() {
+    test_pair();
+    test_runtime();
+    test_errors();
+    TEST_DONE();
+}
@@ -0,0 +1,132 @@
+// Buffer pools: the buffer limit, thread caches flushed back when their
+// thread exits, and a pool destroyed and set up again at the same address
+// while another thread still caches buffers of the old one
+
+#include <pthread.h>
+#include <string.h>
+#include "usb_pool.h"
+#include "test_util.h"
+
+#define LIMIT 64
+
+static usb_pool_t pool;
+static pthread_barrier_t step;
+
+static bool in_pool(usb_pool_t *p, void *buf) {
+    for (usb_pool_slab_t *slab = p->slabs; slab; slab = slab->next) {
+        uint8_t *mem = slab->mem;
+        if ((uint8_t *)buf >= mem && (uint8_t *)buf < mem + slab->bytes) return true;
+    }
+    return false;
+}
+
+// Take every buffer the pool allows, check they are its own and distinct,
+// and give them back
+static int drain_pool(usb_pool_t *p) {
+    void *bufs[LIMIT + 1];
+    int n = 0;
+    while (n <= LIMIT && (bufs[n] = usb_pool_get(p)) != NULL) {
+        CHECK(in_pool(p, bufs[n]));
+        memset(bufs[n], 0xA5, p->buf_size);
+        n++;
+    }
+    for (int i = 0; i < n; i++) {
+        for (int j = i + 1; j < n; j++) CHECK(bufs[i] != bufs[j]);
+        usb_pool_put(p, bufs[i]);
+    }
+    return n;
+}
+
+static void test_limit(void) {
+    usb_pool_t p;
+    CHECK(usb_pool_init(&p, 0, 4, 0) == -1);
+    CHECK(usb_pool_init(&p, 100, 8, LIMIT) == 0);
+    CHECK(p.buf_size == 128 && p.total == 0);
+
+    CHECK(drain_pool(&p) == LIMIT);
+    CHECK(p.total == LIMIT);
+    CHECK(drain_pool(&p) == LIMIT);  // Again, now from the cache and the list
+    CHECK(p.total == LIMIT);
+    usb_pool_destroy(&p);
+    usb_pool_destroy(&p);  // Already destroyed: left alone
+}
+
+// Takes and returns more buffers than its cache keeps, then exits
+static void *churn_main(void *arg) {
+    void *bufs[48];
+    (void)arg;
+    for (int i = 0; i < 48; i++) bufs[i] = usb_pool_get(&pool);
+    for (int i = 0; i < 48; i++) usb_pool_put(&pool, bufs[i]);
+    return NULL;
+}
+
+static void test_thread_exit(void) {
+    CHECK(usb_pool_init(&pool, 256, 16, LIMIT) == 0);
+
+    // The whole limit is available again only if the exited thread's
+    // cached buffers went back to the pool
+    pthread_t thread;
+    CHECK(pthread_create(&thread, NULL, churn_main, NULL) == 0);
+    pthread_join(thread, NULL);
+    CHECK(pool.total == 48);
+    CHECK(drain_pool(&pool) == LIMIT);
+    usb_pool_destroy(&pool);
+}
+
+// Caches buffers of the first pool, then uses the one set up in its
+// place, then exits while caching buffers of that one
+static void *stale_main(void *arg) {
+    void *bufs[8];
+    (void)arg;
+    for (int i = 0; i < 8; i++) bufs[i] = usb_pool_get(&pool);
+    for (int i = 0; i < 8; i++) usb_pool_put(&pool, bufs[i]);
+    pthread_barrier_wait(&step);  // Cache holds buffers of pool #1
+
+    pthread_barrier_wait(&step);  // Pool #1 destroyed, #2 at the same address
+    for (int i = 0; i < 8; i++) {
+        bufs[i] = usb_pool_get(&pool);
+        CHECK(bufs[i] && in_pool(&pool, bufs[i]));
+        if (bufs[i]) memset(bufs[i], 0x5A, pool.buf_size);
+    }
+    for (int i = 0; i < 8; i++) usb_pool_put(&pool, bufs[i]);
+    pthread_barrier_wait(&step);
+
+    pthread_barrier_wait(&step);  // Pool #2 destroyed, #3 at the same address
+    return NULL;
+}
+
+static void test_same_address(void) {
+    pthread_barrier_init(&step, NULL, 2);
+    CHECK(usb_pool_init(&pool, 256, 16, LIMIT) == 0);
+    uint64_t first_id = pool.id;
+
+    pthread_t thread;
+    CHECK(pthread_create(&thread, NULL, stale_main, NULL) == 0);
+    pthread_barrier_wait(&step);
+
+    // The thread's cache entries now name this address with the old id;
+    // it must not hand out buffers of the unmapped slabs
+    usb_pool_destroy(&pool);
+    CHECK(usb_pool_init(&pool, 256, 16, LIMIT) == 0);
+    CHECK(pool.id != first_id);
+    pthread_barrier_wait(&step);
+    pthread_barrier_wait(&step);
+
+    // Exiting, it must not flush the buffers of #2 into #3
+    usb_pool_destroy(&pool);
+    CHECK(usb_pool_init(&pool, 256, 16, LIMIT) == 0);
+    pthread_barrier_wait(&step);
+    pthread_join(thread, NULL);
+    CHECK(pool.free_list == NULL && pool.free_count == 0);
+    CHECK(drain_pool(&pool) == LIMIT);
+
+    usb_pool_destroy(&pool);
+    pthread_barrier_destroy(&step);
+}
+
+int main(void) {
+    test_limit();
+    test_thread_exit();
+    test_same_address();
+    TEST_DONE();
+}
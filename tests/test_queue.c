@@ -0,0 +1,137 @@
+// MPSC message queue: full and empty edges, aborted reservations, the
+// data_fd wakeup, and several producers racing one consumer without
+// losing, duplicating or reordering any producer's messages
+
+#include <poll.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include "usb_queue.h"
+#include "test_util.h"
+
+#define PRODUCERS 4
+#define PER_PRODUCER 200000
+#define ABORT_EVERY 7            // Every n-th reservation of a producer is aborted
+
+typedef struct {
+    uint32_t producer;
+    uint32_t seq;
+} stress_msg_t;
+
+static usb_queue_t stress_q;
+
+static bool readable(int fd) {
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    return poll(&pfd, 1, 0) == 1;
+}
+
+static void test_edges(void) {
+    usb_queue_t q;
+    CHECK(usb_queue_init(&q, 0, 16) == -1);
+    CHECK(usb_queue_init(&q, USB_QUEUE_DEPTH_MAX + 1, 16) == -1);
+    CHECK(usb_queue_init(&q, 5, 16) == 0);
+    CHECK(usb_queue_depth(&q) == 8);
+
+    CHECK(usb_queue_peek(&q) == NULL && !readable(q.data_fd));
+    CHECK(usb_queue_wait_data(&q, 0, -1) == 0);
+
+    // Fill it, one reservation aborted along the way
+    for (int i = 0; i < 8; i++) {
+        usb_queue_slot_t *slot = usb_queue_reserve(&q);
+        CHECK(slot != NULL);
+        if (!slot) return;
+        if (i == 3) {
+            usb_queue_abort(&q, slot);
+            continue;
+        }
+        slot->data[0] = (uint8_t)i;
+        slot->len = 1;
+        usb_queue_commit(&q, slot);
+    }
+    CHECK(usb_queue_reserve(&q) == NULL);
+    CHECK(usb_queue_wait_space(&q, 0, -1) == 0);
+    CHECK(readable(q.data_fd));
+
+    // The aborted slot is skipped, and frees its place like the others
+    for (int i = 0; i < 8; i++) {
+        if (i == 3) continue;
+        usb_queue_slot_t *slot = usb_queue_peek(&q);
+        CHECK(slot && slot->len == 1 && slot->data[0] == i);
+        if (slot) usb_queue_release(&q, slot);
+        CHECK(usb_queue_wait_space(&q, 0, -1) == 1);
+    }
+    CHECK(usb_queue_peek(&q) == NULL);
+    CHECK(usb_queue_count(&q) == 0 && !readable(q.data_fd));
+
+    // A readable stop fd ends a wait that would otherwise never return
+    int stop = eventfd(1, EFD_NONBLOCK);
+    CHECK(usb_queue_wait_data(&q, -1, stop) == -1);
+    close(stop);
+    usb_queue_free(&q);
+    usb_queue_free(&q);  // Zeroed again: left alone
+}
+
+static void *producer_main(void *arg) {
+    uint32_t id = (uint32_t)(uintptr_t)arg;
+    unsigned reservations = 0;
+
+    for (uint32_t seq = 0; seq < PER_PRODUCER; ) {
+        usb_queue_slot_t *slot = usb_queue_reserve(&stress_q);
+        if (!slot) {
+            usb_queue_wait_space(&stress_q, -1, -1);
+            continue;
+        }
+        if (++reservations % ABORT_EVERY == 0) {
+            usb_queue_abort(&stress_q, slot);
+            continue;
+        }
+        stress_msg_t msg = { id, seq++ };
+        memcpy(slot->data, &msg, sizeof(msg));
+        slot->len = sizeof(msg);
+        slot->peer_id = id;
+        usb_queue_commit(&stress_q, slot);
+    }
+    return NULL;
+}
+
+static void test_stress(void) {
+    CHECK(usb_queue_init(&stress_q, 64, sizeof(stress_msg_t)) == 0);
+
+    pthread_t threads[PRODUCERS];
+    for (uintptr_t i = 0; i < PRODUCERS; i++) {
+        CHECK(pthread_create(&threads[i], NULL, producer_main, (void *)i) == 0);
+    }
+
+    // Sleeping on data_fd as well as spinning through a busy queue
+    uint32_t next[PRODUCERS] = { 0 };
+    bool ok = true;
+    for (long got = 0; got < (long)PRODUCERS * PER_PRODUCER && ok; got++) {
+        if (usb_queue_wait_data(&stress_q, 5000, -1) != 1) {
+            ok = false;
+            break;
+        }
+        usb_queue_slot_t *slot = usb_queue_peek(&stress_q);
+        stress_msg_t msg;
+        memcpy(&msg, slot->data, sizeof(msg));
+        ok = slot->len == sizeof(msg) && msg.producer < PRODUCERS &&
+             slot->peer_id == msg.producer && msg.seq == next[msg.producer];
+        if (ok) next[msg.producer]++;
+        usb_queue_release(&stress_q, slot);
+    }
+    CHECK(ok);
+
+    for (int i = 0; i < PRODUCERS; i++) {
+        pthread_join(threads[i], NULL);
+        CHECK(next[i] == PER_PRODUCER);
+    }
+    CHECK(usb_queue_peek(&stress_q) == NULL);
+    CHECK(usb_queue_count(&stress_q) == 0 && !readable(stress_q.data_fd));
+    usb_queue_free(&stress_q);
+}
+
+int main(void) {
+    test_edges();
+    test_stress();
+    TEST_DONE();
+}
@@ -0,0 +1,177 @@
+// Capability TLVs: round trip, the defaults for what a peer leaves out,
+// unknown and short values, truncated blocks, long transport names and
+// output buffers that are too small
+
+#include <string.h>
+#include "usb_raw_caps.h"
+#include "usb_raw_comm.h"
+#include "test_util.h"
+
+static void full_caps(raw_caps_t *caps) {
+    raw_caps_init(caps);
+    caps->mtu = 0x12345678;
+    caps->window = 0xBEEF;
+    caps->csum = RAW_CSUM_NONE;
+    caps->codecs = 0x80000003;
+    caps->codecs_wanted = 0x00000002;
+    caps->batch_us = 250;
+    caps->ticket = 0xCAFEF00D;
+    caps->features = RAW_FEAT_KEEPALIVE | RAW_FEAT_BATCH;
+    strcpy(caps->transport, "vdm");
+}
+
+static bool caps_equal(const raw_caps_t *a, const raw_caps_t *b) {
+    return a->mtu == b->mtu && a->window == b->window && a->csum == b->csum &&
+           a->codecs == b->codecs && a->codecs_wanted == b->codecs_wanted &&
+           a->batch_us == b->batch_us && a->ticket == b->ticket &&
+           a->features == b->features && strcmp(a->transport, b->transport) == 0;
+}
+
+static void test_round_trip(void) {
+    raw_caps_t caps, got;
+    uint8_t buf[RAW_CAPS_MAX];
+
+    full_caps(&caps);
+    int len = raw_caps_encode(&caps, buf, sizeof(buf));
+    CHECK(len > 0 && len <= RAW_CAPS_MAX);
+    raw_caps_init(&got);
+    CHECK(raw_caps_decode(&got, buf, (size_t)len) == 0);
+    CHECK(caps_equal(&caps, &got));
+
+    // Little endian on the wire
+    CHECK(buf[0] == RAW_CAP_MTU && buf[1] == 4);
+    CHECK(buf[2] == 0x78 && buf[5] == 0x12);
+
+    // No transport: no TLV for it
+    caps.transport[0] = '\0';
+    int shorter = raw_caps_encode(&caps, buf, sizeof(buf));
+    CHECK(shorter == len - 2 - 3);
+
+    // An empty block keeps the defaults
+    raw_caps_t defaults;
+    raw_caps_init(&defaults);
+    raw_caps_init(&got);
+    CHECK(raw_caps_decode(&got, buf, 0) == 0);
+    CHECK(caps_equal(&got, &defaults));
+    CHECK(got.mtu == RAW_MTU_DEFAULT && got.csum == RAW_CSUM_CRC32C && got.window == 0);
+}
+
+static void test_unknown_and_short(void) {
+    raw_caps_t got, defaults;
+    raw_caps_init(&defaults);
+
+    // Unknown types are skipped whatever their length, known ones after
+    // them still apply
+    static const uint8_t unknown[] = {
+        0x7F, 0,
+        0xF0, 5, 1, 2, 3, 4, 5,
+        RAW_CAP_WINDOW, 2, 0x34, 0x12,
+        0x00, 1, 0xAA,
+        RAW_CAP_CHECKSUM, 1, RAW_CSUM_NONE,
+    };
+    raw_caps_init(&got);
+    CHECK(raw_caps_decode(&got, unknown, sizeof(unknown)) == 0);
+    CHECK(got.window == 0x1234 && got.csum == RAW_CSUM_NONE);
+    CHECK(got.mtu == defaults.mtu && got.ticket == 0);
+
+    // Values too short for their type are ignored; longer ones are read
+    // from the front (room to grow a type)
+    static const uint8_t short_values[] = {
+        RAW_CAP_MTU, 3, 1, 2, 3,
+        RAW_CAP_WINDOW, 1, 9,
+        RAW_CAP_CHECKSUM, 0,
+        RAW_CAP_CODECS, 7, 1, 0, 0, 0, 1, 0, 0,
+        RAW_CAP_BATCH, 0,
+        RAW_CAP_TICKET, 2, 1, 1,
+        RAW_CAP_FEATURES, 6, 3, 0, 0, 0, 0xFF, 0xFF,
+    };
+    raw_caps_init(&got);
+    CHECK(raw_caps_decode(&got, short_values, sizeof(short_values)) == 0);
+    CHECK(got.mtu == defaults.mtu && got.window == 0 && got.csum == defaults.csum);
+    CHECK(got.codecs == 0 && got.codecs_wanted == 0);
+    CHECK(got.batch_us == 0 && got.ticket == 0);
+    CHECK(got.features == 3);
+}
+
+static void test_truncated(void) {
+    raw_caps_t caps, got;
+    uint8_t buf[RAW_CAPS_MAX];
+
+    full_caps(&caps);
+    int len = raw_caps_encode(&caps, buf, sizeof(buf));
+
+    // Every cut inside a TLV fails, keeping what came before it
+    for (int cut = 1; cut < len; cut++) {
+        raw_caps_init(&got);
+        int ret = raw_caps_decode(&got, buf, (size_t)cut);
+        bool boundary = cut == 6 || cut == 10 || cut == 13 || cut == 23 || cut == 29 ||
+                        cut == 35 || cut == 41;
+        CHECK(ret == (boundary ? 0 : -1));
+        if (cut >= 6) CHECK(got.mtu == caps.mtu);
+        if (cut < 6) CHECK(got.mtu == RAW_MTU_DEFAULT);
+        if (cut < 41) CHECK(got.features == 0);
+    }
+
+    // A lone type byte, and a length past the end
+    static const uint8_t lone[] = { RAW_CAP_WINDOW, 2, 1, 0, RAW_CAP_MTU };
+    raw_caps_init(&got);
+    CHECK(raw_caps_decode(&got, lone, sizeof(lone)) == -1);
+    CHECK(got.window == 1);
+    static const uint8_t past[] = { RAW_CAP_MTU, 255, 1, 2, 3, 4 };
+    raw_caps_init(&got);
+    CHECK(raw_caps_decode(&got, past, sizeof(past)) == -1);
+    CHECK(got.mtu == RAW_MTU_DEFAULT);
+}
+
+static void test_transport_name(void) {
+    raw_caps_t caps, got;
+    uint8_t buf[RAW_CAPS_MAX + 255];
+
+    // A name filling the whole field has no NUL: 16 bytes go out, and the
+    // receiver keeps 15 and terminates them
+    full_caps(&caps);
+    memcpy(caps.transport, "0123456789abcdef", sizeof(caps.transport));
+    int len = raw_caps_encode(&caps, buf, sizeof(buf));
+    CHECK(len > 0 && buf[len - 18] == RAW_CAP_TRANSPORT && buf[len - 17] == 16);
+    raw_caps_init(&got);
+    CHECK(raw_caps_decode(&got, buf, (size_t)len) == 0);
+    CHECK(strcmp(got.transport, "0123456789abcde") == 0);
+
+    // The longest a TLV holds
+    buf[0] = RAW_CAP_TRANSPORT;
+    buf[1] = 255;
+    memset(buf + 2, 'x', 255);
+    raw_caps_init(&got);
+    CHECK(raw_caps_decode(&got, buf, 2 + 255) == 0);
+    CHECK(strlen(got.transport) == sizeof(got.transport) - 1);
+
+    // Empty on the wire clears it
+    buf[1] = 0;
+    CHECK(raw_caps_decode(&got, buf, 2) == 0);
+    CHECK(got.transport[0] == '\0');
+}
+
+static void test_encode_space(void) {
+    raw_caps_t caps;
+    uint8_t buf[RAW_CAPS_MAX];
+
+    full_caps(&caps);
+    memcpy(caps.transport, "0123456789abcdef", sizeof(caps.transport));
+    int len = raw_caps_encode(&caps, buf, sizeof(buf));
+    CHECK(len > 0 && len <= RAW_CAPS_MAX);
+
+    // One byte short anywhere fails as a whole, never a partial block
+    for (int outlen = 0; outlen < len; outlen++) {
+        CHECK(raw_caps_encode(&caps, buf, (size_t)outlen) == -1);
+    }
+    CHECK(raw_caps_encode(&caps, buf, (size_t)len) == len);
+}
+
+int main(void) {
+    test_round_trip();
+    test_unknown_and_short();
+    test_truncated();
+    test_transport_name();
+    test_encode_space();
+    TEST_DONE();
+}
@@ -0,0 +1,132 @@
+// Batch parser: delimiting by length, magic and version checked across a
+// whole batch (vector and scalar paths), truncation and checksums
+
+#include <string.h>
+#include "usb_raw_comm.h"
+#include "usb_raw_parse.h"
+#include "usb_crc32c.h"
+#include "test_util.h"
+
+#define HDR_LEN sizeof(raw_msg_header_t)
+
+static uint8_t buf[64 * 1024];
+
+// Append one message with a payload of len bytes, CRC32C-protected if csum
+static size_t put_msg(size_t off, uint32_t len, bool csum) {
+    raw_msg_header_t hdr;
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, RAW_MSG_MAGIC, 4);
+    hdr.version = RAW_PROTOCOL_VERSION;
+    hdr.msg_type = RAW_MSG_DATA;
+    hdr.flags = csum ? RAW_CSUM_CRC32C : RAW_CSUM_NONE;
+    hdr.length = len;
+    hdr.seq = (uint32_t)off;
+    for (uint32_t i = 0; i < len; i++) buf[off + HDR_LEN + i] = (uint8_t)(off + i);
+    if (csum) {
+        uint32_t crc = usb_crc32c(0, &hdr, sizeof(hdr));
+        hdr.checksum = usb_crc32c(crc, buf + off + HDR_LEN, len);
+    }
+    memcpy(buf + off, &hdr, sizeof(hdr));
+    return off + HDR_LEN + len;
+}
+
+// Build a batch of count messages of varying sizes; offsets[] gets each start
+static size_t build(int count, bool csum, size_t *offsets) {
+    size_t off = 0;
+    for (int i = 0; i < count; i++) {
+        offsets[i] = off;
+        off = put_msg(off, (uint32_t)(i * 13 % 200), csum);
+    }
+    return off;
+}
+
+static void test_valid(void) {
+    raw_frame_ref_t refs[RAW_PARSE_BATCH];
+    size_t offsets[100];
+    size_t next;
+    int error;
+
+    for (int count = 0; count <= 9; count++) {
+        size_t len = build(count, count & 1, offsets);
+        int n = raw_parse_batch(buf, len, 0, refs, RAW_PARSE_BATCH, &next, &error);
+        CHECK(n == count && error == 0 && next == len);
+        for (int i = 0; i < n; i++) {
+            CHECK(refs[i].offset == offsets[i]);
+            CHECK(refs[i].length == (uint32_t)(i * 13 % 200));
+        }
+    }
+
+    // More than one call's worth: the walk stops after max and resumes
+    size_t len = build(100, true, offsets);
+    int n = raw_parse_batch(buf, len, 0, refs, RAW_PARSE_BATCH, &next, &error);
+    CHECK(n == RAW_PARSE_BATCH && error == 0 && next == offsets[RAW_PARSE_BATCH]);
+    n = raw_parse_batch(buf, len, next, refs, RAW_PARSE_BATCH, &next, &error);
+    CHECK(n == 100 - RAW_PARSE_BATCH && error == 0 && next == len);
+}
+
+// Corrupt message bad of a batch of count and expect the ones before it
+static void expect_error(int count, int bad, void (*corrupt)(uint8_t *msg), int want) {
+    raw_frame_ref_t refs[RAW_PARSE_BATCH];
+    size_t offsets[RAW_PARSE_BATCH];
+    size_t next;
+    int error;
+
+    size_t len = build(count, true, offsets);
+    corrupt(buf + offsets[bad]);
+    int n = raw_parse_batch(buf, len, 0, refs, RAW_PARSE_BATCH, &next, &error);
+    if (n != bad || error != want || next != offsets[bad]) {
+        fprintf(stderr, "message %d of %d: got %d valid, error %d; expected %d, error %d\n",
+                bad, count, n, error, bad, want);
+        test_failures++;
+    }
+}
+
+static void bad_magic(uint8_t *msg) { msg[1] = 'X'; }
+static void bad_version(uint8_t *msg) { msg[4] = RAW_PROTOCOL_VERSION + 1; }
+static void bad_length(uint8_t *msg) { msg[offsetof(raw_msg_header_t, length) + 3] = 0x7F; }
+static void bad_payload(uint8_t *msg) { msg[HDR_LEN - 1] ^= 0x01; }  // Checksum field
+static void bad_seq(uint8_t *msg) { msg[offsetof(raw_msg_header_t, seq)] ^= 0x80; }
+
+static void test_errors(void) {
+    // Every position of batches that do and do not fill a vector group
+    for (int count = 1; count <= 13; count += 4) {
+        for (int bad = 0; bad < count; bad++) {
+            expect_error(count, bad, bad_magic, RAW_PARSE_BAD_MAGIC);
+            expect_error(count, bad, bad_version, RAW_PARSE_BAD_VERSION);
+            expect_error(count, bad, bad_length, RAW_PARSE_BAD_LENGTH);
+            expect_error(count, bad, bad_payload, RAW_PARSE_BAD_CHECKSUM);
+            expect_error(count, bad, bad_seq, RAW_PARSE_BAD_CHECKSUM);
+        }
+    }
+
+    // Without a checksum the same damage goes through
+    raw_frame_ref_t refs[4];
+    size_t offsets[4];
+    size_t next;
+    int error;
+    size_t len = build(4, false, offsets);
+    bad_seq(buf + offsets[2]);
+    CHECK(raw_parse_batch(buf, len, 0, refs, 4, &next, &error) == 4 && error == 0);
+
+    // Truncated: a partial header, then a payload cut short
+    len = build(4, true, offsets);
+    int n = raw_parse_batch(buf, offsets[3] + HDR_LEN - 1, 0, refs, 4, &next, &error);
+    CHECK(n == 3 && error == RAW_PARSE_SHORT && next == offsets[3]);
+    n = raw_parse_batch(buf, len - 1, 0, refs, 4, &next, &error);
+    CHECK(n == 3 && error == RAW_PARSE_BAD_LENGTH && next == offsets[3]);
+
+    // A garbage header whose length runs past the end is bad magic, not
+    // bad length
+    len = build(2, true, offsets);
+    memset(buf + len, 0xFF, HDR_LEN);
+    n = raw_parse_batch(buf, len + HDR_LEN, 0, refs, 4, &next, &error);
+    CHECK(n == 2 && error == RAW_PARSE_BAD_MAGIC && next == len);
+}
+
+int main(void) {
+    printf("raw parser implementation: %s\n", raw_parse_impl());
+    test_valid();
+    test_errors();
+    TEST_DONE();
+}
@@ -0,0 +1,125 @@
+// Runtime scheduler: strict priority between levels and byte shares by
+// weight (deficit round robin) within one, seen from the receiving end.
+// Everything is queued before the peer shows up, so the order payloads
+// arrive in is the order the scheduler picked them.
+
+#include <string.h>
+#include <time.h>
+#include "usb_raw_runtime.h"
+#include "test_util.h"
+
+#define DEPTH 1024
+
+typedef struct {
+    int priority;
+    int weight;
+    int count;
+    size_t len;                  // 0 = mixed sizes
+} channel_plan_t;
+
+static const channel_plan_t plan[] = {
+    { 0, 1, 50, 0 },             // Urgent: all of it goes first
+    { 1, 1, 60, 0 },
+    { 1, 3, 300, 0 },            // Three times the bytes of channel 1
+    { 1, 1, 200, 250 },          // Channel 1's bytes, in smaller payloads
+};
+#define PLAN_CHANNELS (int)(sizeof(plan) / sizeof(plan[0]))
+
+static raw_runtime_t ra, rb;
+static uint32_t lcg = 12345;
+
+static size_t mixed_len(size_t max) {
+    lcg = lcg * 1103515245 + 12345;
+    return 3 + (lcg >> 8) % (max - 2);
+}
+
+static void sleep_ms(int ms) {
+    struct timespec ts = { 0, ms * 1000000L };
+    nanosleep(&ts, NULL);
+}
+
+int main(void) {
+    raw_comm_ctx_t a, b;
+    CHECK(raw_comm_init_pair(&a, &b) == 0);
+    CHECK(raw_comm_set_window(&a, 16) == 0 && raw_comm_set_window(&b, 16) == 0);
+
+    raw_runtime_opts_t opts;
+    raw_runtime_opts_init(&opts);
+    opts.queue_depth = DEPTH;
+    opts.channels[RAW_CHANNEL_DEFAULT].weight = 0;
+    for (int ch = 0; ch < PLAN_CHANNELS; ch++) {
+        opts.channels[ch].priority = plan[ch].priority;
+        opts.channels[ch].weight = plan[ch].weight;
+    }
+
+    // The sender holds everything until b answers
+    CHECK(raw_comm_listen(&a) == 0);
+    CHECK(raw_runtime_start(&ra, &a, &opts) == 0);
+    size_t payload = raw_comm_max_payload(&a);
+    size_t sizes[PLAN_CHANNELS][DEPTH];
+    uint8_t msg[RAW_MTU_DEFAULT];
+    for (int ch = 0; ch < PLAN_CHANNELS; ch++) {
+        for (int i = 0; i < plan[ch].count; i++) {
+            size_t len = plan[ch].len ? plan[ch].len : mixed_len(payload);
+            sizes[ch][i] = len;
+            memset(msg, 0, len);
+            msg[0] = (uint8_t)ch;
+            msg[1] = (uint8_t)i;
+            msg[2] = (uint8_t)(i >> 8);
+            CHECK(raw_runtime_send_channel(&ra, 0, (uint8_t)ch, msg, len, 0) == (int)len);
+        }
+    }
+    CHECK(atomic_load(&ra.tx_msgs) == 0);
+
+    CHECK(raw_comm_listen(&b) == 0);
+    CHECK(raw_runtime_start(&rb, &b, &opts) == 0);
+    for (int i = 0; i < 1000 && atomic_load(&ra.state) != RAW_STATE_CONNECTED; i++) sleep_ms(2);
+    CHECK(atomic_load(&ra.state) == RAW_STATE_CONNECTED);
+
+    int total = 0, got[PLAN_CHANNELS] = { 0 };
+    for (int ch = 0; ch < PLAN_CHANNELS; ch++) total += plan[ch].count;
+
+    // Bytes of each channel of the shared level while all were backlogged
+    size_t shared[PLAN_CHANNELS] = { 0 };
+    bool drained = false;
+    bool in_order = true, urgent_first = true;
+
+    for (int n = 0; n < total; n++) {
+        uint8_t ch = 0xFF;
+        int len = raw_runtime_recv_channel(&rb, msg, sizeof(msg), NULL, &ch, 2000);
+        if (len <= 0 || ch >= PLAN_CHANNELS) {
+            CHECK(len > 0 && ch < PLAN_CHANNELS);
+            break;
+        }
+
+        int i = msg[1] | msg[2] << 8;
+        if (msg[0] != ch || i != got[ch] || (size_t)len != sizes[ch][i]) in_order = false;
+        if (ch != 0 && got[0] < plan[0].count) urgent_first = false;
+        got[ch]++;
+
+        if (ch != 0 && !drained) {
+            shared[ch] += (size_t)len;
+            drained = got[ch] == plan[ch].count;
+        }
+    }
+    CHECK(in_order);
+    CHECK(urgent_first);
+    for (int ch = 0; ch < PLAN_CHANNELS; ch++) CHECK(got[ch] == plan[ch].count);
+
+    // Within a round a channel is off by at most one payload, and a few
+    // dozen rounds in that leaves the shares within 15% of the weights
+    double ratio2 = (double)shared[2] / (double)shared[1];
+    double ratio3 = (double)shared[3] / (double)shared[1];
+    printf("level 1 bytes while backlogged: %zu %zu %zu (%.2f %.2f)\n",
+           shared[1], shared[2], shared[3], ratio2, ratio3);
+    CHECK(shared[1] >= 20 * payload);
+    CHECK(ratio2 > 3 * 0.85 && ratio2 < 3 * 1.15);
+    CHECK(ratio3 > 0.85 && ratio3 < 1.15);
+
+    CHECK(atomic_load(&ra.tx_dropped) == 0);
+    raw_runtime_stop(&ra);
+    raw_runtime_stop(&rb);
+    raw_comm_cleanup(&a);
+    raw_comm_cleanup(&b);
+    TEST_DONE();
+}
@@ -0,0 +1,256 @@
+// Shared memory ring transport: record framing across the wrap point,
+// a full ring, the size limit, doorbells, records corrupted by the other
+// side, oversized messages, and sides of dead processes being reclaimed
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include "usb_raw_transport.h"
+#include "test_util.h"
+
+// Layout of usb_raw_shm.c, as another process sees it
+#define RING_SIZE    (1u << 20)  // RAW_SHM_RING_SIZE
+#define DATA_OFFSET  4096        // RAW_SHM_DATA_OFFSET
+#define SEG_RING_SIZE_OFF 8      // raw_shm_segment_t.ring_size
+#define SEG_SIDE_PID_OFF  16     // raw_shm_segment_t.side_pid[2]
+
+static uint8_t tx[RING_SIZE];
+static uint8_t rx[RING_SIZE];
+
+static size_t rec_size(size_t len) {
+    return (4 + len + 7) & ~(size_t)7;
+}
+
+static void fill(uint8_t *buf, size_t len, unsigned seed) {
+    for (size_t i = 0; i < len; i++) buf[i] = (uint8_t)(seed * 31 + i);
+}
+
+static int send_msg(raw_comm_ctx_t *ctx, const uint8_t *msg, size_t len) {
+    return ctx->transport->send(ctx, msg, len);
+}
+
+static int recv_msg(raw_comm_ctx_t *ctx, uint8_t *buf, size_t max_len) {
+    uint32_t from = 0;
+    return ctx->transport->recv(ctx, buf, max_len, &from);
+}
+
+static bool readable(raw_comm_ctx_t *ctx) {
+    struct pollfd pfd = { .fd = ctx->transport->get_fd(ctx), .events = POLLIN };
+    return poll(&pfd, 1, 0) == 1;
+}
+
+// Receive one message and compare it with what send_msg() got for seed
+static bool expect_msg(raw_comm_ctx_t *ctx, size_t len, unsigned seed) {
+    uint8_t want[4096];
+    fill(want, len, seed);
+    int n = recv_msg(ctx, rx, sizeof(rx));
+    return n == (int)len && memcmp(rx, want, len) == 0;
+}
+
+// Odd record sizes walk the records across the end of the ring many
+// times, with a padding marker whenever the next one does not fit before
+// it, while a few records are always queued
+static void test_wraparound(raw_comm_ctx_t *a, raw_comm_ctx_t *b) {
+    unsigned sent = 0, got = 0;
+    size_t sizes[8];
+    bool ok = true;
+
+    for (size_t total = 0; total < 8 * (size_t)RING_SIZE && ok; ) {
+        size_t len = 1 + (sent * 977) % 4001;  // 1..4001, mostly odd
+        fill(tx, len, sent);
+        CHECK(send_msg(a, tx, len) == (int)len);
+        sizes[sent % 8] = len;
+        sent++;
+        total += rec_size(len);
+
+        if (sent - got == 8) {
+            ok = expect_msg(b, sizes[got % 8], got);
+            got++;
+        }
+    }
+    while (ok && got < sent) {
+        ok = expect_msg(b, sizes[got % 8], got);
+        got++;
+    }
+    CHECK(ok);
+    CHECK(recv_msg(b, rx, sizeof(rx)) == 0);
+    CHECK(a->stats->rx_errors == 0 && b->stats->rx_errors == 0);
+}
+
+// Runs on a fresh ring, so that the records below line up with its end
+static void test_full_ring(raw_comm_ctx_t *a, raw_comm_ctx_t *b) {
+    // Largest message the ring takes is half of it, record header included
+    size_t half = RING_SIZE / 2 - 4;
+    size_t quarter = RING_SIZE / 4 - 4;
+    CHECK(send_msg(a, tx, half + 1) == -1);
+    CHECK(send_msg(a, tx, half) == (int)half);
+    CHECK(recv_msg(b, rx, sizeof(rx)) == (int)half);
+
+    // Four records of a quarter fill it exactly, across the end
+    for (int i = 0; i < 4; i++) {
+        fill(tx, quarter, (unsigned)i);
+        CHECK(send_msg(a, tx, quarter) == (int)quarter);
+    }
+    errno = 0;
+    CHECK(send_msg(a, tx, 1) == -1 && errno == EAGAIN);
+
+    // One record read makes room for exactly one more
+    CHECK(recv_msg(b, rx, sizeof(rx)) == (int)quarter);
+    fill(tx, quarter, 4);
+    CHECK(send_msg(a, tx, quarter) == (int)quarter);
+    errno = 0;
+    CHECK(send_msg(a, tx, 1) == -1 && errno == EAGAIN);
+    for (unsigned i = 1; i <= 4; i++) {
+        uint8_t want[64];
+        fill(want, sizeof(want), i);
+        CHECK(recv_msg(b, rx, sizeof(rx)) == (int)quarter && memcmp(rx, want, sizeof(want)) == 0);
+    }
+    CHECK(recv_msg(b, rx, sizeof(rx)) == 0);
+
+    // Free space has to cover the padding to the end of the ring as well:
+    // with the head a quarter short of the end and half the ring free, a
+    // half record does not fit until the rest has been read
+    CHECK(send_msg(a, tx, quarter) == (int)quarter);
+    CHECK(send_msg(a, tx, quarter) == (int)quarter);
+    CHECK(send_msg(a, tx, half) == (int)half);
+    CHECK(recv_msg(b, rx, sizeof(rx)) == (int)quarter);
+    CHECK(recv_msg(b, rx, sizeof(rx)) == (int)quarter);
+    errno = 0;
+    CHECK(send_msg(a, tx, half) == -1 && errno == EAGAIN);
+    CHECK(recv_msg(b, rx, sizeof(rx)) == (int)half);
+    CHECK(send_msg(a, tx, half) == (int)half);
+    CHECK(recv_msg(b, rx, sizeof(rx)) == (int)half);
+    CHECK(recv_msg(b, rx, sizeof(rx)) == 0);
+}
+
+static void test_doorbell(raw_comm_ctx_t *a, raw_comm_ctx_t *b) {
+    CHECK(!readable(b));
+    CHECK(send_msg(a, tx, 10) == 10);
+    CHECK(readable(b));
+    CHECK(send_msg(a, tx, 10) == 10);
+
+    // The bell stays up while records are queued, and is cleared by the
+    // receive that finds the ring empty
+    CHECK(recv_msg(b, rx, sizeof(rx)) == 10);
+    CHECK(recv_msg(b, rx, sizeof(rx)) == 10);
+    CHECK(readable(b));
+    CHECK(recv_msg(b, rx, sizeof(rx)) == 0);
+    CHECK(!readable(b));
+
+    // The direction the other way has its own bell
+    CHECK(!readable(a));
+    CHECK(send_msg(b, tx, 3) == 3);
+    CHECK(readable(a) && !readable(b));
+    CHECK(recv_msg(a, rx, sizeof(rx)) == 3);
+    CHECK(recv_msg(a, rx, sizeof(rx)) == 0);
+}
+
+static void test_oversized(raw_comm_ctx_t *a, raw_comm_ctx_t *b) {
+    uint64_t errors = b->stats->rx_errors;
+
+    // Dropped and counted, not returned cut short; the next one follows
+    fill(tx, 200, 1);
+    CHECK(send_msg(a, tx, 200) == 200);
+    fill(tx, 100, 2);
+    CHECK(send_msg(a, tx, 100) == 100);
+    CHECK(recv_msg(b, rx, 150) == 100);
+    uint8_t want[100];
+    fill(want, sizeof(want), 2);
+    CHECK(memcmp(rx, want, sizeof(want)) == 0);
+    CHECK(b->stats->rx_errors == errors + 1);
+    CHECK(recv_msg(b, rx, sizeof(rx)) == 0);
+}
+
+// Named segment mapped the way another process would
+static uint8_t *map_segment(const char *name) {
+    char path[128];
+    snprintf(path, sizeof(path), "/%s", name);
+    int fd = shm_open(path, O_RDWR, 0);
+    if (fd < 0) return NULL;
+    uint8_t *seg = mmap(NULL, DATA_OFFSET + 2 * (size_t)RING_SIZE, PROT_READ | PROT_WRITE,
+                        MAP_SHARED, fd, 0);
+    close(fd);
+    return seg == MAP_FAILED ? NULL : seg;
+}
+
+static uint32_t dead_pid(void) {
+    pid_t pid = fork();
+    if (pid == 0) _exit(0);
+    waitpid(pid, NULL, 0);
+    return (uint32_t)pid;
+}
+
+static void test_named(void) {
+    char name[64];
+    snprintf(name, sizeof(name), "usbcnet_test_shm.%d", (int)getpid());
+
+    raw_comm_ctx_t a, b, c;
+    CHECK(raw_comm_init(&a, NULL) == 0 && raw_comm_set_transport(&a, "shm", name) == 0);
+    CHECK(raw_comm_init(&b, NULL) == 0 && raw_comm_set_transport(&b, "shm", name) == 0);
+    CHECK(raw_comm_init(&c, NULL) == 0);
+    CHECK(raw_comm_set_transport(&c, "shm", name) == -1);  // Two sides only
+    raw_comm_cleanup(&c);
+
+    uint8_t *seg = map_segment(name);
+    CHECK(seg != NULL);
+    if (!seg) return;
+    uint32_t ring_size;
+    memcpy(&ring_size, seg + SEG_RING_SIZE_OFF, sizeof(ring_size));
+    CHECK(ring_size == RING_SIZE);
+
+    // A record length that runs past the ring loses the framing: the
+    // receiver skips what was published and picks up after it
+    uint64_t errors = b.stats->rx_errors;
+    fill(tx, 64, 7);
+    CHECK(send_msg(&a, tx, 64) == 64);
+    uint32_t bogus = RING_SIZE - 2;
+    memcpy(seg + DATA_OFFSET, &bogus, sizeof(bogus));  // Ring 0, record 0
+    CHECK(send_msg(&a, tx, 64) == 64);
+    CHECK(recv_msg(&b, rx, sizeof(rx)) == 0);
+    CHECK(b.stats->rx_errors == errors + 1);
+    CHECK(send_msg(&a, tx, 64) == 64);
+    CHECK(expect_msg(&b, 64, 7));
+    CHECK(recv_msg(&b, rx, sizeof(rx)) == 0);
+
+    // Both processes gone without detaching: the next pair takes the
+    // sides over and starts on empty rings, not with what was left queued
+    CHECK(send_msg(&a, tx, 64) == 64);
+    raw_comm_cleanup(&b);
+    uint32_t pid = dead_pid();
+    memcpy(seg + SEG_SIDE_PID_OFF, &pid, sizeof(pid));  // Side 0, a's
+    raw_comm_ctx_t d;
+    CHECK(raw_comm_init(&c, NULL) == 0 && raw_comm_set_transport(&c, "shm", name) == 0);
+    CHECK(raw_comm_init(&d, NULL) == 0 && raw_comm_set_transport(&d, "shm", name) == 0);
+    CHECK(recv_msg(&d, rx, sizeof(rx)) == 0);
+    fill(tx, 32, 8);
+    CHECK(send_msg(&c, tx, 32) == 32);
+    CHECK(expect_msg(&d, 32, 8));
+    CHECK(recv_msg(&d, rx, sizeof(rx)) == 0);
+
+    munmap(seg, DATA_OFFSET + 2 * (size_t)RING_SIZE);
+    raw_comm_cleanup(&a);
+    raw_comm_cleanup(&c);
+    raw_comm_cleanup(&d);
+}
+
+int main(void) {
+    raw_comm_ctx_t a, b;
+    CHECK(raw_comm_init_pair(&a, &b) == 0);
+
+    test_full_ring(&a, &b);
+    test_wraparound(&a, &b);
+    test_doorbell(&a, &b);
+    test_oversized(&a, &b);
+    raw_comm_cleanup(&a);
+    raw_comm_cleanup(&b);
+
+    test_named();
+    TEST_DONE();
+}
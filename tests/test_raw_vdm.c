@@ -0,0 +1,257 @@
+// VDM transport: fragmentation around the 24 byte VDM boundary, compact
+// headers for every flag combination, the largest message, and resync
+// at the next message start after a lost fragment
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "usb_raw_transport.h"
+#include "test_util.h"
+
+#define FRAG_BYTES 24                 // RAW_VDM_FRAG_BYTES
+#define MSG_MAX    (1024 * FRAG_BYTES) // RAW_VDM_MSG_MAX
+#define HDR        ((int)sizeof(raw_msg_header_t))
+
+// Test in the middle of a link: forwards VDMs from a_fd to b_fd and
+// loses the ones picked by drop_mask (bit n = n-th VDM from now)
+typedef struct {
+    bool on;
+    int a_fd, b_fd;
+    unsigned long forwarded;
+    uint32_t drop_mask;
+    int seen;
+} relay_t;
+
+static relay_t relay;
+static uint8_t tx[MSG_MAX + 1];
+static uint8_t rx[MSG_MAX + 64];
+
+static void pump_relay(void) {
+    uint32_t buf[8];
+    ssize_t n;
+    while (relay.on && (n = read(relay.a_fd, buf, sizeof(buf))) > 0) {
+        bool drop = relay.seen < 32 && (relay.drop_mask >> relay.seen & 1);
+        relay.seen++;
+        if (drop) continue;
+        CHECK(write(relay.b_fd, buf, (size_t)n) == n);
+        relay.forwarded++;
+    }
+}
+
+static void drop_next(uint32_t mask) {
+    relay.drop_mask = mask;
+    relay.seen = 0;
+}
+
+// Run both ends until b receives a message or ms pass. Leaves at most
+// RAW_VDM_PIPELINE VDMs ahead of the clock, ~2 ms each, so the largest
+// message takes about two seconds.
+static int deliver(raw_comm_ctx_t *a, raw_comm_ctx_t *b, uint8_t *out, size_t max_len, int ms) {
+    struct timespec start, now;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    do {
+        struct pollfd pfd[2] = {
+            { .fd = a->transport->get_fd(a), .events = POLLIN },
+            { .fd = b->transport->get_fd(b), .events = POLLIN },
+        };
+        poll(pfd, 2, 10);
+        a->transport->service(a);
+        pump_relay();
+
+        uint32_t from = 0;
+        int n = b->transport->recv(b, out, max_len, &from);
+        if (n != 0) return n;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+    } while ((now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000 < ms);
+    return 0;
+}
+
+static size_t build(uint8_t *msg, uint8_t type, uint16_t flags, size_t payload,
+                    uint32_t src, uint32_t seq) {
+    raw_msg_header_t hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, RAW_MSG_MAGIC, 4);
+    hdr.version = RAW_PROTOCOL_VERSION;
+    hdr.msg_type = type;
+    hdr.flags = flags;
+    hdr.length = (uint32_t)payload;
+    hdr.src_id = src;
+    hdr.dst_id = src ^ 0xFFFF;
+    hdr.seq = seq;
+    // The transport carries the checksum, it does not check it
+    if ((flags & RAW_FLAG_CSUM_MASK) != RAW_CSUM_NONE) hdr.checksum = seq * 2654435761u;
+    memcpy(msg, &hdr, sizeof(hdr));
+    for (size_t i = 0; i < payload; i++) msg[sizeof(hdr) + i] = (uint8_t)(seq + i * 7);
+    return sizeof(hdr) + payload;
+}
+
+// Send one message and expect it back unchanged; returns the VDMs it took
+static unsigned long round_trip(raw_comm_ctx_t *a, raw_comm_ctx_t *b, size_t len) {
+    unsigned long before = relay.forwarded;
+    CHECK(a->transport->send(a, tx, len) == (int)len);
+    int n = deliver(a, b, rx, sizeof(rx), 5000);
+    CHECK(n == (int)len && memcmp(rx, tx, len) == 0);
+    return relay.forwarded - before;
+}
+
+// Separate a and b from the rings raw_comm_init_pair() gave them
+static void drop_transport(raw_comm_ctx_t *ctx) {
+    const raw_transport_ops_t *old = raw_comm_swap_transport(ctx, NULL);
+    old->close(ctx);
+}
+
+static void watch(raw_comm_ctx_t *ctx) {
+    raw_comm_swap_transport(ctx, ctx->transport);
+}
+
+static void test_sizes(raw_comm_ctx_t *a, raw_comm_ctx_t *b) {
+    static const size_t payloads[] = { 0, 1, 23, 24, 25, 47, 48, 49 };
+    uint32_t seq = 1;
+
+    // Compact: plain data frames
+    for (size_t i = 0; i < sizeof(payloads) / sizeof(payloads[0]); i++) {
+        size_t len = build(tx, RAW_MSG_DATA, 0, payloads[i], 0x1234, seq++);
+        round_trip(a, b, len);
+    }
+
+    // As is (flags the compact form has no room for), ending on both
+    // sides of the 24 byte VDM boundaries
+    static const size_t lens[] = { HDR + 1, 47, 48, 49, 71, 72, 73 };
+    for (size_t i = 0; i < sizeof(lens) / sizeof(lens[0]); i++) {
+        size_t len = build(tx, RAW_MSG_DATA, 0x8000, lens[i] - HDR, 0x1234, seq++);
+        round_trip(a, b, len);
+    }
+
+    // A raw message shorter than a header is sent but not delivered
+    uint64_t errors = b->stats->rx_errors;
+    memset(tx, 0x5A, 25);
+    CHECK(a->transport->send(a, tx, 1) == 1);
+    CHECK(a->transport->send(a, tx, 23) == 23);
+    CHECK(a->transport->send(a, tx, 24) == 24);
+    CHECK(a->transport->send(a, tx, 25) == 25);
+    CHECK(deliver(a, b, rx, sizeof(rx), 200) == 0);
+    CHECK(b->stats->rx_errors == errors + 4);
+
+    // The largest message, as is and compact, and one byte more
+    size_t len = build(tx, RAW_MSG_DATA, 0x8000, MSG_MAX - HDR, 0x1234, seq++);
+    round_trip(a, b, len);
+    len = build(tx, RAW_MSG_DATA, RAW_CSUM_CRC32C, MSG_MAX - HDR, 0x1234, seq++);
+    round_trip(a, b, len);
+    len = build(tx, RAW_MSG_DATA, 0, MSG_MAX + 1 - HDR, 0x1234, seq++);
+    errno = 0;
+    CHECK(a->transport->send(a, tx, len) == -1 && errno == EMSGSIZE);
+
+    // Too large for the receiver's buffer: dropped, not cut short
+    errors = b->stats->rx_errors;
+    len = build(tx, RAW_MSG_DATA, 0, 200, 0x1234, seq++);
+    CHECK(a->transport->send(a, tx, len) == (int)len);
+    CHECK(deliver(a, b, rx, 100, 200) == 0);
+    CHECK(b->stats->rx_errors == errors + 1);
+}
+
+static void test_flags(raw_comm_ctx_t *a, raw_comm_ctx_t *b) {
+    static const uint8_t channels[] = { 0, 1, RAW_CHANNELS - 1 };
+    uint32_t seq = 1000;
+
+    for (int keepalive = 0; keepalive < 2; keepalive++) {
+        for (size_t ch = 0; ch < sizeof(channels); ch++) {
+            for (uint16_t codec = 0; codec < 4; codec++) {
+                for (uint16_t csum = 0; csum < 2; csum++) {
+                    uint16_t flags = (uint16_t)(csum |
+                                                (keepalive ? RAW_FLAG_KEEPALIVE : 0) |
+                                                codec << RAW_FLAG_CODEC_SHIFT |
+                                                channels[ch] << RAW_FLAG_CHANNEL_SHIFT);
+                    size_t len = build(tx, RAW_MSG_DATA, flags, 23 + seq % 3, 0x1234, seq);
+                    seq++;
+                    round_trip(a, b, len);
+                }
+            }
+        }
+    }
+
+    // Ids change, and control messages always carry them
+    round_trip(a, b, build(tx, RAW_MSG_DATA, 0, 10, 0x9999, seq++));
+    round_trip(a, b, build(tx, RAW_MSG_KEEPALIVE, 0, 0, 0x9999, seq++));
+    round_trip(a, b, build(tx, RAW_MSG_DATA_ACK, 0, 4, 0x4321, seq++));
+    round_trip(a, b, build(tx, RAW_MSG_DATA, 0, 10, 0x4321, seq++));
+
+    // A batch: several headers in one message
+    size_t len = build(tx, RAW_MSG_DATA, RAW_CSUM_CRC32C, 30, 0x4321, seq++);
+    len += build(tx + len, RAW_MSG_DATA, 1u << RAW_FLAG_CHANNEL_SHIFT, 5, 0x4321, seq++);
+    len += build(tx + len, RAW_MSG_DATA_ACK, 0, 4, 0x4321, seq++);
+    round_trip(a, b, len);
+}
+
+static void test_resync(raw_comm_ctx_t *a, raw_comm_ctx_t *b) {
+    uint32_t seq = 5000;
+
+    // Compact headers make a 1 byte data frame a single VDM
+    size_t len = build(tx, RAW_MSG_DATA, 0, 1, 0x1234, seq++);
+    CHECK(round_trip(a, b, len) == 1);
+
+    // Middle fragment lost: the message is dropped, the next one arrives
+    static const uint32_t masks[] = {
+        1u << 1,             // Middle of the first message
+        1u << 2,             // Its last fragment: the next SOM restarts
+        1u << 0,             // Its first fragment: the rest is ignored
+        1u << 1 | 1u << 4,   // The middle of both
+    };
+    for (size_t i = 0; i < sizeof(masks) / sizeof(masks[0]); i++) {
+        uint64_t errors = b->stats->rx_errors;
+        uint8_t second[128];
+        size_t first = build(tx, RAW_MSG_DATA, 0x8000, 72 - HDR, 0x1234, seq++);  // 3 VDMs
+        size_t next = build(second, RAW_MSG_DATA, 0x8000, 72 - HDR, 0x1234, seq++);
+
+        drop_next(masks[i]);
+        CHECK(a->transport->send(a, tx, first) == (int)first);
+        CHECK(a->transport->send(a, second, next) == (int)next);
+        int n = deliver(a, b, rx, sizeof(rx), 1000);
+        if (i < 3) {
+            CHECK(n == (int)next && memcmp(rx, second, next) == 0);
+        } else {
+            CHECK(n == 0);
+        }
+        CHECK(deliver(a, b, rx, sizeof(rx), 200) == 0);
+        CHECK(b->stats->rx_errors == errors + (i == 0 ? 1 : i == 3 ? 2 : 0));
+        drop_next(0);
+
+        memcpy(tx, second, next);
+        round_trip(a, b, next);
+    }
+}
+
+int main(void) {
+    raw_comm_ctx_t a, b;
+    CHECK(raw_comm_init_pair(&a, &b) == 0);
+
+    // Loopback pair
+    drop_transport(&a);
+    drop_transport(&b);
+    CHECK(raw_vdm_open_pair(&a, &b) == 0);
+    watch(&a);
+    watch(&b);
+    test_sizes(&a, &b);
+    test_flags(&a, &b);
+
+    // Through the relay, to lose fragments on the way
+    drop_transport(&a);
+    drop_transport(&b);
+    int s1[2], s2[2];
+    CHECK(socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK, 0, s1) == 0);
+    CHECK(socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK, 0, s2) == 0);
+    CHECK(raw_vdm_open_fd(&a, s1[0]) == 0 && raw_vdm_open_fd(&b, s2[0]) == 0);
+    watch(&a);
+    watch(&b);
+    relay = (relay_t){ .on = true, .a_fd = s1[1], .b_fd = s2[1] };
+    test_resync(&a, &b);
+
+    raw_comm_cleanup(&a);
+    raw_comm_cleanup(&b);
+    close(s1[1]);
+    close(s2[1]);
+    TEST_DONE();
+}
@@ -0,0 +1,203 @@
+// Sliding window: in-order delivery, cumulative and selective ACKs, fast
+// retransmit, RTO backoff and the dead link, receive window bounds and
+// the zero window
+
+#include <string.h>
+#include "usb_raw_window.h"
+#include "test_util.h"
+
+#define MSG_SIZE (RAW_FRAME_HEADROOM + 256)
+
+// Queue one frame whose first byte is its sequence number
+static void send_frame(raw_window_t *win, int64_t now) {
+    raw_tx_slot_t *slot = raw_window_tx_slot(win);
+    slot->msg[0] = (uint8_t)win->snd_nxt;
+    raw_window_tx_commit(win, 1, now);
+}
+
+static void test_send_ack(void) {
+    raw_window_t win;
+    CHECK(raw_window_init(&win, 8, MSG_SIZE) == 0);
+    CHECK(win.size == 8 && win.rto_us == RAW_RTO_INITIAL_US);
+
+    for (int i = 0; i < 8; i++) {
+        CHECK(raw_window_can_send(&win));
+        send_frame(&win, 0);
+    }
+    CHECK(!raw_window_can_send(&win));
+    CHECK(raw_window_in_flight(&win) == 8);
+    CHECK(raw_window_needs_timer(&win));
+
+    // Cumulative ACK of the first four, with an RTT sample
+    raw_sack_t ack = { .cum_ack = 4, .window = 8, .sack = 0 };
+    CHECK(raw_window_on_ack(&win, &ack, 1000) == 4);
+    CHECK(raw_window_in_flight(&win) == 4);
+    CHECK(win.rtt_valid && win.srtt_us == 1000);
+    CHECK(win.rto_us == RAW_RTO_MIN_US);
+
+    // The same ACK again, and one beyond what was sent, change nothing
+    CHECK(raw_window_on_ack(&win, &ack, 1000) == 0);
+    raw_sack_t bogus = { .cum_ack = 100, .window = 8, .sack = 0 };
+    CHECK(raw_window_on_ack(&win, &bogus, 1000) == 0);
+    CHECK(raw_window_in_flight(&win) == 4);
+
+    ack.cum_ack = 8;
+    CHECK(raw_window_on_ack(&win, &ack, 2000) == 4);
+    CHECK(raw_window_in_flight(&win) == 0);
+    CHECK(!raw_window_needs_timer(&win));
+
+    raw_window_free(&win);
+}
+
+static void test_fast_retransmit(void) {
+    raw_window_t win;
+    bool dead;
+    CHECK(raw_window_init(&win, 8, MSG_SIZE) == 0);
+
+    for (int i = 0; i < 6; i++) send_frame(&win, 0);
+
+    // Frame 0 lost: 1 and 2 SACKed is not yet enough
+    raw_sack_t ack = { .cum_ack = 0, .window = 8, .sack = 0x3 };
+    CHECK(raw_window_on_ack(&win, &ack, 100) == 2);
+    CHECK(raw_window_next_rtx(&win, 100, &dead) == NULL && !dead);
+
+    ack.sack = 0x7;
+    CHECK(raw_window_on_ack(&win, &ack, 110) == 1);
+    raw_tx_slot_t *slot = raw_window_next_rtx(&win, 110, &dead);
+    CHECK(slot != NULL && !dead);
+    CHECK(slot && slot->msg[0] == 0);
+    CHECK(win.fast_retransmits == 1);
+
+    // Only once per frame, and not for the frames that got through
+    CHECK(raw_window_next_rtx(&win, 120, &dead) == NULL);
+
+    // The cumulative ACK releases the SACKed frames without counting them twice
+    ack.cum_ack = 4;
+    ack.sack = 0;
+    CHECK(raw_window_on_ack(&win, &ack, 200) == 1);
+    CHECK(raw_window_in_flight(&win) == 2);
+
+    raw_window_free(&win);
+}
+
+static void test_rto_backoff(void) {
+    raw_window_t win;
+    bool dead;
+    CHECK(raw_window_init(&win, 4, MSG_SIZE) == 0);
+
+    send_frame(&win, 0);
+    CHECK(raw_window_next_rtx(&win, RAW_RTO_INITIAL_US - 1, &dead) == NULL && !dead);
+
+    int64_t now = RAW_RTO_INITIAL_US;
+    CHECK(raw_window_next_rtx(&win, now, &dead) != NULL);
+    CHECK(win.retransmits == 1);
+
+    // The second timeout waits twice as long
+    CHECK(raw_window_next_rtx(&win, now + 2 * RAW_RTO_INITIAL_US - 1, &dead) == NULL);
+    now += 2 * RAW_RTO_INITIAL_US;
+    CHECK(raw_window_next_rtx(&win, now, &dead) != NULL);
+
+    // A retransmitted frame gives no RTT sample (Karn)
+    raw_sack_t ack = { .cum_ack = 1, .window = 4, .sack = 0 };
+    CHECK(raw_window_on_ack(&win, &ack, now + 10) == 1);
+    CHECK(!win.rtt_valid);
+
+    // A frame that never gets through ends the link
+    send_frame(&win, now);
+    int resent = 0;
+    for (int i = 0; i < 100 && !dead; i++) {
+        now += RAW_RTO_MAX_US;
+        if (raw_window_next_rtx(&win, now, &dead)) resent++;
+    }
+    CHECK(dead);
+    CHECK(resent == RAW_MAX_RETRIES);
+
+    raw_window_free(&win);
+}
+
+static void test_receive(void) {
+    raw_window_t win;
+    raw_sack_t ack;
+    uint8_t data[4] = { 0 };
+    CHECK(raw_window_init(&win, 4, MSG_SIZE) == 0);
+
+    // Out of order: 1 and 3 before 0
+    data[0] = 1;
+    CHECK(raw_window_on_data(&win, 1, 2, data, 1) == 1);
+    data[0] = 3;
+    CHECK(raw_window_on_data(&win, 3, 0, data, 1) == 1);
+    CHECK(raw_window_peek(&win) == NULL);
+    CHECK(raw_window_on_data(&win, 1, 2, data, 1) == 0);
+    CHECK(raw_window_on_data(&win, 4, 0, data, 1) == -1);
+
+    CHECK(win.ack_pending);
+    raw_window_build_ack(&win, &ack);
+    CHECK(ack.cum_ack == 0 && ack.window == 4 && ack.sack == 0x5);
+    CHECK(!win.ack_pending);
+
+    data[0] = 0;
+    CHECK(raw_window_on_data(&win, 0, 1, data, 1) == 1);
+    raw_window_build_ack(&win, &ack);
+    CHECK(ack.cum_ack == 2 && ack.window == 2 && ack.sack == 0x1);
+
+    // Delivered in sequence order with their channels
+    const raw_rx_slot_t *slot = raw_window_peek(&win);
+    CHECK(slot && slot->data[0] == 0 && slot->channel == 1 && slot->len == 1);
+    raw_window_consume(&win);
+    slot = raw_window_peek(&win);
+    CHECK(slot && slot->data[0] == 1 && slot->channel == 2);
+    raw_window_consume(&win);
+    CHECK(raw_window_peek(&win) == NULL);
+    CHECK(raw_window_on_data(&win, 0, 0, data, 1) == 0);
+    CHECK(win.duplicates == 2);
+
+    // Oversized payloads are cut to the slot
+    uint8_t big[MSG_SIZE] = { 0 };
+    CHECK(raw_window_on_data(&win, 2, 0, big, sizeof(big)) == 1);
+    slot = raw_window_peek(&win);
+    CHECK(slot && slot->len == MSG_SIZE - RAW_FRAME_HEADROOM);
+
+    raw_window_free(&win);
+}
+
+static void test_zero_window(void) {
+    raw_window_t win, peer;
+    raw_sack_t ack;
+    uint8_t data[1] = { 0 };
+    CHECK(raw_window_init(&win, 2, MSG_SIZE) == 0);
+    CHECK(raw_window_init(&peer, 2, MSG_SIZE) == 0);
+
+    // The receiver fills up without reading
+    CHECK(raw_window_on_data(&peer, 0, 0, data, 1) == 1);
+    CHECK(raw_window_on_data(&peer, 1, 0, data, 1) == 1);
+    raw_window_build_ack(&peer, &ack);
+    CHECK(ack.window == 0 && peer.zero_window_sent);
+
+    send_frame(&win, 0);
+    send_frame(&win, 0);
+    CHECK(raw_window_on_ack(&win, &ack, 100) == 2);
+    CHECK(!raw_window_can_send(&win));
+    CHECK(raw_window_needs_timer(&win));
+    CHECK(!raw_window_probe_due(&win, 100 + win.rto_us - 1));
+    CHECK(raw_window_probe_due(&win, 100 + win.rto_us));
+
+    // Reading reopens it and owes the sender an update
+    raw_window_consume(&peer);
+    CHECK(peer.ack_pending);
+    raw_window_build_ack(&peer, &ack);
+    CHECK(ack.window == 1);
+    raw_window_on_ack(&win, &ack, 200);
+    CHECK(raw_window_can_send(&win));
+
+    raw_window_free(&win);
+    raw_window_free(&peer);
+}
+
+int main(void) {
+    test_send_ack();
+    test_fast_retransmit();
+    test_rto_backoff();
+    test_receive();
+    test_zero_window();
+    TEST_DONE();
+}
@@ -0,0 +1,212 @@
+// File transfer resume over a named shared memory segment: a receiver
+// stopped partway leaves a bitmap that matches what is on disk, and the
+// next run sends only the chunks still missing and ends with the same
+// bytes as the source
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "usb_sendfile.h"
+#include "test_util.h"
+
+#define FILE_BYTES (16u << 20)
+#define RESUME_HDR 32            // file_resume_t in usb_sendfile.c
+
+static char dir[64], src_path[128], dst_path[128], shm_name[64];
+static uint8_t *src;
+
+// What the sending child reports back
+typedef struct {
+    uint64_t tx_packets;
+    uint64_t retransmits;
+} send_report_t;
+
+static void sleep_ms(int ms) {
+    struct timespec ts = { ms / 1000, (ms % 1000) * 1000000L };
+    nanosleep(&ts, NULL);
+}
+
+static int64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Run one side in a child process, the way usb-c-net --mode send-file /
+// recv-file with FILE_TRANSPORT=raw and RAW_SHM_NAME would
+static pid_t spawn(bool send, int report_fd) {
+    pid_t pid = fork();
+    if (pid != 0) return pid;
+
+    static usb_net_device_t device;
+    static usb_stats_page_t page;
+    if (usb_net_init(&device) < 0) _exit(2);
+    strcpy(device.config.file_transport, "raw");
+    strcpy(device.config.raw_transport, "shm");
+    strcpy(device.config.raw_shm_name, shm_name);
+    strcpy(device.config.file_path, send ? src_path : dst_path);
+    device.stats_page = &page;
+
+    int ret = send ? usb_sendfile_run_send(&device) : usb_sendfile_run_recv(&device);
+    if (report_fd >= 0) {
+        send_report_t report = {
+            usb_stat_read(&page.raw.tx_packets),
+            usb_stat_read(&page.raw.retransmits),
+        };
+        if (write(report_fd, &report, sizeof(report)) != (ssize_t)sizeof(report)) ret = -1;
+    }
+    usb_net_cleanup(&device);
+    _exit(ret < 0 ? 1 : 0);
+}
+
+// Exit status of pid, killing it if it takes longer than ms
+static int wait_exit(pid_t pid, int ms) {
+    int status;
+    int64_t deadline = now_ms() + ms;
+    while (waitpid(pid, &status, WNOHANG) == 0) {
+        if (now_ms() > deadline) {
+            kill(pid, SIGKILL);
+            waitpid(pid, &status, 0);
+            return -1;
+        }
+        sleep_ms(10);
+    }
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+// The receiver has written the byte at offset (the source has no zeros)
+static bool arrived(int fd, off_t offset) {
+    uint8_t byte = 0;
+    return fd >= 0 && pread(fd, &byte, 1, offset) == 1 && byte != 0;
+}
+
+static void cleanup_files(void) {
+    char path[160];
+    unlink(src_path);
+    unlink(dst_path);
+    snprintf(path, sizeof(path), "%s%s", dst_path, USB_FILE_RESUME_SUFFIX);
+    unlink(path);
+    rmdir(dir);
+}
+
+int main(void) {
+    // The children need libusb to initialize, which a build machine may not allow
+    usb_net_device_t probe;
+    if (usb_net_init(&probe) < 0) {
+        printf("usb_net_init failed, skipping the file transfer test\n");
+        return 0;
+    }
+    usb_net_cleanup(&probe);
+
+    strcpy(dir, "/tmp/usbcnet_sendfile.XXXXXX");
+    CHECK(mkdtemp(dir) != NULL);
+    snprintf(src_path, sizeof(src_path), "%s/source.bin", dir);
+    snprintf(dst_path, sizeof(dst_path), "%s/received.bin", dir);
+    snprintf(shm_name, sizeof(shm_name), "usbcnet_test_sendfile.%d", (int)getpid());
+
+    src = malloc(FILE_BYTES);
+    uint32_t x = 1;
+    for (size_t i = 0; i < FILE_BYTES; i++) {
+        x = x * 1103515245 + 12345;
+        src[i] = (uint8_t)(1 + (x >> 16) % 255);
+    }
+    int fd = open(src_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    CHECK(fd >= 0 && write(fd, src, FILE_BYTES) == (ssize_t)FILE_BYTES);
+    close(fd);
+
+    // First run: freeze the sender a quarter of the way in, then stop the
+    // receiver the way Ctrl+C would and kill the sender
+    pid_t recv1 = spawn(false, -1);
+    pid_t send1 = spawn(true, -1);
+    int dst = -1;
+    bool stopped = false;
+    for (int64_t deadline = now_ms() + 30000; now_ms() < deadline; ) {
+        if (dst < 0) dst = open(dst_path, O_RDONLY);
+        if (arrived(dst, FILE_BYTES / 4)) {
+            kill(send1, SIGSTOP);
+            stopped = true;
+            break;
+        }
+        usleep(200);
+    }
+    CHECK(stopped);
+    sleep_ms(100);
+    CHECK(!arrived(dst, FILE_BYTES - 1));
+    kill(recv1, SIGTERM);
+    CHECK(wait_exit(recv1, 5000) == 1);  // Stopped before the file was complete
+    kill(send1, SIGKILL);
+    wait_exit(send1, 5000);
+
+    // The bitmap only claims chunks that are on disk
+    char resume_path[160];
+    snprintf(resume_path, sizeof(resume_path), "%s%s", dst_path, USB_FILE_RESUME_SUFFIX);
+    int rfd = open(resume_path, O_RDONLY);
+    CHECK(rfd >= 0);
+    uint8_t hdr[RESUME_HDR];
+    uint32_t chunk_size = 0;
+    CHECK(pread(rfd, hdr, sizeof(hdr), 0) == (ssize_t)sizeof(hdr) && memcmp(hdr, "UCFR", 4) == 0);
+    memcpy(&chunk_size, hdr + 24, sizeof(chunk_size));
+    CHECK(chunk_size > 0);
+    uint64_t chunks = chunk_size ? (FILE_BYTES + chunk_size - 1) / chunk_size : 0;
+    uint64_t have = 0;
+    bool consistent = true;
+    uint8_t *chunk = malloc(chunk_size ? chunk_size : 1);
+    uint64_t bits = 0;
+    for (uint64_t c = 0; c < chunks; c++) {
+        if (c % 64 == 0) {
+            CHECK(pread(rfd, &bits, sizeof(bits), RESUME_HDR + (off_t)(c / 64) * 8) == 8);
+        }
+        if (!(bits >> (c % 64) & 1)) continue;
+
+        size_t len = FILE_BYTES - c * chunk_size < chunk_size ? FILE_BYTES - c * chunk_size : chunk_size;
+        have++;
+        if (pread(dst, chunk, len, (off_t)(c * chunk_size)) != (ssize_t)len ||
+            memcmp(chunk, src + c * chunk_size, len) != 0) {
+            consistent = false;
+        }
+    }
+    close(rfd);
+    close(dst);
+    printf("first run: %llu of %llu chunks\n", (unsigned long long)have, (unsigned long long)chunks);
+    CHECK(consistent);
+    CHECK(have >= chunks / 4 && have < chunks);
+
+    // Second run: only the missing chunks go over the link
+    int report[2];
+    CHECK(pipe(report) == 0);
+    pid_t recv2 = spawn(false, -1);
+    pid_t send2 = spawn(true, report[1]);
+    close(report[1]);
+    CHECK(wait_exit(send2, 60000) == 0);
+    CHECK(wait_exit(recv2, 10000) == 0);
+    send_report_t sent = { 0, 0 };
+    CHECK(read(report[0], &sent, sizeof(sent)) == (ssize_t)sizeof(sent));
+    close(report[0]);
+
+    // Besides the chunks: the offer, the DONE and the handshake
+    uint64_t missing = chunks - have;
+    uint64_t messages = sent.tx_packets - sent.retransmits;
+    printf("second run: %llu messages for %llu missing chunks\n",
+           (unsigned long long)messages, (unsigned long long)missing);
+    CHECK(messages >= missing && messages <= missing + 32);
+
+    uint8_t *out = malloc(FILE_BYTES);
+    dst = open(dst_path, O_RDONLY);
+    struct stat st;
+    CHECK(dst >= 0 && fstat(dst, &st) == 0 && st.st_size == (off_t)FILE_BYTES);
+    CHECK(read(dst, out, FILE_BYTES) == (ssize_t)FILE_BYTES && memcmp(out, src, FILE_BYTES) == 0);
+    close(dst);
+    CHECK(access(resume_path, F_OK) != 0);  // Removed once complete
+
+    free(out);
+    free(chunk);
+    free(src);
+    cleanup_files();
+    TEST_DONE();
+}
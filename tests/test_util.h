@@ -0,0 +1,34 @@
+// USB-C Software Network - Unit Test Helpers
+// Each test is a plain program that CTest runs: CHECK() reports a failed
+// condition with its location and the test carries on, TEST_DONE() ends
+// main() with a nonzero status if any check failed.
+
+#ifndef TEST_UTIL_H
+#define TEST_UTIL_H
+
+#include <stdio.h>
+
+static int test_failures;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+        test_failures++; \
+    } \
+} while (0)
+
+#define CHECK_EQ_U32(got, want) do { \
+    unsigned long got_ = (unsigned long)(got), want_ = (unsigned long)(want); \
+    if (got_ != want_) { \
+        fprintf(stderr, "%s:%d: %s is 0x%08lx, expected 0x%08lx\n", \
+                __FILE__, __LINE__, #got, got_, want_); \
+        test_failures++; \
+    } \
+} while (0)
+
+#define TEST_DONE() do { \
+    if (test_failures) fprintf(stderr, "%d check(s) failed\n", test_failures); \
+    return test_failures ? 1 : 0; \
+} while (0)
+
+#endif // TEST_UTIL_H